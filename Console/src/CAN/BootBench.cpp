@@ -0,0 +1,1160 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Throughput benchmark of the flashing protocol.
+
+  @note
+	Each run flashes a synthetic image with a CBootSession into a
+	simulated target on its own CSimBus, the same engine and simulator
+	as "-sim" of the console application. The simulated time does not
+	depend on the host, so the results of a run are reproducible and
+	can be compared between builds. Only "host_us" is measured on the
+	host and shows the cost of the simulation itself.
+
+	The runs sweep the image size, the bit rate, the window of the
+	stub stream, the erase strategy, the frame loss and the time the stub
+	takes per data frame, -errors adds bit errors to all runs. A slow
+	stub lets the data frames queue up in its receive FIFO, the window
+	has to adapt to the round trip time. Window 0 writes through the ROM boot loader
+	without a stub, which acknowledges every frame. Erase "plan" lets
+	the session choose between sector and mass erase, "mass" always
+	erases the whole flash.
+
+	The results are written as JSON, one object per run in a fixed
+	order with fixed keys:
+
+	  { "version": 1, "pid": "430", "runs": [ { "name":
+	    "stub-w12-32k-500k-plan-0ppm", "image_bytes": 32768,
+	    "bit_rate": 500000, "data_bit_rate": 0, "window": 12,
+	    "erase": "plan", "loss_ppm": 0, "error_ppm": 0,
+	    "stub_frame_us": 0, "result": 0,
+	    "verified": true, "time_us": 1350210, "bytes_per_s": 24268.1,
+	    "frames": 5210, "frames_per_s": 3858.7, "bus_utilisation":
+	    0.4213, "frames_lost": 0, "error_frames": 0, "host_us": 81234 },
+	    ... ] }
+
+	The name identifies a run across builds. A run through the stub
+	fails if it takes more than BENCH_WINDOW_SLACK percent longer than
+	the same case with a smaller window: the window has to settle below
+	the receive FIFO of the stub whatever its maximum is. The slack
+	covers the overrun which finds the depth of the FIFO, on an image of
+	two blocks it costs some percent.
+
+	The rows check flashes images of whole rows of 256 bytes and images
+	which end inside a row through the ROM boot loader. Each row takes
+	exactly one Write Memory and the row behind the image stays erased,
+	an image of whole rows gets no empty block at its end:
+
+	  "rows": [ { "image_bytes": 4096, "blocks": 16, "writes": 16,
+	    "failed": 0 }, ... ]
+
+	-threads=<n> adds a sweep of the channel count: 1, 2, 4, ... up to n
+	channels, each a bus with its own target, are flashed at the same
+	time by sessions on a thread each, like the console. "host_us" grows
+	with the host cost per channel, "time_us" is the longest session and
+	stays flat while the host keeps up:
+
+	  "threads": [ { "channels": 64, "failed": 0, "time_us": 1350210,
+	    "host_us": 2481123 }, ... ]
+
+	The reactor which reads the receive FIFOs of all VCI channels on
+	one thread needs adapters, it is not benchmarked. -reactor=<n>
+	checks its rules of VciRxPolicy.hpp in simulated time instead: 1,
+	2, 4, ... up to n channels, in turn in the frame, batch and poll
+	mode, receive frames at random times on one reactor loop. A frame
+	must be read when it signals the FIFO, a partial batch within
+	VCI_RX_LATENCY_MS. "latency_us" is the longest time a frame waited
+	in the FIFO per mode, "wakeups" the passes of the loop which read
+	frames:
+
+	  "reactor": [ { "channels": 63, "failed": 0, "frames": 120344,
+	    "wakeups": 40211, "latency_us": { "frame": 0, "batch": 1000,
+	    "poll": 0 } }, ... ]
+
+	-trace runs the cases of -quick twice, once with the logger off and
+	once at LOG_TRACE, every frame then goes through the ring to the
+	log file of -tracelog=<file>. The simulated time must not change,
+	"host_diff_us" is the host time the trace adds to the sessions and
+	"dropped" the records lost while the formatter was behind:
+
+	  "trace": { "runs": 8, "failed": 0, "time_us": { "off": 20352968,
+	    "trace": 20352968 }, "time_diff_us": 0, "host_us": { "off":
+	    23550, "trace": 37163 }, "host_diff_us": 13613, "dropped": 0 }
+
+	-coro=<n> runs 1, 4, 16, ... up to n coroutine sessions of the ROM
+	boot loader on the thread of one CBootLoop, each with its own bus
+	and target. "resume_ns" is the host time per resumed coroutine
+	including the simulation, "yield_ns" the bare cost of a suspension
+	and resume of the loop:
+
+	  "coro": [ { "sessions": 1024, "failed": 0, "time_us": 2349120,
+	    "host_us": 3120345, "resumes": 2904576, "resume_ns": 1074.3,
+	    "yield_ns": 21.4 }, ... ]
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootCoSession.hpp"
+#include "BootLog.hpp"
+#include "BootSession.hpp"
+#include "HexFile.hpp"
+#include "SimBus.hpp"
+#include "StubProtocol.hpp"
+#include "VciRxPolicy.hpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define BENCH_FD_DATA_RATE      2000000 // data bit rate with -fd
+#define BENCH_SLOW_STUB_US      3000    // time per data frame of a slow stub
+#define BENCH_SCALE_LEN         32768   // image of the channel sweep
+#define BENCH_SCALE_RATE        500000  // bit rate of the channel sweep
+#define BENCH_CORO_LEN          4096    // image of the coroutine sweep
+#define BENCH_CORO_FLASH        0x10000 // flash of its targets, a thousand of them fit in memory
+#define BENCH_CORO_STEP         4       // growth of the session count
+#define BENCH_YIELD_TASKS       64      // coroutines of the yield test
+#define BENCH_YIELDS            100000  // suspensions per coroutine
+#define BENCH_REACTOR_US        2000000 // simulated time of the reactor check
+#define BENCH_REACTOR_GAP_US    3000    // max. time between two frames of a channel
+#define BENCH_TRACE_FILE        "VCIBootBench.log"  // default log file of -trace
+#define BENCH_ROW_LEN           256     // bytes of a Write Memory block
+#define BENCH_WINDOW_SLACK      10      // percent a larger window may be slower than a smaller one
+
+#define ARRAY_COUNT(a)          (sizeof(a) / sizeof((a)[0]))
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT32 dwImageLen;                  // bytes of the image
+	UINT32 dwBitRate;                   // bus bit rate in bit/s
+	UINT32 dwDataBitRate;               // CAN FD data bit rate, 0 = classic CAN
+	UINT32 dwWindow;                    // frames in flight of the stub, 0 = ROM boot loader
+	BOOL   fMassErase;                  // always erase the whole flash
+	UINT32 dwLossPpm;                   // injected frame loss
+	UINT32 dwErrorPpm;                  // injected bit errors
+	UINT32 dwStubFrameUs;               // time the stub takes per data frame, 0 = bus speed
+} BenchCase;
+
+typedef struct {
+	int    iResult;                     // SESSION_xxx
+	BOOL   fVerified;                   // flash of the target equals the image
+	BOOL   fTailErased;                 // the row behind the image is erased
+	UINT32 dwWrites;                    // Write Memory commands to the flash taken by the target
+	UINT64 qwTimeUs;                    // duration of the session
+	UINT64 qwBusTime;                   // simulated time of the bus
+	UINT64 qwBusyTime;                  // time the bus carried frames
+	UINT32 dwFrames;                    // frames on the bus
+	UINT32 dwLost;                      // frames lost
+	UINT32 dwErrors;                    // error frames
+	UINT64 qwHostUs;                    // host time of the run
+} BenchResult;
+
+typedef struct {
+	UINT32 dwChannels;                  // buses flashed at the same time
+	UINT32 dwFailed;                    // sessions failed or not verified
+	UINT64 qwTimeUs;                    // longest session
+	UINT64 qwHostUs;                    // host time of the run
+} BenchThreads;
+
+typedef struct {
+	UINT32 dwSessions;                  // coroutine sessions on the loop
+	UINT32 dwFailed;                    // sessions failed or not verified
+	UINT64 qwTimeUs;                    // longest session
+	UINT64 qwHostUs;                    // host time of the run
+	UINT64 qwResumes;                   // coroutines resumed by the loop
+} BenchCoro;
+
+typedef struct {
+	UINT32 dwChannels;                  // channels of the reactor
+	UINT32 dwFailed;                    // frames read later than their mode allows
+	UINT32 dwFrames;                    // frames read
+	UINT32 dwWakeups;                   // passes of the loop which read frames
+	UINT32 adwLatency[CAN_RX_MODES];    // longest wait of a frame in the FIFO per mode
+} BenchReactor;
+
+typedef struct {
+	UINT32 dwRuns;                      // cases per pass
+	UINT32 dwFailed;                    // runs failed, not verified or slower with the trace
+	UINT64 aqwTimeUs[2];                // sum of the sessions without and with the trace
+	UINT64 aqwHostUs[2];                // host time of the sessions without and with the trace
+	UINT32 dwDropped;                   // records dropped by the logger
+} BenchTrace;
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+static const UINT32 adwImageLen[]  = { 4096, 32768, 131072 };
+static const UINT32 adwBitRate[]   = { 125000, 500000, 1000000 };
+static const UINT32 adwWindow[]    = { 0, STUB_ACK_FRAMES, 8, STUB_WINDOW_FRAMES };
+static const UINT32 adwLossPpm[]   = { 0, 10000 };
+static const UINT32 adwStubUs[]    = { 0, BENCH_SLOW_STUB_US };
+static const UINT32 adwRowLen[]    = { 256, 4096, 4104, 4351 };    // whole rows and a partial last row
+
+// reduced sweep of -quick
+static const UINT32 adwQuickLen[]  = { 4096, 32768 };
+static const UINT32 adwQuickRate[] = { 500000 };
+static const UINT32 adwQuickWin[]  = { 0, STUB_WINDOW_FRAMES };
+static const UINT32 adwQuickLoss[] = { 0 };
+static const UINT32 adwQuickStub[] = { 0 };
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void MakeImage(UINT32 dwLen, HexData& Image);
+void RunCase  (const BenchCase& sCase, const SimConfig& sPart, const HexData& Image, BenchResult& sResult);
+void CaseName (const BenchCase& sCase, char* pszName, size_t nSize);
+void WriteRun (FILE* pFile, const BenchCase& sCase, const BenchResult& sResult);
+void RunThreads (const BenchCase& sCase, const SimConfig& sPart, const HexData& Image, BenchThreads& sThreads);
+void RunCoro  (const SimConfig& sPart, UINT32 dwBitRate, const HexData& Image, BenchCoro& sCoro);
+void RunReactor(BenchReactor& sReactor);
+BOOL RunTrace (const SimConfig& sPart, BOOL fFd, UINT32 dwErrorPpm, const char* pszFile, BenchTrace& sTrace);
+double YieldCost(void);
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Main entry point of the benchmark.
+*/
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	SimConfig   sPart;
+	std::string strOut;
+	std::string strTrace = BENCH_TRACE_FILE;
+	BOOL        fQuick = FALSE;
+	BOOL        fTrace = FALSE;
+	BOOL        fFd = FALSE;
+	UINT8       bLogLevel = LOG_OFF;
+	UINT32      dwErrorPpm = 0;
+	UINT32      dwThreads = 0;
+	UINT32      dwCoro = 0;
+	UINT32      dwReactor = 0;
+
+	// usage: VCIBootBench [options]
+	//   -out=<file>  JSON results, default stdout
+	//   -quick       small sweep for a quick check
+	//   -fd          CAN FD with 2 Mbit/s data rate
+	//   -pid=<hex>   simulated part, default the part of -sim
+	//   -errors=<p>  a bit error destroys p percent of the frames
+	//   -threads=<n> flashes up to n channels at the same time, a thread each
+	//   -coro=<n>    runs up to n coroutine sessions on one thread
+	//   -reactor=<n> checks the receive rules of up to n VCI channels
+	//   -trace       compares the -quick cases with the trace on and off
+	//   -tracelog=<file> log file of -trace, default VCIBootBench.log
+	//   -v<n>        log level of the sessions, default 0
+	SimDefaultConfig(sPart);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "-out=", 5) == 0)
+		{
+			strOut = argv[i] + 5;
+		}
+		else if (strcmp(argv[i], "-quick") == 0)
+		{
+			fQuick = TRUE;
+		}
+		else if (strcmp(argv[i], "-fd") == 0)
+		{
+			fFd = TRUE;
+		}
+		else if (strncmp(argv[i], "-pid=", 5) == 0)
+		{
+			SimConfigPart(sPart, (UINT32)strtoul(argv[i] + 5, NULL, 16));
+		}
+		else if (strncmp(argv[i], "-errors=", 8) == 0)
+		{
+			dwErrorPpm = (UINT32)(atof(argv[i] + 8) * 10000.0);
+		}
+		else if (strncmp(argv[i], "-threads=", 9) == 0)
+		{
+			dwThreads = (UINT32)atoi(argv[i] + 9);
+		}
+		else if (strncmp(argv[i], "-coro=", 6) == 0)
+		{
+			dwCoro = (UINT32)atoi(argv[i] + 6);
+		}
+		else if (strncmp(argv[i], "-reactor=", 9) == 0)
+		{
+			dwReactor = (UINT32)atoi(argv[i] + 9);
+		}
+		else if (strcmp(argv[i], "-trace") == 0)
+		{
+			fTrace = TRUE;
+		}
+		else if (strncmp(argv[i], "-tracelog=", 10) == 0)
+		{
+			fTrace = TRUE;
+			strTrace = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "-v", 2) == 0)
+		{
+			bLogLevel = (UINT8)atoi(argv[i] + 2);
+		}
+		else
+		{
+			printf("\n unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	const UINT32* pdwLen  = fQuick ? adwQuickLen  : adwImageLen;
+	const UINT32* pdwRate = fQuick ? adwQuickRate : adwBitRate;
+	const UINT32* pdwWin  = fQuick ? adwQuickWin  : adwWindow;
+	const UINT32* pdwLoss = fQuick ? adwQuickLoss : adwLossPpm;
+	const UINT32* pdwStub = fQuick ? adwQuickStub : adwStubUs;
+	UINT32 dwLens   = fQuick ? ARRAY_COUNT(adwQuickLen)  : ARRAY_COUNT(adwImageLen);
+	UINT32 dwRates  = fQuick ? ARRAY_COUNT(adwQuickRate) : ARRAY_COUNT(adwBitRate);
+	UINT32 dwWins   = fQuick ? ARRAY_COUNT(adwQuickWin)  : ARRAY_COUNT(adwWindow);
+	UINT32 dwLosses = fQuick ? ARRAY_COUNT(adwQuickLoss) : ARRAY_COUNT(adwLossPpm);
+	UINT32 dwStubs  = fQuick ? ARRAY_COUNT(adwQuickStub) : ARRAY_COUNT(adwStubUs);
+
+	FILE* pOut = stdout;
+	if (!strOut.empty())
+	{
+		pOut = fopen(strOut.c_str(), "w");
+		if (!pOut)
+		{
+			printf("\n cannot create %s\n", strOut.c_str());
+			return 1;
+		}
+	}
+
+	BootLogStart(bLogLevel);
+
+	fprintf(pOut, "{\n  \"version\": 1,\n  \"pid\": \"%03X\",\n  \"runs\": [", (unsigned int)sPart.dwPid);
+
+	UINT32 dwRuns = 0;
+	UINT32 dwFailed = 0;
+	for (UINT32 l = 0; l < dwLens; l++)
+	{
+		HexData Image;
+		MakeImage(pdwLen[l], Image);
+
+		for (UINT32 r = 0; r < dwRates; r++)
+		{
+			// time of each case per window, to compare the windows
+			std::vector<UINT64> WinTime(dwWins * 2 * dwLosses * dwStubs, 0);
+
+			for (UINT32 w = 0; w < dwWins; w++)
+			{
+				for (UINT32 e = 0; e < 2; e++)
+				{
+					for (UINT32 p = 0; p < dwLosses; p++)
+					{
+						for (UINT32 s = 0; s < dwStubs; s++)
+						{
+							// the ROM boot loader has no stub
+							if (!pdwWin[w] && pdwStub[s])
+							{
+								continue;
+							}
+
+							BenchCase   sCase;
+							BenchResult sResult;
+
+							sCase.dwImageLen = pdwLen[l];
+							sCase.dwBitRate = pdwRate[r];
+							sCase.dwDataBitRate = fFd ? BENCH_FD_DATA_RATE : 0;
+							sCase.dwWindow = pdwWin[w];
+							sCase.fMassErase = e ? TRUE : FALSE;
+							sCase.dwLossPpm = pdwLoss[p];
+							sCase.dwErrorPpm = dwErrorPpm;
+							sCase.dwStubFrameUs = pdwStub[s];
+
+							RunCase(sCase, sPart, Image, sResult);
+							fprintf(pOut, dwRuns ? ",\n" : "\n");
+							WriteRun(pOut, sCase, sResult);
+							fflush(pOut);
+
+							// a larger window of the stub must not be slower
+							BOOL fSlower = FALSE;
+							WinTime[((w * 2 + e) * dwLosses + p) * dwStubs + s] = sResult.qwTimeUs;
+							for (UINT32 v = 0; (v < w) && pdwWin[w]; v++)
+							{
+								UINT64 qwSmaller = WinTime[((v * 2 + e) * dwLosses + p) * dwStubs + s];
+								if (pdwWin[v] && (sResult.qwTimeUs * 100 > qwSmaller * (100 + BENCH_WINDOW_SLACK)))
+								{
+									fSlower = TRUE;
+								}
+							}
+
+							dwRuns++;
+							if ((sResult.iResult != SESSION_OK) || !sResult.fVerified || fSlower)
+							{
+								dwFailed++;
+							}
+							if (pOut != stdout)
+							{
+								char szName[64];
+								CaseName(sCase, szName, sizeof(szName));
+								printf("\n %-40s %s %8.3f s %9.1f B/s", szName,
+									(sResult.iResult != SESSION_OK) ? "failed" : (!sResult.fVerified ? "differ" : (fSlower ? "slower" : "ok    ")),
+									sResult.qwTimeUs / 1000000.0,
+									sResult.qwTimeUs ? (sCase.dwImageLen * 1000000.0) / sResult.qwTimeUs : 0.0);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	fprintf(pOut, "\n  ],\n  \"rows\": [");
+	for (UINT32 l = 0; l < ARRAY_COUNT(adwRowLen); l++)
+	{
+		HexData     Image;
+		BenchCase   sCase;
+		BenchResult sResult;
+
+		MakeImage(adwRowLen[l], Image);
+		sCase.dwImageLen = adwRowLen[l];
+		sCase.dwBitRate = BENCH_SCALE_RATE;
+		sCase.dwDataBitRate = 0;
+		sCase.dwWindow = 0;
+		sCase.fMassErase = FALSE;
+		sCase.dwLossPpm = 0;
+		sCase.dwErrorPpm = 0;
+		sCase.dwStubFrameUs = 0;
+
+		// a recovered block would be written twice, the case is free of errors
+		RunCase(sCase, sPart, Image, sResult);
+		UINT32 dwBlocks = (adwRowLen[l] + BENCH_ROW_LEN - 1) / BENCH_ROW_LEN;
+		BOOL fFailed = ((sResult.iResult != SESSION_OK) || !sResult.fVerified || !sResult.fTailErased ||
+		                (sResult.dwWrites != dwBlocks)) ? TRUE : FALSE;
+		fprintf(pOut, "%s\n    { \"image_bytes\": %u, \"blocks\": %u, \"writes\": %u, \"failed\": %u }",
+			l ? "," : "", (unsigned int)adwRowLen[l], (unsigned int)dwBlocks, (unsigned int)sResult.dwWrites,
+			fFailed ? 1u : 0u);
+		fflush(pOut);
+
+		dwRuns++;
+		if (fFailed)
+		{
+			dwFailed++;
+		}
+		if (pOut != stdout)
+		{
+			char szName[64];
+			snprintf(szName, sizeof(szName), "rows-%u", (unsigned int)adwRowLen[l]);
+			printf("\n %-40s %s %8u blocks %5u writes", szName, fFailed ? "failed" : "ok    ",
+				(unsigned int)dwBlocks, (unsigned int)sResult.dwWrites);
+		}
+	}
+	fprintf(pOut, "\n  ]");
+
+	if (dwThreads > 0)
+	{
+		HexData   Image;
+		BenchCase sCase;
+
+		MakeImage(BENCH_SCALE_LEN, Image);
+		sCase.dwImageLen = BENCH_SCALE_LEN;
+		sCase.dwBitRate = BENCH_SCALE_RATE;
+		sCase.dwDataBitRate = fFd ? BENCH_FD_DATA_RATE : 0;
+		sCase.dwWindow = STUB_WINDOW_FRAMES;
+		sCase.fMassErase = FALSE;
+		sCase.dwLossPpm = 0;
+		sCase.dwErrorPpm = dwErrorPpm;
+		sCase.dwStubFrameUs = 0;
+
+		fprintf(pOut, ",\n  \"threads\": [");
+		for (UINT32 dwChannels = 1; ; dwChannels *= 2)
+		{
+			BenchThreads sThreads;
+
+			// the last step is the requested count
+			sThreads.dwChannels = (dwChannels < dwThreads) ? dwChannels : dwThreads;
+			RunThreads(sCase, sPart, Image, sThreads);
+			fprintf(pOut, "%s\n    { \"channels\": %u, \"failed\": %u, \"time_us\": %llu, \"host_us\": %llu }",
+				(dwChannels > 1) ? "," : "", (unsigned int)sThreads.dwChannels, (unsigned int)sThreads.dwFailed,
+				(unsigned long long)sThreads.qwTimeUs, (unsigned long long)sThreads.qwHostUs);
+			fflush(pOut);
+
+			dwRuns++;
+			if (sThreads.dwFailed)
+			{
+				dwFailed++;
+			}
+			if (pOut != stdout)
+			{
+				char szName[64];
+				snprintf(szName, sizeof(szName), "threads-%uch", (unsigned int)sThreads.dwChannels);
+				printf("\n %-40s %s %8.3f s %9.3f s host", szName,
+					sThreads.dwFailed ? "failed" : "ok    ", sThreads.qwTimeUs / 1000000.0, sThreads.qwHostUs / 1000000.0);
+			}
+			if (sThreads.dwChannels >= dwThreads)
+			{
+				break;
+			}
+		}
+		fprintf(pOut, "\n  ]");
+	}
+
+	if (dwCoro > 0)
+	{
+		HexData Image;
+		double  dYieldNs = YieldCost();
+
+		MakeImage(BENCH_CORO_LEN, Image);
+		fprintf(pOut, ",\n  \"coro\": [");
+		for (UINT32 dwSessions = 1; ; dwSessions *= BENCH_CORO_STEP)
+		{
+			BenchCoro sCoro;
+
+			// the last step is the requested count
+			sCoro.dwSessions = (dwSessions < dwCoro) ? dwSessions : dwCoro;
+			RunCoro(sPart, BENCH_SCALE_RATE, Image, sCoro);
+			double dResumeNs = sCoro.qwResumes ? (sCoro.qwHostUs * 1000.0) / sCoro.qwResumes : 0.0;
+			fprintf(pOut, "%s\n    { \"sessions\": %u, \"failed\": %u, \"time_us\": %llu, \"host_us\": %llu,"
+				" \"resumes\": %llu, \"resume_ns\": %.1f, \"yield_ns\": %.1f }",
+				(dwSessions > 1) ? "," : "", (unsigned int)sCoro.dwSessions, (unsigned int)sCoro.dwFailed,
+				(unsigned long long)sCoro.qwTimeUs, (unsigned long long)sCoro.qwHostUs,
+				(unsigned long long)sCoro.qwResumes, dResumeNs, dYieldNs);
+			fflush(pOut);
+
+			dwRuns++;
+			if (sCoro.dwFailed)
+			{
+				dwFailed++;
+			}
+			if (pOut != stdout)
+			{
+				char szName[64];
+				snprintf(szName, sizeof(szName), "coro-%u", (unsigned int)sCoro.dwSessions);
+				printf("\n %-40s %s %8.3f s %9.3f s host, %7.1f ns/resume", szName,
+					sCoro.dwFailed ? "failed" : "ok    ", sCoro.qwTimeUs / 1000000.0, sCoro.qwHostUs / 1000000.0, dResumeNs);
+			}
+			if (sCoro.dwSessions >= dwCoro)
+			{
+				break;
+			}
+		}
+		fprintf(pOut, "\n  ]");
+		if (pOut != stdout)
+		{
+			printf("\n %-40s %7.1f ns/yield", "coro-yield", dYieldNs);
+		}
+	}
+
+	if (dwReactor > 0)
+	{
+		fprintf(pOut, ",\n  \"reactor\": [");
+		for (UINT32 dwChannels = 1; ; dwChannels *= 2)
+		{
+			BenchReactor sReactor;
+
+			// the last step is the requested count
+			sReactor.dwChannels = (dwChannels < dwReactor) ? dwChannels : dwReactor;
+			RunReactor(sReactor);
+			fprintf(pOut, "%s\n    { \"channels\": %u, \"failed\": %u, \"frames\": %u, \"wakeups\": %u,"
+				" \"latency_us\": { \"frame\": %u, \"batch\": %u, \"poll\": %u } }",
+				(dwChannels > 1) ? "," : "", (unsigned int)sReactor.dwChannels, (unsigned int)sReactor.dwFailed,
+				(unsigned int)sReactor.dwFrames, (unsigned int)sReactor.dwWakeups,
+				(unsigned int)sReactor.adwLatency[CAN_RX_FRAME], (unsigned int)sReactor.adwLatency[CAN_RX_BATCH],
+				(unsigned int)sReactor.adwLatency[CAN_RX_POLL]);
+			fflush(pOut);
+
+			dwRuns++;
+			if (sReactor.dwFailed)
+			{
+				dwFailed++;
+			}
+			if (pOut != stdout)
+			{
+				char szName[64];
+				snprintf(szName, sizeof(szName), "reactor-%uch", (unsigned int)sReactor.dwChannels);
+				printf("\n %-40s %s %8u frames %7u wakeups, batch latency %u us", szName,
+					sReactor.dwFailed ? "failed" : "ok    ", (unsigned int)sReactor.dwFrames,
+					(unsigned int)sReactor.dwWakeups, (unsigned int)sReactor.adwLatency[CAN_RX_BATCH]);
+			}
+			if (sReactor.dwChannels >= dwReactor)
+			{
+				break;
+			}
+		}
+		fprintf(pOut, "\n  ]");
+	}
+
+	if (fTrace)
+	{
+		BenchTrace sTrace;
+
+		// the log of the sweep is stopped for both passes
+		BootLogStop();
+		BOOL fOpened = RunTrace(sPart, fFd, dwErrorPpm, strTrace.c_str(), sTrace);
+		BootLogStart(bLogLevel);
+		if (!fOpened)
+		{
+			printf("\n cannot create %s\n", strTrace.c_str());
+			return 1;
+		}
+
+		INT64 iTimeDiff = (INT64)(sTrace.aqwTimeUs[1] - sTrace.aqwTimeUs[0]);
+		INT64 iHostDiff = (INT64)(sTrace.aqwHostUs[1] - sTrace.aqwHostUs[0]);
+		fprintf(pOut, ",\n  \"trace\": { \"runs\": %u, \"failed\": %u, \"time_us\": { \"off\": %llu, \"trace\": %llu },"
+			" \"time_diff_us\": %lld, \"host_us\": { \"off\": %llu, \"trace\": %llu }, \"host_diff_us\": %lld,"
+			" \"dropped\": %u }", (unsigned int)sTrace.dwRuns, (unsigned int)sTrace.dwFailed,
+			(unsigned long long)sTrace.aqwTimeUs[0], (unsigned long long)sTrace.aqwTimeUs[1], (long long)iTimeDiff,
+			(unsigned long long)sTrace.aqwHostUs[0], (unsigned long long)sTrace.aqwHostUs[1], (long long)iHostDiff,
+			(unsigned int)sTrace.dwDropped);
+		fflush(pOut);
+
+		dwRuns++;
+		if (sTrace.dwFailed)
+		{
+			dwFailed++;
+		}
+		if (pOut != stdout)
+		{
+			printf("\n %-40s %s %8.3f s %9.3f s host off, %9.3f s host trace, %u dropped", "trace",
+				sTrace.dwFailed ? "failed" : "ok    ", sTrace.aqwTimeUs[1] / 1000000.0,
+				sTrace.aqwHostUs[0] / 1000000.0, sTrace.aqwHostUs[1] / 1000000.0, (unsigned int)sTrace.dwDropped);
+		}
+	}
+
+	fprintf(pOut, "\n}\n");
+	if (pOut != stdout)
+	{
+		fclose(pOut);
+		printf("\n %u runs, %u failed\n", dwRuns, dwFailed);
+	}
+
+	BootLogStop();
+	return dwFailed ? 2 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Builds an image which compresses like code: runs of random bytes,
+  repeated words and erased gaps. The image only depends on its length.
+
+  @param dwLen  bytes of the image
+  @param Image  the image at the start of the flash
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void MakeImage(UINT32 dwLen, HexData& Image)
+{
+	UINT32 dwSeed = 0x12345678;
+
+	Image.records.clear();
+	Image.Data.resize(dwLen);
+	Image.HexDataLen = dwLen;
+	Image.StartAdres = 0x08000000;
+	Image.LinStartAdres = 0;
+
+	for (UINT32 i = 0; i < dwLen; )
+	{
+		dwSeed = dwSeed * 1103515245 + 12345;
+		UINT32 dwRun = 16 + ((dwSeed >> 16) & 0x7F);
+		UINT32 dwKind = (dwSeed >> 8) & 0x03;
+
+		for (UINT32 j = 0; (j < dwRun) && (i < dwLen); j++, i++)
+		{
+			if (dwKind == 0)
+			{
+				Image.Data[i] = 0xFF;
+			}
+			else if (dwKind == 1)
+			{
+				Image.Data[i] = (UINT8)(dwSeed >> ((j & 3) * 8));
+			}
+			else
+			{
+				dwSeed = dwSeed * 1103515245 + 12345;
+				Image.Data[i] = (UINT8)(dwSeed >> 16);
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashes the image into a new simulated target.
+
+  @param sCase    parameters of the run
+  @param sPart    configuration of the simulated part
+  @param Image    image to flash
+  @param sResult  results of the run
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void RunCase(const BenchCase& sCase, const SimConfig& sPart, const HexData& Image, BenchResult& sResult)
+{
+	SimConfig sCfg = sPart;
+	sCfg.dwBitRate = sCase.dwBitRate;
+	sCfg.dwDataBitRate = sCase.dwDataBitRate;
+	sCfg.dwLossPpm = sCase.dwLossPpm;
+	sCfg.dwErrorPpm = sCase.dwErrorPpm;
+	sCfg.dwStubFrameUs = sCase.dwStubFrameUs;
+
+	auto tStart = std::chrono::steady_clock::now();
+
+	CSimBus     Bus(sCfg);
+	CSimTarget* pTarget = Bus.AddTarget(sCfg);
+	CSimPort*   pPort = Bus.AddPort(sCfg.dwIdBase);
+
+	CBootSession Session(0, pPort, Image);
+	Session.SetMassErase(sCase.fMassErase);
+	if (sCase.dwWindow)
+	{
+		Session.SetStub(NULL, sCase.dwDataBitRate ? TRUE : FALSE, TRUE);
+		Session.SetStubWindow(sCase.dwWindow);
+	}
+	sResult.iResult = Session.Run();
+
+	auto tEnd = std::chrono::steady_clock::now();
+
+	// the image starts at the beginning of the flash
+	const std::vector<UINT8>& Flash = pTarget->GetFlash();
+	UINT32 dwOffset = Image.StartAdres - sCfg.dwFlashBase;
+	sResult.fVerified = ((dwOffset + Image.HexDataLen <= Flash.size()) &&
+		(memcmp(&Flash[dwOffset], Image.Data.data(), Image.HexDataLen) == 0)) ? TRUE : FALSE;
+
+	// up to the end of the next row behind the image
+	UINT32 dwTail = (dwOffset + Image.HexDataLen + 2 * BENCH_ROW_LEN - 1) / BENCH_ROW_LEN * BENCH_ROW_LEN;
+	sResult.fTailErased = TRUE;
+	for (UINT32 i = dwOffset + Image.HexDataLen; (i < dwTail) && (i < Flash.size()); i++)
+	{
+		if (Flash[i] != 0xFF)
+		{
+			sResult.fTailErased = FALSE;
+		}
+	}
+	sResult.dwWrites = pTarget->GetFlashWrites();
+
+	sResult.qwTimeUs = Session.GetDuration();
+	sResult.qwBusTime = Bus.GetTime();
+	sResult.qwBusyTime = Bus.GetBusyTime();
+	sResult.dwFrames = Bus.GetFramesSent();
+	sResult.dwLost = Bus.GetFramesLost();
+	sResult.dwErrors = Bus.GetErrorFrames();
+	sResult.qwHostUs = (UINT64)std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashes the image into a number of simulated targets at the same
+  time, each on its own bus, like the console with several channels.
+
+  @param sCase    parameters of each session
+  @param sPart    configuration of the simulated part
+  @param Image    image to flash
+  @param sThreads   number of channels, results of the run
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void RunThreads(const BenchCase& sCase, const SimConfig& sPart, const HexData& Image, BenchThreads& sThreads)
+{
+	SimConfig sCfg = sPart;
+	sCfg.dwBitRate = sCase.dwBitRate;
+	sCfg.dwDataBitRate = sCase.dwDataBitRate;
+	sCfg.dwLossPpm = sCase.dwLossPpm;
+	sCfg.dwErrorPpm = sCase.dwErrorPpm;
+	sCfg.dwStubFrameUs = sCase.dwStubFrameUs;
+
+	auto tStart = std::chrono::steady_clock::now();
+
+	std::vector<CSimBus*>      Buses;
+	std::vector<CSimTarget*>   Targets;
+	std::vector<CBootSession*> Sessions;
+	for (UINT32 i = 0; i < sThreads.dwChannels; i++)
+	{
+		CSimBus* pBus = new CSimBus(sCfg);
+		Buses.push_back(pBus);
+		Targets.push_back(pBus->AddTarget(sCfg));
+
+		CBootSession* pSession = new CBootSession(i, pBus->AddPort(sCfg.dwIdBase), Image);
+		pSession->SetMassErase(sCase.fMassErase);
+		if (sCase.dwWindow)
+		{
+			pSession->SetStub(NULL, sCase.dwDataBitRate ? TRUE : FALSE, TRUE);
+			pSession->SetStubWindow(sCase.dwWindow);
+		}
+		Sessions.push_back(pSession);
+	}
+	BootRunSessions(Sessions);
+
+	auto tEnd = std::chrono::steady_clock::now();
+
+	sThreads.dwFailed = 0;
+	sThreads.qwTimeUs = 0;
+	UINT32 dwOffset = Image.StartAdres - sCfg.dwFlashBase;
+	for (UINT32 i = 0; i < sThreads.dwChannels; i++)
+	{
+		const std::vector<UINT8>& Flash = Targets[i]->GetFlash();
+		BOOL fVerified = ((dwOffset + Image.HexDataLen <= Flash.size()) &&
+			(memcmp(&Flash[dwOffset], Image.Data.data(), Image.HexDataLen) == 0)) ? TRUE : FALSE;
+		if ((Sessions[i]->GetResult() != SESSION_OK) || !fVerified)
+		{
+			sThreads.dwFailed++;
+		}
+		if (sThreads.qwTimeUs < Sessions[i]->GetDuration())
+		{
+			sThreads.qwTimeUs = Sessions[i]->GetDuration();
+		}
+		delete Sessions[i];
+		delete Buses[i];
+	}
+	sThreads.qwHostUs = (UINT64)std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashes the image with coroutine sessions on one loop, each session
+  with its own simulated bus and target.
+
+  @param sPart      configuration of the simulated part
+  @param dwBitRate  bus bit rate in bit/s
+  @param Image      image to flash
+  @param sCoro      number of sessions, results of the run
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void RunCoro(const SimConfig& sPart, UINT32 dwBitRate, const HexData& Image, BenchCoro& sCoro)
+{
+	SimConfig sCfg = sPart;
+	sCfg.dwBitRate = dwBitRate;
+	sCfg.dwFlashSize = BENCH_CORO_FLASH;
+
+	auto tStart = std::chrono::steady_clock::now();
+
+	CBootLoop Loop;
+	std::vector<CSimBus*>        Buses;
+	std::vector<CSimTarget*>     Targets;
+	std::vector<CBootCoSession*> Sessions;
+	for (UINT32 i = 0; i < sCoro.dwSessions; i++)
+	{
+		CSimBus* pBus = new CSimBus(sCfg);
+		Buses.push_back(pBus);
+		Targets.push_back(pBus->AddTarget(sCfg));
+
+		CBootCoSession* pSession = new CBootCoSession(Loop, i, pBus->AddPort(sCfg.dwIdBase), Image);
+		Sessions.push_back(pSession);
+		Loop.Spawn(pSession->Run());
+	}
+	Loop.Run();
+
+	auto tEnd = std::chrono::steady_clock::now();
+
+	sCoro.dwFailed = 0;
+	sCoro.qwTimeUs = 0;
+	sCoro.qwResumes = Loop.GetResumes();
+	UINT32 dwOffset = Image.StartAdres - sCfg.dwFlashBase;
+	for (UINT32 i = 0; i < sCoro.dwSessions; i++)
+	{
+		const std::vector<UINT8>& Flash = Targets[i]->GetFlash();
+		BOOL fVerified = ((dwOffset + Image.HexDataLen <= Flash.size()) &&
+			(memcmp(&Flash[dwOffset], Image.Data.data(), Image.HexDataLen) == 0)) ? TRUE : FALSE;
+		if ((Sessions[i]->GetResult() != SESSION_OK) || !fVerified)
+		{
+			sCoro.dwFailed++;
+		}
+		if (sCoro.qwTimeUs < Sessions[i]->GetDuration())
+		{
+			sCoro.qwTimeUs = Sessions[i]->GetDuration();
+		}
+		delete Sessions[i];
+		delete Buses[i];
+	}
+	sCoro.qwHostUs = (UINT64)std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the loop of the VCI reactor in simulated time: it waits for the
+  first reader event or the shortest wait of its channels, reads the
+  FIFOs the rules of VciRxPolicy.hpp read and takes the next wait from
+  them. The channels are in turn in the frame, batch and poll mode and
+  receive frames at random times.
+
+  @param sReactor  number of channels, results of the run
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void RunReactor(BenchReactor& sReactor)
+{
+	std::vector<std::vector<UINT64> > Arrivals(sReactor.dwChannels);
+	std::vector<size_t> Next(sReactor.dwChannels, 0);
+	std::vector<size_t> Read(sReactor.dwChannels, 0);
+	UINT32 dwSeed = 0x12345678;
+
+	// arrival times of the frames of each channel
+	for (UINT32 i = 0; i < sReactor.dwChannels; i++)
+	{
+		for (UINT64 qwTime = 0; ; )
+		{
+			dwSeed = dwSeed * 1103515245 + 12345;
+			qwTime += 1 + (dwSeed >> 8) % BENCH_REACTOR_GAP_US;
+			if (qwTime >= BENCH_REACTOR_US)
+			{
+				break;
+			}
+			Arrivals[i].push_back(qwTime);
+		}
+	}
+
+	sReactor.dwFailed = 0;
+	sReactor.dwFrames = 0;
+	sReactor.dwWakeups = 0;
+	memset(sReactor.adwLatency, 0, sizeof(sReactor.adwLatency));
+
+	// the receive mode of a new channel signals the reader event, the first pass is at once
+	UINT64 qwNow = 0;
+	for (;;)
+	{
+		BOOL   fRead = FALSE;
+		UINT32 dwWait = VCI_RX_IDLE_MS;
+		for (UINT32 i = 0; i < sReactor.dwChannels; i++)
+		{
+			UINT32 dwMode = i % CAN_RX_MODES;
+			while ((Next[i] < Arrivals[i].size()) && (Arrivals[i][Next[i]] <= qwNow))
+			{
+				Next[i]++;
+			}
+
+			BOOL fSignaled = (Next[i] - Read[i] >= VciRxThreshold(dwMode)) ? TRUE : FALSE;
+			if (VciRxMustRead(dwMode, fSignaled) && (Next[i] > Read[i]))
+			{
+				// a frame which signals its FIFO is read at once, a partial batch after the latency bound
+				UINT32 dwBound = (dwMode == CAN_RX_BATCH) ? VCI_RX_LATENCY_MS * 1000 : 0;
+				for (; Read[i] < Next[i]; Read[i]++)
+				{
+					UINT32 dwLatency = (UINT32)(qwNow - Arrivals[i][Read[i]]);
+					if (dwLatency > dwBound)
+					{
+						sReactor.dwFailed++;
+					}
+					if (sReactor.adwLatency[dwMode] < dwLatency)
+					{
+						sReactor.adwLatency[dwMode] = dwLatency;
+					}
+					sReactor.dwFrames++;
+				}
+				fRead = TRUE;
+			}
+			if (dwWait > VciRxWaitMs(dwMode))
+			{
+				dwWait = VciRxWaitMs(dwMode);
+			}
+		}
+		if (fRead)
+		{
+			sReactor.dwWakeups++;
+		}
+
+		// the wait ends with the frame which signals a FIFO, the poll mode does not wait
+		UINT64 qwWake = dwWait ? qwNow + (UINT64)dwWait * 1000 : BENCH_REACTOR_US;
+		for (UINT32 i = 0; i < sReactor.dwChannels; i++)
+		{
+			size_t nSignal = Read[i] + (dwWait ? VciRxThreshold(i % CAN_RX_MODES) : 1) - 1;
+			if ((nSignal < Arrivals[i].size()) && (qwWake > Arrivals[i][nSignal]))
+			{
+				qwWake = Arrivals[i][nSignal];
+			}
+		}
+		if (qwWake >= BENCH_REACTOR_US)
+		{
+			break;
+		}
+		qwNow = qwWake;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Coroutine of the yield test, suspends and is resumed by the loop.
+*/
+//////////////////////////////////////////////////////////////////////////
+static CBootTask YieldTask(CBootLoop& Loop, UINT32 dwCount)
+{
+	for (UINT32 i = 0; i < dwCount; i++)
+	{
+		co_await Loop.Yield();
+	}
+	co_return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the host time in ns of one suspension and resume of a
+  coroutine on the loop, without a transport.
+*/
+//////////////////////////////////////////////////////////////////////////
+double YieldCost(void)
+{
+	CBootLoop Loop;
+
+	for (UINT32 i = 0; i < BENCH_YIELD_TASKS; i++)
+	{
+		Loop.Spawn(YieldTask(Loop, BENCH_YIELDS));
+	}
+
+	auto tStart = std::chrono::steady_clock::now();
+	Loop.Run();
+	auto tEnd = std::chrono::steady_clock::now();
+
+	UINT64 qwNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd - tStart).count();
+	return Loop.GetResumes() ? (double)qwNs / Loop.GetResumes() : 0.0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashes the cases of -quick with the logger off, then again with
+  every frame traced to a file. A case fails if it fails in a pass or
+  its simulated time changes with the trace. The logger is stopped
+  when the passes are done.
+
+  @param sPart       configuration of the simulated part
+  @param fFd         CAN FD with BENCH_FD_DATA_RATE
+  @param dwErrorPpm  injected bit errors
+  @param pszFile     log file of the trace
+  @param sTrace      results of both passes
+
+  @return FALSE if the log file could not be created
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL RunTrace(const SimConfig& sPart, BOOL fFd, UINT32 dwErrorPpm, const char* pszFile, BenchTrace& sTrace)
+{
+	std::vector<UINT64> TimeOff;
+
+	memset(&sTrace, 0, sizeof(sTrace));
+	for (UINT32 t = 0; t < 2; t++)
+	{
+		if (!BootLogStart(t ? LOG_TRACE : LOG_OFF, t ? pszFile : NULL))
+		{
+			return FALSE;
+		}
+
+		UINT32 dwCase = 0;
+		for (UINT32 l = 0; l < ARRAY_COUNT(adwQuickLen); l++)
+		{
+			HexData Image;
+			MakeImage(adwQuickLen[l], Image);
+
+			for (UINT32 r = 0; r < ARRAY_COUNT(adwQuickRate); r++)
+			{
+				for (UINT32 w = 0; w < ARRAY_COUNT(adwQuickWin); w++)
+				{
+					for (UINT32 e = 0; e < 2; e++, dwCase++)
+					{
+						BenchCase   sCase;
+						BenchResult sResult;
+
+						sCase.dwImageLen = adwQuickLen[l];
+						sCase.dwBitRate = adwQuickRate[r];
+						sCase.dwDataBitRate = fFd ? BENCH_FD_DATA_RATE : 0;
+						sCase.dwWindow = adwQuickWin[w];
+						sCase.fMassErase = e ? TRUE : FALSE;
+						sCase.dwLossPpm = 0;
+						sCase.dwErrorPpm = dwErrorPpm;
+						sCase.dwStubFrameUs = 0;
+
+						RunCase(sCase, sPart, Image, sResult);
+						sTrace.aqwTimeUs[t] += sResult.qwTimeUs;
+						sTrace.aqwHostUs[t] += sResult.qwHostUs;
+						if (!t)
+						{
+							TimeOff.push_back(sResult.qwTimeUs);
+						}
+						if ((sResult.iResult != SESSION_OK) || !sResult.fVerified ||
+						    (t && (sResult.qwTimeUs != TimeOff[dwCase])))
+						{
+							sTrace.dwFailed++;
+						}
+					}
+				}
+			}
+		}
+
+		sTrace.dwRuns = dwCase;
+		sTrace.dwDropped += BootLogDropped();
+		BootLogStop();
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Formats the name of a run, e.g. "stub-w12-32k-500k-plan-0ppm", runs
+  with bit errors get the suffix "-<ppm>err", runs with a slow stub the
+  suffix "-slow<us>".
+*/
+//////////////////////////////////////////////////////////////////////////
+void CaseName(const BenchCase& sCase, char* pszName, size_t nSize)
+{
+	char szMode[24];
+
+	if (sCase.dwWindow)
+	{
+		snprintf(szMode, sizeof(szMode), "stub-w%u", (unsigned int)sCase.dwWindow);
+	}
+	else
+	{
+		snprintf(szMode, sizeof(szMode), "rom");
+	}
+	snprintf(pszName, nSize, "%s%s-%uk-%uk-%s-%uppm", szMode, sCase.dwDataBitRate ? "-fd" : "",
+		(unsigned int)(sCase.dwImageLen / 1024), (unsigned int)(sCase.dwBitRate / 1000),
+		sCase.fMassErase ? "mass" : "plan", (unsigned int)sCase.dwLossPpm);
+	if (sCase.dwErrorPpm)
+	{
+		size_t nLen = strlen(pszName);
+		snprintf(pszName + nLen, nSize - nLen, "-%uerr", (unsigned int)sCase.dwErrorPpm);
+	}
+	if (sCase.dwStubFrameUs)
+	{
+		size_t nLen = strlen(pszName);
+		snprintf(pszName + nLen, nSize - nLen, "-slow%u", (unsigned int)sCase.dwStubFrameUs);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Writes the parameters and results of a run as a JSON object.
+*/
+//////////////////////////////////////////////////////////////////////////
+void WriteRun(FILE* pFile, const BenchCase& sCase, const BenchResult& sResult)
+{
+	char   szName[64];
+	double dSeconds = sResult.qwTimeUs / 1000000.0;
+
+	CaseName(sCase, szName, sizeof(szName));
+	fprintf(pFile, "    {\n      \"name\": \"%s\",\n      \"image_bytes\": %u,\n      \"bit_rate\": %u,\n"
+		"      \"data_bit_rate\": %u,\n      \"window\": %u,\n      \"erase\": \"%s\",\n      \"loss_ppm\": %u,\n"
+		"      \"error_ppm\": %u,\n      \"stub_frame_us\": %u,\n",
+		szName, (unsigned int)sCase.dwImageLen, (unsigned int)sCase.dwBitRate,
+		(unsigned int)sCase.dwDataBitRate, (unsigned int)sCase.dwWindow,
+		sCase.fMassErase ? "mass" : "plan", (unsigned int)sCase.dwLossPpm, (unsigned int)sCase.dwErrorPpm,
+		(unsigned int)sCase.dwStubFrameUs);
+	fprintf(pFile, "      \"result\": %d,\n      \"verified\": %s,\n      \"time_us\": %llu,\n"
+		"      \"bytes_per_s\": %.1f,\n      \"frames\": %u,\n      \"frames_per_s\": %.1f,\n",
+		sResult.iResult, sResult.fVerified ? "true" : "false", (unsigned long long)sResult.qwTimeUs,
+		dSeconds > 0 ? sCase.dwImageLen / dSeconds : 0.0, (unsigned int)sResult.dwFrames,
+		dSeconds > 0 ? sResult.dwFrames / dSeconds : 0.0);
+	fprintf(pFile, "      \"bus_utilisation\": %.4f,\n      \"frames_lost\": %u,\n      \"error_frames\": %u,\n"
+		"      \"host_us\": %llu\n    }",
+		sResult.qwBusTime ? (double)sResult.qwBusyTime / sResult.qwBusTime : 0.0,
+		(unsigned int)sResult.dwLost, (unsigned int)sResult.dwErrors, (unsigned long long)sResult.qwHostUs);
+}
@@ -0,0 +1,756 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Broadcast of one image to a group of identical boot loader nodes.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootBroadcast.hpp"
+#include "BootProtocol.hpp"
+#include "BootLog.hpp"
+
+#include <string.h>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define MAX_DRAIN_FRAMES                40      // filler frames to end a write
+#define MAX_GROUP_ROUNDS                4       // group writes per block without progress
+#define MAX_REPAIR_READS                4       // attempts to read back a frame or a part of a block
+#define REPAIR_READ_LEN                 64      // bytes per read of a missed block
+#define CONNECT_TIMEOUT_US              100000  // wait for the sync ACKs
+
+#define NODE_BIT(n)                     ((UINT32)1 << (n))
+#define PACER                           NODE_BIT(0)     // acknowledges the data frames
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+  @param dwChannel    number of the channel, used in messages
+  @param pTransport   channel to all nodes, receives the responses of
+                      every ID base
+  @param Image        image to write, must live as long as the broadcast
+  @param dwGroupBase  ID base the nodes listen to besides their own
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootBroadcast::CBootBroadcast(UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image, UINT32 dwGroupBase)
+	: m_Image(Image)
+{
+	BootRtoInit(m_aRto);
+	m_dwChannel = dwChannel;
+	m_pTransport = pTransport;
+	m_dwGroupBase = dwGroupBase;
+	m_fRxTrace = FALSE;
+
+	m_dwUnsettled = 0;
+	m_qwLastResponse = 0;
+
+	m_dwGroupFrames = 0;
+	m_dwGroupRetries = 0;
+	m_dwRepairs = 0;
+
+	m_qwStart = 0;
+	m_qwDuration = 0;
+	m_iResult = SESSION_NOT_STARTED;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds a node to the group. The session must use the transport of the
+  broadcast and the ID base of the node.
+
+  @return FALSE if the group is full
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootBroadcast::AddNode(CBootSession* pSession)
+{
+	if (m_Nodes.size() >= BROADCAST_MAX_NODES)
+	{
+		return FALSE;
+	}
+	m_Nodes.push_back(pSession);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the broadcast and the repairs of the single nodes, then releases
+  the transport.
+
+  @return SESSION_OK or the first error of the nodes, the result of
+          every node is available from its session
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootBroadcast::Run(void)
+{
+	m_qwStart = m_pTransport->GetTime();
+	for (size_t i = 0; i < m_Nodes.size(); i++)
+	{
+		m_Nodes[i]->m_qwStart = m_qwStart;
+		m_Nodes[i]->m_fStarted = TRUE;
+	}
+
+	m_iResult = Flash();
+	m_qwDuration = m_pTransport->GetTime() - m_qwStart;
+	for (size_t i = 0; i < m_Nodes.size(); i++)
+	{
+		if (m_Nodes[i]->m_qwDuration == 0)
+		{
+			m_Nodes[i]->m_qwDuration = m_qwDuration;
+		}
+	}
+	m_pTransport->Detach();
+	return m_iResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Connects the group, erases it and sends the image block by block to
+  all nodes. Afterwards each node repairs the blocks it missed.
+
+  @return SESSION_OK or the first error of the nodes
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootBroadcast::Flash(void)
+{
+	UINT32 dwNodes = Connect();
+	if (!dwNodes)
+	{
+		BootLog(LOG_ERROR, "\n [%u] Error BootLoader notstarted", m_dwChannel);
+		return SESSION_NOT_STARTED;
+	}
+	BootLog(LOG_INFO, "\n [%u] BootLoader started on nodes %08X........OK", m_dwChannel, dwNodes);
+
+	dwNodes = MassErase(dwNodes);
+	if (!dwNodes)
+	{
+		BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+		return SESSION_ERASE_ERROR;
+	}
+	BootLog(LOG_INFO, "\n [%u] Erase memory complete\n", m_dwChannel);
+
+	//-------- one stream for the group ----------
+	UINT32 dwBlocks = (m_Image.HexDataLen + 255) / 256;
+	m_BlockAcks.assign(dwBlocks, 0);
+	if (!(dwNodes & PACER))
+	{
+		BootLog(LOG_INFO, "\n [%u] No pacer, the nodes are written one by one", m_dwChannel);
+	}
+	for (UINT32 dwBlock = 0; (dwBlock < dwBlocks) && (dwNodes & PACER); dwBlock++)
+	{
+		UINT32 dwOffset = dwBlock * 256;
+		UINT32 dwLen = m_Image.HexDataLen - dwOffset;
+		if (dwLen > 256)
+		{
+			dwLen = 256;
+		}
+
+		BootLog(LOG_DEBUG, "\n [%u] Write memory %u block to the group ", m_dwChannel, dwBlock);
+		m_BlockAcks[dwBlock] = WriteBlock(dwOffset, dwLen, dwNodes);
+	}
+
+	//-------- missed blocks node by node ----------
+	for (UINT32 n = 0; n < (UINT32)m_Nodes.size(); n++)
+	{
+		CBootSession* pSession = m_Nodes[n];
+		int iResult = SESSION_OK;
+
+		if (!(dwNodes & NODE_BIT(n)))
+		{
+			continue;
+		}
+		if (m_dwUnsettled & NODE_BIT(n))
+		{
+			BOOL fFilled;
+			pSession->DrainWrite(NULL, 0, fFilled);
+		}
+		for (UINT32 dwBlock = 0; dwBlock < dwBlocks; dwBlock++)
+		{
+			UINT32 dwOffset = dwBlock * 256;
+			UINT32 dwLen = m_Image.HexDataLen - dwOffset;
+			if (dwLen > 256)
+			{
+				dwLen = 256;
+			}
+
+			if (!(m_BlockAcks[dwBlock] & NODE_BIT(n)) && !RepairBlock(pSession, dwOffset, dwLen))
+			{
+				BootLog(LOG_ERROR, "\n [%u] Write error", pSession->m_dwChannel);
+				iResult = SESSION_WRITE_ERROR;
+				break;
+			}
+		}
+
+		pSession->m_iResult = iResult;
+		pSession->m_qwDuration = m_pTransport->GetTime() - m_qwStart;
+		if (iResult == SESSION_OK)
+		{
+			pSession->m_dwWritten = m_Image.HexDataLen;
+			BootLog(LOG_INFO, "\n [%u] Write memory complete", pSession->m_dwChannel);
+		}
+	}
+
+	for (size_t i = 0; i < m_Nodes.size(); i++)
+	{
+		if (m_Nodes[i]->m_iResult != SESSION_OK)
+		{
+			return m_Nodes[i]->m_iResult;
+		}
+	}
+	return SESSION_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reports the group statistics. The nodes are reported by their
+  sessions.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootBroadcast::Report(void)
+{
+	BootLog(LOG_INFO, "\n [%u] Broadcast: %u nodes, %u blocks in %u ms", m_dwChannel,
+		(UINT32)m_Nodes.size(), (UINT32)m_BlockAcks.size(), (UINT32)(m_qwDuration / 1000));
+	BootLog(LOG_INFO, "\n [%u] Group: %u frames, %u block parts sent again, %u blocks repaired on single nodes",
+		m_dwChannel, m_dwGroupFrames, m_dwGroupRetries, m_dwRepairs);
+	BootLog(LOG_INFO, "\n [%u] Group responses: write data srtt %u us, write block srtt %u us", m_dwChannel,
+		m_aRto[RTO_WRITE_DATA].GetSrtt(), m_aRto[RTO_WRITE_BLOCK].GetSrtt());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmits a frame with the ID base of the group.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootBroadcast::TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData)
+{
+	BootSendFrame(m_pTransport, m_dwChannel, m_dwGroupBase + dwMsgId, (dwMsgId == BOOT_ID_DATA) ? CAN_FLAG_BULK : 0,
+		dwLen, pbData);
+	m_dwGroupFrames++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Collects the responses of the nodes to a command. Every node answers
+  once, with ACK or NACK on the identifier of the command (data frames
+  on the identifier of the write command). Returns as soon as all
+  nodes answered. Frames of other nodes or commands are late responses
+  and ignored.
+
+  @param dwMsgId      identifier of the command
+  @param dwNodes      nodes which are expected to answer
+  @param dwTimeoutUs  max. time to wait in microseconds
+  @param dwNacked     receives the nodes which answered with NACK
+
+  @return nodes which answered with ACK
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::Collect(UINT32 dwMsgId, UINT32 dwNodes, UINT32 dwTimeoutUs, UINT32& dwNacked)
+{
+	UINT64   qwDeadline = m_pTransport->GetTime() + dwTimeoutUs;
+	UINT32   dwAcked = 0;
+	CanFrame sFrame;
+
+	dwNacked = 0;
+	while ((dwAcked | dwNacked) != dwNodes)
+	{
+		UINT64 qwNow = m_pTransport->GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			break;
+		}
+		if (!m_pTransport->Receive(sFrame, (UINT32)(qwDeadline - qwNow)))
+		{
+			continue;
+		}
+
+		// frames of the adapter are already logged by the receive thread
+		if (m_fRxTrace)
+		{
+			BootLogData(LOG_TRACE, sFrame.abData, sFrame.bLen,
+				"\n[%u] Time: %10u  ID: %3X Sim  Len: %1u  Data:", m_dwChannel, (UINT32)sFrame.qwTime, sFrame.dwMsgId, sFrame.bLen);
+		}
+
+		UINT32 dwBase = sFrame.dwMsgId & ~(CAN_ID_RANGE - 1);
+		UINT32 dwId = sFrame.dwMsgId - dwBase;
+		UINT32 dwBit = 0;
+		for (UINT32 n = 0; n < (UINT32)m_Nodes.size(); n++)
+		{
+			if (m_Nodes[n]->GetIdBase() == dwBase)
+			{
+				dwBit = NODE_BIT(n);
+				break;
+			}
+		}
+
+		if (!(dwNodes & dwBit) || ((dwAcked | dwNacked) & dwBit) || (sFrame.bLen == 0) ||
+		    ((dwId != dwMsgId) && !((dwMsgId == BOOT_ID_DATA) && (dwId == BOOT_CMD_WRITE))))
+		{
+			continue;
+		}
+		if (sFrame.abData[0] == BOOT_ACK)
+		{
+			dwAcked |= dwBit;
+			m_qwLastResponse = sFrame.qwTime;
+		}
+		else if (sFrame.abData[0] == BOOT_NACK)
+		{
+			dwNacked |= dwBit;
+			m_qwLastResponse = sFrame.qwTime;
+		}
+	}
+
+	return dwAcked;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a command to the group and collects the responses with the
+  timeout of the given command type. The time until the last response
+  updates the timeout estimation.
+
+  @param dwMsgId   identifier of the command
+  @param dwLen     length of the command
+  @param pbData    data of the command
+  @param bRto      command type, RTO_xxx
+  @param dwNodes   nodes which are expected to answer
+  @param dwNacked  receives the nodes which answered with NACK
+
+  @return nodes which answered with ACK
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::Transact(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData, UINT8 bRto,
+                                UINT32 dwNodes, UINT32& dwNacked)
+{
+	UINT64 qwSent = m_pTransport->GetTime();
+	UINT32 dwTimeout = m_aRto[bRto].GetTimeout();
+
+	m_pTransport->SetRxMode(BootRxMode(bRto));
+	TransmitFrame(dwMsgId, dwLen, pbData);
+	UINT32 dwAcked = Collect(dwMsgId, dwNodes, dwTimeout, dwNacked);
+
+	if ((dwAcked | dwNacked) == dwNodes)
+	{
+		m_aRto[bRto].AddSample((UINT32)(m_qwLastResponse - qwSent));
+	}
+	else
+	{
+		m_aRto[bRto].Backoff();
+		BootLog(LOG_ERROR, "\n [%u] No response of nodes %08X after %u us (ID %3X) ", m_dwChannel,
+			dwNodes & ~(dwAcked | dwNacked), dwTimeout, dwMsgId);
+	}
+	return dwAcked;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Synchronizes with the boot loaders of the group. Nodes which do not
+  answer the group are connected by their sessions.
+
+  @return nodes which answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::Connect(void)
+{
+	UINT32 dwAll = (m_Nodes.size() >= 32) ? 0xFFFFFFFF : (NODE_BIT(m_Nodes.size()) - 1);
+	UINT32 dwNacked;
+
+	TransmitFrame(BOOT_ID_SYNC, 0, NULL);
+	UINT32 dwNodes = Collect(BOOT_ID_SYNC, dwAll, CONNECT_TIMEOUT_US, dwNacked);
+
+	for (UINT32 n = 0; n < (UINT32)m_Nodes.size(); n++)
+	{
+		if (!(dwNodes & NODE_BIT(n)) && m_Nodes[n]->Connect())
+		{
+			dwNodes |= NODE_BIT(n);
+		}
+	}
+	return dwNodes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases the complete flash of all nodes at once. A node which misses
+  the erase is erased by its session.
+
+  @param dwNodes  connected nodes
+
+  @return erased nodes
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::MassErase(UINT32 dwNodes)
+{
+	UINT8  bMass = 0xFF;
+	UINT32 dwNacked;
+	UINT32 dwErased = 0;
+
+	UINT32 dwStarted = Transact(BOOT_CMD_ERASE, 1, &bMass, RTO_ERASE, dwNodes, dwNacked);
+	if (dwStarted)
+	{
+		UINT64 qwEraseStart = m_qwLastResponse;
+		dwErased = Collect(BOOT_CMD_ERASE, dwStarted, m_aRto[RTO_ERASE_DONE].GetTimeout(), dwNacked);
+		if (dwErased == dwStarted)
+		{
+			m_aRto[RTO_ERASE_DONE].AddSample((UINT32)(m_qwLastResponse - qwEraseStart));
+		}
+	}
+
+	for (UINT32 n = 0; n < (UINT32)m_Nodes.size(); n++)
+	{
+		if (!(dwNodes & NODE_BIT(n)) || (dwErased & NODE_BIT(n)))
+		{
+			continue;
+		}
+		if (m_Nodes[n]->MassErase())
+		{
+			dwErased |= NODE_BIT(n);
+		}
+		else
+		{
+			BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_Nodes[n]->m_dwChannel);
+			m_Nodes[n]->m_iResult = SESSION_ERASE_ERROR;
+		}
+	}
+	return dwErased;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes up to 256 bytes to the group with one Write Memory command.
+  The pacer acknowledges the data frames, all nodes acknowledge the
+  command and the last frame. A node which rejects the command drops
+  out, the others continue. Stops when the pacer misses a frame.
+
+  @param dwAddr     target address
+  @param pbData     data to write
+  @param dwLen      number of bytes, 1..256
+  @param dwNodes    nodes to write
+  @param dwAcked    receives the bytes acknowledged by all nodes if
+                    fTogether is TRUE, the frame following them is
+                    undecided on every node
+  @param fTogether  receives TRUE if all nodes stopped at the same frame
+
+  @return nodes which acknowledged the whole block
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::WriteMemory(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32 dwNodes,
+                                   UINT32& dwAcked, BOOL& fTogether)
+{
+	UINT8  abCommand[BOOT_RANGE_LEN];
+	UINT32 dwNacked;
+
+	dwAcked = 0;
+	fTogether = TRUE;
+
+	BootRangeCommand(abCommand, dwAddr, dwLen);
+	//
+	// a node without ACK got the command and lost only its ACK, unless
+	// no node answered at all
+	//
+	UINT32 dwIn = Transact(BOOT_CMD_WRITE, BOOT_RANGE_LEN, abCommand, RTO_WRITE_START, dwNodes, dwNacked);
+	if (dwIn || dwNacked)
+	{
+		dwIn = dwNodes & ~dwNacked;
+	}
+	fTogether = ((dwIn == 0) || (dwIn == dwNodes)) ? TRUE : FALSE;
+	if (!(dwIn & PACER))
+	{
+		return 0;
+	}
+
+	while (dwAcked < dwLen)
+	{
+		UINT32 dwFrame = dwLen - dwAcked;
+		if (dwFrame > 8)
+		{
+			dwFrame = 8;
+		}
+
+		if (dwAcked + dwFrame < dwLen)
+		{
+			if (!Transact(BOOT_ID_DATA, dwFrame, &pbData[dwAcked], RTO_WRITE_DATA, PACER, dwNacked))
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			UINT32 dwLast = Transact(BOOT_ID_DATA, dwFrame, &pbData[dwAcked], RTO_WRITE_BLOCK, dwIn, dwNacked);
+			if (dwLast == 0)
+			{
+				return 0;
+			}
+			fTogether = (dwLast == dwIn) ? fTogether : FALSE;
+			dwIn = dwLast;
+		}
+		dwAcked += dwFrame;
+	}
+
+	return dwIn;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Brings the nodes back to command mode after a broken group write.
+  Filler frames with 0xFF are sent to the group until every node
+  rejects one. Nodes in command mode answer the filler with a NACK,
+  nodes which still wait for data take it as erased bytes. Only the
+  pacer answers every filler, so it sets the pace until it is drained;
+  the others are at the same frame and follow with it. The NACKs of the
+  nodes in command mode are collected as well, they would delay the
+  next command otherwise.
+
+  @param dwNodes  nodes which may still wait for data
+  @param dwGroup  all nodes of the stream
+
+  @return nodes which did not return to command mode
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::DrainWrite(UINT32 dwNodes, UINT32 dwGroup)
+{
+	UINT8 abFill[8];
+
+	memset(abFill, 0xFF, sizeof(abFill));
+	for (UINT32 i = 0; (i < MAX_DRAIN_FRAMES) && dwNodes; i++)
+	{
+		UINT32 dwNacked;
+		UINT32 dwWait = (dwGroup & ~dwNodes) | ((dwNodes & PACER) ? PACER : dwNodes);
+
+		TransmitFrame(BOOT_ID_DATA, 8, abFill);
+		Collect(BOOT_ID_DATA, dwWait, m_aRto[RTO_WRITE_BLOCK].GetTimeout(), dwNacked);
+		dwNodes &= ~dwNacked;
+	}
+
+	// late answers to the fillers would be taken for answers to the next command
+	CanFrame sFrame;
+	while (m_pTransport->Receive(sFrame, m_aRto[RTO_WRITE_DATA].GetTimeout()))
+	{
+		if (m_fRxTrace)
+		{
+			BootLogData(LOG_TRACE, sFrame.abData, sFrame.bLen,
+				"\n[%u] Time: %10u  ID: %3X Sim  Len: %1u  Data:", m_dwChannel, (UINT32)sFrame.qwTime, sFrame.dwMsgId, sFrame.bLen);
+		}
+	}
+
+	return dwNodes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes one block of the image to the group. If no node acknowledged
+  a frame, the frame was lost on the bus: the nodes are drained, the
+  frame is read back on every node and the rest of the block is sent to
+  the group again. Otherwise the nodes which missed a frame are marked
+  for the repair.
+
+  @param dwOffset  offset of the block in the image
+  @param dwLen     number of bytes, 1..256
+  @param dwNodes   nodes to write
+
+  @return nodes which have the whole block
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootBroadcast::WriteBlock(UINT32 dwOffset, UINT32 dwLen, UINT32 dwNodes)
+{
+	UINT32       dwAddr = m_Image.StartAdres + dwOffset;
+	const UINT8* pbData = &m_Image.Data[dwOffset];
+	UINT32       dwDone = 0;
+	UINT32       dwRound = 0;
+
+	for (;;)
+	{
+		UINT32 dwAcked;
+		BOOL   fTogether;
+		UINT32 dwStart = dwDone;
+
+		UINT32 dwComplete = WriteMemory(dwAddr + dwDone, &pbData[dwDone], dwLen - dwDone, dwNodes, dwAcked, fTogether);
+		if (dwComplete == dwNodes)
+		{
+			return dwNodes;
+		}
+
+		m_dwUnsettled = DrainWrite((dwNodes & ~dwComplete) | m_dwUnsettled, dwNodes);
+		if (!fTogether || (m_dwUnsettled & dwNodes) || (dwRound >= MAX_GROUP_ROUNDS))
+		{
+			return dwComplete;
+		}
+
+		//
+		// all nodes stopped at the same frame, it holds either the
+		// data or still 0xFF on every node
+		//
+		dwDone += dwAcked;
+
+		UINT32 dwFrame = (dwLen - dwDone > 8) ? 8 : (dwLen - dwDone);
+		UINT32 dwData = 0;
+		UINT32 dwBlank = 0;
+		for (UINT32 n = 0; n < (UINT32)m_Nodes.size(); n++)
+		{
+			UINT8 abRead[8];
+			BOOL  fRead = FALSE;
+
+			for (UINT32 i = 0; (i < MAX_REPAIR_READS) && !fRead && (dwNodes & NODE_BIT(n)); i++)
+			{
+				fRead = m_Nodes[n]->ReadMemory(dwAddr + dwDone, abRead, dwFrame);
+			}
+			if (!fRead)
+			{
+				continue;
+			}
+			m_Nodes[n]->m_dwReadBacks++;
+			if (memcmp(abRead, &pbData[dwDone], dwFrame) == 0)
+			{
+				dwData |= NODE_BIT(n);
+			}
+			else
+			{
+				BOOL fBlank = TRUE;
+				for (UINT32 i = 0; i < dwFrame; i++)
+				{
+					fBlank = fBlank && (abRead[i] == 0xFF);
+				}
+				dwBlank |= fBlank ? NODE_BIT(n) : 0;
+			}
+		}
+
+		if (dwData == dwNodes)
+		{
+			dwDone += dwFrame;
+		}
+		else if (dwBlank != dwNodes)
+		{
+			return 0;
+		}
+		if (dwDone >= dwLen)
+		{
+			return dwNodes;
+		}
+		dwRound = (dwDone > dwStart) ? 0 : (dwRound + 1);
+
+		m_dwGroupRetries++;
+		BootLog(LOG_DEBUG, "\n [%u] Write %08X to the group again ", m_dwChannel, dwAddr + dwDone);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes a block which a node missed in the group stream. The block is
+  read back in parts up to the first frame which differs, the node
+  holds the data up to some frame followed by erased bytes, and the
+  write continues behind the last programmed byte.
+
+  @param pSession  session of the node
+  @param dwOffset  offset of the block in the image
+  @param dwLen     number of bytes, 1..256
+
+  @return TRUE if the block is programmed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootBroadcast::RepairBlock(CBootSession* pSession, UINT32 dwOffset, UINT32 dwLen)
+{
+	UINT32 dwAddr = m_Image.StartAdres + dwOffset;
+	UINT8  abRead[256];
+	UINT32 dwDone = 0;
+	UINT32 dwRead = 0;
+
+	while ((dwDone == dwRead) && (dwRead < dwLen))
+	{
+		UINT32 dwPart = (dwLen - dwRead > REPAIR_READ_LEN) ? REPAIR_READ_LEN : (dwLen - dwRead);
+		BOOL   fRead = FALSE;
+
+		for (UINT32 i = 0; (i < MAX_REPAIR_READS) && !fRead; i++)
+		{
+			fRead = pSession->ReadMemory(dwAddr + dwRead, &abRead[dwRead], dwPart);
+		}
+		if (!fRead)
+		{
+			return FALSE;
+		}
+		dwRead += dwPart;
+
+		while (dwDone < dwRead)
+		{
+			UINT32 dwFrame = (dwRead - dwDone > 8) ? 8 : (dwRead - dwDone);
+			if (memcmp(&abRead[dwDone], &m_Image.Data[dwOffset + dwDone], dwFrame) != 0)
+			{
+				break;
+			}
+			dwDone += dwFrame;
+		}
+	}
+	for (UINT32 i = dwDone; i < dwRead; i++)
+	{
+		if (abRead[i] != 0xFF)
+		{
+			BootLog(LOG_ERROR, "\n [%u] Verify error at %08X ", pSession->m_dwChannel, dwAddr + i);
+			return FALSE;
+		}
+	}
+
+	m_dwRepairs++;
+	BootLog(LOG_DEBUG, "\n [%u] Repair block at %08X, %u bytes programmed ", pSession->m_dwChannel, dwAddr, dwDone);
+	return pSession->WriteBlock(dwAddr, &m_Image.Data[dwOffset], dwLen, dwDone);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the broadcasts in parallel, one thread per channel. Returns when
+  all broadcasts are finished.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootRunBroadcasts(std::vector<CBootBroadcast*>& Broadcasts)
+{
+	if (Broadcasts.size() == 1)
+	{
+		Broadcasts[0]->Run();
+		return;
+	}
+
+	std::vector<std::thread> Threads;
+	for (size_t i = 0; i < Broadcasts.size(); i++)
+	{
+		Threads.push_back(std::thread(&CBootBroadcast::Run, Broadcasts[i]));
+	}
+	for (size_t i = 0; i < Threads.size(); i++)
+	{
+		Threads[i].join();
+	}
+}
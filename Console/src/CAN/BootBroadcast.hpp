@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Broadcast of one image to a group of identical boot loader nodes.
+
+  @note
+	All nodes of the group listen to the commands with the ID base of
+	the group in addition to their own ID base and answer with their
+	own ID base. Connect, erase and every write block are sent once to
+	the group; each node acknowledges on its own identifier, so the
+	host knows which node took which command.
+
+	An ACK per node for every data frame would cost more bus time than
+	the data itself. Only the first node of the group, the pacer,
+	acknowledges the data frames; the last frame of a block is
+	acknowledged by every node after programming. A CAN frame reaches
+	all nodes or none, so a node whose ACK is missing while others
+	answered only lost its ACK.
+
+	The nodes which did not acknowledge the whole block are brought
+	back to command mode by filler frames to the group and the block is
+	marked in the ACK bitmap. If a frame was lost for all nodes, the
+	frame is read back on each node and the rest of the block is sent
+	to the group again.
+
+	When the stream is complete, the session of each node repairs its
+	missed blocks on its own: the block is read back and the write
+	continues behind the last programmed byte. Bytes are never
+	programmed twice.
+
+	The nodes share one transport, which receives the responses of all
+	of them. The broadcast and the sessions of its nodes run on one
+	thread.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTBROADCAST_HPP_
+#define _BOOTBROADCAST_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootSession.hpp"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define BROADCAST_MAX_NODES             32      // nodes per group, bits of the ACK bitmap
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class flashes one image to all nodes of a broadcast group.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootBroadcast
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootBroadcast(UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image, UINT32 dwGroupBase);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL AddNode   (CBootSession* pSession);
+	void SetRxTrace(BOOL fTrace) { m_fRxTrace = fTrace; }
+
+	int  Run   (void);
+	void Report(void);
+
+	UINT32 GetChannel(void) const { return m_dwChannel; }
+	int    GetResult (void) const { return m_iResult;   }
+
+  private:
+	//---------------------------------------------------------------
+	// frame exchange
+	//---------------------------------------------------------------
+	void   TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData);
+	UINT32 Collect      (UINT32 dwMsgId, UINT32 dwNodes, UINT32 dwTimeoutUs, UINT32& dwNacked);
+	UINT32 Transact     (UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData, UINT8 bRto,
+	                     UINT32 dwNodes, UINT32& dwNacked);
+
+	//---------------------------------------------------------------
+	// group commands
+	//---------------------------------------------------------------
+	int    Flash      (void);
+	UINT32 Connect    (void);
+	UINT32 MassErase  (UINT32 dwNodes);
+	UINT32 WriteMemory(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32 dwNodes,
+	                   UINT32& dwAcked, BOOL& fTogether);
+	UINT32 DrainWrite (UINT32 dwNodes, UINT32 dwGroup);
+
+	//---------------------------------------------------------------
+	// image transfer
+	//---------------------------------------------------------------
+	UINT32 WriteBlock (UINT32 dwOffset, UINT32 dwLen, UINT32 dwNodes);
+	BOOL   RepairBlock(CBootSession* pSession, UINT32 dwOffset, UINT32 dwLen);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	UINT32         m_dwChannel;         // number of the channel, used in messages
+	ICanTransport* m_pTransport;        // channel to all nodes
+	const HexData& m_Image;             // image to write
+	UINT32         m_dwGroupBase;       // ID base of the group commands
+	BOOL           m_fRxTrace;          // log received frames
+
+	std::vector<CBootSession*> m_Nodes; // sessions of the nodes, bit n = m_Nodes[n], 0 = pacer
+	std::vector<UINT32> m_BlockAcks;    // per block: nodes which acknowledged the whole block
+	UINT32         m_dwUnsettled;       // nodes which did not return to command mode
+	UINT64         m_qwLastResponse;    // time of the last response seen by Collect()
+
+	CRtoEstimator  m_aRto[RTO_COUNT];   // response timeouts of the whole group
+
+	UINT32         m_dwGroupFrames;     // frames sent to the group
+	UINT32         m_dwGroupRetries;    // block parts sent to the group again
+	UINT32         m_dwRepairs;         // blocks written to single nodes
+
+	UINT64         m_qwStart;           // transport time at start
+	UINT64         m_qwDuration;        // duration of the broadcast and the repairs
+	int            m_iResult;           // SESSION_xxx, first error of the nodes
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void BootRunBroadcasts(std::vector<CBootBroadcast*>& Broadcasts);
+
+#endif //_BOOTBROADCAST_HPP_
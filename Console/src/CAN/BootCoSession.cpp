@@ -0,0 +1,510 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashing session as coroutines on the event loop.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootCoSession.hpp"
+#include "BootGeometry.hpp"
+#include "BootProtocol.hpp"
+#include "BootLog.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+  @param Loop        loop which runs the coroutines of the session
+  @param dwChannel   number of the channel, used in messages
+  @param pTransport  channel to the target
+  @param Image       image to write, must live as long as the session
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootCoSession::CBootCoSession(CBootLoop& Loop, UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image)
+	: m_Loop(Loop)
+	, m_Image(Image)
+{
+	BootRtoInit(m_aRto);
+	m_dwChannel = dwChannel;
+	m_pTransport = pTransport;
+	m_dwIdBase = 0;
+	m_fMassErase = FALSE;
+	m_dwConnectWaitUs = CONNECT_WAIT_US;
+	m_dwState = 0;
+	m_qwAckTime = 0;
+
+	m_qwStart = 0;
+	m_qwDuration = 0;
+	m_iResult = SESSION_NOT_STARTED;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashes the image and leaves the time keeping of the transport.
+  Spawn the task on the loop.
+
+  @return SESSION_OK or the error, also available with GetResult()
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Run(void)
+{
+	m_qwStart = m_pTransport->GetTime();
+
+	m_iResult = co_await Flash();
+	m_qwDuration = m_pTransport->GetTime() - m_qwStart;
+	BootLog(LOG_DEBUG, "\n [%u] Responses: %u matched, %u late, %u unsolicited", m_dwChannel,
+		m_Dispatch.GetMatched(), m_Dispatch.GetLate(), m_Dispatch.GetUnsolicited());
+	m_pTransport->Detach();
+	co_return m_iResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Connects to the boot loader, erases the sectors of the image, or
+  the whole flash if the layout of the part is unknown, and writes
+  the image.
+
+  @return SESSION_OK or the error
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Flash(void)
+{
+	if (!co_await Connect())
+	{
+		BootLog(LOG_ERROR, "\n [%u] Error BootLoader notstarted", m_dwChannel);
+		co_return SESSION_NOT_STARTED;
+	}
+
+	//----------- erase -------------
+	UINT32 dwPid = (UINT32)co_await GetId();
+	CFlashLayout Layout;
+	std::vector<UINT32> Sectors;
+	std::vector<UINT8> Pages;
+	if (!m_fMassErase && dwPid && Layout.SetPart(dwPid, 0) &&
+	    Layout.PlanErase(m_Image.StartAdres, m_Image.HexDataLen, Sectors) && (Sectors.back() <= 0xFF))
+	{
+		Pages.assign(Sectors.begin(), Sectors.end());
+	}
+
+	BOOL fErased = TRUE;
+	if (Pages.empty())
+	{
+		fErased = co_await Erase(std::span<const UINT8>());
+	}
+	for (size_t i = 0; fErased && (i < Pages.size()); i += BOOT_MAX_PAGES)
+	{
+		size_t nCount = (Pages.size() - i > BOOT_MAX_PAGES) ? BOOT_MAX_PAGES : (Pages.size() - i);
+		fErased = co_await Erase(std::span<const UINT8>(&Pages[i], nCount));
+	}
+	if (!fErased)
+	{
+		BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+		co_return SESSION_ERASE_ERROR;
+	}
+
+	//---------------- write -------------
+	for (UINT32 dwOffset = 0; dwOffset < m_Image.HexDataLen; )
+	{
+		// a block ends at a 256 byte boundary of the address
+		UINT32 dwLen = BOOT_BLOCK_LEN - ((m_Image.StartAdres + dwOffset) % BOOT_BLOCK_LEN);
+		if (dwLen > m_Image.HexDataLen - dwOffset)
+		{
+			dwLen = m_Image.HexDataLen - dwOffset;
+		}
+		if (!co_await WriteMemory(m_Image.StartAdres + dwOffset, std::span<const UINT8>(&m_Image.Data[dwOffset], dwLen)))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Write error at %08X", m_dwChannel, m_Image.StartAdres + dwOffset);
+			co_return SESSION_WRITE_ERROR;
+		}
+		dwOffset += dwLen;
+	}
+
+	BootLog(LOG_INFO, "\n [%u] %u bytes written", m_dwChannel, m_Image.HexDataLen);
+	co_return SESSION_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Synchronizes with the boot loader like CBootSession: the frames of
+  BootSyncId() with a growing interval. Both stay expected, the answer
+  can be to an earlier frame.
+
+  @return TRUE if the boot loader answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Connect(void)
+{
+	UINT64 qwStart = m_pTransport->GetTime();
+	UINT32 dwInterval = CONNECT_FIRST_US;
+	CanFrame sFrame;
+
+	m_dwState = STATE_INIT_BOOT_LOADER;
+	if (!BootExpectSync(m_Dispatch, m_dwIdBase, m_dwChannel))
+	{
+		co_return FALSE;
+	}
+
+	for (UINT32 i = 0; ; i++)
+	{
+		UINT64 qwNow = m_pTransport->GetTime();
+		if (qwNow - qwStart >= m_dwConnectWaitUs)
+		{
+			co_return FALSE;
+		}
+
+		UINT32 dwMsgId = BootSyncId(i);
+		UINT64 qwEnd = qwNow + dwInterval;
+		if (qwEnd > qwStart + m_dwConnectWaitUs)
+		{
+			qwEnd = qwStart + m_dwConnectWaitUs;
+		}
+		TransmitFrame(dwMsgId, 0, NULL);
+
+		// a NACK also shows a running boot loader
+		while ((qwNow = m_pTransport->GetTime()) < qwEnd)
+		{
+			if (!co_await m_Loop.Receive(m_pTransport, sFrame, (UINT32)(qwEnd - qwNow)) || (sFrame.bLen == 0))
+			{
+				continue;
+			}
+			int iResult = m_Dispatch.Dispatch(sFrame.dwMsgId, sFrame.abData[0], m_dwState);
+			if ((iResult == DISPATCH_ACK) || (iResult == DISPATCH_NACK))
+			{
+				BootLog(LOG_INFO, "\n [%u] Boot loader ready after %u us, %u frames", m_dwChannel,
+					(UINT32)(sFrame.qwTime - qwStart), i + 1);
+				co_return TRUE;
+			}
+		}
+		dwInterval = BootSyncInterval(dwInterval);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the product ID of the target with the Get ID command.
+
+  @return product ID, 0 if the command failed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::GetId(void)
+{
+	UINT8 abPid[2];
+
+	if (!co_await Transact(BOOT_CMD_GET_ID, 0, NULL, STATE_READ_START, STATE_READ_START_COMPLETE, RTO_READ) ||
+	    !co_await ReadData(BOOT_CMD_GET_ID, std::span<UINT8>(abPid, 2), RTO_READ))
+	{
+		co_return 0;
+	}
+	co_return (int)(((UINT32)abPid[0] << 8) | abPid[1]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases flash pages, or the whole flash, and waits for the second ACK
+  at the end of the erase.
+
+  @param Pages  page numbers, 1..255 of them, none for a mass erase
+
+  @return TRUE if the erase is complete
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Erase(std::span<const UINT8> Pages)
+{
+	UINT8 bCount = BootEraseCount((UINT32)Pages.size());
+
+	if (!co_await Transact(BOOT_CMD_ERASE, 1, &bCount, STATE_INIT_ERASE, STATE_INIT_ERASE_OK, RTO_ERASE))
+	{
+		co_return FALSE;
+	}
+	UINT64 qwEraseStart = m_qwAckTime;
+
+	// the page numbers follow in frames of up to 8 bytes
+	for (size_t i = 0; i < Pages.size(); i += CAN_MAX_LEN)
+	{
+		size_t nLen = (Pages.size() - i > CAN_MAX_LEN) ? CAN_MAX_LEN : (Pages.size() - i);
+		TransmitFrame(BOOT_CMD_ERASE, (UINT32)nLen, &Pages[i]);
+	}
+
+	m_pTransport->SetRxMode(BootRxMode(RTO_ERASE_DONE));
+	if (!Expect(BOOT_CMD_ERASE, STATE_INIT_ERASE_OK, STATE_ERASE_COMPLETE))
+	{
+		co_return FALSE;
+	}
+	if (co_await WaitAck(m_aRto[RTO_ERASE_DONE].GetTimeout()) != BOOT_ACK)
+	{
+		m_aRto[RTO_ERASE_DONE].Backoff();
+		co_return FALSE;
+	}
+	if (Pages.empty())
+	{
+		m_aRto[RTO_ERASE_DONE].AddSample((UINT32)(m_qwAckTime - qwEraseStart));
+	}
+	co_return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes a block with the Write Memory command, the data frames are
+  acknowledged one by one.
+
+  @param dwAddr  target address
+  @param Data    1..256 bytes within one 256 byte row
+
+  @return TRUE if the whole block is programmed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::WriteMemory(UINT32 dwAddr, std::span<const UINT8> Data)
+{
+	UINT8 abCommand[BOOT_RANGE_LEN];
+
+	UINT32 dwLen = BootRangeCommand(abCommand, dwAddr, (UINT32)Data.size());
+	if (!co_await Transact(BOOT_CMD_WRITE, dwLen, abCommand, STATE_WRITE_START, STATE_WRITE_START_COMLETE, RTO_WRITE_START))
+	{
+		co_return FALSE;
+	}
+
+	for (size_t i = 0; i < Data.size(); i += CAN_MAX_LEN)
+	{
+		size_t nLen = (Data.size() - i > CAN_MAX_LEN) ? CAN_MAX_LEN : (Data.size() - i);
+		if (!co_await Transact(BOOT_ID_DATA, (UINT32)nLen, &Data[i], STATE_WRITE_DATA_BLOCK, STATE_WRITE_DATA_BLOCK_COMPLETE,
+			(i + nLen < Data.size()) ? RTO_WRITE_DATA : RTO_WRITE_BLOCK))
+		{
+			co_return FALSE;
+		}
+	}
+	co_return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads target memory with the Read Memory command.
+
+  @param dwAddr  target address
+  @param Data    receives 1..256 bytes
+
+  @return TRUE if all data was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::ReadMemory(UINT32 dwAddr, std::span<UINT8> Data)
+{
+	UINT8 abCommand[BOOT_RANGE_LEN];
+
+	UINT32 dwLen = BootRangeCommand(abCommand, dwAddr, (UINT32)Data.size());
+	if (!co_await Transact(BOOT_CMD_READ, dwLen, abCommand, STATE_READ_START, STATE_READ_START_COMPLETE, RTO_READ))
+	{
+		co_return FALSE;
+	}
+	co_return co_await ReadData(BOOT_CMD_READ, Data, RTO_READ);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Starts code in the target with the Go command.
+
+  @param dwAddr  address of the vector table of the code
+
+  @return TRUE if the command was acknowledged
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Go(UINT32 dwAddr)
+{
+	UINT8 abCommand[BOOT_ADDR_LEN];
+
+	UINT32 dwLen = BootAddrCommand(abCommand, dwAddr);
+	co_return co_await Transact(BOOT_CMD_GO, dwLen, abCommand, STATE_GO, STATE_GO_COMPLETE, RTO_WRITE_START);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a frame and waits for its ACK with the timeout of the command
+  type. The round trip time of the ACK updates the timeout estimation.
+
+  @param dwMsgId  identifier of the frame without the ID base
+  @param dwLen    payload length
+  @param pbData   payload
+  @param dwWait   state bits the response waits for
+  @param dwDone   state bits set by the ACK
+  @param bRto     command type, RTO_xxx
+
+  @return TRUE if the frame was acknowledged in time
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::Transact(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData, UINT32 dwWait, UINT32 dwDone,
+                                   UINT8 bRto)
+{
+	UINT64 qwSent = m_pTransport->GetTime();
+	UINT32 dwTimeout = m_aRto[bRto].GetTimeout();
+
+	m_dwState = dwWait;
+	if (!Expect(dwMsgId, dwWait, dwDone))
+	{
+		co_return FALSE;
+	}
+	m_pTransport->SetRxMode(BootRxMode(bRto));
+	TransmitFrame(dwMsgId, dwLen, pbData);
+
+	int iAck = co_await WaitAck(dwTimeout);
+	if (iAck == BOOT_ACK)
+	{
+		m_aRto[bRto].AddSample((UINT32)(m_qwAckTime - qwSent));
+		co_return TRUE;
+	}
+	if (iAck == BOOT_NACK)
+	{
+		BootLog(LOG_DEBUG, "\n [%u] NACK (ID %3X) ", m_dwChannel, dwMsgId);
+		co_return FALSE;
+	}
+
+	m_aRto[bRto].Backoff();
+	BootLog(LOG_ERROR, "\n [%u] Response timeout after %u us (ID %3X) ", m_dwChannel, dwTimeout, dwMsgId);
+	co_return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Waits for the ACK or NACK of the pending request. Late responses of
+  earlier requests and unsolicited frames are counted by the dispatch
+  and skipped.
+
+  @param dwTimeoutUs  max. time to wait
+
+  @return BOOT_ACK or BOOT_NACK, 0 on timeout
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::WaitAck(UINT32 dwTimeoutUs)
+{
+	UINT64 qwDeadline = m_pTransport->GetTime() + dwTimeoutUs;
+	UINT64 qwNow;
+	CanFrame sFrame;
+
+	while ((qwNow = m_pTransport->GetTime()) < qwDeadline)
+	{
+		if (!co_await m_Loop.Receive(m_pTransport, sFrame, (UINT32)(qwDeadline - qwNow)) || (sFrame.bLen == 0))
+		{
+			continue;
+		}
+		int iResult = m_Dispatch.Dispatch(sFrame.dwMsgId, sFrame.abData[0], m_dwState);
+		if ((iResult == DISPATCH_ACK) || (iResult == DISPATCH_NACK))
+		{
+			m_qwAckTime = sFrame.qwTime;
+			co_return (iResult == DISPATCH_ACK) ? BOOT_ACK : BOOT_NACK;
+		}
+	}
+	co_return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Receives the data frames and the final ACK of a read command after
+  the command was acknowledged. The data can contain any byte.
+
+  @param dwMsgId  identifier of the command without the ID base
+  @param Data     receives the data
+  @param bRto     command type, RTO_xxx
+
+  @return TRUE if all data was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootTask CBootCoSession::ReadData(UINT32 dwMsgId, std::span<UINT8> Data, UINT8 bRto)
+{
+	UINT32 dwTimeout = m_aRto[bRto].GetTimeout();
+	size_t nCount = 0;
+	CanFrame sFrame;
+
+	// the data of a long read comes back to back
+	m_pTransport->SetRxMode((Data.size() > CAN_MAX_LEN) ? CAN_RX_BATCH : CAN_RX_FRAME);
+	while (nCount < Data.size())
+	{
+		if (!co_await m_Loop.Receive(m_pTransport, sFrame, dwTimeout))
+		{
+			co_return FALSE;
+		}
+		if (sFrame.dwMsgId != m_dwIdBase + dwMsgId)
+		{
+			continue;
+		}
+		for (UINT8 i = 0; (i < sFrame.bLen) && (nCount < Data.size()); i++)
+		{
+			Data[nCount++] = sFrame.abData[i];
+		}
+	}
+	m_dwState = STATE_READ_DATA;
+	if (!Expect(dwMsgId, STATE_READ_DATA, STATE_READ_COMPLETE))
+	{
+		co_return FALSE;
+	}
+	co_return (co_await WaitAck(dwTimeout) == BOOT_ACK) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Enters the response of the next request in the dispatch table and
+  retires the request before. Data frames are answered on the
+  identifier of Write Memory.
+
+  @param dwMsgId  identifier of the request without the ID base
+  @param dwWait   state bits the response waits for
+  @param dwDone   state bits set by the ACK
+
+  @return FALSE if the dispatch table has no entry left
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootCoSession::Expect(UINT32 dwMsgId, UINT32 dwWait, UINT32 dwDone)
+{
+	m_Dispatch.Retire();
+	if (!m_Dispatch.Expect(m_dwIdBase + dwMsgId, dwWait, dwDone) ||
+	    ((dwMsgId == BOOT_ID_DATA) && !m_Dispatch.Expect(m_dwIdBase + BOOT_CMD_WRITE, dwWait, dwDone)))
+	{
+		BootLog(LOG_ERROR, "\n [%u] No dispatch entry for ID %3X ", m_dwChannel, dwMsgId);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a frame to the node.
+
+  @param dwMsgId  identifier without the ID base
+  @param dwLen    payload length, up to 8
+  @param pbData   payload
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootCoSession::TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData)
+{
+	BootSendFrame(m_pTransport, m_dwChannel, m_dwIdBase + dwMsgId, 0, dwLen, pbData);
+}
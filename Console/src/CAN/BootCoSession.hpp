@@ -0,0 +1,108 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashing session as coroutines on the event loop.
+
+  @note
+	The steps of the ROM boot loader protocol are coroutines, e.g.
+
+	  if (!co_await Session.Erase(Pages)) ...
+	  if (!co_await Session.WriteMemory(dwAddr, Block)) ...
+
+	Every co_await of a response suspends the session until the frame
+	arrives on the loop, the thread of the loop serves the other
+	sessions meanwhile. Run() is the whole flash: connect, erase the
+	sectors of the image and write it block by block.
+
+	The frames are built and the responses checked like in CBootSession:
+	the payloads come from BootProtocol.hpp, every request is entered in
+	a dispatch table (BootDispatch.hpp) with the state bits it waits for
+	and sets. A late ACK of an earlier request or a frame of another
+	node does not complete a step.
+
+	The session covers the write path of the ROM boot loader. The stub,
+	delta flash, journal, device store and the recovery of a broken
+	block are left to CBootSession, a lost response ends the session
+	with an error.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTCOSESSION_HPP_
+#define _BOOTCOSESSION_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootLoop.hpp"
+#include "BootSession.hpp"
+
+#include <span>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class flashes one image to one target on the thread of a loop.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootCoSession
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootCoSession(CBootLoop& Loop, UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void SetIdBase   (UINT32 dwIdBase)   { m_dwIdBase = dwIdBase;     }
+	void SetMassErase(BOOL fMassErase)   { m_fMassErase = fMassErase; }
+	void SetConnectWait(UINT32 dwWaitUs) { m_dwConnectWaitUs = dwWaitUs; }
+
+	CBootTask Run        (void);
+	CBootTask Connect    (void);
+	CBootTask GetId      (void);
+	CBootTask Erase      (std::span<const UINT8> Pages);
+	CBootTask WriteMemory(UINT32 dwAddr, std::span<const UINT8> Data);
+	CBootTask ReadMemory (UINT32 dwAddr, std::span<UINT8> Data);
+	CBootTask Go         (UINT32 dwAddr);
+
+	UINT32 GetChannel (void) const { return m_dwChannel;  }
+	int    GetResult  (void) const { return m_iResult;    }
+	UINT64 GetDuration(void) const { return m_qwDuration; }
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	CBootTask Flash   (void);
+	CBootTask Transact(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData, UINT32 dwWait, UINT32 dwDone, UINT8 bRto);
+	CBootTask WaitAck (UINT32 dwTimeoutUs);
+	CBootTask ReadData(UINT32 dwMsgId, std::span<UINT8> Data, UINT8 bRto);
+	BOOL      Expect  (UINT32 dwMsgId, UINT32 dwWait, UINT32 dwDone);
+	void      TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CBootLoop&     m_Loop;                  // loop the coroutines run on
+	UINT32         m_dwChannel;             // channel number for messages
+	ICanTransport* m_pTransport;            // channel to the target
+	const HexData& m_Image;                 // image to write
+	UINT32         m_dwIdBase;              // added to all identifiers of the node
+	BOOL           m_fMassErase;            // always erase the whole flash
+	UINT32         m_dwConnectWaitUs;       // time to wait for the boot loader
+	CRtoEstimator  m_aRto[RTO_COUNT];       // response timeout per command type
+	CBootDispatch  m_Dispatch;              // pending requests by response identifier
+	UINT32         m_dwState;               // STATE_xxx of the pending request
+	UINT64         m_qwAckTime;             // transport time of the last ACK or NACK
+
+	UINT64         m_qwStart;               // transport time the session started
+	UINT64         m_qwDuration;            // duration of the session
+	int            m_iResult;               // SESSION_xxx
+};
+
+#endif //_BOOTCOSESSION_HPP_
@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320) of image data
+  and flash contents.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootCrc.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Lookup table with one entry per byte value. It is built by the
+  constructor of the static instance before main() runs, so all
+  threads see the same table.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCrcTable
+{
+  public:
+	CCrcTable()
+	{
+		for (UINT32 i = 0; i < 256; i++)
+		{
+			UINT32 dwCrc = i;
+			for (UINT8 j = 0; j < 8; j++)
+			{
+				dwCrc = (dwCrc & 1) ? ((dwCrc >> 1) ^ 0xEDB88320) : (dwCrc >> 1);
+			}
+			m_adwCrc[i] = dwCrc;
+		}
+	}
+
+	UINT32 m_adwCrc[256];
+};
+
+static const CCrcTable CrcTable;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Calculates the CRC of a memory range.
+
+  @param pbData  data
+  @param dwLen   number of bytes
+  @param dwCrc   CRC of the preceding data, 0 for the first range
+
+  @return CRC including the range
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 BootCrc32(const UINT8* pbData, UINT32 dwLen, UINT32 dwCrc)
+{
+	dwCrc = ~dwCrc;
+	for (UINT32 i = 0; i < dwLen; i++)
+	{
+		dwCrc = CrcTable.m_adwCrc[(dwCrc ^ pbData[i]) & 0xFF] ^ (dwCrc >> 8);
+	}
+	return ~dwCrc;
+}
@@ -0,0 +1,27 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320) of image data
+  and flash contents.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTCRC_HPP_
+#define _BOOTCRC_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+UINT32 BootCrc32(const UINT8* pbData, UINT32 dwLen, UINT32 dwCrc = 0);
+
+#endif //_BOOTCRC_HPP_
@@ -0,0 +1,293 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sectors which differ between the installed image and a new image.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootDelta.hpp"
+#include "BootCrc.hpp"
+#include "BootLog.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor. All sectors of the image count as changed until the
+  installed image is known.
+
+  @param Image   new image, must live as long as the object
+  @param Layout  sectors of the flash, must live as long as the object
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootDelta::CBootDelta(const HexData& Image, const CFlashLayout& Layout)
+	: m_Image(Image)
+	, m_Layout(Layout)
+{
+	m_dwFirstSector = 0;
+	m_fBase = FALSE;
+	m_qwEraseTime = 0;
+	m_qwWriteTime = 0;
+	m_dwWritten = 0;
+
+	Cover(Image.StartAdres, Image.HexDataLen);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Takes the installed image from an image file.
+
+  @param Base  image which is installed on the target
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::SetBase(const HexData& Base)
+{
+	Cover(Base.StartAdres, Base.HexDataLen);
+	for (UINT32 i = 0; i < GetSectors(); i++)
+	{
+		m_InstalledCrc[i] = SectorCrc(Base, i);
+		m_Known[i] = 1;
+	}
+	m_fBase = TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Takes the installed image from the CRC of its sectors, e.g. kept in
+  the device store. A sector is known only if the address and the size
+  match the layout.
+
+  @param Sectors  installed sectors, ascending
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::SetBase(const std::vector<SectorState>& Sectors)
+{
+	if (!Sectors.empty())
+	{
+		Cover(Sectors.front().dwAddr, Sectors.back().dwAddr + Sectors.back().dwSize - Sectors.front().dwAddr);
+	}
+	for (size_t s = 0; s < Sectors.size(); s++)
+	{
+		UINT32 dwSector;
+		if (m_Layout.Find(Sectors[s].dwAddr, dwSector) && (dwSector >= m_dwFirstSector) &&
+		    (dwSector - m_dwFirstSector < GetSectors()) && (m_Layout.GetAddr(dwSector) == Sectors[s].dwAddr) &&
+		    (m_Layout.GetSize(dwSector) == Sectors[s].dwSize))
+		{
+			SetInstalled(dwSector - m_dwFirstSector, Sectors[s].dwCrc);
+		}
+	}
+	m_fBase = TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Takes the CRC of an installed sector, e.g. reported by the target.
+
+  @param dwIndex  index of the sector
+  @param dwCrc    CRC-32 of the whole sector
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::SetInstalled(UINT32 dwIndex, UINT32 dwCrc)
+{
+	m_InstalledCrc[dwIndex] = dwCrc;
+	m_Known[dwIndex] = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns TRUE if a sector must be erased and written.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootDelta::IsChanged(UINT32 dwIndex) const
+{
+	return (!m_Known[dwIndex] || (m_InstalledCrc[dwIndex] != m_NewCrc[dwIndex])) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the number of changed sectors.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootDelta::GetChanged(void) const
+{
+	UINT32 dwChanged = 0;
+
+	for (UINT32 i = 0; i < GetSectors(); i++)
+	{
+		dwChanged += IsChanged(i) ? 1 : 0;
+	}
+	return dwChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the parts of the new image in changed sectors. Adjacent
+  changed sectors form one range.
+
+  @param Ranges  receives the ranges in ascending order
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::GetRanges(std::vector<ImageRange>& Ranges) const
+{
+	UINT32 dwImageEnd = m_Image.StartAdres + m_Image.HexDataLen;
+
+	Ranges.clear();
+	for (UINT32 i = 0; i < GetSectors(); i++)
+	{
+		UINT32 dwStart = GetSectorAddr(i);
+		UINT32 dwEnd = dwStart + GetSectorSize(i);
+		if (dwStart < m_Image.StartAdres)
+		{
+			dwStart = m_Image.StartAdres;
+		}
+		if (dwEnd > dwImageEnd)
+		{
+			dwEnd = dwImageEnd;
+		}
+		if (!IsChanged(i) || (dwStart >= dwEnd))
+		{
+			continue;
+		}
+
+		UINT32 dwOffset = dwStart - m_Image.StartAdres;
+		if (!Ranges.empty() && (Ranges.back().dwOffset + Ranges.back().dwLen == dwOffset))
+		{
+			Ranges.back().dwLen += dwEnd - dwStart;
+		}
+		else
+		{
+			ImageRange sRange = { dwOffset, dwEnd - dwStart };
+			Ranges.push_back(sRange);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Keeps the times of the delta flash for the report.
+
+  @param qwEraseTime  duration of the sector erase in microseconds
+  @param qwWriteTime  duration of the write in microseconds
+  @param dwWritten    bytes written
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::SetTimes(UINT64 qwEraseTime, UINT64 qwWriteTime, UINT32 dwWritten)
+{
+	m_qwEraseTime = qwEraseTime;
+	m_qwWriteTime = qwWriteTime;
+	m_dwWritten = dwWritten;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reports the changed sectors and the time saved. The saved time is
+  estimated with the write rate of this session.
+
+  @param dwChannel  number of the channel, used in messages
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::Report(UINT32 dwChannel) const
+{
+	std::vector<ImageRange> Ranges;
+	UINT32 dwChanged = 0;
+
+	GetRanges(Ranges);
+	for (size_t i = 0; i < Ranges.size(); i++)
+	{
+		dwChanged += Ranges[i].dwLen;
+	}
+	UINT32 dwSkipped = m_Image.HexDataLen - dwChanged;
+	UINT64 qwSaved = m_dwWritten ? (m_qwWriteTime * dwSkipped / m_dwWritten) : 0;
+
+	BootLog(LOG_INFO, "\n [%u] Delta: %u of %u sectors changed", dwChannel, GetChanged(), GetSectors());
+	BootLog(LOG_INFO, "\n [%u] Delta: erase %u ms, write %u ms", dwChannel,
+		(UINT32)(m_qwEraseTime / 1000), (UINT32)(m_qwWriteTime / 1000));
+	BootLog(LOG_INFO, "\n [%u] Delta: %u bytes skipped, about %u ms of writing saved", dwChannel,
+		dwSkipped, (UINT32)(qwSaved / 1000));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Extends the sectors to cover an address range. New sectors of the
+  new image start unknown. Parts outside the flash are not covered.
+
+  @param dwStart  start address
+  @param dwLen    length in bytes
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDelta::Cover(UINT32 dwStart, UINT32 dwLen)
+{
+	UINT32 dwFirst, dwLast;
+
+	if ((dwLen == 0) || !m_Layout.Find(dwStart, dwFirst))
+	{
+		return;
+	}
+	if (!m_Layout.Find(dwStart + dwLen - 1, dwLast))
+	{
+		dwLast = m_Layout.GetSectors() - 1;
+	}
+	if (!m_NewCrc.empty())
+	{
+		UINT32 dwOldLast = m_dwFirstSector + GetSectors() - 1;
+		dwFirst = (dwFirst < m_dwFirstSector) ? dwFirst : m_dwFirstSector;
+		dwLast = (dwLast > dwOldLast) ? dwLast : dwOldLast;
+	}
+
+	m_dwFirstSector = dwFirst;
+	m_NewCrc.resize(dwLast - dwFirst + 1);
+	m_InstalledCrc.assign(m_NewCrc.size(), 0);
+	m_Known.assign(m_NewCrc.size(), 0);
+	for (UINT32 i = 0; i < GetSectors(); i++)
+	{
+		m_NewCrc[i] = SectorCrc(m_Image, i);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Computes the CRC of a sector holding an image, the bytes outside the
+  image are erased.
+
+  @param Image    image in the flash
+  @param dwIndex  index of the sector
+
+  @return CRC-32 of the whole sector
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootDelta::SectorCrc(const HexData& Image, UINT32 dwIndex) const
+{
+	std::vector<UINT8> Sector(GetSectorSize(dwIndex), 0xFF);
+	UINT32 dwAddr = GetSectorAddr(dwIndex);
+
+	for (UINT32 i = 0; i < (UINT32)Sector.size(); i++)
+	{
+		if ((dwAddr + i >= Image.StartAdres) && (dwAddr + i - Image.StartAdres < Image.HexDataLen))
+		{
+			Sector[i] = Image.Data[dwAddr + i - Image.StartAdres];
+		}
+	}
+	return BootCrc32(Sector.data(), (UINT32)Sector.size());
+}
@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sectors which differ between the installed image and a new image.
+
+  @note
+	A reflash usually changes only a few sectors, e.g. a calibration
+	table or a version string. The installed image is known as the
+	CRC-32 of each sector: computed from an image file, or reported by
+	the target. A sector is compared as a whole, bytes which are not
+	part of an image count as erased (0xFF). A sector without an
+	installed CRC counts as changed.
+
+	The sectors cover the new image and the installed image, so
+	sectors of an older, longer image are erased too. Only changed
+	sectors are erased and only their part of the new image is written.
+
+	The sectors are those of the flash layout of the target
+	(BootGeometry.hpp), they can differ in size.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTDELTA_HPP_
+#define _BOOTDELTA_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+#include "BootDevice.hpp"
+#include "BootGeometry.hpp"
+#include "HexFile.hpp"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define DELTA_SECTOR_SIZE               0x800           // erase unit of an unknown family, 2 KB pages
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// part of the image to write
+//
+typedef struct {
+	UINT32 dwOffset;                    // offset in the image
+	UINT32 dwLen;                       // length in bytes
+} ImageRange;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class compares the sectors of the installed image with the new
+  image and keeps the statistics of the delta flash.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootDelta
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootDelta(const HexData& Image, const CFlashLayout& Layout);
+
+	//---------------------------------------------------------------
+	// installed image
+	//---------------------------------------------------------------
+	void SetBase     (const HexData& Base);
+	void SetBase     (const std::vector<SectorState>& Sectors);
+	void SetInstalled(UINT32 dwIndex, UINT32 dwCrc);
+	BOOL HasBase     (void) const { return m_fBase; }
+
+	//---------------------------------------------------------------
+	// sectors
+	//---------------------------------------------------------------
+	UINT32 GetSectors   (void) const { return (UINT32)m_NewCrc.size(); }
+	UINT32 GetSector    (UINT32 dwIndex) const { return m_dwFirstSector + dwIndex; }
+	UINT32 GetSectorAddr(UINT32 dwIndex) const { return m_Layout.GetAddr(m_dwFirstSector + dwIndex); }
+	UINT32 GetSectorSize(UINT32 dwIndex) const { return m_Layout.GetSize(m_dwFirstSector + dwIndex); }
+	UINT32 GetNewCrc    (UINT32 dwIndex) const { return m_NewCrc[dwIndex]; }
+	BOOL   IsChanged    (UINT32 dwIndex) const;
+	UINT32 GetChanged   (void) const;
+	void   GetRanges    (std::vector<ImageRange>& Ranges) const;
+
+	//---------------------------------------------------------------
+	// statistics
+	//---------------------------------------------------------------
+	void SetTimes(UINT64 qwEraseTime, UINT64 qwWriteTime, UINT32 dwWritten);
+	void Report  (UINT32 dwChannel) const;
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	void   Cover    (UINT32 dwStart, UINT32 dwLen);
+	UINT32 SectorCrc(const HexData& Image, UINT32 dwIndex) const;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	const HexData&      m_Image;        // new image
+	const CFlashLayout& m_Layout;       // sectors of the flash
+	UINT32              m_dwFirstSector;// number of the first sector
+	std::vector<UINT32> m_NewCrc;       // CRC per sector of the new image
+	std::vector<UINT32> m_InstalledCrc; // CRC per sector of the installed image
+	std::vector<UINT8>  m_Known;        // the installed CRC of the sector is known
+	BOOL                m_fBase;        // the installed image is known
+
+	UINT64              m_qwEraseTime;  // duration of the sector erase
+	UINT64              m_qwWriteTime;  // duration of the write
+	UINT32              m_dwWritten;    // bytes written
+};
+
+#endif //_BOOTDELTA_HPP_
@@ -0,0 +1,314 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Persistent state of the flashed devices.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootDevice.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// address of the unique ID per family
+//
+typedef struct {
+	UINT32 dwPid;                       // product ID reported by Get ID
+	UINT32 dwUidAddr;                   // address of the 96 bit unique ID
+} UidEntry;
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+static const UidEntry asUidTable[] = {
+	{ 0x410, 0x1FFFF7E8 },              // STM32F1 medium density
+	{ 0x414, 0x1FFFF7E8 },              // STM32F1 high density
+	{ 0x418, 0x1FFFF7E8 },              // STM32F105/107
+	{ 0x430, 0x1FFFF7E8 },              // STM32F1 XL density
+	{ 0x440, 0x1FFFF7AC },              // STM32F05x
+	{ 0x448, 0x1FFFF7AC },              // STM32F07x
+	{ 0x422, 0x1FFFF7AC },              // STM32F30x
+	{ 0x438, 0x1FFFF7AC },              // STM32F334
+	{ 0x411, 0x1FFF7A10 },              // STM32F2
+	{ 0x413, 0x1FFF7A10 },              // STM32F405/407
+	{ 0x419, 0x1FFF7A10 },              // STM32F42x/43x
+	{ 0x421, 0x1FFF7A10 },              // STM32F446
+	{ 0x449, 0x1FF0F420 },              // STM32F74x/75x
+	{ 0x451, 0x1FF0F420 },              // STM32F76x/77x
+	{ 0x415, 0x1FFF7590 },              // STM32L47x/48x
+	{ 0x416, 0x1FF80050 },              // STM32L1 category 1
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the address of the unique ID of a family.
+
+  @param dwPid  product ID reported by Get ID
+
+  @return address, 0 if the family is not known
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 BootDeviceUidAddr(UINT32 dwPid)
+{
+	for (size_t i = 0; i < sizeof(asUidTable) / sizeof(asUidTable[0]); i++)
+	{
+		if (asUidTable[i].dwPid == dwPid)
+		{
+			return asUidTable[i].dwUidAddr;
+		}
+	}
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Initializes the state of a device which is not in the store.
+
+  @param sState  receives the state
+  @param pbUid   unique ID of the device
+  @param dwPid   product ID of the device
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootDeviceInit(DeviceState& sState, const UINT8* pbUid, UINT32 dwPid)
+{
+	memcpy(sState.abUid, pbUid, DEVICE_UID_LEN);
+	sState.dwPid = dwPid;
+	sState.bVersion = 0;
+	sState.Commands.clear();
+	sState.dwFlashSize = 0;
+	sState.fImage = FALSE;
+	sState.dwImageCrc = 0;
+	sState.dwImageStart = 0;
+	sState.dwImageLen = 0;
+	sState.Sectors.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+  @param pszDir  directory of the device files, must exist
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootDeviceStore::CBootDeviceStore(const char* pszDir)
+{
+	m_strDir = pszDir;
+	if (!m_strDir.empty() && (m_strDir.back() != '/') && (m_strDir.back() != '\\'))
+	{
+		m_strDir += '/';
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Loads the state of a device.
+
+  @param pbUid   unique ID of the device
+  @param sState  receives the state
+
+  @return TRUE if the device is in the store
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootDeviceStore::Load(const UINT8* pbUid, DeviceState& sState) const
+{
+	std::string strFile = GetFile(pbUid);
+	FILE* pFile = fopen(strFile.c_str(), "r");
+	char  szLine[512];
+
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	// the first line repeats the unique ID of the file name
+	BOOL fMatch = (fgets(szLine, sizeof(szLine), pFile) && (strncmp(szLine, "D1 ", 3) == 0) &&
+	               (strFile.find(std::string(szLine + 3, DEVICE_UID_LEN * 2)) != std::string::npos)) ? TRUE : FALSE;
+	if (fMatch)
+	{
+		BootDeviceInit(sState, pbUid, 0);
+	}
+
+	while (fMatch && fgets(szLine, sizeof(szLine), pFile))
+	{
+		unsigned int uValue, uAddr, uLen;
+		SectorState  sSector;
+		int          iUsed;
+
+		switch (szLine[0])
+		{
+		case 'P':
+			if (sscanf(szLine, "P %x", &uValue) == 1)
+			{
+				sState.dwPid = uValue;
+			}
+			break;
+
+		case 'V':
+			if (sscanf(szLine, "V %x", &uValue) == 1)
+			{
+				sState.bVersion = (UINT8)uValue;
+			}
+			break;
+
+		case 'C':
+			for (const char* psz = szLine + 1; sscanf(psz, " %x%n", &uValue, &iUsed) == 1; psz += iUsed)
+			{
+				sState.Commands.push_back((UINT8)uValue);
+			}
+			break;
+
+		case 'G':
+			if (sscanf(szLine, "G %u", &uValue) == 1)
+			{
+				sState.dwFlashSize = uValue;
+			}
+			break;
+
+		case 'I':
+			if (sscanf(szLine, "I %x %x %u", &uValue, &uAddr, &uLen) == 3)
+			{
+				sState.fImage = TRUE;
+				sState.dwImageCrc = uValue;
+				sState.dwImageStart = uAddr;
+				sState.dwImageLen = uLen;
+			}
+			break;
+
+		case 'S':
+			// the sectors follow each other
+			if ((sscanf(szLine, "S %x %u %x", &uAddr, &uLen, &uValue) == 3) && uLen &&
+			    (sState.Sectors.empty() || (uAddr == sState.Sectors.back().dwAddr + sState.Sectors.back().dwSize)))
+			{
+				sSector.dwAddr = uAddr;
+				sSector.dwSize = uLen;
+				sSector.dwCrc = uValue;
+				sState.Sectors.push_back(sSector);
+			}
+			break;
+		}
+	}
+
+	fclose(pFile);
+	return fMatch;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Saves the state of a device. The file is written under a name of
+  this process and thread and then replaces the file of the device.
+
+  @param sState  state of the device
+
+  @return TRUE if the state is saved
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootDeviceStore::Save(const DeviceState& sState) const
+{
+	std::string strFile = GetFile(sState.abUid);
+	char        szSuffix[40];
+
+#ifdef _WIN32
+	unsigned int uProcess = (unsigned int)GetCurrentProcessId();
+#else
+	unsigned int uProcess = (unsigned int)getpid();
+#endif
+	snprintf(szSuffix, sizeof(szSuffix), ".%u.%08X.tmp", uProcess,
+		(unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::string strTemp = strFile + szSuffix;
+
+	FILE* pFile = fopen(strTemp.c_str(), "w");
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	fprintf(pFile, "D1 %s\n", strFile.substr(m_strDir.size(), DEVICE_UID_LEN * 2).c_str());
+	fprintf(pFile, "P %03X\n", (unsigned int)sState.dwPid);
+	if (sState.bVersion)
+	{
+		fprintf(pFile, "V %02X\n", (unsigned int)sState.bVersion);
+	}
+	if (!sState.Commands.empty())
+	{
+		fprintf(pFile, "C");
+		for (size_t i = 0; i < sState.Commands.size(); i++)
+		{
+			fprintf(pFile, " %02X", (unsigned int)sState.Commands[i]);
+		}
+		fprintf(pFile, "\n");
+	}
+	if (sState.dwFlashSize)
+	{
+		fprintf(pFile, "G %u\n", (unsigned int)sState.dwFlashSize);
+	}
+	if (sState.fImage)
+	{
+		fprintf(pFile, "I %08X %08X %u\n", (unsigned int)sState.dwImageCrc,
+			(unsigned int)sState.dwImageStart, (unsigned int)sState.dwImageLen);
+		for (size_t i = 0; i < sState.Sectors.size(); i++)
+		{
+			fprintf(pFile, "S %08X %u %08X\n", (unsigned int)sState.Sectors[i].dwAddr,
+				(unsigned int)sState.Sectors[i].dwSize, (unsigned int)sState.Sectors[i].dwCrc);
+		}
+	}
+
+	BOOL fWritten = (fflush(pFile) == 0) ? TRUE : FALSE;
+	fclose(pFile);
+
+#ifdef _WIN32
+	fWritten = fWritten && MoveFileExA(strTemp.c_str(), strFile.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	fWritten = fWritten && (rename(strTemp.c_str(), strFile.c_str()) == 0);
+#endif
+	if (!fWritten)
+	{
+		remove(strTemp.c_str());
+	}
+	return fWritten;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the path of the file of a device.
+*/
+//////////////////////////////////////////////////////////////////////////
+std::string CBootDeviceStore::GetFile(const UINT8* pbUid) const
+{
+	std::string strFile = m_strDir;
+	char        szByte[4];
+
+	for (UINT32 i = 0; i < DEVICE_UID_LEN; i++)
+	{
+		snprintf(szByte, sizeof(szByte), "%02X", (unsigned int)pbUid[i]);
+		strFile += szByte;
+	}
+	return strFile + ".dev";
+}
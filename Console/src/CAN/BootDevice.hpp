@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Persistent state of the flashed devices.
+
+  @note
+	The store remembers per device what the flasher knows about it and
+	what it put on it, so a later session can skip work: the boot
+	loader version and commands, the flash size, the installed image
+	and the CRC of each of its sectors. A device is identified by the
+	96 bit unique ID of the STM32, read with Read Memory.
+
+	Each device has a small text file in the store directory, named by
+	its unique ID, so a lookup reads one file:
+
+	  D1 <unique id>
+	  P <pid>
+	  V <boot loader version>
+	  C <command> <command> ...
+	  G <flash size>
+	  I <image crc> <start address> <image length>
+	  S <sector address> <sector size> <crc>
+
+	Unknown lines are skipped. A file is replaced as a whole: it is
+	written under a name of its own and renamed, so parallel flashing
+	processes never read a partial file and the last writer wins.
+	Before the flash is changed the installed image is removed from the
+	state, an interrupted session leaves no stale sector CRCs.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTDEVICE_HPP_
+#define _BOOTDEVICE_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define DEVICE_UID_LEN                  12      // bytes of the unique ID
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// CRC of an installed sector
+//
+typedef struct {
+	UINT32 dwAddr;                      // start of the sector
+	UINT32 dwSize;                      // size of the sector in bytes
+	UINT32 dwCrc;                       // CRC-32 of the whole sector
+} SectorState;
+
+//
+// state of one device
+//
+typedef struct {
+	UINT8  abUid[DEVICE_UID_LEN];       // unique ID as read from the device
+	UINT32 dwPid;                       // product ID reported by Get ID
+	UINT8  bVersion;                    // boot loader version, 0 = unknown
+	std::vector<UINT8> Commands;        // commands of the boot loader, empty = unknown
+	UINT32 dwFlashSize;                 // flash size in bytes, 0 = unknown
+	BOOL   fImage;                      // the image below is installed
+	UINT32 dwImageCrc;                  // CRC of the installed image
+	UINT32 dwImageStart;                // load address of the installed image
+	UINT32 dwImageLen;                  // length of the installed image
+	std::vector<SectorState> Sectors;   // sectors of the installed image, ascending
+} DeviceState;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class loads and saves the state of devices. It keeps no state
+  of its own, all sessions of a process share one store.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootDeviceStore
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootDeviceStore(const char* pszDir);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL Load(const UINT8* pbUid, DeviceState& sState) const;
+	BOOL Save(const DeviceState& sState) const;
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	std::string GetFile(const UINT8* pbUid) const;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	std::string m_strDir;               // directory of the device files
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void   BootDeviceInit  (DeviceState& sState, const UINT8* pbUid, UINT32 dwPid);
+UINT32 BootDeviceUidAddr(UINT32 dwPid);
+
+#endif //_BOOTDEVICE_HPP_
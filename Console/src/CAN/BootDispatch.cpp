@@ -0,0 +1,179 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Dispatch of ACK and NACK frames to the pending requests.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootDispatch.hpp"
+#include "BootProtocol.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootDispatch::CBootDispatch()
+{
+	for (UINT32 i = 0; i < DISPATCH_SLOTS; i++)
+	{
+		m_aRequests[i].dwRespId = CAN_ID_NONE;
+		m_aRequests[i].fPending = FALSE;
+		m_aRequests[i].dwWait = 0;
+		m_aRequests[i].dwDone = 0;
+		m_aRequests[i].dwSerial = 0;
+	}
+	m_dwPending = 0;
+	m_dwSerial = 0;
+	m_dwMatched = 0;
+	m_dwLate = 0;
+	m_dwUnsolicited = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Enters a pending request. A request already waiting on the same
+  identifier is replaced, a new identifier may take the entry of a
+  retired request.
+
+  @param dwRespId  identifier of the response including the ID base
+  @param dwWait    state bits of the request, the ACK clears them
+  @param dwDone    state bits set by the ACK
+
+  @return FALSE if all entries of the table are pending
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootDispatch::Expect(UINT32 dwRespId, UINT32 dwWait, UINT32 dwDone)
+{
+	Request* pRequest = Find(dwRespId, TRUE);
+	if (!pRequest)
+	{
+		return FALSE;
+	}
+
+	if (!pRequest->fPending)
+	{
+		m_dwPending++;
+	}
+	pRequest->fPending = TRUE;
+	pRequest->dwWait = dwWait;
+	pRequest->dwDone = dwDone;
+	pRequest->dwSerial = ++m_dwSerial;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Retires all pending requests, their responses are late from now on.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootDispatch::Retire(void)
+{
+	for (UINT32 i = 0; (i < DISPATCH_SLOTS) && m_dwPending; i++)
+	{
+		if (m_aRequests[i].fPending)
+		{
+			m_aRequests[i].fPending = FALSE;
+			m_dwPending--;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Completes the request a received frame answers. The request must
+  still be pending and the state must still contain its wait bits,
+  e.g. not while a session waits for its turn.
+
+  @param dwRespId  identifier of the frame
+  @param bCode     first data byte of the frame
+  @param dwState   state of the session, the wait bits of the request
+                   are replaced by its done bits on ACK
+
+  @return DISPATCH_xxx
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootDispatch::Dispatch(UINT32 dwRespId, UINT8 bCode, UINT32& dwState)
+{
+	Request* pRequest = Find(dwRespId, FALSE);
+	if (!pRequest)
+	{
+		m_dwUnsolicited++;
+		return DISPATCH_UNSOLICITED;
+	}
+
+	// other bytes are the data of an earlier read
+	if (!pRequest->fPending || !(dwState & pRequest->dwWait) || ((bCode != BOOT_ACK) && (bCode != BOOT_NACK)))
+	{
+		m_dwLate++;
+		return DISPATCH_LATE;
+	}
+
+	pRequest->fPending = FALSE;
+	m_dwPending--;
+	m_dwMatched++;
+	if (bCode == BOOT_NACK)
+	{
+		return DISPATCH_NACK;
+	}
+	dwState = (dwState & ~pRequest->dwWait) | pRequest->dwDone;
+	return DISPATCH_ACK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Looks up the entry of an identifier. The multiplicative hash spreads
+  the identifiers of the nodes, which differ in the upper bits only,
+  over the table.
+
+  A full table has no free entry left, a probe runs over all entries.
+  The entry taken from a retired request stays in use, so the probes
+  of the other identifiers still find theirs.
+
+  @param dwRespId  identifier of the response
+  @param fAdd      TRUE to take a free or retired entry if the
+                   identifier is new
+
+  @return the entry, NULL if not found or all entries are pending
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootDispatch::Request* CBootDispatch::Find(UINT32 dwRespId, BOOL fAdd)
+{
+	UINT32   dwSlot = ((dwRespId * 0x9E3779B1) >> 16) & (DISPATCH_SLOTS - 1);
+	Request* pOldest = NULL;
+
+	for (UINT32 i = 0; i < DISPATCH_SLOTS; i++)
+	{
+		Request* pRequest = &m_aRequests[(dwSlot + i) & (DISPATCH_SLOTS - 1)];
+		if (pRequest->dwRespId == dwRespId)
+		{
+			return pRequest;
+		}
+		if (pRequest->dwRespId == CAN_ID_NONE)
+		{
+			if (!fAdd)
+			{
+				return NULL;
+			}
+			pRequest->dwRespId = dwRespId;
+			return pRequest;
+		}
+		if (!pRequest->fPending && (!pOldest || ((INT32)(pRequest->dwSerial - pOldest->dwSerial) < 0)))
+		{
+			pOldest = pRequest;
+		}
+	}
+
+	if (!fAdd || !pOldest)
+	{
+		return NULL;
+	}
+	pOldest->dwRespId = dwRespId;
+	return pOldest;
+}
@@ -0,0 +1,106 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Dispatch of ACK and NACK frames to the pending requests.
+
+  @note
+	Every command waits for its response on an identifier of its own,
+	data frames are answered on the identifier of Write Memory. A
+	pending request is entered with the identifier of its response and
+	the state bits it waits for and sets, the wait bits tell a write
+	command from its data frames.
+	A received frame finds its request with one lookup in a small open
+	addressing table instead of a test per state bit.
+
+	A request is retired when the next one is entered or its response
+	arrived, its entry stays in the table. A frame on the identifier of
+	a retired request is late, e.g. the ACK of a filler frame, a frame
+	on an identifier never expected is unsolicited. Both are counted
+	and change no state. When the table is full, a new identifier
+	takes the entry of the request retired longest ago, late frames
+	on the old identifier count as unsolicited from then on. Expect()
+	fails only when all entries are pending.
+
+	The table is keyed by the full CAN identifier including the ID
+	base of the node, so the requests of several sessions on the same
+	bus can share one table.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTDISPATCH_HPP_
+#define _BOOTDISPATCH_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define DISPATCH_SLOTS          32      // entries of the table, a power of two
+
+// result of Dispatch()
+#define DISPATCH_ACK            0       // the request is complete
+#define DISPATCH_NACK           1       // the request was rejected
+#define DISPATCH_LATE           2       // no request waits on the identifier any more
+#define DISPATCH_UNSOLICITED    3       // no request was entered for the identifier
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class maps the response identifiers to the pending requests.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootDispatch
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootDispatch();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL   Expect  (UINT32 dwRespId, UINT32 dwWait, UINT32 dwDone);
+	void   Retire  (void);
+	int    Dispatch(UINT32 dwRespId, UINT8 bCode, UINT32& dwState);
+
+	UINT32 GetMatched    (void) const { return m_dwMatched;     }
+	UINT32 GetLate       (void) const { return m_dwLate;        }
+	UINT32 GetUnsolicited(void) const { return m_dwUnsolicited; }
+
+  private:
+	//---------------------------------------------------------------
+	// data types
+	//---------------------------------------------------------------
+	typedef struct {
+		UINT32 dwRespId;                // identifier of the response, CAN_ID_NONE = free
+		BOOL   fPending;                // the request waits for the response
+		UINT32 dwWait;                  // state bits of the pending request
+		UINT32 dwDone;                  // state bits set by the ACK
+		UINT32 dwSerial;                // order in which the requests were entered
+	} Request;
+
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	Request* Find(UINT32 dwRespId, BOOL fAdd);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	Request m_aRequests[DISPATCH_SLOTS];    // open addressing, linear probing
+	UINT32  m_dwPending;                    // number of pending requests
+	UINT32  m_dwSerial;                     // serial number of the last request
+	UINT32  m_dwMatched;                    // ACK or NACK of a pending request
+	UINT32  m_dwLate;                       // frames of retired requests
+	UINT32  m_dwUnsolicited;                // frames on identifiers never expected
+};
+
+#endif //_BOOTDISPATCH_HPP_
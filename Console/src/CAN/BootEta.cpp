@@ -0,0 +1,343 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Predicted duration of a flashing session.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootEta.hpp"
+#include "CanTiming.hpp"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+//
+// payload lengths of CAN FD frames above 8 bytes
+//
+static const UINT8 abFdLen[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootEta::CBootEta(void)
+{
+	m_fPlanned = FALSE;
+	m_dwBitRate = 0;
+	m_dwDataBitRate = 0;
+	m_dwResponseUs = ETA_RESPONSE_US;
+	m_dwHostUs = ETA_HOST_US;
+	m_dwPhase = ETA_PHASES;
+	memset(m_aPhase, 0, sizeof(m_aPhase));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Starts a new plan for a bus.
+
+  @param dwBitRate      nominal bit rate in bit/s, 0 = not known
+  @param dwDataBitRate  data bit rate in bit/s, 0 = classic CAN
+
+  @return FALSE if the bit rate is not known, nothing is predicted then
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootEta::SetBus(UINT32 dwBitRate, UINT32 dwDataBitRate)
+{
+	m_dwBitRate = dwBitRate;
+	m_dwDataBitRate = dwDataBitRate;
+	m_fPlanned = dwBitRate ? TRUE : FALSE;
+	m_dwPhase = ETA_PHASES;
+	memset(m_aPhase, 0, sizeof(m_aPhase));
+	return m_fPlanned;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sets the latencies of an exchange besides its frames.
+
+  @param dwResponseUs  command on the bus until the target starts its
+                       response
+  @param dwHostUs      response on the bus until the host sends the
+                       next command
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::SetLatency(UINT32 dwResponseUs, UINT32 dwHostUs)
+{
+	m_dwResponseUs = dwResponseUs;
+	m_dwHostUs = dwHostUs;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the duration of a frame with the largest number of stuff
+  bits. A CAN FD frame above 8 bytes is padded to the next valid
+  length.
+
+  @param dwLen  payload bytes
+  @param fFd    CAN FD frame with bit rate switch
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CBootEta::GetFrameNs(UINT32 dwLen, BOOL fFd) const
+{
+	CanBits sBits;
+
+	fFd = (fFd && m_dwDataBitRate) ? TRUE : FALSE;
+	for (UINT32 i = 0; fFd && (dwLen > CAN_MAX_LEN) && (i < sizeof(abFdLen)); i++)
+	{
+		if (abFdLen[i] >= dwLen)
+		{
+			dwLen = abFdLen[i];
+			break;
+		}
+	}
+	CanFrameBitsMax(dwLen, fFd, sBits);
+	return CanBitsTimeNs(sBits, m_dwBitRate, m_dwDataBitRate);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds exchanges of a classic command frame and its response.
+
+  @param dwPhase    ETA_xxx
+  @param dwCmdLen   payload of the command
+  @param dwRespLen  payload of the response
+  @param dwCount    number of exchanges
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::AddExchange(UINT32 dwPhase, UINT32 dwCmdLen, UINT32 dwRespLen, UINT32 dwCount)
+{
+	if (!m_fPlanned)
+	{
+		return;
+	}
+
+	UINT64 qwBusNs = GetFrameNs(dwCmdLen, FALSE) + GetFrameNs(dwRespLen, FALSE);
+	m_aPhase[dwPhase].qwBusNs += qwBusNs * dwCount;
+	m_aPhase[dwPhase].qwTimeNs += (qwBusNs + (UINT64)(m_dwResponseUs + m_dwHostUs) * 1000) * dwCount;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds frames which are sent back to back without a response.
+
+  @param dwPhase  ETA_xxx
+  @param dwLen    payload of each frame
+  @param fFd      CAN FD frames with bit rate switch
+  @param dwCount  number of frames
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::AddFrames(UINT32 dwPhase, UINT32 dwLen, BOOL fFd, UINT32 dwCount)
+{
+	if (!m_fPlanned)
+	{
+		return;
+	}
+
+	UINT64 qwBusNs = GetFrameNs(dwLen, fFd) * dwCount;
+	m_aPhase[dwPhase].qwBusNs += qwBusNs;
+	m_aPhase[dwPhase].qwTimeNs += qwBusNs;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds the stream of one block with a window of frames in flight. The
+  target reports its progress every dwAckFrames frames and after the
+  last one. The stream is limited by the bus if the frames in flight
+  behind a group cover the round trip of its status, else each group
+  waits for the part of the round trip they do not cover.
+
+  @param dwPhase      ETA_xxx
+  @param dwLen        bytes of the stream
+  @param dwFrameLen   bytes per data frame
+  @param fFd          CAN FD frames with bit rate switch
+  @param dwWindow     max. data frames in flight, at least dwAckFrames
+  @param dwAckFrames  data frames per progress status
+  @param dwStatusLen  payload of a status frame
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::AddStream(UINT32 dwPhase, UINT32 dwLen, UINT32 dwFrameLen, BOOL fFd, UINT32 dwWindow,
+                         UINT32 dwAckFrames, UINT32 dwStatusLen)
+{
+	if (!m_fPlanned || (dwLen == 0))
+	{
+		return;
+	}
+
+	UINT32 dwFrames = (dwLen + dwFrameLen - 1) / dwFrameLen;
+	UINT32 dwGroups = (dwFrames + dwAckFrames - 1) / dwAckFrames;
+	UINT64 qwFrameNs = GetFrameNs(dwFrameLen, fFd);
+	UINT64 qwStatusNs = GetFrameNs(dwStatusLen, FALSE);
+	UINT64 qwBusNs = qwFrameNs * (dwFrames - 1) + GetFrameNs(dwLen - (dwFrames - 1) * dwFrameLen, fFd) +
+	                 qwStatusNs * dwGroups;
+
+	UINT64 qwRoundNs = (UINT64)(m_dwResponseUs + m_dwHostUs) * 1000;
+	UINT64 qwCoverNs = qwFrameNs * (dwWindow - dwAckFrames);
+	UINT64 qwWaitNs = (qwRoundNs > qwCoverNs) ? qwRoundNs - qwCoverNs : 0;
+
+	m_aPhase[dwPhase].qwBusNs += qwBusNs;
+	m_aPhase[dwPhase].qwTimeNs += qwBusNs + qwRoundNs + qwWaitNs * (dwGroups - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds a time the target is busy without frames on the bus, e.g. an
+  erase or the programming of a block.
+
+  @param dwPhase  ETA_xxx
+  @param qwUs     duration in microseconds
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::AddWait(UINT32 dwPhase, UINT64 qwUs)
+{
+	if (m_fPlanned)
+	{
+		m_aPhase[dwPhase].qwTimeNs += qwUs * 1000;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the predicted duration of all phases in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CBootEta::GetTime(void) const
+{
+	UINT64 qwNs = 0;
+
+	for (UINT32 i = 0; i < ETA_PHASES; i++)
+	{
+		qwNs += m_aPhase[i].qwTimeNs;
+	}
+	return (qwNs + 999) / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the bus time of all phases in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CBootEta::GetBusTime(void) const
+{
+	UINT64 qwNs = 0;
+
+	for (UINT32 i = 0; i < ETA_PHASES; i++)
+	{
+		qwNs += m_aPhase[i].qwBusNs;
+	}
+	return (qwNs + 999) / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Starts the measurement of a phase, the running phase ends. A phase
+  may be started again, its durations add up.
+
+  @param dwPhase  ETA_xxx
+  @param qwNow    transport time
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::Begin(UINT32 dwPhase, UINT64 qwNow)
+{
+	End(qwNow);
+	m_dwPhase = dwPhase;
+	m_aPhase[dwPhase].qwStart = qwNow;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Ends the measurement of the running phase.
+
+  @param qwNow  transport time
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootEta::End(UINT64 qwNow)
+{
+	if (m_dwPhase < ETA_PHASES)
+	{
+		m_aPhase[m_dwPhase].qwActual += qwNow - m_aPhase[m_dwPhase].qwStart;
+		m_dwPhase = ETA_PHASES;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the remaining time of the session. The rest of the running
+  phase is predicted from the measured rate of the part done, blended
+  with the plan: at the start of the phase the plan counts, at its end
+  the measurement. The phases after it count with their plan.
+
+  @param dwDone   work done in the running phase, e.g. bytes
+  @param dwTotal  work of the whole phase
+  @param qwNow    transport time
+
+  @return remaining time in microseconds
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CBootEta::GetRemain(UINT32 dwDone, UINT32 dwTotal, UINT64 qwNow) const
+{
+	if (!m_fPlanned || (m_dwPhase >= ETA_PHASES) || (dwTotal == 0))
+	{
+		return 0;
+	}
+
+	const EtaPhase& sPhase = m_aPhase[m_dwPhase];
+	UINT64 qwElapsed = sPhase.qwActual + qwNow - sPhase.qwStart;
+	UINT64 qwPlan = (sPhase.qwTimeNs + 999) / 1000;
+	UINT64 qwLeft = dwTotal - ((dwDone < dwTotal) ? dwDone : dwTotal);
+
+	// (1 - f) * ((1 - f) * plan + f * elapsed / f)
+	UINT64 qwRemain = (qwLeft * (qwLeft * qwPlan / dwTotal) + qwLeft * qwElapsed) / dwTotal;
+	for (UINT32 i = m_dwPhase + 1; i < ETA_PHASES; i++)
+	{
+		qwRemain += (m_aPhase[i].qwTimeNs + 999) / 1000;
+	}
+	return qwRemain;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the measured duration of all phases in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CBootEta::GetActual(void) const
+{
+	UINT64 qwUs = 0;
+
+	for (UINT32 i = 0; i < ETA_PHASES; i++)
+	{
+		qwUs += m_aPhase[i].qwActual;
+	}
+	return qwUs;
+}
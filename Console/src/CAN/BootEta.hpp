@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Predicted duration of a flashing session.
+
+  @note
+	The session describes its plan as protocol steps: exchanges of a
+	command and its response, frames without response, block streams of
+	the stub and waits for the flash. Each step costs the bus time of
+	its frames with the worst case stuffing (CanTiming.hpp), an exchange
+	also the turnaround of the target and the latency of the host. The
+	turnaround and the host latency are measured while connecting, the
+	erase and programming times come from the geometry of the family or
+	from typical values.
+
+	The bus time alone is the ceiling for this bus: no host and no
+	target can flash the image faster with the same protocol.
+
+	While a phase runs, the prediction of the rest of the phase is scaled
+	by the measured time of the part already done, the phases after it
+	keep their prediction.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTETA_HPP_
+#define _BOOTETA_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// phases of a session
+//
+#define ETA_ERASE                       0       // erase of the flash
+#define ETA_UPLOAD                      1       // upload and start of the stub
+#define ETA_WRITE                       2       // write of the image
+#define ETA_CHECK                       3       // CRC check of the blocks by the stub
+#define ETA_PHASES                      4
+
+//
+// typical times if they are not measured or known from the geometry
+//
+#define ETA_RESPONSE_US                 150     // turnaround of the target
+#define ETA_HOST_US                     100     // host and adapter per exchange
+#define ETA_PROGRAM_US                  5000    // programming of 256 bytes
+#define ETA_ERASE_US_PER_KB             20000   // sector erase
+#define ETA_MASS_ERASE_US               2000000 // mass erase
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT64 qwBusNs;                     // bus time of the frames
+	UINT64 qwTimeNs;                    // predicted duration
+	UINT64 qwStart;                     // transport time the phase started, 0 = not started
+	UINT64 qwActual;                    // measured duration of the finished phase
+} EtaPhase;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class predicts the duration of a session from its plan.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootEta
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootEta(void);
+
+	//---------------------------------------------------------------
+	// plan
+	//---------------------------------------------------------------
+	BOOL SetBus     (UINT32 dwBitRate, UINT32 dwDataBitRate);
+	void SetLatency (UINT32 dwResponseUs, UINT32 dwHostUs);
+	void AddExchange(UINT32 dwPhase, UINT32 dwCmdLen, UINT32 dwRespLen, UINT32 dwCount);
+	void AddFrames  (UINT32 dwPhase, UINT32 dwLen, BOOL fFd, UINT32 dwCount);
+	void AddStream  (UINT32 dwPhase, UINT32 dwLen, UINT32 dwFrameLen, BOOL fFd, UINT32 dwWindow,
+	                 UINT32 dwAckFrames, UINT32 dwStatusLen);
+	void AddWait    (UINT32 dwPhase, UINT64 qwUs);
+	UINT64 GetFrameNs(UINT32 dwLen, BOOL fFd) const;
+
+	BOOL   IsPlanned  (void) const { return m_fPlanned; }
+	UINT64 GetTime    (void) const;
+	UINT64 GetBusTime (void) const;
+	const EtaPhase& GetPhase(UINT32 dwPhase) const { return m_aPhase[dwPhase]; }
+
+	//---------------------------------------------------------------
+	// live estimate
+	//---------------------------------------------------------------
+	void   Begin    (UINT32 dwPhase, UINT64 qwNow);
+	void   End      (UINT64 qwNow);
+	UINT64 GetRemain(UINT32 dwDone, UINT32 dwTotal, UINT64 qwNow) const;
+	UINT64 GetActual(void) const;
+
+  private:
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	BOOL     m_fPlanned;                // the bus is known, the plan is valid
+	UINT32   m_dwBitRate;               // nominal bit rate in bit/s
+	UINT32   m_dwDataBitRate;           // data bit rate in bit/s, 0 = classic CAN
+	UINT32   m_dwResponseUs;            // turnaround of the target
+	UINT32   m_dwHostUs;                // host and adapter per exchange
+	UINT32   m_dwPhase;                 // running phase, ETA_PHASES = none
+	EtaPhase m_aPhase[ETA_PHASES];      // prediction and measurement per phase
+};
+
+#endif //_BOOTETA_HPP_
@@ -0,0 +1,212 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flash layout of the STM32 families.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootGeometry.hpp"
+
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define KB                              1024
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+//
+// sectors of the F2/F4 1 MB bank and of the F7 banks
+//
+#define F4_SECTORS      { { 4, 16 * KB }, { 1, 64 * KB }, { 7, 128 * KB }, { 0, 0 } }
+#define F7_SECTORS      { { 4, 32 * KB }, { 1, 128 * KB }, { 7, 256 * KB }, { 0, 0 } }
+
+static const FlashGeometry asGeometry[] = {
+	// pid    flash       bank        size reg    option bytes       unit  us/KB  mass us    sectors
+	{ 0x440,   64 * KB,           0, 0x1FFFF7CC, 0x1FFFF800, 16, 2, 20000,    40000, { {  64,  1 * KB } } },  // STM32F05x
+	{ 0x448,  128 * KB,           0, 0x1FFFF7CC, 0x1FFFF800, 16, 2, 10000,    40000, { {  64,  2 * KB } } },  // STM32F07x
+	{ 0x410,  128 * KB,           0, 0x1FFFF7E0, 0x1FFFF800, 16, 2, 20000,    40000, { { 128,  1 * KB } } },  // STM32F1 medium density
+	{ 0x414,  512 * KB,           0, 0x1FFFF7E0, 0x1FFFF800, 16, 2, 10000,    40000, { { 256,  2 * KB } } },  // STM32F1 high density
+	{ 0x418,  256 * KB,           0, 0x1FFFF7E0, 0x1FFFF800, 16, 2, 10000,    40000, { { 128,  2 * KB } } },  // STM32F105/107
+	{ 0x430, 1024 * KB,    512 * KB, 0x1FFFF7E0, 0x1FFFF800, 16, 2, 10000,    80000, { { 256,  2 * KB } } },  // STM32F1 XL density
+	{ 0x422,  256 * KB,           0, 0x1FFFF7CC, 0x1FFFF800, 16, 2, 10000,    40000, { { 128,  2 * KB } } },  // STM32F30x
+	{ 0x438,   64 * KB,           0, 0x1FFFF7CC, 0x1FFFF800, 16, 2, 10000,    40000, { {  32,  2 * KB } } },  // STM32F334
+	{ 0x411, 1024 * KB,           0, 0x1FFF7A22, 0x1FFFC000, 16, 4, 10000,  8000000, F4_SECTORS },           // STM32F2
+	{ 0x413, 1024 * KB,           0, 0x1FFF7A22, 0x1FFFC000, 16, 4, 10000,  8000000, F4_SECTORS },           // STM32F405/407
+	{ 0x419, 2048 * KB,   1024 * KB, 0x1FFF7A22, 0x1FFFC000, 16, 4, 10000, 16000000, F4_SECTORS },           // STM32F42x/43x
+	{ 0x421,  512 * KB,           0, 0x1FFF7A22, 0x1FFFC000, 16, 4, 10000,  4000000, F4_SECTORS },           // STM32F446
+	{ 0x449, 1024 * KB,           0, 0x1FF0F442, 0x1FFF0000, 32, 4,  8000,  8000000, F7_SECTORS },           // STM32F74x/75x
+	{ 0x451, 2048 * KB,           0, 0x1FF0F442, 0x1FFF0000, 32, 4,  8000, 16000000, F7_SECTORS },           // STM32F76x/77x
+	{ 0x415, 1024 * KB,    512 * KB, 0x1FFF75E0, 0x1FFF7800, 16, 8, 11000,    25000, { { 256,  2 * KB } } },  // STM32L47x/48x
+	{ 0x416,  128 * KB,           0, 0x1FF8004C, 0x1FF80000, 32, 4, 12800,  1640000, { { 512, 256    } } },  // STM32L1 category 1
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the flash geometry of a family.
+
+  @param dwPid  product ID reported by Get ID
+
+  @return entry of the table, NULL if the family is not known
+
+*/
+//////////////////////////////////////////////////////////////////////////
+const FlashGeometry* BootGeometryFind(UINT32 dwPid)
+{
+	for (size_t i = 0; i < sizeof(asGeometry) / sizeof(asGeometry[0]); i++)
+	{
+		if (asGeometry[i].dwPid == dwPid)
+		{
+			return &asGeometry[i];
+		}
+	}
+	return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor. The layout starts with one sector of 0 bytes.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CFlashLayout::CFlashLayout(void)
+{
+	m_pGeometry = NULL;
+	m_Addr.assign(1, GEOMETRY_FLASH_BASE);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Takes the layout of a family from the geometry table. The layout of
+  the first bank is repeated for the second bank of a dual bank part.
+
+  @param dwPid        product ID reported by Get ID
+  @param dwFlashSize  flash size of the device, 0 = largest of the family
+
+  @return FALSE if the family is not in the table, the layout is unchanged then
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CFlashLayout::SetPart(UINT32 dwPid, UINT32 dwFlashSize)
+{
+	const FlashGeometry* pGeometry = BootGeometryFind(dwPid);
+	if (!pGeometry)
+	{
+		return FALSE;
+	}
+
+	UINT32 dwEnd = GEOMETRY_FLASH_BASE + ((dwFlashSize && (dwFlashSize < pGeometry->dwFlashSize)) ? dwFlashSize : pGeometry->dwFlashSize);
+	UINT32 dwBank = pGeometry->dwBankSize ? pGeometry->dwBankSize : pGeometry->dwFlashSize;
+
+	m_pGeometry = pGeometry;
+	m_Addr.assign(1, GEOMETRY_FLASH_BASE);
+	for (UINT32 dwBankAddr = GEOMETRY_FLASH_BASE; dwBankAddr < dwEnd; dwBankAddr += dwBank)
+	{
+		UINT32 dwAddr = dwBankAddr;
+		for (UINT32 r = 0; (r < GEOMETRY_MAX_RUNS) && pGeometry->aRuns[r].dwCount; r++)
+		{
+			for (UINT32 i = 0; (i < pGeometry->aRuns[r].dwCount) && (dwAddr < dwEnd); i++)
+			{
+				dwAddr += pGeometry->aRuns[r].dwSize;
+				m_Addr.push_back(dwAddr);
+			}
+		}
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Uses sectors of one size, e.g. for an unknown family.
+
+  @param dwSectorSize  size of each sector in bytes
+  @param dwFlashSize   flash size of the device
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CFlashLayout::SetUniform(UINT32 dwSectorSize, UINT32 dwFlashSize)
+{
+	m_pGeometry = NULL;
+	m_Addr.assign(1, GEOMETRY_FLASH_BASE);
+	for (UINT32 dwAddr = GEOMETRY_FLASH_BASE; dwAddr - GEOMETRY_FLASH_BASE < dwFlashSize; )
+	{
+		dwAddr += dwSectorSize;
+		m_Addr.push_back(dwAddr);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Finds the sector which holds an address.
+
+  @param dwAddr    address in the flash
+  @param dwSector  receives the number of the sector
+
+  @return FALSE if the address is outside the flash
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CFlashLayout::Find(UINT32 dwAddr, UINT32& dwSector) const
+{
+	if ((dwAddr < m_Addr.front()) || (dwAddr >= m_Addr.back()))
+	{
+		return FALSE;
+	}
+
+	dwSector = (UINT32)(std::upper_bound(m_Addr.begin(), m_Addr.end(), dwAddr) - m_Addr.begin()) - 1;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Plans the erase of an address range. The sectors of the range are
+  erased one by one if this is faster than a mass erase by the typical
+  erase times of the family.
+
+  @param dwStart  start address of the range
+  @param dwLen    length in bytes
+  @param Sectors  receives the numbers of the sectors to erase
+
+  @return FALSE if a mass erase is faster or the layout is not known
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CFlashLayout::PlanErase(UINT32 dwStart, UINT32 dwLen, std::vector<UINT32>& Sectors) const
+{
+	UINT32 dwFirst, dwLast;
+
+	Sectors.clear();
+	if (!m_pGeometry || (dwLen == 0) || !Find(dwStart, dwFirst) || !Find(dwStart + dwLen - 1, dwLast))
+	{
+		return FALSE;
+	}
+
+	UINT64 qwEraseUs = 0;
+	for (UINT32 i = dwFirst; i <= dwLast; i++)
+	{
+		Sectors.push_back(i);
+		qwEraseUs += (UINT64)m_pGeometry->dwEraseUsPerKb * GetSize(i) / 1024;
+	}
+	if (qwEraseUs >= m_pGeometry->dwMassEraseUs)
+	{
+		Sectors.clear();
+		return FALSE;
+	}
+	return TRUE;
+}
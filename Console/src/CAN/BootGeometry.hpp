@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flash layout of the STM32 families.
+
+  @note
+	The erase unit of an STM32 depends on the family: uniform pages of
+	1 or 2 KB on F0/F1/F3/L4, 256 byte pages on L1, and sectors of
+	mixed sizes on F2/F4/F7 (16, 64 and 128 KB on F4, a 1 MB bank
+	consists of only 12 sectors). Dual bank parts repeat the layout of
+	the first bank, the sectors are numbered on over both banks.
+
+	The table holds one entry per product ID of Get ID, with the
+	largest flash of the family. The real size is read from the flash
+	size register of the device if the family has one. The typical
+	erase times of the data sheet decide between a mass erase and an
+	erase of the sectors of the image: a mass erase of an F1 takes as
+	long as one page erase, of an F4 as long as the erase of the whole
+	flash sector by sector. A new part needs only a table entry.
+
+	The layout numbers the sectors from the start of the flash, this is
+	the page or sector number of the Erase command.
+
+	A write unit of up to a word takes a program of all ones as erased,
+	it can be programmed again. From a double word on the unit carries
+	ECC bits (L4 and newer) and is programmed once per erase, also with
+	all ones.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTGEOMETRY_HPP_
+#define _BOOTGEOMETRY_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define GEOMETRY_FLASH_BASE             0x08000000      // start of the flash of all STM32
+#define GEOMETRY_MAX_RUNS               4               // runs of equal sectors per bank
+#define GEOMETRY_MAX_FLASH              0x200000        // flash size assumed for an unknown family
+#define GEOMETRY_ECC_UNIT               8               // write units from this size on are programmed once
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// consecutive sectors of the same size
+//
+typedef struct {
+	UINT32 dwCount;                     // number of sectors, 0 = end of the list
+	UINT32 dwSize;                      // size of each sector in bytes
+} SectorRun;
+
+//
+// flash of one family
+//
+typedef struct {
+	UINT32    dwPid;                    // product ID reported by Get ID
+	UINT32    dwFlashSize;              // largest flash of the family in bytes
+	UINT32    dwBankSize;               // size of a bank of a dual bank part, 0 = one bank
+	UINT32    dwSizeAddr;               // register with the flash size in KB, 0 = none
+	UINT32    dwOptionAddr;             // address of the option bytes
+	UINT32    dwOptionLen;              // length of the option bytes
+	UINT32    dwWriteUnit;              // programming unit in bytes
+	UINT32    dwEraseUsPerKb;           // typical sector erase time per KB
+	UINT32    dwMassEraseUs;            // typical mass erase time
+	SectorRun aRuns[GEOMETRY_MAX_RUNS]; // sectors of one bank
+} FlashGeometry;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class holds the sectors of the flash of one device: from the
+  geometry table, or uniform sectors if the family is not known or
+  the sector size is given.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CFlashLayout
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CFlashLayout(void);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL SetPart   (UINT32 dwPid, UINT32 dwFlashSize);
+	void SetUniform(UINT32 dwSectorSize, UINT32 dwFlashSize);
+
+	const FlashGeometry* GetGeometry(void) const { return m_pGeometry; }
+	UINT32 GetFlashSize(void) const { return m_Addr.back() - GEOMETRY_FLASH_BASE; }
+	UINT32 GetWriteUnit(void) const { return m_pGeometry ? m_pGeometry->dwWriteUnit : 1; }
+	BOOL   HasEcc      (void) const { return (GetWriteUnit() >= GEOMETRY_ECC_UNIT) ? TRUE : FALSE; }
+
+	//---------------------------------------------------------------
+	// sectors
+	//---------------------------------------------------------------
+	UINT32 GetSectors(void) const { return (UINT32)m_Addr.size() - 1; }
+	UINT32 GetAddr   (UINT32 dwSector) const { return m_Addr[dwSector]; }
+	UINT32 GetSize   (UINT32 dwSector) const { return m_Addr[dwSector + 1] - m_Addr[dwSector]; }
+	BOOL   Find      (UINT32 dwAddr, UINT32& dwSector) const;
+
+	//---------------------------------------------------------------
+	// erase planner
+	//---------------------------------------------------------------
+	BOOL   PlanErase (UINT32 dwStart, UINT32 dwLen, std::vector<UINT32>& Sectors) const;
+
+  private:
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	const FlashGeometry* m_pGeometry;   // entry of the table, NULL = uniform sectors
+	std::vector<UINT32>  m_Addr;        // start of each sector and the end of the flash
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+const FlashGeometry* BootGeometryFind(UINT32 dwPid);
+
+#endif //_BOOTGEOMETRY_HPP_
@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Progress journal of a flashing session.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootJournal.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootJournal::CBootJournal()
+{
+	m_pFile = 0;
+	m_sKey.dwPid = 0;
+	m_sKey.dwImageCrc = 0;
+	m_sKey.dwStartAddr = 0;
+	m_sKey.dwImageLen = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Destructor. Closes the file, the journal stays on disk.
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootJournal::~CBootJournal()
+{
+	Close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Opens the journal of a session. The blocks of an earlier run are
+  loaded if the key matches, otherwise the journal is started over.
+
+  @param pszFile  path of the journal file
+  @param sKey     target and image of this session
+
+  @return TRUE if the journal can be written
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootJournal::Open(const char* pszFile, const JournalKey& sKey)
+{
+	Close();
+	m_strFile = pszFile;
+	m_sKey = sKey;
+	m_Blocks.clear();
+
+	if (!Load(sKey))
+	{
+		return Restart();
+	}
+
+	m_pFile = fopen(m_strFile.c_str(), "a");
+	return (m_pFile != 0) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reads the journal file. Returns TRUE if it belongs to the given key.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootJournal::Load(const JournalKey& sKey)
+{
+	FILE* pFile = fopen(m_strFile.c_str(), "r");
+	char  szLine[128];
+	BOOL  fMatch = FALSE;
+
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	if (fgets(szLine, sizeof(szLine), pFile))
+	{
+		unsigned int uPid, uCrc, uAddr, uLen;
+		if ((sscanf(szLine, "J1 %x %x %x %u", &uPid, &uCrc, &uAddr, &uLen) == 4) &&
+		    (uPid == sKey.dwPid) && (uCrc == sKey.dwImageCrc) &&
+		    (uAddr == sKey.dwStartAddr) && (uLen == sKey.dwImageLen))
+		{
+			fMatch = TRUE;
+		}
+	}
+
+	while (fMatch && fgets(szLine, sizeof(szLine), pFile))
+	{
+		unsigned int uAddr, uLen, uCrc;
+		char         cEnd;
+
+		// a line without newline was cut by the interruption
+		if ((sscanf(szLine, "B %x %u %x%c", &uAddr, &uLen, &uCrc, &cEnd) == 4) && (cEnd == '\n'))
+		{
+			JournalBlock sBlock = { uAddr, uLen, uCrc };
+			m_Blocks.push_back(sBlock);
+		}
+	}
+
+	fclose(pFile);
+	return fMatch;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Appends a programmed block.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootJournal::Commit(UINT32 dwAddr, UINT32 dwLen, UINT32 dwCrc)
+{
+	JournalBlock sBlock = { dwAddr, dwLen, dwCrc };
+
+	if (!m_pFile)
+	{
+		return FALSE;
+	}
+
+	m_Blocks.push_back(sBlock);
+	fprintf(m_pFile, "B %08X %u %08X\n", (unsigned int)dwAddr, (unsigned int)dwLen, (unsigned int)dwCrc);
+	return (fflush(m_pFile) == 0) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Forgets all blocks, e.g. because the target is erased again.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootJournal::Restart(void)
+{
+	Close();
+	m_Blocks.clear();
+
+	m_pFile = fopen(m_strFile.c_str(), "w");
+	if (!m_pFile)
+	{
+		return FALSE;
+	}
+
+	fprintf(m_pFile, "J1 %04X %08X %08X %u\n", (unsigned int)m_sKey.dwPid, (unsigned int)m_sKey.dwImageCrc,
+		(unsigned int)m_sKey.dwStartAddr, (unsigned int)m_sKey.dwImageLen);
+	return (fflush(m_pFile) == 0) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Deletes the journal after the image is completely written.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootJournal::Remove(void)
+{
+	Close();
+	m_Blocks.clear();
+	if (!m_strFile.empty())
+	{
+		remove(m_strFile.c_str());
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns TRUE if the block was committed with the same data.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootJournal::IsCommitted(UINT32 dwAddr, UINT32 dwLen, UINT32 dwCrc) const
+{
+	for (size_t i = 0; i < m_Blocks.size(); i++)
+	{
+		const JournalBlock& sBlock = m_Blocks[i];
+		if ((sBlock.dwAddr == dwAddr) && (sBlock.dwLen == dwLen) && (sBlock.dwCrc == dwCrc))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Closes the journal file.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootJournal::Close(void)
+{
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = 0;
+	}
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Progress journal of a flashing session.
+
+  @note
+	The journal is a small text file. The first line holds the key of
+	the session, every programmed block appends one line with its
+	address, length and CRC:
+
+	  J1 <pid> <image crc> <start address> <image length>
+	  B <address> <length> <crc>
+
+	Lines are flushed one by one, an interrupted session leaves at most
+	one incomplete line which is ignored when the journal is loaded.
+	A journal with a different key belongs to another target or image
+	and is started over.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTJOURNAL_HPP_
+#define _BOOTJOURNAL_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT32 dwPid;                       // product ID reported by Get ID
+	UINT32 dwImageCrc;                  // CRC of the complete image
+	UINT32 dwStartAddr;                 // load address of the image
+	UINT32 dwImageLen;                  // length of the image in bytes
+} JournalKey;
+
+typedef struct {
+	UINT32 dwAddr;                      // start address of the block
+	UINT32 dwLen;                       // length of the block
+	UINT32 dwCrc;                       // CRC of the programmed data
+} JournalBlock;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class records the blocks which are programmed and verified, so
+  an interrupted session can continue behind them.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootJournal
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CBootJournal();
+	~CBootJournal();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL Open   (const char* pszFile, const JournalKey& sKey);
+	BOOL Commit (UINT32 dwAddr, UINT32 dwLen, UINT32 dwCrc);
+	BOOL Restart(void);
+	void Remove (void);
+
+	BOOL IsCommitted(UINT32 dwAddr, UINT32 dwLen, UINT32 dwCrc) const;
+	UINT32 GetBlocks(void) const { return (UINT32)m_Blocks.size(); }
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	BOOL Load(const JournalKey& sKey);
+	void Close(void);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	std::string               m_strFile;    // path of the journal file
+	FILE*                     m_pFile;      // open for appending
+	JournalKey                m_sKey;       // key of the current session
+	std::vector<JournalBlock> m_Blocks;     // committed blocks
+};
+
+#endif //_BOOTJOURNAL_HPP_
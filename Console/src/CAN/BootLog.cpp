@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Asynchronous logger for the boot loader console.
+
+  The ring is a bounded multi producer / single consumer queue. Every
+  slot carries a sequence number: a producer claims a slot by advancing
+  the head index, fills it and publishes it by bumping the sequence. The
+  formatter thread consumes the slots in order. If the ring is full the
+  record is dropped and counted instead of blocking the caller.
+
+  A producer counts itself in dwLogProducers before it looks at
+  fLogRunning, the stop clears the flag before it waits for the count
+  to drop to zero. So every producer either writes directly or its
+  slot is published before the last drain. The direct writes, the
+  formatter and the change of the output file hold LogMutex, the
+  records do not interleave.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootLog.hpp"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+// global variables
+//////////////////////////////////////////////////////////////////////////
+
+UINT8 g_bLogLevel = LOG_INFO;
+
+typedef struct {
+	std::atomic<UINT32> dwSeq;          // slot sequence number
+	LogRecord           sRec;           // record data
+} LogSlot;
+
+static LogSlot              aLogRing[LOG_RING_SIZE];
+static std::atomic<UINT32>  dwLogHead(0);       // next slot to claim
+static UINT32               dwLogTail = 0;      // next slot to format
+static std::atomic<UINT32>  dwLogDropped(0);    // records lost on overflow
+static std::atomic<BOOL>    fLogQuit(FALSE);    // quit flag for the formatter
+static std::atomic<BOOL>    fLogRunning(FALSE); // formatter thread is started
+static std::atomic<UINT32>  dwLogProducers(0);  // callers between the running check and the publish
+static std::thread          LogThread;
+static std::mutex           LogMutex;           // protects the output
+static FILE*                pLogFile = stdout;  // output of the formatter
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Formats one record to the console.
+*/
+//////////////////////////////////////////////////////////////////////////
+static void FormatRecord(const LogRecord& sRec)
+{
+	const UINT32* a = sRec.adwArg;
+
+	// unused arguments are zero and ignored by printf
+	fprintf(pLogFile, sRec.pszFormat, a[0], a[1], a[2], a[3]);
+
+	for (UINT8 i = 0; i < sRec.bDataLen; i++)
+	{
+		fprintf(pLogFile, " %.2X", sRec.abData[i]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Formats all published records.
+
+  @return
+	number of formatted records
+*/
+//////////////////////////////////////////////////////////////////////////
+static UINT32 DrainRing(void)
+{
+	UINT32 dwCount = 0;
+
+	for (;;)
+	{
+		LogSlot& sSlot = aLogRing[dwLogTail & (LOG_RING_SIZE - 1)];
+		if (sSlot.dwSeq.load(std::memory_order_acquire) != dwLogTail + 1)
+		{
+			break;
+		}
+
+		FormatRecord(sSlot.sRec);
+
+		// hand the slot back to the producers for the next lap
+		sSlot.dwSeq.store(dwLogTail + LOG_RING_SIZE, std::memory_order_release);
+		dwLogTail++;
+		dwCount++;
+	}
+
+	return dwCount;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Formatter thread.
+*/
+//////////////////////////////////////////////////////////////////////////
+static void LogThreadProc(void)
+{
+	UINT32 dwReported = 0;
+
+	while (!fLogQuit.load())
+	{
+		UINT32 dwCount;
+		{
+			std::lock_guard<std::mutex> Lock(LogMutex);
+
+			dwCount = DrainRing();
+			if (dwCount == 0)
+			{
+				fflush(pLogFile);
+			}
+
+			UINT32 dwDropped = dwLogDropped.load();
+			if (dwDropped != dwReported)
+			{
+				fprintf(pLogFile, "\n %u log records dropped", dwDropped - dwReported);
+				dwReported = dwDropped;
+			}
+		}
+		if (dwCount == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	std::lock_guard<std::mutex> Lock(LogMutex);
+	DrainRing();
+	fflush(pLogFile);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Starts the formatter thread.
+
+  @param bLevel
+	verbosity level, LOG_OFF ... LOG_TRACE
+  @param pszFile
+	file which receives the output, NULL = console
+
+  @return
+	TRUE on success
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootLogStart(UINT8 bLevel, const char* pszFile)
+{
+	if (LogThread.joinable())
+	{
+		return FALSE;
+	}
+	if (pszFile)
+	{
+		FILE* pFile = fopen(pszFile, "w");
+		if (!pFile)
+		{
+			return FALSE;
+		}
+
+		std::lock_guard<std::mutex> Lock(LogMutex);
+		pLogFile = pFile;
+	}
+
+	for (UINT32 i = 0; i < LOG_RING_SIZE; i++)
+	{
+		aLogRing[i].dwSeq.store(i);
+	}
+	dwLogHead.store(0);
+	dwLogTail = 0;
+	dwLogDropped.store(0);
+	fLogQuit.store(FALSE);
+
+	g_bLogLevel = bLevel;
+	LogThread = std::thread(LogThreadProc);
+	fLogRunning.store(TRUE);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Formats all pending records and stops the formatter thread. A log
+  file is closed, later records go to the console. Producers which
+  still fill a slot are waited for, new ones write directly.
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootLogStop(void)
+{
+	if (LogThread.joinable())
+	{
+		fLogRunning.store(FALSE);
+		while (dwLogProducers.load() != 0)
+		{
+			std::this_thread::yield();
+		}
+		fLogQuit.store(TRUE);
+		LogThread.join();
+	}
+
+	std::lock_guard<std::mutex> Lock(LogMutex);
+	if (pLogFile != stdout)
+	{
+		fclose(pLogFile);
+		pLogFile = stdout;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Copies a record into the ring. Called by BootLog/BootLogData after
+  the level check. Never blocks while the formatter runs, a direct
+  write waits for the output.
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootLogWrite(const char* pszFormat, const UINT32* pdwArgs, UINT8 bArgs,
+                  const UINT8* pbData, UINT8 bDataLen)
+{
+	//
+	// without the formatter thread (e.g. before start) write directly,
+	// the count keeps the stop from the last drain until the slot is
+	// published
+	//
+	dwLogProducers.fetch_add(1);
+	if (!fLogRunning.load())
+	{
+		dwLogProducers.fetch_sub(1);
+
+		LogRecord sRec = {};
+		sRec.pszFormat = pszFormat;
+		for (UINT8 i = 0; i < bArgs; i++)
+		{
+			sRec.adwArg[i] = pdwArgs[i];
+		}
+		sRec.bDataLen = (bDataLen > LOG_MAX_DATA) ? LOG_MAX_DATA : bDataLen;
+		for (UINT8 i = 0; i < sRec.bDataLen; i++)
+		{
+			sRec.abData[i] = pbData[i];
+		}
+
+		std::lock_guard<std::mutex> Lock(LogMutex);
+		FormatRecord(sRec);
+		return;
+	}
+
+	//
+	// claim a slot
+	//
+	UINT32 dwPos = dwLogHead.load(std::memory_order_relaxed);
+	LogSlot* pSlot;
+	for (;;)
+	{
+		pSlot = &aLogRing[dwPos & (LOG_RING_SIZE - 1)];
+		INT32 lDiff = (INT32)(pSlot->dwSeq.load(std::memory_order_acquire) - dwPos);
+		if (lDiff == 0)
+		{
+			if (dwLogHead.compare_exchange_weak(dwPos, dwPos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (lDiff < 0)
+		{
+			// ring full, the formatter is behind
+			dwLogDropped.fetch_add(1, std::memory_order_relaxed);
+			dwLogProducers.fetch_sub(1, std::memory_order_release);
+			return;
+		}
+		else
+		{
+			dwPos = dwLogHead.load(std::memory_order_relaxed);
+		}
+	}
+
+	//
+	// fill and publish the slot
+	//
+	LogRecord& sRec = pSlot->sRec;
+	sRec.pszFormat = pszFormat;
+	sRec.bArgs = bArgs;
+	for (UINT8 i = 0; i < LOG_MAX_ARGS; i++)
+	{
+		sRec.adwArg[i] = (i < bArgs) ? pdwArgs[i] : 0;
+	}
+	sRec.bDataLen = (bDataLen > LOG_MAX_DATA) ? LOG_MAX_DATA : bDataLen;
+	for (UINT8 i = 0; i < sRec.bDataLen; i++)
+	{
+		sRec.abData[i] = pbData[i];
+	}
+
+	pSlot->dwSeq.store(dwPos + 1, std::memory_order_release);
+	dwLogProducers.fetch_sub(1, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the number of records dropped because the ring was full.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 BootLogDropped(void)
+{
+	return dwLogDropped.load();
+}
@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Asynchronous logger for the boot loader console.
+
+  @note
+	The caller only copies a small binary record (pointer to a static
+	format string, up to LOG_MAX_ARGS integer arguments and an optional
+	CAN payload) into a lock-free ring. Formatting and console output is
+	done by a background thread, so logging a frame in the receive or
+	transmit path does not block on the console. The output can go to
+	a file instead of the console.
+
+	What the trace costs the sessions is measured by VCIBootBench
+	-trace (BootBench.cpp): the -quick cases with the logger off and at
+	LOG_TRACE, the simulated time must not change.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTLOG_HPP_
+#define _BOOTLOG_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// verbosity levels
+//
+#define LOG_OFF                 0       // no output at all
+#define LOG_ERROR               1       // errors only
+#define LOG_INFO                2       // session progress
+#define LOG_DEBUG               3       // per block progress
+#define LOG_TRACE               4       // every CAN frame
+
+#define LOG_MAX_ARGS            4       // max. number of format arguments
+#define LOG_MAX_DATA            8       // max. number of payload bytes
+#define LOG_RING_SIZE           8192    // number of records, power of 2
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const char* pszFormat;              // printf format, must be a literal
+	UINT32      adwArg[LOG_MAX_ARGS];   // integer format arguments
+	UINT8       bArgs;                  // number of valid arguments
+	UINT8       bDataLen;               // number of valid payload bytes
+	UINT8       abData[LOG_MAX_DATA];   // payload printed after the text
+} LogRecord;
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+extern UINT8 g_bLogLevel;               // current verbosity level
+
+BOOL   BootLogStart(UINT8 bLevel, const char* pszFile = NULL);
+void   BootLogStop(void);
+void   BootLogWrite(const char* pszFormat, const UINT32* pdwArgs, UINT8 bArgs,
+                    const UINT8* pbData, UINT8 bDataLen);
+UINT32 BootLogDropped(void);
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a log record with up to LOG_MAX_ARGS integer arguments.
+
+  @param bLevel
+	verbosity level of the record
+  @param pszFormat
+	printf format string. The pointer is stored, so it must be a literal.
+*/
+//////////////////////////////////////////////////////////////////////////
+template<typename... Args>
+inline void BootLog(UINT8 bLevel, const char* pszFormat, Args... args)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+
+	if (bLevel <= g_bLogLevel)
+	{
+		UINT32 adwArgs[] = { 0, (UINT32)args... };
+		BootLogWrite(pszFormat, adwArgs + 1, (UINT8)sizeof...(Args), 0, 0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a log record followed by a hex dump of a CAN payload.
+*/
+//////////////////////////////////////////////////////////////////////////
+template<typename... Args>
+inline void BootLogData(UINT8 bLevel, const UINT8* pbData, UINT8 bDataLen,
+                        const char* pszFormat, Args... args)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+
+	if (bLevel <= g_bLogLevel)
+	{
+		UINT32 adwArgs[] = { 0, (UINT32)args... };
+		BootLogWrite(pszFormat, adwArgs + 1, (UINT8)sizeof...(Args), pbData, bDataLen);
+	}
+}
+
+#endif //_BOOTLOG_HPP_
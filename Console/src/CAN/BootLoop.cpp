@@ -0,0 +1,226 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Event loop of the coroutine sessions.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootLoop.hpp"
+
+#include <chrono>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Takes a frame which is already there, else the coroutine suspends.
+*/
+//////////////////////////////////////////////////////////////////////////
+bool CBootLoop::RxAwaiter::await_ready(void)
+{
+	m_fReceived = m_pTransport->Receive(*m_psFrame, 0);
+	return m_fReceived || (m_dwTimeoutUs == 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Registers the suspended coroutine with the loop.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::RxAwaiter::await_suspend(std::coroutine_handle<> hWaiter)
+{
+	Waiter sWaiter;
+
+	sWaiter.hWaiter = hWaiter;
+	sWaiter.pAwaiter = this;
+	sWaiter.qwDeadline = m_pTransport->GetTime() + m_dwTimeoutUs;
+	m_pLoop->m_Waiters.push_back(sWaiter);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Resumes the coroutine in the next pass of the loop.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::YieldAwaiter::await_suspend(std::coroutine_handle<> hWaiter)
+{
+	m_pLoop->m_Ready.push_back(hWaiter);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootLoop::CBootLoop()
+{
+	m_qwResumes = 0;
+	m_qwAdvances = 0;
+	m_qwWaits = 0;
+	m_fNotified = FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a session, it starts with the next pass of the loop.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::Spawn(CBootTask&& Task)
+{
+	m_Ready.push_back(Task.m_hTask);
+	m_Tasks.push_back(std::move(Task));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the sessions until all of them are finished.
+
+  Each pass resumes the coroutines which yielded, then the ones whose
+  frame arrived or whose wait ended, in the order they suspended. A
+  pass which resumes none lets the clock of every transport run on to
+  the next frame or deadline. A transport on the host clock needs no
+  help, the loop blocks until a frame is queued then.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::Run(void)
+{
+	std::vector<std::coroutine_handle<> > Ready;
+	std::vector<Waiter> Waiters;
+
+	while (!m_Ready.empty() || !m_Waiters.empty())
+	{
+		BOOL fProgress = FALSE;
+
+		Ready.swap(m_Ready);
+		for (size_t i = 0; i < Ready.size(); i++)
+		{
+			m_qwResumes++;
+			Ready[i].resume();
+			fProgress = TRUE;
+		}
+		Ready.clear();
+
+		// a frame queued from here on ends the wait of this pass
+		m_fNotified = FALSE;
+
+		// coroutines which suspend again are added to m_Waiters
+		Waiters.swap(m_Waiters);
+		for (size_t i = 0; i < Waiters.size(); i++)
+		{
+			RxAwaiter* pAwaiter = Waiters[i].pAwaiter;
+			BOOL fReceived = pAwaiter->m_pTransport->Receive(*pAwaiter->m_psFrame, 0);
+			if (!fReceived && (pAwaiter->m_pTransport->GetTime() < Waiters[i].qwDeadline))
+			{
+				m_Waiters.push_back(Waiters[i]);
+				continue;
+			}
+			pAwaiter->m_fReceived = fReceived;
+			m_qwResumes++;
+			Waiters[i].hWaiter.resume();
+			fProgress = TRUE;
+		}
+		Waiters.clear();
+
+		if (!fProgress)
+		{
+			BOOL fAdvanced = FALSE;
+
+			m_qwAdvances++;
+			for (size_t i = 0; i < m_Waiters.size(); i++)
+			{
+				if (m_Waiters[i].pAwaiter->m_pTransport->Advance(m_Waiters[i].qwDeadline))
+				{
+					fAdvanced = TRUE;
+				}
+			}
+			if (!fAdvanced)
+			{
+				Wait();
+			}
+		}
+	}
+
+	for (auto it = m_Notifies.begin(); it != m_Notifies.end(); ++it)
+	{
+		if (it->second)
+		{
+			it->first->SetRxNotify(NULL);
+		}
+	}
+	m_Notifies.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Wakes the loop, called by a transport when it queued a frame.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::Notify(void)
+{
+	std::lock_guard<std::mutex> Lock(m_NotifyMutex);
+
+	m_fNotified = TRUE;
+	m_NotifyCond.notify_one();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Blocks until a transport of the waiting coroutines queues a frame,
+  at most until the first deadline or the time a transport must be
+  polled again. A transport is asked for its notify when a coroutine
+  first waits on it here. If one of them can not notify, the loop
+  only yields the processor and polls again.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootLoop::Wait(void)
+{
+	UINT64 qwWait = ~(UINT64)0;
+
+	for (size_t i = 0; i < m_Waiters.size(); i++)
+	{
+		ICanTransport* pTransport = m_Waiters[i].pAwaiter->m_pTransport;
+		auto it = m_Notifies.find(pTransport);
+		if (it == m_Notifies.end())
+		{
+			it = m_Notifies.emplace(pTransport, pTransport->SetRxNotify(this)).first;
+		}
+		if (!it->second)
+		{
+			std::this_thread::yield();
+			return;
+		}
+
+		UINT64 qwNow = pTransport->GetTime();
+		UINT64 qwLeft = (m_Waiters[i].qwDeadline > qwNow) ? m_Waiters[i].qwDeadline - qwNow : 0;
+		UINT32 dwPoll = pTransport->GetPollWait();
+		if (dwPoll && (dwPoll < qwLeft))
+		{
+			qwLeft = dwPoll;
+		}
+		if (qwLeft < qwWait)
+		{
+			qwWait = qwLeft;
+		}
+	}
+	if ((qwWait == 0) || m_Waiters.empty())
+	{
+		return;
+	}
+
+	// a spurious wake-up only costs a pass
+	std::unique_lock<std::mutex> Lock(m_NotifyMutex);
+	if (!m_fNotified)
+	{
+		m_qwWaits++;
+		m_NotifyCond.wait_for(Lock, std::chrono::microseconds(qwWait));
+	}
+}
@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Event loop of the coroutine sessions.
+
+  @note
+	A CBootSession blocks in Receive() of its transport, so every
+	session needs a thread. A coroutine session suspends instead: each
+	co_await of a frame registers the coroutine with the loop and
+	returns to it. The loop polls the transports of the suspended
+	coroutines, resumes the ones whose frame arrived or whose timeout
+	expired and lets the clock of the transports run on when none of
+	them can go on. Any number of sessions run on the thread of the
+	loop, the protocol code still reads top down.
+
+	Transports on the host clock, e.g. the VCI channels read by the
+	receive reactor, wake the loop when a frame is queued
+	(ICanRxNotify). When no coroutine can go on, the loop blocks until
+	one of them has a frame or the first wait ends.
+
+	A coroutine of a session returns a CBootTask. Awaiting a task
+	starts it and continues the caller when it returns, the value of
+	co_return is the result of the co_await. Tasks handed to Spawn()
+	are the sessions, Run() returns when all of them are finished.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTLOOP_HPP_
+#define _BOOTLOOP_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is a coroutine of a session with an int result, e.g.
+  SESSION_xxx or a BOOL. The coroutine starts when it is awaited or
+  run by the loop and is destroyed with the task.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootTask
+{
+  public:
+	struct promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	//---------------------------------------------------------------
+	// the caller continues when the coroutine returns
+	//---------------------------------------------------------------
+	struct FinalAwaiter
+	{
+		bool await_ready(void) const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(Handle hTask) noexcept
+		{
+			std::coroutine_handle<> hCaller = hTask.promise().hCaller;
+			return hCaller ? hCaller : std::noop_coroutine();
+		}
+		void await_resume(void) const noexcept {}
+	};
+
+	struct promise_type
+	{
+		int                     iResult;    // value of co_return
+		std::coroutine_handle<> hCaller;    // coroutine which awaits the task, none for a session
+
+		promise_type() : iResult(0) {}
+		CBootTask           get_return_object(void)    { return CBootTask(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend(void) noexcept { return {}; }
+		FinalAwaiter        final_suspend(void) noexcept   { return {}; }
+		void                return_value(int iResult)  { this->iResult = iResult; }
+		void                unhandled_exception(void)  { std::terminate(); }
+	};
+
+	//---------------------------------------------------------------
+	// constructor / destructor, a task can be moved but not copied
+	//---------------------------------------------------------------
+	CBootTask(CBootTask&& Other) noexcept : m_hTask(Other.m_hTask) { Other.m_hTask = Handle(); }
+	~CBootTask() { if (m_hTask) m_hTask.destroy(); }
+
+	CBootTask(const CBootTask&) = delete;
+	CBootTask& operator=(const CBootTask&) = delete;
+
+	//---------------------------------------------------------------
+	// co_await starts the coroutine, its result is returned
+	//---------------------------------------------------------------
+	bool await_ready(void) const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> hCaller) noexcept
+	{
+		m_hTask.promise().hCaller = hCaller;
+		return m_hTask;
+	}
+	int  await_resume(void) const noexcept { return m_hTask.promise().iResult; }
+
+	BOOL IsDone   (void) const { return m_hTask.done() ? TRUE : FALSE; }
+	int  GetResult(void) const { return m_hTask.promise().iResult; }
+
+  private:
+	friend class CBootLoop;
+
+	explicit CBootTask(Handle hTask) : m_hTask(hTask) {}
+
+	Handle m_hTask;                         // the coroutine
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class runs the sessions on one thread. A coroutine waits for a
+  frame with co_await Loop.Receive() and for its turn with co_await
+  Loop.Yield().
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootLoop : public ICanRxNotify
+{
+  public:
+	//---------------------------------------------------------------
+	// waits for the next frame of a transport
+	//---------------------------------------------------------------
+	class RxAwaiter
+	{
+	  public:
+		RxAwaiter(CBootLoop* pLoop, ICanTransport* pTransport, CanFrame& sFrame, UINT32 dwTimeoutUs)
+			: m_pLoop(pLoop), m_pTransport(pTransport), m_psFrame(&sFrame), m_dwTimeoutUs(dwTimeoutUs), m_fReceived(FALSE) {}
+
+		bool await_ready(void);
+		void await_suspend(std::coroutine_handle<> hWaiter);
+		BOOL await_resume(void) const noexcept { return m_fReceived; }
+
+	  private:
+		friend class CBootLoop;
+
+		CBootLoop*     m_pLoop;
+		ICanTransport* m_pTransport;
+		CanFrame*      m_psFrame;
+		UINT32         m_dwTimeoutUs;
+		BOOL           m_fReceived;         // result of the co_await
+	};
+
+	//---------------------------------------------------------------
+	// lets the other coroutines run first
+	//---------------------------------------------------------------
+	class YieldAwaiter
+	{
+	  public:
+		explicit YieldAwaiter(CBootLoop* pLoop) : m_pLoop(pLoop) {}
+
+		bool await_ready(void) const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> hWaiter);
+		void await_resume(void) const noexcept {}
+
+	  private:
+		CBootLoop* m_pLoop;
+	};
+
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootLoop();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void         Spawn  (CBootTask&& Task);
+	void         Run    (void);
+	RxAwaiter    Receive(ICanTransport* pTransport, CanFrame& sFrame, UINT32 dwTimeoutUs)
+	{
+		return RxAwaiter(this, pTransport, sFrame, dwTimeoutUs);
+	}
+	YieldAwaiter Yield  (void) { return YieldAwaiter(this); }
+
+	UINT32 GetTasks   (void) const { return (UINT32)m_Tasks.size(); }
+	UINT64 GetResumes (void) const { return m_qwResumes; }
+	UINT64 GetAdvances(void) const { return m_qwAdvances; }
+	UINT64 GetWaits   (void) const { return m_qwWaits;    }
+
+	//---------------------------------------------------------------
+	// ICanRxNotify
+	//---------------------------------------------------------------
+	virtual void Notify(void);
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	void   Wait(void);
+
+	//---------------------------------------------------------------
+	// data types
+	//---------------------------------------------------------------
+	typedef struct {
+		std::coroutine_handle<> hWaiter;    // suspended coroutine
+		RxAwaiter*              pAwaiter;   // its frame and result
+		UINT64                  qwDeadline; // end of the wait on the transport clock
+	} Waiter;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	std::vector<CBootTask>  m_Tasks;        // sessions of the loop
+	std::vector<Waiter>     m_Waiters;      // coroutines waiting for a frame
+	std::vector<std::coroutine_handle<> > m_Ready; // coroutines to resume in the next pass
+	UINT64                  m_qwResumes;    // coroutines resumed by the loop
+	UINT64                  m_qwAdvances;   // passes in which the clocks had to run on
+	UINT64                  m_qwWaits;      // passes in which the loop blocked
+
+	std::mutex              m_NotifyMutex;  // protects the wait for a frame
+	std::condition_variable m_NotifyCond;   // signals a queued frame
+	std::atomic<BOOL>       m_fNotified;    // a frame was queued since the last poll
+	std::unordered_map<ICanTransport*, BOOL> m_Notifies; // transports asked for a notify, TRUE = it notifies
+};
+
+#endif //_BOOTLOOP_HPP_
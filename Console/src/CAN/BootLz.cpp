@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Compression of image blocks for the fast loader stub.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootLz.hpp"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define LZ_MIN_MATCH                    4       // shortest match
+#define LZ_LAST_LITERALS                5       // the stream ends with literals
+#define LZ_MATCH_LIMIT                  12      // no match starts behind len - 12
+#define LZ_MAX_OFFSET                   0xFFFF  // distance of a match
+#define LZ_HASH_BITS                    12
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Hash of the 4 bytes at a position.
+*/
+//////////////////////////////////////////////////////////////////////////
+static UINT32 LzHash(const UINT8* pb)
+{
+	UINT32 dwSeq = (UINT32)pb[0] | ((UINT32)pb[1] << 8) | ((UINT32)pb[2] << 16) | ((UINT32)pb[3] << 24);
+	return (dwSeq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Appends a length above 15 in the LZ4 encoding: bytes of 255 and the
+  rest.
+*/
+//////////////////////////////////////////////////////////////////////////
+static void LzPutLength(UINT32 dwLen, std::vector<UINT8>& Stream)
+{
+	for (; dwLen >= 255; dwLen -= 255)
+	{
+		Stream.push_back(255);
+	}
+	Stream.push_back((UINT8)dwLen);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Appends one sequence: literals followed by a match. A match length
+  of 0 ends the stream with the literals.
+*/
+//////////////////////////////////////////////////////////////////////////
+static void LzPutSequence(const UINT8* pbLiterals, UINT32 dwLiterals, UINT32 dwOffset, UINT32 dwMatch,
+                          std::vector<UINT8>& Stream)
+{
+	UINT32 dwMatchCode = dwMatch ? (dwMatch - LZ_MIN_MATCH) : 0;
+
+	Stream.push_back((UINT8)(((dwLiterals < 15) ? dwLiterals : 15) << 4 | ((dwMatchCode < 15) ? dwMatchCode : 15)));
+	if (dwLiterals >= 15)
+	{
+		LzPutLength(dwLiterals - 15, Stream);
+	}
+	Stream.insert(Stream.end(), pbLiterals, pbLiterals + dwLiterals);
+
+	if (dwMatch)
+	{
+		Stream.push_back((UINT8)dwOffset);
+		Stream.push_back((UINT8)(dwOffset >> 8));
+		if (dwMatchCode >= 15)
+		{
+			LzPutLength(dwMatchCode - 15, Stream);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Compresses a block.
+
+  @param pbData  data to compress
+  @param dwLen   length of the data, up to LZ_MAX_LEN
+  @param Stream  receives the length header and the LZ4 block
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootLzCompress(const UINT8* pbData, UINT32 dwLen, std::vector<UINT8>& Stream)
+{
+	std::vector<UINT32> Table(1 << LZ_HASH_BITS, 0xFFFFFFFF);
+	UINT32 dwAnchor = 0;
+	UINT32 dwPos = 0;
+
+	Stream.clear();
+	Stream.push_back((UINT8)(dwLen >> 8));
+	Stream.push_back((UINT8)dwLen);
+
+	while (dwPos + LZ_MATCH_LIMIT < dwLen)
+	{
+		UINT32 dwHash = LzHash(&pbData[dwPos]);
+		UINT32 dwRef = Table[dwHash];
+		Table[dwHash] = dwPos;
+
+		if ((dwRef == 0xFFFFFFFF) || (dwPos - dwRef > LZ_MAX_OFFSET) ||
+		    (memcmp(&pbData[dwRef], &pbData[dwPos], LZ_MIN_MATCH) != 0))
+		{
+			dwPos++;
+			continue;
+		}
+
+		// the match ends before the last literals
+		UINT32 dwMatch = LZ_MIN_MATCH;
+		while ((dwPos + dwMatch + LZ_LAST_LITERALS < dwLen) && (pbData[dwRef + dwMatch] == pbData[dwPos + dwMatch]))
+		{
+			dwMatch++;
+		}
+
+		LzPutSequence(&pbData[dwAnchor], dwPos - dwAnchor, dwPos - dwRef, dwMatch, Stream);
+		dwPos += dwMatch;
+		dwAnchor = dwPos;
+	}
+
+	LzPutSequence(&pbData[dwAnchor], dwLen - dwAnchor, 0, 0, Stream);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Decompresses a stream like the stub does. Every length and offset is
+  checked against the buffers.
+
+  @param pbStream  length header and LZ4 block
+  @param dwLen     length of the stream
+  @param Data      receives the decompressed data
+  @param dwMaxLen  size of the buffer of the stub
+
+  @return FALSE if the stream is corrupt or too long
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootLzDecompress(const UINT8* pbStream, UINT32 dwLen, std::vector<UINT8>& Data, UINT32 dwMaxLen)
+{
+	if (dwLen < LZ_HEADER_LEN + 1)
+	{
+		return FALSE;
+	}
+
+	UINT32 dwOut = ((UINT32)pbStream[0] << 8) | pbStream[1];
+	UINT32 dwIn = LZ_HEADER_LEN;
+	if (dwOut > dwMaxLen)
+	{
+		return FALSE;
+	}
+	Data.clear();
+	Data.reserve(dwOut);
+
+	while (dwIn < dwLen)
+	{
+		UINT8  bToken = pbStream[dwIn++];
+		UINT32 dwLiterals = bToken >> 4;
+		if (dwLiterals == 15)
+		{
+			UINT8 bMore;
+			do
+			{
+				if (dwIn >= dwLen)
+				{
+					return FALSE;
+				}
+				bMore = pbStream[dwIn++];
+				dwLiterals += bMore;
+			} while (bMore == 255);
+		}
+		if ((dwLiterals > dwLen - dwIn) || (Data.size() + dwLiterals > dwOut))
+		{
+			return FALSE;
+		}
+		Data.insert(Data.end(), &pbStream[dwIn], &pbStream[dwIn] + dwLiterals);
+		dwIn += dwLiterals;
+
+		// the last sequence has no match
+		if (dwIn == dwLen)
+		{
+			break;
+		}
+
+		if (dwIn + 2 > dwLen)
+		{
+			return FALSE;
+		}
+		UINT32 dwOffset = (UINT32)pbStream[dwIn] | ((UINT32)pbStream[dwIn + 1] << 8);
+		dwIn += 2;
+		UINT32 dwMatch = (bToken & 0x0F);
+		if (dwMatch == 15)
+		{
+			UINT8 bMore;
+			do
+			{
+				if (dwIn >= dwLen)
+				{
+					return FALSE;
+				}
+				bMore = pbStream[dwIn++];
+				dwMatch += bMore;
+			} while (bMore == 255);
+		}
+		dwMatch += LZ_MIN_MATCH;
+		if ((dwOffset == 0) || (dwOffset > Data.size()) || (Data.size() + dwMatch > dwOut))
+		{
+			return FALSE;
+		}
+
+		// byte by byte, the match may overlap its own output
+		size_t nFrom = Data.size() - dwOffset;
+		for (UINT32 i = 0; i < dwMatch; i++)
+		{
+			Data.push_back(Data[nFrom + i]);
+		}
+	}
+
+	return (Data.size() == dwOut) ? TRUE : FALSE;
+}
@@ -0,0 +1,44 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Compression of image blocks for the fast loader stub.
+
+  @note
+	The stream is an LZ4 block (sequences of literals and matches, up
+	to 64 KB back) behind the length of the decompressed data, 2 bytes
+	big endian. LZ4 decompresses with byte copies only and without a
+	dictionary in RAM, which suits a stub on a Cortex-M. The compressor
+	is greedy with a hash table of 4 byte sequences; the host has time,
+	but a better match search gains little on code.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTLZ_HPP_
+#define _BOOTLZ_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define LZ_HEADER_LEN                   2       // length of the decompressed data
+#define LZ_MAX_LEN                      0xFFFF  // max. length of the decompressed data
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void BootLzCompress  (const UINT8* pbData, UINT32 dwLen, std::vector<UINT8>& Stream);
+BOOL BootLzDecompress(const UINT8* pbStream, UINT32 dwLen, std::vector<UINT8>& Data, UINT32 dwMaxLen);
+
+#endif //_BOOTLZ_HPP_
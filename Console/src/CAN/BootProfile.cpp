@@ -0,0 +1,279 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Latency profile of a flashing session.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootProfile.hpp"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+static const char* const apszPhase[PROFILE_PHASES] = {
+	"connect", "erase", "erase_done", "write_header", "data_frame",
+	"data_block", "read", "stub_cmd", "stub_data", "stub_store"
+};
+
+static const char* const apszPart[PROFILE_PARTS] = {
+	"tx", "target", "rx", "total"
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootProfile::CBootProfile(void)
+{
+	memset(m_aHist, 0, sizeof(m_aHist));
+	m_dwSession = 0;
+	m_dwPid = 0;
+	m_iResult = 0;
+	m_qwTimeUs = 0;
+	m_dwBytes = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds the time stamps of one answered command. A time stamp of 0 is
+  not known, the parts which need it are skipped. The adapter time
+  stamps are also skipped if they are out of order with the host time
+  stamps, e.g. while the adapter clock is not yet aligned.
+
+  @param dwPhase  PROFILE_xxx phase of the command
+  @param qwSend   host time the command was sent
+  @param qwTx     time the command was on the bus, 0 = unknown
+  @param qwRx     time the response was on the bus, 0 = unknown
+  @param qwWake   host time the response was processed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootProfile::Add(UINT32 dwPhase, UINT64 qwSend, UINT64 qwTx, UINT64 qwRx, UINT64 qwWake)
+{
+	if ((dwPhase >= PROFILE_PHASES) || (qwWake < qwSend))
+	{
+		return;
+	}
+
+	if ((qwTx < qwSend) || (qwTx > qwWake))
+	{
+		qwTx = 0;
+	}
+	if ((qwRx < qwSend) || (qwRx > qwWake) || (qwTx && (qwRx < qwTx)))
+	{
+		qwRx = 0;
+	}
+
+	ProfileHist* pHist = m_aHist[dwPhase];
+	if (qwTx)
+	{
+		AddSample(pHist[PROFILE_TX], qwTx - qwSend);
+	}
+	if (qwTx && qwRx)
+	{
+		AddSample(pHist[PROFILE_TARGET], qwRx - qwTx);
+	}
+	if (qwRx)
+	{
+		AddSample(pHist[PROFILE_RX], qwWake - qwRx);
+	}
+	AddSample(pHist[PROFILE_TOTAL], qwWake - qwSend);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sets the summary of the session written with the profile.
+
+  @param dwSession  number of the session
+  @param dwPid      product ID of the target, 0 = unknown
+  @param iResult    SESSION_xxx result
+  @param qwTimeUs   duration of the session
+  @param dwBytes    bytes of the image
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootProfile::SetSession(UINT32 dwSession, UINT32 dwPid, int iResult, UINT64 qwTimeUs, UINT32 dwBytes)
+{
+	m_dwSession = dwSession;
+	m_dwPid = dwPid;
+	m_iResult = iResult;
+	m_qwTimeUs = qwTimeUs;
+	m_dwBytes = dwBytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a sample to a histogram.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootProfile::AddSample(ProfileHist& sHist, UINT64 qwUs)
+{
+	UINT32 dwUs = (qwUs > 0xFFFFFFFF) ? 0xFFFFFFFF : (UINT32)qwUs;
+	UINT32 dwBucket = 0;
+
+	while ((dwBucket < PROFILE_BUCKETS - 1) && (dwUs >> (dwBucket + 1)))
+	{
+		dwBucket++;
+	}
+
+	if ((sHist.dwCount == 0) || (dwUs < sHist.dwMin))
+	{
+		sHist.dwMin = dwUs;
+	}
+	if (dwUs > sHist.dwMax)
+	{
+		sHist.dwMax = dwUs;
+	}
+	sHist.dwCount++;
+	sHist.qwSum += dwUs;
+	sHist.adwBucket[dwBucket]++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Writes a histogram as a JSON object.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootProfile::WriteHist(FILE* pFile, const ProfileHist& sHist)
+{
+	static const UINT32 adwPercent[] = { 50, 90, 99 };
+	UINT32 adwPercentile[3];
+
+	// upper end of the bucket which holds the percentile
+	for (UINT32 p = 0; p < 3; p++)
+	{
+		UINT64 qwRank = ((UINT64)sHist.dwCount * adwPercent[p] + 99) / 100;
+		UINT64 qwSeen = 0;
+		UINT32 dwBucket = 0;
+		for (; dwBucket < PROFILE_BUCKETS - 1; dwBucket++)
+		{
+			qwSeen += sHist.adwBucket[dwBucket];
+			if (qwSeen >= qwRank)
+			{
+				break;
+			}
+		}
+		adwPercentile[p] = (dwBucket < PROFILE_BUCKETS - 1) ? ((2u << dwBucket) - 1) : sHist.dwMax;
+		if (adwPercentile[p] > sHist.dwMax)
+		{
+			adwPercentile[p] = sHist.dwMax;
+		}
+	}
+
+	fprintf(pFile, "{ \"count\": %u, \"sum_us\": %llu, \"min_us\": %u, \"max_us\": %u, "
+		"\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"buckets\": [",
+		(unsigned int)sHist.dwCount, (unsigned long long)sHist.qwSum, (unsigned int)sHist.dwMin,
+		(unsigned int)sHist.dwMax, (unsigned int)adwPercentile[0], (unsigned int)adwPercentile[1],
+		(unsigned int)adwPercentile[2]);
+	for (UINT32 i = 0; i < PROFILE_BUCKETS; i++)
+	{
+		fprintf(pFile, (i == 0) ? " %u" : ", %u", (unsigned int)sHist.adwBucket[i]);
+	}
+	fprintf(pFile, " ] }");
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes the profile as a JSON object. Phases without samples and parts
+  without time stamps are left out.
+
+  @param pFile  open file
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootProfile::Write(FILE* pFile) const
+{
+	UINT64 aqwPart[PROFILE_TOTAL] = { 0 };
+
+	for (UINT32 i = 0; i < PROFILE_PHASES; i++)
+	{
+		for (UINT32 j = 0; j < PROFILE_TOTAL; j++)
+		{
+			aqwPart[j] += m_aHist[i][j].qwSum;
+		}
+	}
+	UINT32 dwBound = PROFILE_TX;
+	for (UINT32 j = PROFILE_TX + 1; j < PROFILE_TOTAL; j++)
+	{
+		if (aqwPart[j] > aqwPart[dwBound])
+		{
+			dwBound = j;
+		}
+	}
+
+	fprintf(pFile, "    {\n      \"session\": %u,\n      \"pid\": \"%03X\",\n      \"result\": %d,\n"
+		"      \"time_us\": %llu,\n      \"bytes\": %u,\n      \"bound\": \"%s\",\n      \"phases\": {",
+		(unsigned int)m_dwSession, (unsigned int)m_dwPid, m_iResult, (unsigned long long)m_qwTimeUs,
+		(unsigned int)m_dwBytes, aqwPart[dwBound] ? apszPart[dwBound] : "unknown");
+
+	const char* pszPhaseSep = "\n";
+	for (UINT32 i = 0; i < PROFILE_PHASES; i++)
+	{
+		if (m_aHist[i][PROFILE_TOTAL].dwCount == 0)
+		{
+			continue;
+		}
+		fprintf(pFile, "%s        \"%s\": {", pszPhaseSep, apszPhase[i]);
+		pszPhaseSep = ",\n";
+
+		const char* pszPartSep = "\n";
+		for (UINT32 j = 0; j < PROFILE_PARTS; j++)
+		{
+			if (m_aHist[i][j].dwCount == 0)
+			{
+				continue;
+			}
+			fprintf(pFile, "%s          \"%s\": ", pszPartSep, apszPart[j]);
+			WriteHist(pFile, m_aHist[i][j]);
+			pszPartSep = ",\n";
+		}
+		fprintf(pFile, "\n        }");
+	}
+	fprintf(pFile, "\n      }\n    }");
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes the profiles of all sessions of a run into one JSON file.
+
+  @param pszFile   name of the file
+  @param Profiles  profiles of the sessions
+
+  @return TRUE if the file is written
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootProfileWrite(const char* pszFile, const std::vector<const CBootProfile*>& Profiles)
+{
+	FILE* pFile = fopen(pszFile, "w");
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	fprintf(pFile, "{\n  \"version\": 1,\n  \"sessions\": [\n");
+	for (size_t i = 0; i < Profiles.size(); i++)
+	{
+		Profiles[i]->Write(pFile);
+		fprintf(pFile, (i + 1 < Profiles.size()) ? ",\n" : "\n");
+	}
+	fprintf(pFile, "  ]\n}\n");
+
+	BOOL fWritten = (fflush(pFile) == 0) ? TRUE : FALSE;
+	fclose(pFile);
+	return fWritten;
+}
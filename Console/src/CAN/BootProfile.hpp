@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Latency profile of a flashing session.
+
+  @note
+	Every answered command gives four time stamps on the transport
+	clock: the host sends the frame, the frame is on the bus (transmit
+	time stamp of the adapter), the response is on the bus (receive
+	time stamp of the adapter) and the host thread wakes up with the
+	response. They split the round trip into three parts:
+
+	  tx      host send until the command is on the bus: host, driver
+	          and adapter queue, and the command frame itself
+	  target  command on the bus until the response is on the bus:
+	          processing of the target and the response frame
+	  rx      response on the bus until the host thread runs: adapter,
+	          driver and thread wake-up
+
+	A part is recorded only if the adapter delivers both of its time
+	stamps, the total round trip always. The parts are collected per
+	phase of the protocol in histograms with power of two buckets, so
+	a profile stays small however long the session runs.
+
+	The profile is written as JSON, one object per session:
+
+	  { "version": 1, "sessions": [ { "session": 0, "pid": "430",
+	    "result": 0, "time_us": 3539210, "bytes": 6220,
+	    "bound": "target", "phases": { "connect": { "tx": { "count":
+	    1, "sum_us": 180, "min_us": 180, "max_us": 180, "p50_us": 256,
+	    "p90_us": 256, "p99_us": 256, "buckets": [ ... ] }, ... } } } ] }
+
+	Bucket i counts the times from 2^i to 2^(i+1) - 1 us, bucket 0 also
+	the time 0. The percentiles are the upper ends of their buckets.
+	"bound" names the part with the largest sum over all phases.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTPROFILE_HPP_
+#define _BOOTPROFILE_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define PROFILE_BUCKETS                 25      // 1 us .. 16 s
+
+//
+// phases of the protocol
+//
+#define PROFILE_CONNECT                 0       // sync frame until the first answer
+#define PROFILE_ERASE                   1       // erase command until its ACK
+#define PROFILE_ERASE_DONE              2       // ACK of the erase until the end of the erase
+#define PROFILE_WRITE_HEADER            3       // write memory command and address
+#define PROFILE_DATA_FRAME              4       // data frame of a write block
+#define PROFILE_DATA_BLOCK              5       // last frame of a block, includes programming
+#define PROFILE_READ                    6       // read memory command and address
+#define PROFILE_STUB_CMD                7       // command of the stub until its status
+#define PROFILE_STUB_DATA               8       // stream frame of the stub until its progress
+#define PROFILE_STUB_STORE              9       // end of a stub block until it is stored
+#define PROFILE_PHASES                  10
+
+//
+// parts of a round trip
+//
+#define PROFILE_TX                      0       // host send until the command is on the bus
+#define PROFILE_TARGET                  1       // command on the bus until the response is on the bus
+#define PROFILE_RX                      2       // response on the bus until the host wakes up
+#define PROFILE_TOTAL                   3       // host send until the host wakes up
+#define PROFILE_PARTS                   4
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT32 dwCount;                     // number of samples
+	UINT64 qwSum;                       // sum of the samples in us
+	UINT32 dwMin;                       // smallest sample
+	UINT32 dwMax;                       // largest sample
+	UINT32 adwBucket[PROFILE_BUCKETS];  // samples per power of two
+} ProfileHist;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class collects the latencies of one session.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootProfile
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootProfile(void);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void Add(UINT32 dwPhase, UINT64 qwSend, UINT64 qwTx, UINT64 qwRx, UINT64 qwWake);
+	void SetSession(UINT32 dwSession, UINT32 dwPid, int iResult, UINT64 qwTimeUs, UINT32 dwBytes);
+
+	const ProfileHist& GetHist(UINT32 dwPhase, UINT32 dwPart) const { return m_aHist[dwPhase][dwPart]; }
+
+	void Write(FILE* pFile) const;
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	static void AddSample(ProfileHist& sHist, UINT64 qwUs);
+	static void WriteHist(FILE* pFile, const ProfileHist& sHist);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	ProfileHist m_aHist[PROFILE_PHASES][PROFILE_PARTS];
+	UINT32      m_dwSession;            // number of the session
+	UINT32      m_dwPid;                // product ID of the target
+	int         m_iResult;              // SESSION_xxx result of the session
+	UINT64      m_qwTimeUs;             // duration of the session
+	UINT32      m_dwBytes;              // bytes of the image
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+BOOL BootProfileWrite(const char* pszFile, const std::vector<const CBootProfile*>& Profiles);
+
+#endif //_BOOTPROFILE_HPP_
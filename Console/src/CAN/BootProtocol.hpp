@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Protocol of the STM32 ROM boot loader (AN3154), shared by the
+  sessions on their own thread, the coroutine sessions on a loop and
+  the broadcast.
+
+  @note
+	Every command is sent on its own identifier and answered with ACK
+	or NACK in the first data byte on the same identifier. The data
+	frames of Write Memory are sent on BOOT_ID_DATA and answered on
+	BOOT_CMD_WRITE. Addresses are big endian, lengths and page counts
+	are sent minus one.
+
+	A session enters the response of each request with the state bits
+	it waits for and sets in the dispatch table (BootDispatch.hpp), so
+	a stray ACK, e.g. of an earlier request or a filler frame, does not
+	complete the next step.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTPROTOCOL_HPP_
+#define _BOOTPROTOCOL_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define BOOT_ACK                        0x79
+#define BOOT_NACK                       0x1F
+
+#define BOOT_ID_SYNC                    0x79    // first frame after reset, answered on the same identifier
+
+//
+// commands of the boot loader
+//
+#define BOOT_CMD_GET                    0x00
+#define BOOT_CMD_GET_VERSION            0x01
+#define BOOT_CMD_GET_ID                 0x02
+#define BOOT_CMD_READ                   0x11
+#define BOOT_CMD_GO                     0x21
+#define BOOT_CMD_WRITE                  0x31
+#define BOOT_CMD_ERASE                  0x43
+#define BOOT_ID_DATA                    0x04    // data frames of a write, answered on BOOT_CMD_WRITE
+
+#define BOOT_BLOCK_LEN                  256     // max. bytes of a Write Memory or Read Memory
+#define BOOT_MAX_PAGES                  255     // page numbers of one Erase, 0xFF is a mass erase
+#define BOOT_MASS_ERASE                 0xFF    // page count of a mass erase
+#define BOOT_ADDR_LEN                   4       // payload of Go
+#define BOOT_RANGE_LEN                  5       // payload of Read Memory and Write Memory
+
+//
+// sync frames while the target comes out of reset: the interval starts
+// short and grows up to the maximum until the target answers
+//
+#define CONNECT_FIRST_US                3000    // first sync interval
+#define CONNECT_MAX_US                  50000   // max. sync interval
+
+//
+// state bits of the requests, the wait bits of a request in the
+// dispatch table must be set for its ACK to set the done bits
+//
+#define STATE_INIT_BOOT_LOADER          0x0001
+#define STATE_BOOT_LOADER_STARTED       0x0002
+#define STATE_INIT_ERASE                0x0004
+#define STATE_INIT_ERASE_OK             0x0008
+#define STATE_ERASE_COMPLETE            0x0010
+#define STATE_WRITE_START               0x0020
+#define STATE_WRITE_START_COMLETE       0x0040
+#define STATE_WRITE_DATA_BLOCK          0x0080
+#define STATE_WRITE_DATA_BLOCK_COMPLETE 0x0100
+#define STATE_READ_START                0x0200
+#define STATE_READ_START_COMPLETE       0x0400
+#define STATE_READ_DATA                 0x0800
+#define STATE_READ_COMPLETE             0x1000
+#define STATE_GO                        0x2000
+#define STATE_GO_COMPLETE               0x4000
+#define STATE_NACK                      0x8000  // NACK received for the pending command
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Writes the payload of Go: the big endian address.
+
+  @return BOOT_ADDR_LEN
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 BootAddrCommand(UINT8* pbCommand, UINT32 dwAddr)
+{
+	pbCommand[0] = (UINT8)(dwAddr >> 24);
+	pbCommand[1] = (UINT8)(dwAddr >> 16);
+	pbCommand[2] = (UINT8)(dwAddr >> 8);
+	pbCommand[3] = (UINT8)dwAddr;
+	return BOOT_ADDR_LEN;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Writes the payload of Read Memory and Write Memory: the big endian
+  address and the length minus one.
+
+  @param dwLen  number of bytes, 1..BOOT_BLOCK_LEN
+
+  @return BOOT_RANGE_LEN
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 BootRangeCommand(UINT8* pbCommand, UINT32 dwAddr, UINT32 dwLen)
+{
+	BootAddrCommand(pbCommand, dwAddr);
+	pbCommand[4] = (UINT8)(dwLen - 1);
+	return BOOT_RANGE_LEN;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the identifier of a frame of the connect sequence. The sync
+  frame is answered by a boot loader after reset, Get Version by one
+  which is already synchronized, every fourth frame is Get Version.
+
+  @param dwFrame  number of the frame, from 0
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 BootSyncId(UINT32 dwFrame)
+{
+	return ((dwFrame % 4) == 3) ? BOOT_CMD_GET_VERSION : BOOT_ID_SYNC;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the interval after the next frame of the connect sequence,
+  twice the last one up to CONNECT_MAX_US. The first one is
+  CONNECT_FIRST_US.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 BootSyncInterval(UINT32 dwInterval)
+{
+	return (dwInterval * 2 < CONNECT_MAX_US) ? dwInterval * 2 : CONNECT_MAX_US;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the payload of Erase: the number of pages minus one, or
+  BOOT_MASS_ERASE for no pages.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT8 BootEraseCount(UINT32 dwPages)
+{
+	return dwPages ? (UINT8)(dwPages - 1) : (UINT8)BOOT_MASS_ERASE;
+}
+
+#endif //_BOOTPROTOCOL_HPP_
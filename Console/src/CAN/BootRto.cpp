@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Response timeout estimation from measured round trip times.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootRto.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor of an estimator without bounds, which is set up later by
+  assignment.
+*/
+//////////////////////////////////////////////////////////////////////////
+CRtoEstimator::CRtoEstimator(void)
+	: CRtoEstimator(0, 0, 0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+
+  @param dwInitialUs
+	timeout used until the first sample is taken
+  @param dwMinUs
+	lower bound of the timeout
+  @param dwMaxUs
+	upper bound of the timeout, also the limit for backoff
+*/
+//////////////////////////////////////////////////////////////////////////
+CRtoEstimator::CRtoEstimator(UINT32 dwInitialUs, UINT32 dwMinUs, UINT32 dwMaxUs)
+{
+	m_dwSrtt = 0;
+	m_dwRttVar = 0;
+	m_dwRto = dwInitialUs;
+	m_dwMinUs = dwMinUs;
+	m_dwMaxUs = dwMaxUs;
+	m_dwSlackUs = 0;
+	m_dwGranularityUs = 0;
+	m_dwBackoff = 0;
+	m_dwMaxRtt = 0;
+	m_dwSamples = 0;
+	m_dwTimeouts = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a round trip time sample. Only samples of frames which were not
+  retransmitted must be added (Karn's algorithm).
+*/
+//////////////////////////////////////////////////////////////////////////
+void CRtoEstimator::AddSample(UINT32 dwRttUs)
+{
+	if (m_dwSamples == 0)
+	{
+		m_dwSrtt = dwRttUs;
+		m_dwRttVar = dwRttUs / 2;
+	}
+	else
+	{
+		UINT32 dwDelta = (m_dwSrtt > dwRttUs) ? (m_dwSrtt - dwRttUs) : (dwRttUs - m_dwSrtt);
+		m_dwRttVar = m_dwRttVar - (m_dwRttVar >> 2) + (dwDelta >> 2);
+		m_dwSrtt = m_dwSrtt - (m_dwSrtt >> 3) + (dwRttUs >> 3);
+	}
+
+	UINT64 qwVar = 4 * (UINT64)m_dwRttVar;
+	UINT64 qwRto = (UINT64)m_dwSrtt + ((qwVar > m_dwGranularityUs) ? qwVar : m_dwGranularityUs);
+	m_dwRto = (qwRto > m_dwMaxUs) ? m_dwMaxUs : (UINT32)qwRto;
+
+	if (dwRttUs > m_dwMaxRtt)
+	{
+		m_dwMaxRtt = dwRttUs;
+	}
+	m_dwBackoff = 0;
+	m_dwSamples++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Called when a response timed out. Doubles the timeout for the next
+  attempt.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CRtoEstimator::Backoff(void)
+{
+	if (m_dwBackoff < 16)
+	{
+		m_dwBackoff++;
+	}
+	m_dwTimeouts++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the current response timeout in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CRtoEstimator::GetTimeout(void) const
+{
+	UINT64 qwTimeout = (UINT64)m_dwRto << m_dwBackoff;
+
+	if (qwTimeout < m_dwMinUs)
+	{
+		qwTimeout = m_dwMinUs;
+	}
+	qwTimeout += m_dwSlackUs;
+	if (qwTimeout > m_dwMaxUs)
+	{
+		qwTimeout = m_dwMaxUs;
+	}
+	return (UINT32)qwTimeout;
+}
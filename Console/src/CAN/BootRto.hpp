@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Response timeout estimation from measured round trip times.
+
+  @note
+	The estimator follows RFC 6298 (TCP retransmission timer):
+	  SRTT   = 7/8 SRTT + 1/8 R
+	  RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+	  RTO    = SRTT + max(G, 4 RTTVAR)
+	bounded by a per command minimum and maximum. Every timeout doubles
+	the current RTO until the next valid sample. G is the granularity of
+	the response, e.g. the stub reports its progress only every few
+	frames; without it a deterministic response lets RTTVAR decay to
+	nothing and the smallest delay times out.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTRTO_HPP_
+#define _BOOTRTO_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class tracks the response latency of one command type.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CRtoEstimator
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CRtoEstimator(void);
+	CRtoEstimator(UINT32 dwInitialUs, UINT32 dwMinUs, UINT32 dwMaxUs);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void   AddSample (UINT32 dwRttUs);
+	void   Backoff   (void);
+	UINT32 GetTimeout(void) const;
+
+	void   SetSlack  (UINT32 dwSlackUs) { m_dwSlackUs = dwSlackUs; }
+	void   SetGranularity(UINT32 dwGranularityUs) { m_dwGranularityUs = dwGranularityUs; }
+
+	UINT32 GetMinimum (void) const { return m_dwMinUs;    }
+	UINT32 GetSlack   (void) const { return m_dwSlackUs;  }
+	UINT32 GetSrtt    (void) const { return m_dwSrtt;     }
+	UINT32 GetRttVar  (void) const { return m_dwRttVar;   }
+	UINT32 GetMaxRtt  (void) const { return m_dwMaxRtt;   }
+	UINT32 GetSamples (void) const { return m_dwSamples;  }
+	UINT32 GetTimeouts(void) const { return m_dwTimeouts; }
+
+  private:
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	UINT32 m_dwSrtt;                    // smoothed round trip time
+	UINT32 m_dwRttVar;                  // round trip time variation
+	UINT32 m_dwRto;                     // timeout without backoff
+	UINT32 m_dwMinUs;                   // lower bound of the timeout
+	UINT32 m_dwMaxUs;                   // upper bound of the timeout
+	UINT32 m_dwSlackUs;                 // added for delays not seen in the samples
+	UINT32 m_dwGranularityUs;           // lower bound of the variation term
+	UINT32 m_dwBackoff;                 // number of doublings since last sample
+	UINT32 m_dwMaxRtt;                  // largest sample seen
+	UINT32 m_dwSamples;                 // number of samples
+	UINT32 m_dwTimeouts;                // number of timeouts
+};
+
+#endif //_BOOTRTO_HPP_
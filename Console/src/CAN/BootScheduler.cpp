@@ -0,0 +1,109 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Scheduling of the sessions of several boot loader nodes on one bus.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootScheduler.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+
+  @param dwSlots  number of sessions on the channel
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootScheduler::CBootScheduler(UINT32 dwSlots)
+{
+	Slot sSlot = { FALSE, FALSE, FALSE, 0, 0, 0, 0 };
+
+	m_Slots.assign(dwSlots, sSlot);
+	m_dwTicket = 1;
+	m_dwDeferrals = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Starts an exchange of a session if it is its turn.
+
+  @param dwSlot    slot of the session
+  @param qwNow     current time of the transport
+  @param dwBusyUs  time the target works on the flash before it
+                   responds, 0 if the response follows at once
+  @param dwHoldUs  time after dwBusyUs in which the response is
+                   expected
+  @param fExclusive  TRUE for an exchange which needs the bus alone
+
+  @return TRUE if the session may send now, FALSE if it has to wait
+          for the responses of other sessions first
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootScheduler::Begin(UINT32 dwSlot, UINT64 qwNow, UINT32 dwBusyUs, UINT32 dwHoldUs, BOOL fExclusive)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+	Slot& sSlot = m_Slots[dwSlot];
+
+	for (size_t i = 0; i < m_Slots.size(); i++)
+	{
+		const Slot& sOther = m_Slots[i];
+		BOOL fWait;
+
+		if (i == dwSlot)
+		{
+			continue;
+		}
+		if (sOther.fPending)
+		{
+			fWait = fExclusive || sOther.fExclusive ||
+			        ((sOther.qwHold <= qwNow) && (qwNow < sOther.qwRelease) &&
+			         (sOther.dwTicket < sSlot.dwLastTicket));
+		}
+		else
+		{
+			// a waiting exclusive exchange goes first, the lowest slot
+			// first if several are waiting
+			fWait = sOther.fWaitExclusive && (!fExclusive || (i < dwSlot));
+		}
+
+		if (fWait)
+		{
+			sSlot.fWaitExclusive = fExclusive;
+			m_dwDeferrals++;
+			return FALSE;
+		}
+	}
+
+	sSlot.fWaitExclusive = FALSE;
+	sSlot.fPending = TRUE;
+	sSlot.fExclusive = fExclusive;
+	sSlot.qwHold = qwNow + dwBusyUs;
+	sSlot.qwRelease = sSlot.qwHold + dwHoldUs;
+	sSlot.dwTicket = m_dwTicket++;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Ends the exchange of a session, with a response or by timeout.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootScheduler::End(UINT32 dwSlot)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+	Slot& sSlot = m_Slots[dwSlot];
+
+	if (sSlot.fPending)
+	{
+		sSlot.fPending = FALSE;
+		sSlot.dwLastTicket = sSlot.dwTicket;
+	}
+}
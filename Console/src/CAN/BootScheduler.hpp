@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Scheduling of the sessions of several boot loader nodes on one bus.
+
+  @note
+	The host frames of a node win the arbitration against the responses
+	of all nodes with a higher ID base. Sessions which exchange frames
+	as fast as possible can keep the bus busy, so the response of such
+	a node is delayed until its session times out.
+
+	The scheduler hands out the bus in rounds: a session only starts a
+	new exchange when no other session still waits for the response of
+	an exchange which started before its own last one. An exchange which
+	waits for the flash (the last frame of a write block) holds back the
+	others only after the expected programming time, so the bus is used
+	by the other nodes while one node programs. An exchange whose
+	response is overdue no longer holds back the others, the response
+	is most likely lost and the session waits for its timeout.
+
+	The data of a read command is sent by the target in one burst, which
+	would delay the responses to all other nodes. Reads are exclusive:
+	they start when no other exchange is pending and hold back all
+	other sessions until they are complete.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTSCHEDULER_HPP_
+#define _BOOTSCHEDULER_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <mutex>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class orders the exchanges of the sessions on one channel. Each
+  session uses its own slot, the scheduler is called from the threads
+  of the sessions.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootScheduler
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootScheduler(UINT32 dwSlots);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL Begin(UINT32 dwSlot, UINT64 qwNow, UINT32 dwBusyUs, UINT32 dwHoldUs, BOOL fExclusive);
+	void End  (UINT32 dwSlot);
+
+	UINT32 GetSlots    (void) const { return (UINT32)m_Slots.size(); }
+	UINT32 GetDeferrals(void) const { return m_dwDeferrals; }
+
+  private:
+	//---------------------------------------------------------------
+	// data types
+	//---------------------------------------------------------------
+	typedef struct {
+		BOOL   fPending;                // exchange waits for its response
+		BOOL   fExclusive;              // no other exchange while this one is pending
+		BOOL   fWaitExclusive;          // waits for an exclusive exchange
+		UINT64 qwHold;                  // the exchange holds back the others from here
+		UINT64 qwRelease;               // ... until here, the response is overdue then
+		UINT32 dwTicket;                // order of the current exchange
+		UINT32 dwLastTicket;            // order of the previous exchange
+	} Slot;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	std::mutex        m_Mutex;          // protects the slots
+	std::vector<Slot> m_Slots;          // state per session
+	UINT32            m_dwTicket;       // next ticket
+	UINT32            m_dwDeferrals;    // calls of Begin() which had to wait
+};
+
+#endif //_BOOTSCHEDULER_HPP_
@@ -0,0 +1,2457 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashing session with one STM32 boot loader (AN3154).
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootSession.hpp"
+#include "BootProtocol.hpp"
+#include "BootLog.hpp"
+#include "BootCrc.hpp"
+#include "BootStub.hpp"
+#include "CanTiming.hpp"
+
+#include <string.h>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define MAX_BLOCK_RETRIES               8       // recoveries per write block without progress
+#define MAX_DRAIN_FRAMES                40      // filler frames to end a write
+#define SCHEDULE_POLL_US                200     // wait for the turn on a shared bus
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+//
+// the logger keeps the format pointer, one literal per line
+//
+static const char* const aszRtoReport[RTO_COUNT] = {
+	"\n  erase       : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  erase done  : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  write start : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  write data  : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  write block : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  read        : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  stub command: %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  stub data   : %5u samples, srtt %7u us, rttvar %7u us, max %7u us",
+	"\n  stub store  : %5u samples, srtt %7u us, rttvar %7u us, max %7u us"
+};
+
+//
+// predicted and measured time per phase of the session
+//
+static const char* const aszEtaReport[ETA_PHASES] = {
+	"\n  erase       : predicted %7u ms, bus %7u ms, took %7u ms",
+	"\n  stub upload : predicted %7u ms, bus %7u ms, took %7u ms",
+	"\n  write       : predicted %7u ms, bus %7u ms, took %7u ms",
+	"\n  stub check  : predicted %7u ms, bus %7u ms, took %7u ms"
+};
+
+//
+// initial timeout, lower and upper bound per command type in us, the
+// initial values are the former fixed timeouts
+//
+static const UINT32 adwRtoLimits[RTO_COUNT][3] = {
+	{   100000,   2000,  1000000 },             // RTO_ERASE
+	{ 30000000, 100000, 30000000 },             // RTO_ERASE_DONE
+	{   100000,   2000,  1000000 },             // RTO_WRITE_START
+	{   100000,   2000,  1000000 },             // RTO_WRITE_DATA
+	{   100000,   2000,  1000000 },             // RTO_WRITE_BLOCK
+	{   100000,   2000,  1000000 },             // RTO_READ
+	{   100000,   2000,  1000000 },             // RTO_STUB_CMD
+	{   100000,   2000,  1000000 },             // RTO_STUB_DATA
+	{   100000, 100000,  1000000 }              // RTO_STUB_STORE
+};
+
+//
+// phase of the latency profile per command type
+//
+static const UINT8 abRtoPhase[RTO_COUNT] = {
+	PROFILE_ERASE, PROFILE_ERASE_DONE, PROFILE_WRITE_HEADER, PROFILE_DATA_FRAME, PROFILE_DATA_BLOCK,
+	PROFILE_READ, PROFILE_STUB_CMD, PROFILE_STUB_DATA, PROFILE_STUB_STORE
+};
+
+//
+// receive mode per command type: the ACK of each data frame of a write
+// holds up the next frame, bulk responses and long waits are batched
+//
+static const UINT8 abRxMode[RTO_COUNT] = {
+	CAN_RX_FRAME, CAN_RX_BATCH, CAN_RX_FRAME, CAN_RX_POLL, CAN_RX_FRAME,
+	CAN_RX_FRAME, CAN_RX_FRAME, CAN_RX_BATCH, CAN_RX_FRAME
+};
+
+//
+// the logger keeps the format pointer, one literal per receive mode
+//
+static const char* const aszRxReport[CAN_RX_MODES] = {
+	"\n [%u] RX batch : %6u wake-ups/s, %6u frames/s, latency %6u us",
+	"\n [%u] RX frame : %6u wake-ups/s, %6u frames/s, latency %6u us",
+	"\n [%u] RX poll  : %6u wake-ups/s, %6u frames/s, latency %6u us"
+};
+
+//
+// identifiers of a session besides the data frames of the stub, the
+// commands are answered on their own identifier
+//
+static const UINT8 abSessionIds[] = {
+	BOOT_ID_SYNC, BOOT_CMD_GET, BOOT_CMD_GET_VERSION, BOOT_CMD_GET_ID, BOOT_CMD_READ, BOOT_CMD_GO, BOOT_CMD_WRITE,
+	BOOT_CMD_ERASE, BOOT_ID_DATA, STUB_ID_STATUS, STUB_ID_CMD
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+  @param dwChannel   number of the channel, used in messages
+  @param pTransport  channel to the target
+  @param Image       image to write, must live as long as the session
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootSession::CBootSession(UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image)
+	: m_Image(Image)
+{
+	BootRtoInit(m_aRto);
+	m_dwChannel = dwChannel;
+	m_pTransport = pTransport;
+	m_dwIdBase = 0;
+	m_pScheduler = NULL;
+	m_dwSlot = 0;
+	m_fTurn = FALSE;
+	m_fRxTrace = FALSE;
+
+	memset(m_abMessage, 0, sizeof(m_abMessage));
+	m_dwMsgLength = 0;
+	m_dwMsgId = 0;
+	m_dwState = 0;
+	m_qwStateTime = 0;
+	m_qwStateBusTime = 0;
+
+	m_dwReadLength = 0;
+	m_dwReadCount = 0;
+	m_dwReadId = 0;
+
+	m_dwBlockRetries = 0;
+	m_dwDrainFrames = 0;
+	m_dwReadBacks = 0;
+	m_fRestoring = FALSE;
+	m_dwConnectWaitUs = CONNECT_WAIT_US;
+	m_qwReadyTime = 0;
+	m_dwSyncFrames = 0;
+	m_qwConnectTime = 0;
+	m_fProbed = FALSE;
+
+	m_pStub = NULL;
+	m_pDelta = NULL;
+	m_fDelta = FALSE;
+	m_pBase = NULL;
+	m_dwSectorSize = 0;
+	m_fMassErase = FALSE;
+
+	m_pStore = NULL;
+	m_fDevice = FALSE;
+	UINT8 abNoUid[DEVICE_UID_LEN] = { 0 };
+	BootDeviceInit(m_sDevice, abNoUid, 0);
+
+	m_fStarted = FALSE;
+	m_qwStart = 0;
+	m_qwDuration = 0;
+	m_dwWritten = 0;
+	m_iResult = SESSION_NOT_STARTED;
+	m_dwPid = 0;
+	m_dwEtaBytes = 0;
+	m_dwEtaStep = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Destructor.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootSession::~CBootSession()
+{
+	delete m_pStub;
+	delete m_pDelta;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes the image through a fast loader stub in RAM. The session falls
+  back to the ROM boot loader if there is no stub for the target.
+
+  @param pszDir     directory of the stub images, NULL for the built in
+                    image of the simulated target
+  @param fFd        use CAN FD if the stub and the transport support it
+  @param fCompress  compress the blocks if the stub supports it
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::SetStub(const char* pszDir, BOOL fFd, BOOL fCompress)
+{
+	delete m_pStub;
+	m_pStub = new CBootStub(this, pszDir, fFd, fCompress);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sets the max. number of data frames the stub streams without a
+  progress report, the congestion window of the stub stays below. Call
+  SetStub() first.
+
+  @param dwFrames  STUB_ACK_FRAMES .. STUB_WINDOW_FRAMES
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::SetStubWindow(UINT32 dwFrames)
+{
+	if (m_pStub)
+	{
+		m_pStub->SetWindow(dwFrames);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases and writes only the sectors which differ from the installed
+  image. Without an installed image the stub reports the installed
+  sectors, without a stub the whole image is written.
+
+  @param pBase         installed image, NULL to ask the stub
+  @param dwSectorSize  size of uniform sectors in bytes, 0 for the
+                       layout of the target
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::SetDelta(const HexData* pBase, UINT32 dwSectorSize)
+{
+	m_fDelta = TRUE;
+	m_pBase = pBase;
+	m_dwSectorSize = dwSectorSize;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Shares the bus with the sessions of other nodes. A response can wait
+  behind one exchange of every other node, this delay depends on the
+  progress of the other sessions and is added to the estimated
+  timeouts. The end of the erase is not affected.
+
+  @param pScheduler  scheduler of the bus, must live as long as the session
+  @param dwSlot      slot of the session in the scheduler
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::SetScheduler(CBootScheduler* pScheduler, UINT32 dwSlot)
+{
+	m_pScheduler = pScheduler;
+	m_dwSlot = dwSlot;
+
+	for (UINT8 i = 0; i < RTO_COUNT; i++)
+	{
+		if (i != RTO_ERASE_DONE)
+		{
+			m_aRto[i].SetSlack(m_aRto[i].GetMinimum() * (pScheduler->GetSlots() - 1));
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the session and releases the transport, so sessions which share
+  the transport no longer wait for this one.
+
+  @return SESSION_OK or the error, also available with GetResult()
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootSession::Run(void)
+{
+	m_qwStart = m_pTransport->GetTime();
+	m_fStarted = TRUE;
+
+	m_iResult = Flash();
+	m_qwDuration = m_pTransport->GetTime() - m_qwStart;
+	m_Profile.SetSession(m_dwChannel, m_dwPid, m_iResult, m_qwDuration, m_Image.HexDataLen);
+	m_pTransport->Detach();
+	return m_iResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Connects to the boot loader, continues an interrupted session or
+  erases the flash and writes the image. A delta flash erases and
+  writes the changed sectors only.
+
+  @return SESSION_OK or the error
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootSession::Flash(void)
+{
+	//
+	// a response can wait behind a frame on the bus, without this
+	// variation a spurious timeout costs a recovery
+	//
+	UINT32 dwBitRate;
+	UINT32 dwDataBitRate;
+	if (m_pTransport->GetBitRate(dwBitRate, dwDataBitRate) && dwBitRate)
+	{
+		CanBits sBits;
+		CanFrameBitsMax(8, FALSE, sBits);
+		for (UINT8 i = 0; i < RTO_COUNT; i++)
+		{
+			m_aRto[i].SetGranularity((UINT32)(CanBitsTimeNs(sBits, dwBitRate, dwBitRate) / 1000));
+		}
+	}
+
+	//-------- init Boot_Loader ----------
+	UINT64 qwConnectStart = m_pTransport->GetTime();
+	if (!Connect())
+	{
+		BootLog(LOG_ERROR, "\n [%u] Error BootLoader notstarted", m_dwChannel);
+		return SESSION_NOT_STARTED;
+	}
+	BootLog(LOG_INFO, "\n [%u] BootLoader started........OK", m_dwChannel);
+
+	//----------- resume -------------
+	JournalKey sKey;
+	BOOL       fResume = FALSE;
+	UINT32     dwResume = 0;
+	UINT32     dwDone = 0;
+
+	sKey.dwPid = GetId();
+	m_dwPid = sKey.dwPid;
+	sKey.dwImageCrc = BootCrc32(m_Image.Data.data(), m_Image.HexDataLen);
+	sKey.dwStartAddr = m_Image.StartAdres;
+	sKey.dwImageLen = m_Image.HexDataLen;
+	if (m_pStore)
+	{
+		LoadDevice(sKey.dwPid);
+	}
+	if (!Probe())
+	{
+		BootLog(LOG_ERROR, "\n [%u] Error BootLoader notstarted", m_dwChannel);
+		return SESSION_NOT_STARTED;
+	}
+	m_qwConnectTime = m_pTransport->GetTime() - qwConnectStart;
+	BootLog(LOG_INFO, "\n [%u] Connected in %u ms", m_dwChannel, (UINT32)(m_qwConnectTime / 1000));
+
+	if (!HasCommand(BOOT_CMD_WRITE) || !HasCommand(BOOT_CMD_ERASE))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Boot loader can not erase and write", m_dwChannel);
+		return SESSION_NOT_STARTED;
+	}
+	if (m_pStub && !HasCommand(BOOT_CMD_GO))
+	{
+		BootLog(LOG_INFO, "\n [%u] Boot loader has no Go command, the stub is not used", m_dwChannel);
+		delete m_pStub;
+		m_pStub = NULL;
+	}
+	PlanLayout(sKey.dwPid);
+
+	//----------- delta -------------
+	std::vector<ImageRange> Ranges;
+	ImageRange sWhole = { 0, m_Image.HexDataLen };
+	Ranges.push_back(sWhole);
+	if (m_fDelta)
+	{
+		delete m_pDelta;
+		m_pDelta = new CBootDelta(m_Image, m_Layout);
+		if (m_pBase)
+		{
+			m_pDelta->SetBase(*m_pBase);
+		}
+		int iResult = PlanDelta(sKey.dwPid, Ranges);
+		if (iResult != SESSION_OK)
+		{
+			return iResult;
+		}
+	}
+
+	if (!m_pDelta && !m_strJournal.empty() && HasCommand(BOOT_CMD_READ))
+	{
+		if (!m_Journal.Open(m_strJournal.c_str(), sKey))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Journal can not be written", m_dwChannel);
+		}
+		else if (PlanResume(dwResume, dwDone))
+		{
+			BootLog(LOG_INFO, "\n [%u] Resume at %08X, %u of %u bytes written", m_dwChannel,
+				m_Image.StartAdres + dwResume, dwResume + dwDone, m_Image.HexDataLen);
+			fResume = TRUE;
+		}
+		else
+		{
+			dwResume = 0;
+			dwDone = 0;
+			m_Journal.Restart();
+		}
+	}
+
+	//----------- erase -------------
+	std::vector<UINT32> Sectors;
+	BOOL fMass = FALSE;
+	if (m_pDelta)
+	{
+		for (UINT32 i = 0; i < m_pDelta->GetSectors(); i++)
+		{
+			if (m_pDelta->IsChanged(i))
+			{
+				Sectors.push_back(m_pDelta->GetSector(i));
+			}
+		}
+	}
+	else if (!fResume && (m_fMassErase || !m_Layout.PlanErase(m_Image.StartAdres, m_Image.HexDataLen, Sectors) ||
+	         (Sectors.back() > 0xFF)))
+	{
+		Sectors.clear();
+		fMass = TRUE;
+	}
+	PlanEta(Ranges, dwResume + dwDone, Sectors, fMass);
+
+	UINT64 qwEraseStart = m_pTransport->GetTime();
+	m_Eta.Begin(ETA_ERASE, qwEraseStart);
+	ForgetImage();
+	if (m_pDelta)
+	{
+		BootLog(LOG_INFO, "\n [%u] Erase %u changed sectors", m_dwChannel, (UINT32)Sectors.size());
+		if (!EraseSectors(Sectors))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+			return SESSION_ERASE_ERROR;
+		}
+	}
+	else if (!fResume && !fMass)
+	{
+		BootLog(LOG_INFO, "\n [%u] Erase %u sectors, %u KB", m_dwChannel, (UINT32)Sectors.size(),
+			(m_Layout.GetAddr(Sectors.back()) + m_Layout.GetSize(Sectors.back()) - m_Layout.GetAddr(Sectors.front())) / 1024);
+		if (!EraseSectors(Sectors))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+			return SESSION_ERASE_ERROR;
+		}
+	}
+	else if (fMass)
+	{
+		BootLog(LOG_INFO, "\n [%u] Erase all memory start.....please wait\n", m_dwChannel);
+		if (!MassErase())
+		{
+			BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+			return SESSION_ERASE_ERROR;
+		}
+		BootLog(LOG_INFO, "\n [%u] Erase memory complete\n", m_dwChannel);
+	}
+
+	//
+	// an erased write unit of the broken block can not be told from a
+	// unit programmed with the filler, the sector is written again
+	//
+	if (fResume && m_Layout.HasEcc() && (dwResume < m_Image.HexDataLen))
+	{
+		if (!RestoreSector(m_Image.StartAdres + dwResume))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Erase memory error\n", m_dwChannel);
+			return SESSION_ERASE_ERROR;
+		}
+		dwDone = 0;
+	}
+
+	//---------------- write hex--------------
+	UINT64 qwWriteStart = m_pTransport->GetTime();
+	int iResult = WriteImage(sKey.dwPid, Ranges, dwResume, dwDone);
+	m_Eta.End(m_pTransport->GetTime());
+	if (m_pDelta)
+	{
+		m_pDelta->SetTimes(qwWriteStart - qwEraseStart, m_pTransport->GetTime() - qwWriteStart, m_dwWritten);
+	}
+	if (iResult == SESSION_OK)
+	{
+		SaveImage(sKey.dwImageCrc);
+	}
+	return iResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes ranges of the image through the stub or with the ROM boot
+  loader.
+
+  @param dwPid     product ID of the target
+  @param Ranges    parts of the image to write, ascending
+  @param dwResume  offset of the first journal block to write
+  @param dwDone    bytes of that block which are already programmed
+
+  @return SESSION_OK or the error
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootSession::WriteImage(UINT32 dwPid, const std::vector<ImageRange>& Ranges, UINT32 dwResume, UINT32 dwDone)
+{
+	if (m_pStub)
+	{
+		m_Eta.Begin(ETA_UPLOAD, m_pTransport->GetTime());
+		int iStart = m_pStub->Start(dwPid);
+		if (iStart == STUB_START_FAILED)
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub does not answer, reset the target", m_dwChannel);
+			return SESSION_STUB_ERROR;
+		}
+		if (iStart == STUB_START_OK)
+		{
+			m_Eta.Begin(ETA_WRITE, m_pTransport->GetTime());
+			if (!m_pStub->Write(Ranges, dwResume, dwDone))
+			{
+				BootLog(LOG_ERROR, "\n [%u] Write error", m_dwChannel);
+				return SESSION_WRITE_ERROR;
+			}
+			m_Journal.Remove();
+
+			BootLog(LOG_INFO, "\n [%u] Write memory complete", m_dwChannel);
+			return SESSION_OK;
+		}
+		BootLog(LOG_INFO, "\n [%u] Write with the ROM boot loader", m_dwChannel);
+	}
+
+	m_Eta.Begin(ETA_WRITE, m_pTransport->GetTime());
+	for (size_t r = 0; r < Ranges.size(); r++)
+	{
+		UINT32 dwRangeEnd = Ranges[r].dwOffset + Ranges[r].dwLen;
+		UINT32 dwLen;
+
+		for (UINT32 dwOffset = (Ranges[r].dwOffset > dwResume) ? Ranges[r].dwOffset : dwResume; dwOffset < dwRangeEnd; dwOffset += dwLen)
+		{
+			dwLen = BlockLen(dwOffset, dwRangeEnd);
+
+			// the last block is padded to the programming unit
+			const UINT8* pbBlock = &m_Image.Data[dwOffset];
+			UINT32       dwUnit = m_Layout.GetWriteUnit();
+			UINT32       dwPadded = (dwLen + dwUnit - 1) / dwUnit * dwUnit;
+			UINT8        abBlock[256];
+			if (dwPadded != dwLen)
+			{
+				memcpy(abBlock, pbBlock, dwLen);
+				memset(&abBlock[dwLen], 0xFF, dwPadded - dwLen);
+				pbBlock = abBlock;
+			}
+
+			BootLog(LOG_DEBUG, "\n [%u] Write memory %d block  ", m_dwChannel, (dwOffset >> 8) + 1);
+			if (!WriteBlock(m_Image.StartAdres + dwOffset, pbBlock, dwPadded, dwDone))
+			{
+				BootLog(LOG_ERROR, "\n [%u] Write error", m_dwChannel);
+				return SESSION_WRITE_ERROR;
+			}
+			m_Journal.Commit(m_Image.StartAdres + dwOffset, dwLen, BootCrc32(&m_Image.Data[dwOffset], dwLen));
+			m_dwWritten += dwLen - dwDone;
+			dwDone = 0;
+			ShowProgress(m_dwWritten);
+		}
+	}
+	m_Journal.Remove();
+
+	BootLog(LOG_INFO, "\n [%u] Write memory complete", m_dwChannel);
+	return SESSION_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Predicts the duration of the erase and the write from the bit rate
+  of the transport and logs it with the bus time, the ceiling of this
+  bus. The turnaround of the target and the latency of the host are
+  taken from the commands sent while connecting, the erase times from
+  the geometry of the family. A block of the stub is predicted without
+  compression, i.e. as the upper bound.
+
+  @param Ranges      parts of the image to write, ascending
+  @param dwFrom      offset the write starts at
+  @param Sectors     sectors to erase, empty for none or a mass erase
+  @param fMassErase  the whole flash is erased
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::PlanEta(const std::vector<ImageRange>& Ranges, UINT32 dwFrom, const std::vector<UINT32>& Sectors,
+                           BOOL fMassErase)
+{
+	UINT32 dwBitRate;
+	UINT32 dwDataBitRate;
+
+	if (!m_pTransport->GetBitRate(dwBitRate, dwDataBitRate) || !m_Eta.SetBus(dwBitRate, dwDataBitRate))
+	{
+		return;
+	}
+
+	//
+	// the commands while connecting have no payload and are answered
+	// by one byte, the bus time of both frames is taken off
+	//
+	const ProfileHist& sTotal = m_Profile.GetHist(PROFILE_READ, PROFILE_TOTAL);
+	const ProfileHist& sTarget = m_Profile.GetHist(PROFILE_READ, PROFILE_TARGET);
+	if (sTotal.dwCount)
+	{
+		UINT64 qwCmd = m_Eta.GetFrameNs(0, FALSE) / 1000;
+		UINT64 qwAck = m_Eta.GetFrameNs(1, FALSE) / 1000;
+		UINT64 qwRound = sTotal.qwSum / sTotal.dwCount;
+		UINT64 qwTarget = sTarget.dwCount ? sTarget.qwSum / sTarget.dwCount : qwRound - qwCmd;
+		UINT32 dwResponse = (qwTarget > qwAck) ? (UINT32)(qwTarget - qwAck) : 0;
+		UINT32 dwHost = (qwRound > qwCmd + qwTarget) ? (UINT32)(qwRound - qwCmd - qwTarget) : 0;
+		m_Eta.SetLatency(dwResponse, dwHost);
+		BootLog(LOG_DEBUG, "\n [%u] Predicted with %u us turnaround, %u us host latency", m_dwChannel,
+			dwResponse, dwHost);
+	}
+
+	//
+	// erase, the second ACK comes when the flash is erased
+	//
+	const FlashGeometry* pGeometry = m_Layout.GetGeometry();
+	BOOL fStub = (m_pStub && m_pStub->IsRunning()) ? TRUE : FALSE;
+	if (fMassErase)
+	{
+		m_Eta.AddExchange(ETA_ERASE, 1, 1, 1);
+		m_Eta.AddFrames(ETA_ERASE, 1, FALSE, 1);
+		m_Eta.AddWait(ETA_ERASE, pGeometry ? pGeometry->dwMassEraseUs : ETA_MASS_ERASE_US);
+	}
+	else if (!Sectors.empty())
+	{
+		UINT32 dwCount = (UINT32)Sectors.size();
+		UINT64 qwEraseUs = 0;
+		for (UINT32 i = 0; i < dwCount; i++)
+		{
+			qwEraseUs += (UINT64)(pGeometry ? pGeometry->dwEraseUsPerKb : ETA_ERASE_US_PER_KB) *
+			             m_Layout.GetSize(Sectors[i]) / 1024;
+		}
+		if (fStub)
+		{
+			m_Eta.AddExchange(ETA_ERASE, 8, 8, dwCount);
+		}
+		else
+		{
+			UINT32 dwCommands = (dwCount + 254) / 255;
+			m_Eta.AddExchange(ETA_ERASE, 1, 1, dwCommands);
+			m_Eta.AddFrames(ETA_ERASE, 8, FALSE, (dwCount + 7) / 8);
+			m_Eta.AddFrames(ETA_ERASE, 1, FALSE, dwCommands);
+		}
+		m_Eta.AddWait(ETA_ERASE, qwEraseUs);
+	}
+
+	//
+	// upload and start of the stub, Go is answered by the ROM boot
+	// loader and the stub reports when it is ready
+	//
+	if (!fStub && m_pStub && (m_pStub->Load(m_dwPid) == STUB_START_OK))
+	{
+		for (UINT32 dwOffset = 0; dwOffset < m_pStub->GetImageLen(); dwOffset += 256)
+		{
+			PlanRomBlock(ETA_UPLOAD, (m_pStub->GetImageLen() - dwOffset > 256) ? 256 : m_pStub->GetImageLen() - dwOffset, FALSE);
+		}
+		m_Eta.AddExchange(ETA_UPLOAD, 4, 1, 1);
+		m_Eta.AddFrames(ETA_UPLOAD, 8, FALSE, 1);
+		fStub = TRUE;
+	}
+
+	//
+	// write, the stub programs a block while it receives the next one
+	// and the flush waits for the last one
+	//
+	m_dwEtaBytes = 0;
+	m_dwEtaStep = 0;
+	UINT64 qwProgramUs = 0;
+	for (size_t r = 0; r < Ranges.size(); r++)
+	{
+		UINT32 dwRangeEnd = Ranges[r].dwOffset + Ranges[r].dwLen;
+		UINT32 dwLen;
+
+		for (UINT32 dwOffset = (Ranges[r].dwOffset > dwFrom) ? Ranges[r].dwOffset : dwFrom; dwOffset < dwRangeEnd; dwOffset += dwLen)
+		{
+			if (!fStub)
+			{
+				dwLen = BlockLen(dwOffset, dwRangeEnd);
+				PlanRomBlock(ETA_WRITE, dwLen, TRUE);
+			}
+			else
+			{
+				UINT32 dwEnd = (dwOffset / m_pStub->GetBlockSize() + 1) * m_pStub->GetBlockSize();
+				dwLen = ((dwEnd < dwRangeEnd) ? dwEnd : dwRangeEnd) - dwOffset;
+
+				UINT64 qwBlockNs = m_Eta.GetPhase(ETA_WRITE).qwTimeNs;
+				m_Eta.AddExchange(ETA_WRITE, 7, 8, 1);
+				m_Eta.AddStream(ETA_WRITE, dwLen, m_pStub->GetFrameLen(), m_pStub->IsFd(), m_pStub->GetWindow(),
+					STUB_ACK_FRAMES, 8);
+				m_Eta.AddExchange(ETA_WRITE, 5, 8, 1);
+				qwBlockNs = m_Eta.GetPhase(ETA_WRITE).qwTimeNs - qwBlockNs;
+				if (qwProgramUs * 1000 > qwBlockNs)
+				{
+					m_Eta.AddWait(ETA_WRITE, qwProgramUs - qwBlockNs / 1000);
+				}
+				qwProgramUs = (UINT64)ETA_PROGRAM_US * ((dwLen + 255) / 256);
+				m_Eta.AddExchange(ETA_CHECK, 8, 8, 1);
+			}
+			m_dwEtaBytes += dwLen;
+		}
+	}
+	if (fStub)
+	{
+		m_Eta.AddExchange(ETA_WRITE, 1, 8, 1);
+		m_Eta.AddWait(ETA_WRITE, qwProgramUs);
+	}
+
+	BootLog(LOG_INFO, "\n [%u] Predicted %u ms, bus time %u ms", m_dwChannel, (UINT32)(m_Eta.GetTime() / 1000),
+		(UINT32)(m_Eta.GetBusTime() / 1000));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds a block of the ROM boot loader to the prediction: the command
+  with the address, a data frame per 8 bytes, each acknowledged, and
+  the programming before the last ACK.
+
+  @param dwPhase  ETA_xxx
+  @param dwLen    bytes of the block, 1..256
+  @param fFlash   the block is programmed, not written to RAM
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::PlanRomBlock(UINT32 dwPhase, UINT32 dwLen, BOOL fFlash)
+{
+	m_Eta.AddExchange(dwPhase, 5, 1, 1);
+	m_Eta.AddExchange(dwPhase, 8, 1, dwLen / 8);
+	if (dwLen % 8)
+	{
+		m_Eta.AddExchange(dwPhase, dwLen % 8, 1, 1);
+	}
+	if (fFlash)
+	{
+		m_Eta.AddWait(dwPhase, ETA_PROGRAM_US);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Logs the remaining time of the session after each tenth of the
+  bytes to write.
+
+  @param dwDone  bytes written in this session
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::ShowProgress(UINT32 dwDone)
+{
+	if (!m_Eta.IsPlanned() || (m_dwEtaBytes == 0))
+	{
+		return;
+	}
+
+	UINT32 dwStep = (UINT32)((UINT64)dwDone * 10 / m_dwEtaBytes);
+	if ((dwStep <= m_dwEtaStep) || (dwStep >= 10))
+	{
+		return;
+	}
+	m_dwEtaStep = dwStep;
+	BootLog(LOG_INFO, "\n [%u] %u %% written, %u ms left", m_dwChannel, dwStep * 10,
+		(UINT32)(m_Eta.GetRemain(dwDone, m_dwEtaBytes, m_pTransport->GetTime()) / 1000));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Selects the flash layout of the target. The flash size is read from
+  the size register once per device. Uniform sectors are used if the
+  sector size is given or the family is not known.
+
+  @param dwPid  product ID of the target
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::PlanLayout(UINT32 dwPid)
+{
+	const FlashGeometry* pGeometry = BootGeometryFind(dwPid);
+	UINT8 abSize[2];
+
+	if (pGeometry && !m_sDevice.dwFlashSize && pGeometry->dwSizeAddr && HasCommand(BOOT_CMD_READ) &&
+	    ReadMemory(pGeometry->dwSizeAddr, abSize, 2))
+	{
+		// an unprogrammed register reads as 0xFFFF
+		UINT32 dwKb = ((UINT32)abSize[1] << 8) | abSize[0];
+		m_sDevice.dwFlashSize = ((dwKb != 0) && (dwKb != 0xFFFF)) ? dwKb * 1024 : 0;
+	}
+
+	if (m_dwSectorSize)
+	{
+		m_Layout.SetUniform(m_dwSectorSize, m_sDevice.dwFlashSize ? m_sDevice.dwFlashSize :
+			(pGeometry ? pGeometry->dwFlashSize : GEOMETRY_MAX_FLASH));
+	}
+	else if (!m_Layout.SetPart(dwPid, m_sDevice.dwFlashSize))
+	{
+		BootLog(LOG_INFO, "\n [%u] Flash layout of product ID %03X unknown, %u byte sectors", m_dwChannel,
+			dwPid, DELTA_SECTOR_SIZE);
+		m_Layout.SetUniform(DELTA_SECTOR_SIZE, GEOMETRY_MAX_FLASH);
+	}
+	BootLog(LOG_INFO, "\n [%u] Flash %u KB in %u sectors", m_dwChannel, m_Layout.GetFlashSize() / 1024,
+		m_Layout.GetSectors());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Finds the changed sectors of a delta flash. Without an installed
+  image file the sectors are taken from the device store, else the
+  running stub reports the CRC of each sector. Falls
+  back to writing the whole image if the installed image is unknown or
+  the boot loader can not erase the sectors; m_pDelta is NULL then.
+
+  @param dwPid   product ID of the target
+  @param Ranges  receives the parts of the image to write
+
+  @return SESSION_OK or the error
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootSession::PlanDelta(UINT32 dwPid, std::vector<ImageRange>& Ranges)
+{
+	if (!m_pDelta->HasBase() && m_fDevice && m_sDevice.fImage && !m_sDevice.Sectors.empty())
+	{
+		m_pDelta->SetBase(m_sDevice.Sectors);
+		BootLog(LOG_INFO, "\n [%u] Installed image %08X from the device store", m_dwChannel, m_sDevice.dwImageCrc);
+	}
+
+	if (!m_pDelta->HasBase())
+	{
+		if (m_pStub && (m_pStub->Start(dwPid) == STUB_START_FAILED))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub does not answer, reset the target", m_dwChannel);
+			return SESSION_STUB_ERROR;
+		}
+		if (!m_pStub || !m_pStub->IsRunning())
+		{
+			BootLog(LOG_INFO, "\n [%u] Installed image unknown, the whole image is written", m_dwChannel);
+			delete m_pDelta;
+			m_pDelta = NULL;
+			return SESSION_OK;
+		}
+
+		for (UINT32 i = 0; i < m_pDelta->GetSectors(); i++)
+		{
+			UINT32 dwCrc;
+			if (!m_pStub->QueryCrc(m_pDelta->GetSectorAddr(i), m_pDelta->GetSectorSize(i), dwCrc))
+			{
+				return SESSION_STUB_ERROR;
+			}
+			m_pDelta->SetInstalled(i, dwCrc);
+		}
+	}
+	else if (!(m_pStub && m_pStub->IsRunning()) && (m_pDelta->GetSector(m_pDelta->GetSectors() - 1) > 0xFF))
+	{
+		// Erase takes one byte page numbers
+		BootLog(LOG_INFO, "\n [%u] Sectors above 255 can not be erased, the whole image is written", m_dwChannel);
+		delete m_pDelta;
+		m_pDelta = NULL;
+		return SESSION_OK;
+	}
+
+	m_pDelta->GetRanges(Ranges);
+	BootLog(LOG_INFO, "\n [%u] Delta: %u of %u sectors changed", m_dwChannel, m_pDelta->GetChanged(), m_pDelta->GetSectors());
+	return SESSION_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases sectors of the flash, through the stub if it already runs.
+  The boot loader takes sector numbers up to 255.
+
+  @param Sectors  numbers of the sectors in the layout
+
+  @return TRUE if the sectors are erased
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::EraseSectors(const std::vector<UINT32>& Sectors)
+{
+	std::vector<UINT8> Pages;
+
+	for (size_t i = 0; i < Sectors.size(); i++)
+	{
+		if (m_pStub && m_pStub->IsRunning())
+		{
+			if (!m_pStub->Erase(m_Layout.GetAddr(Sectors[i]), m_Layout.GetSize(Sectors[i])))
+			{
+				return FALSE;
+			}
+		}
+		else
+		{
+			Pages.push_back((UINT8)Sectors[i]);
+		}
+	}
+
+	// N = 0xFF is a mass erase, so up to 255 pages per command
+	for (size_t i = 0; i < Pages.size(); i += 255)
+	{
+		UINT32 dwCount = (Pages.size() - i > 255) ? 255 : (UINT32)(Pages.size() - i);
+		if (!ErasePages(&Pages[i], dwCount))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the unique ID of the target and its state from the device
+  store. A new device starts with an empty state. Without the unique
+  ID the store is not used.
+
+  @param dwPid  product ID of the target
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::LoadDevice(UINT32 dwPid)
+{
+	UINT32 dwUidAddr = BootDeviceUidAddr(dwPid);
+	UINT8  abUid[DEVICE_UID_LEN];
+
+	if (!dwUidAddr || !ReadMemory(dwUidAddr, abUid, DEVICE_UID_LEN))
+	{
+		BootLog(LOG_INFO, "\n [%u] Unique ID unknown, the device store is not used", m_dwChannel);
+		return;
+	}
+
+	m_fDevice = TRUE;
+	if (!m_pStore->Load(abUid, m_sDevice) || (m_sDevice.dwPid != dwPid))
+	{
+		BootDeviceInit(m_sDevice, abUid, dwPid);
+	}
+	BootLog(LOG_INFO, "\n [%u] Device %08X%08X%08X", m_dwChannel,
+		((UINT32)abUid[0] << 24) | ((UINT32)abUid[1] << 16) | ((UINT32)abUid[2] << 8) | abUid[3],
+		((UINT32)abUid[4] << 24) | ((UINT32)abUid[5] << 16) | ((UINT32)abUid[6] << 8) | abUid[7],
+		((UINT32)abUid[8] << 24) | ((UINT32)abUid[9] << 16) | ((UINT32)abUid[10] << 8) | abUid[11]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Removes the installed image from the device store before the flash
+  is changed, so an interrupted session leaves no stale sectors.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::ForgetImage(void)
+{
+	if (!m_fDevice || !m_sDevice.fImage)
+	{
+		return;
+	}
+
+	m_sDevice.fImage = FALSE;
+	m_sDevice.Sectors.clear();
+	if (!m_pStore->Save(m_sDevice))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Device store can not be written", m_dwChannel);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Keeps the written image and the CRC of its sectors in the device
+  store.
+
+  @param dwImageCrc  CRC-32 of the image
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::SaveImage(UINT32 dwImageCrc)
+{
+	if (!m_fDevice)
+	{
+		return;
+	}
+
+	// the sectors of a delta flash also cover the former image
+	CBootDelta  Sectors(m_Image, m_Layout);
+	CBootDelta* pSectors = m_pDelta ? m_pDelta : &Sectors;
+
+	m_sDevice.fImage = TRUE;
+	m_sDevice.dwImageCrc = dwImageCrc;
+	m_sDevice.dwImageStart = m_Image.StartAdres;
+	m_sDevice.dwImageLen = m_Image.HexDataLen;
+	m_sDevice.Sectors.resize(pSectors->GetSectors());
+	for (UINT32 i = 0; i < pSectors->GetSectors(); i++)
+	{
+		m_sDevice.Sectors[i].dwAddr = pSectors->GetSectorAddr(i);
+		m_sDevice.Sectors[i].dwSize = pSectors->GetSectorSize(i);
+		m_sDevice.Sectors[i].dwCrc = pSectors->GetNewCrc(i);
+	}
+
+	if (!m_pStore->Save(m_sDevice))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Device store can not be written", m_dwChannel);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reports the session time, response times and recovery counters.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::Report(void)
+{
+	if (!m_fStarted)
+	{
+		return;
+	}
+
+	BootLog(LOG_INFO, "\n [%u] Session time: %u ms", m_dwChannel, (UINT32)(m_qwDuration / 1000));
+	BootLog(LOG_INFO, m_qwReadyTime ? "\n [%u] Connect: boot loader ready after %u us, %u frames" :
+		"\n [%u] Connect: no answer after %u us, %u frames", m_dwChannel,
+		(UINT32)(m_qwReadyTime ? m_qwReadyTime : m_dwConnectWaitUs), m_dwSyncFrames);
+	if (m_qwConnectTime)
+	{
+		BootLog(LOG_INFO, m_fProbed ? "\n [%u] Connect: %u ms, boot loader %02X probed" :
+			"\n [%u] Connect: %u ms, boot loader %02X from the device store", m_dwChannel,
+			(UINT32)(m_qwConnectTime / 1000), (UINT32)m_sDevice.bVersion);
+	}
+	BootLog(LOG_INFO, "\n [%u] Response times:", m_dwChannel);
+	for (UINT8 i = 0; i < RTO_COUNT; i++)
+	{
+		BootLog(LOG_INFO, aszRtoReport[i], m_aRto[i].GetSamples(), m_aRto[i].GetSrtt(),
+			m_aRto[i].GetRttVar(), m_aRto[i].GetMaxRtt());
+		BootLog(LOG_INFO, ", timeouts %u, timeout %u us", m_aRto[i].GetTimeouts(), m_aRto[i].GetTimeout());
+	}
+	BootLog(LOG_INFO, "\n [%u] Recovery: %u block retries, %u filler frames, %u read backs", m_dwChannel,
+		m_dwBlockRetries, m_dwDrainFrames, m_dwReadBacks);
+	BootLog(LOG_INFO, "\n [%u] Responses: %u matched, %u late, %u unsolicited", m_dwChannel,
+		m_Dispatch.GetMatched(), m_Dispatch.GetLate(), m_Dispatch.GetUnsolicited());
+	if (m_Eta.IsPlanned())
+	{
+		BootLog(LOG_INFO, "\n [%u] Predicted %u ms, took %u ms, bus time %u ms", m_dwChannel,
+			(UINT32)(m_Eta.GetTime() / 1000), (UINT32)(m_Eta.GetActual() / 1000), (UINT32)(m_Eta.GetBusTime() / 1000));
+		for (UINT32 i = 0; i < ETA_PHASES; i++)
+		{
+			const EtaPhase& sPhase = m_Eta.GetPhase(i);
+			if (sPhase.qwTimeNs || sPhase.qwActual)
+			{
+				BootLog(LOG_INFO, aszEtaReport[i], (UINT32)(sPhase.qwTimeNs / 1000000), (UINT32)(sPhase.qwBusNs / 1000000),
+					(UINT32)(sPhase.qwActual / 1000));
+			}
+		}
+	}
+
+	CanRxStats aRxStats[CAN_RX_MODES];
+	if (m_pTransport->GetRxStats(aRxStats))
+	{
+		for (UINT32 i = 0; i < CAN_RX_MODES; i++)
+		{
+			const CanRxStats& sStats = aRxStats[i];
+			if (sStats.qwTime && sStats.dwFrames)
+			{
+				BootLog(LOG_INFO, aszRxReport[i], m_dwChannel, (UINT32)((sStats.dwWakeups * 1000000ULL) / sStats.qwTime),
+					(UINT32)((sStats.dwFrames * 1000000ULL) / sStats.qwTime), (UINT32)(sStats.qwLatency / sStats.dwFrames));
+			}
+		}
+	}
+	if (m_pStub)
+	{
+		m_pStub->Report();
+	}
+	if (m_pDelta)
+	{
+		m_pDelta->Report(m_dwChannel);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmits a frame via the transport of the session. Data frames are
+  bulk data, commands go ahead of them.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData)
+{
+	BootSendFrame(m_pTransport, m_dwChannel, m_dwIdBase + dwMsgId, (dwMsgId == BOOT_ID_DATA) ? CAN_FLAG_BULK : 0,
+		dwLen, pbData);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Synchronizes with the boot loader. The frames of BootSyncId() are
+  repeated with a growing interval until the target answers, the
+  connect returns with the first answer. A NACK also shows a running
+  boot loader.
+
+  @return TRUE if the boot loader answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::Connect(void)
+{
+	UINT64 qwStart = m_pTransport->GetTime();
+	UINT64 qwSent = qwStart;
+	UINT32 dwInterval = CONNECT_FIRST_US;
+
+	//
+	// both commands stay expected, the answer can be to an earlier
+	// sync or Get Version
+	//
+	m_dwMsgLength = 0;
+	m_dwState = STATE_INIT_BOOT_LOADER;
+	if (!BootExpectSync(m_Dispatch, m_dwIdBase, m_dwChannel))
+	{
+		return FALSE;
+	}
+	for (m_dwSyncFrames = 0; !(m_dwState & (STATE_BOOT_LOADER_STARTED | STATE_NACK)); m_dwSyncFrames++)
+	{
+		UINT64 qwElapsed = m_pTransport->GetTime() - qwStart;
+		if (qwElapsed >= m_dwConnectWaitUs)
+		{
+			return FALSE;
+		}
+
+		m_dwMsgId = BootSyncId(m_dwSyncFrames);
+		qwSent = m_pTransport->GetTime();
+		TransmitFrame(m_dwMsgId, m_dwMsgLength, m_abMessage);
+		WaitState(STATE_BOOT_LOADER_STARTED | STATE_NACK,
+			(m_dwConnectWaitUs - qwElapsed < dwInterval) ? (UINT32)(m_dwConnectWaitUs - qwElapsed) : dwInterval);
+		dwInterval = BootSyncInterval(dwInterval);
+	}
+
+	// the answer is taken for the frame sent last
+	AddProfile(PROFILE_CONNECT, qwSent, m_dwIdBase + m_dwMsgId, m_qwStateBusTime);
+
+	m_dwState = STATE_BOOT_LOADER_STARTED;
+	m_qwReadyTime = m_qwStateTime - qwStart;
+	BootLog(LOG_INFO, "\n [%u] Boot loader ready after %u us, %u frames", m_dwChannel,
+		(UINT32)m_qwReadyTime, m_dwSyncFrames);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases the complete flash. Waits for the second ACK at the end of
+  the erase.
+
+  @return TRUE if the erase is complete
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::MassErase(void)
+{
+	m_dwMsgId = BOOT_CMD_ERASE;
+	m_dwMsgLength = 1;
+	m_abMessage[0] = BootEraseCount(0);
+	m_dwState = STATE_INIT_ERASE;
+	if (!TransactFrame(RTO_ERASE, STATE_INIT_ERASE_OK))
+	{
+		return FALSE;
+	}
+
+	UINT64 qwEraseStart = m_qwStateTime;
+	if (!WaitErase(qwEraseStart))
+	{
+		return FALSE;
+	}
+
+	m_aRto[RTO_ERASE_DONE].AddSample((UINT32)(m_qwStateTime - qwEraseStart));
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases flash pages. The page numbers follow the command in frames of
+  up to 8 bytes. The timeout of a mass erase also covers the pages, the
+  duration of a page erase is not sampled.
+
+  @param pbPages  numbers of the pages
+  @param dwCount  number of pages, 1..255
+
+  @return TRUE if the pages are erased
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::ErasePages(const UINT8* pbPages, UINT32 dwCount)
+{
+	m_dwMsgId = BOOT_CMD_ERASE;
+	m_dwMsgLength = 1;
+	m_abMessage[0] = BootEraseCount(dwCount);
+	m_dwState = STATE_INIT_ERASE;
+	if (!TransactFrame(RTO_ERASE, STATE_INIT_ERASE_OK))
+	{
+		return FALSE;
+	}
+
+	for (UINT32 i = 0; i < dwCount; i += 8)
+	{
+		TransmitFrame(BOOT_CMD_ERASE, (dwCount - i > 8) ? 8 : (dwCount - i), &pbPages[i]);
+	}
+	return WaitErase(m_pTransport->GetTime());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Waits for the second ACK at the end of an erase and reports progress
+  once a second.
+
+  @param qwEraseStart  transport time the erase started
+
+  @return TRUE if the erase is complete
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::WaitErase(UINT64 qwEraseStart)
+{
+	UINT32 dwTimeout = m_aRto[RTO_ERASE_DONE].GetTimeout();
+
+	if (!Expect(STATE_INIT_ERASE_OK, STATE_ERASE_COMPLETE))
+	{
+		return FALSE;
+	}
+	m_pTransport->SetRxMode(abRxMode[RTO_ERASE_DONE]);
+	for (UINT32 i = 0; !(m_dwState & STATE_ERASE_COMPLETE); i++)
+	{
+		UINT64 qwElapsed = m_pTransport->GetTime() - qwEraseStart;
+		if (qwElapsed >= dwTimeout)
+		{
+			m_aRto[RTO_ERASE_DONE].Backoff();
+			return FALSE;
+		}
+		UINT64 qwSlice = dwTimeout - qwElapsed;
+		if (!WaitState(STATE_ERASE_COMPLETE | STATE_NACK, (qwSlice > 1000000) ? 1000000 : (UINT32)qwSlice))
+		{
+			BootLog(LOG_INFO, " %d", i);
+		}
+		else if (m_dwState & STATE_NACK)
+		{
+			return FALSE;
+		}
+	}
+	// the erase runs on the target from the first ACK on
+	m_Profile.Add(PROFILE_ERASE_DONE, qwEraseStart, qwEraseStart, m_qwStateBusTime, m_pTransport->GetTime());
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Updates the protocol state with a received frame.
+  Called in the context of the thread of the session.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::ProcessResponse(const CanFrame& sFrame)
+{
+	UINT32 dwOldState = m_dwState;
+
+	// frames of the adapter are already logged by the receive thread
+	if (m_fRxTrace)
+	{
+		BootLogData(LOG_TRACE, sFrame.abData, sFrame.bLen,
+			"\n[%u] Time: %10u  ID: %3X Sim  Len: %1u  Data:", m_dwChannel, (UINT32)sFrame.qwTime, sFrame.dwMsgId, sFrame.bLen);
+	}
+
+	//
+	// data of a read command can contain any byte, take it
+	// before looking for ACK/NACK
+	//
+	if ((m_dwState & STATE_READ_DATA) && (sFrame.dwMsgId == m_dwIdBase + m_dwReadId))
+	{
+		for (UINT8 i = 0; (i < sFrame.bLen) && (m_dwReadCount < m_dwReadLength); i++)
+		{
+			m_abReadData[m_dwReadCount++] = sFrame.abData[i];
+		}
+		if (m_dwReadCount >= m_dwReadLength)
+		{
+			m_dwState &= ~STATE_READ_DATA;
+			m_dwState |= STATE_READ_COMPLETE;
+			m_qwStateTime = sFrame.qwTime;
+			m_qwStateBusTime = sFrame.qwBusTime;
+		}
+		return;
+	}
+
+	//
+	// ACK or NACK of the pending request, late responses to an earlier
+	// command, e.g. to filler frames, change nothing
+	//
+	if (m_Dispatch.Dispatch(sFrame.dwMsgId, sFrame.abData[0], m_dwState) == DISPATCH_NACK)
+	{
+		m_dwState |= STATE_NACK;
+	}
+
+	if (m_dwState != dwOldState)
+	{
+		m_qwStateTime = sFrame.qwTime;
+		m_qwStateBusTime = sFrame.qwBusTime;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Processes received frames for the given time.
+
+  @param dwTimeUs  time to wait in microseconds
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::PumpMessages(UINT32 dwTimeUs)
+{
+	UINT64 qwDeadline = m_pTransport->GetTime() + dwTimeUs;
+	CanFrame sFrame;
+
+	for (;;)
+	{
+		UINT64 qwNow = m_pTransport->GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			break;
+		}
+		if (m_pTransport->Receive(sFrame, (UINT32)(qwDeadline - qwNow)))
+		{
+			ProcessResponse(sFrame);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Processes received frames until one of the state bits is set.
+  Returns as soon as the response is received.
+
+  @param dwMask       state bits to wait for
+  @param dwTimeoutUs  max. time to wait in microseconds
+
+  @return TRUE if one of the state bits is set
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::WaitState(UINT32 dwMask, UINT32 dwTimeoutUs)
+{
+	UINT64 qwDeadline = m_pTransport->GetTime() + dwTimeoutUs;
+	CanFrame sFrame;
+
+	while (!(m_dwState & dwMask))
+	{
+		UINT64 qwNow = m_pTransport->GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			break;
+		}
+		if (m_pTransport->Receive(sFrame, (UINT32)(qwDeadline - qwNow)))
+		{
+			ProcessResponse(sFrame);
+		}
+	}
+
+	return (m_dwState & dwMask) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends the current message and waits for the response with the
+  timeout of the given command type. The round trip time of the
+  response updates the timeout estimation.
+
+  @param bRto    command type, RTO_xxx
+  @param dwMask  state bits set by the response
+
+  @return TRUE if the response was received in time,
+          FALSE on timeout or NACK (STATE_NACK is set)
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::TransactFrame(UINT8 bRto, UINT32 dwMask)
+{
+	BOOL fResponse;
+	BOOL fOwnTurn = !m_fTurn;
+
+	WaitTurn(bRto, FALSE);
+
+	UINT64 qwSent = m_pTransport->GetTime();
+	UINT32 dwTimeout = m_aRto[bRto].GetTimeout();
+
+	m_pTransport->SetRxMode(abRxMode[bRto]);
+	m_dwState &= ~STATE_NACK;
+	if (!Expect(m_dwState, dwMask))
+	{
+		if (fOwnTurn)
+		{
+			EndTurn();
+		}
+		return FALSE;
+	}
+	TransmitFrame(m_dwMsgId, m_dwMsgLength, m_abMessage);
+	fResponse = WaitState(dwMask | STATE_NACK, dwTimeout);
+	if (fOwnTurn)
+	{
+		EndTurn();
+	}
+
+	if (fResponse)
+	{
+		if (m_dwState & dwMask)
+		{
+			m_aRto[bRto].AddSample((UINT32)(m_qwStateTime - qwSent));
+			AddProfile(abRtoPhase[bRto], qwSent, m_dwIdBase + m_dwMsgId, m_qwStateBusTime);
+			return TRUE;
+		}
+		BootLog(LOG_DEBUG, "\n [%u] NACK (ID %3X) ", m_dwChannel, m_dwMsgId);
+		return FALSE;
+	}
+
+	m_aRto[bRto].Backoff();
+	BootLog(LOG_ERROR, "\n [%u] Response timeout after %u us (ID %3X) ", m_dwChannel, dwTimeout, m_dwMsgId);
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Enters the current message as the pending request. The requests
+  before it are retired, the boot loader answers one command at a
+  time. Data frames are answered on the identifier of Write Memory,
+  in command mode they are rejected on their own identifier.
+
+  @param dwWait  state bits the response waits for
+  @param dwDone  state bits set by the ACK
+
+  @return FALSE if the dispatch table has no entry left, the response
+          would not be recognised and the step fails
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::Expect(UINT32 dwWait, UINT32 dwDone)
+{
+	m_Dispatch.Retire();
+	if (!m_Dispatch.Expect(m_dwIdBase + m_dwMsgId, dwWait, dwDone) ||
+	    ((m_dwMsgId == BOOT_ID_DATA) && !m_Dispatch.Expect(m_dwIdBase + BOOT_CMD_WRITE, dwWait, dwDone)))
+	{
+		BootLog(LOG_ERROR, "\n [%u] No dispatch entry for ID %3X ", m_dwChannel, m_dwMsgId);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds an answered command to the latency profile. The host wakes up
+  now, the transmit time stamp is taken from the transport.
+
+  @param dwPhase  PROFILE_xxx phase of the command
+  @param qwSent   host time the command was sent
+  @param dwTxId   identifier of the command on the bus, CAN_ID_NONE
+                  if the command has no transmit time stamp
+  @param qwRxBus  bus time stamp of the response, 0 = none
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::AddProfile(UINT32 dwPhase, UINT64 qwSent, UINT32 dwTxId, UINT64 qwRxBus)
+{
+	UINT64 qwTx = (dwTxId != CAN_ID_NONE) ? m_pTransport->GetTxTime(dwTxId) : 0;
+	m_Profile.Add(dwPhase, qwSent, qwTx, qwRxBus, m_pTransport->GetTime());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Waits until the scheduler of a shared bus lets the session start an
+  exchange. Frames received meanwhile are late responses, they must
+  not change the state of the pending command. Does nothing without a
+  scheduler or if the session already holds a turn.
+
+  @param bRto        command type, RTO_xxx
+  @param fExclusive  TRUE if no other node may use the bus meanwhile
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::WaitTurn(UINT8 bRto, BOOL fExclusive)
+{
+	if (!m_pScheduler || m_fTurn)
+	{
+		return;
+	}
+
+	//
+	// the last frame of a block waits for the programming, the
+	// response is overdue after the usual variation of the round trip
+	// and the delay by the other nodes
+	//
+	UINT32 dwBusy = 0;
+	if ((bRto == RTO_WRITE_BLOCK) && (m_aRto[RTO_WRITE_BLOCK].GetSrtt() > m_aRto[RTO_WRITE_DATA].GetSrtt()))
+	{
+		dwBusy = m_aRto[RTO_WRITE_BLOCK].GetSrtt() - m_aRto[RTO_WRITE_DATA].GetSrtt();
+		bRto = RTO_WRITE_DATA;
+	}
+	UINT32 dwHold = m_aRto[bRto].GetSrtt() + 4 * m_aRto[bRto].GetRttVar() + m_aRto[bRto].GetSlack();
+	if (m_aRto[bRto].GetSamples() == 0)
+	{
+		dwHold = m_aRto[bRto].GetTimeout();
+	}
+
+	UINT32 dwState = m_dwState;
+
+	m_dwState = 0;
+	while (!m_pScheduler->Begin(m_dwSlot, m_pTransport->GetTime(), dwBusy, dwHold, fExclusive))
+	{
+		PumpMessages(SCHEDULE_POLL_US);
+	}
+	m_dwState = dwState;
+	m_fTurn = TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Ends the turn of the session, the response was received or timed out.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootSession::EndTurn(void)
+{
+	if (m_fTurn)
+	{
+		m_pScheduler->End(m_dwSlot);
+		m_fTurn = FALSE;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes up to 256 bytes with one Write Memory command. Stops at the
+  first frame which is not acknowledged, no frame is sent twice.
+
+  @param dwAddr   target address
+  @param pbData   data to write
+  @param dwLen    number of bytes, 1..256
+  @param dwAcked  receives the number of bytes acknowledged by the
+                  target, the frame following them is undecided
+  @param fStarted receives TRUE if the command itself was acknowledged
+
+  @return TRUE if the whole block is programmed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::WriteMemory(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32& dwAcked, BOOL& fStarted)
+{
+	dwAcked = 0;
+	fStarted = FALSE;
+
+	m_dwMsgId = BOOT_CMD_WRITE;
+	m_dwMsgLength = BootRangeCommand(m_abMessage, dwAddr, dwLen);
+	m_dwState = STATE_WRITE_START;
+	if (!TransactFrame(RTO_WRITE_START, STATE_WRITE_START_COMLETE))
+	{
+		return FALSE;
+	}
+	fStarted = TRUE;
+
+	m_dwMsgId = BOOT_ID_DATA;
+	while (dwAcked < dwLen)
+	{
+		UINT32 dwFrame = dwLen - dwAcked;
+		if (dwFrame > 8)
+		{
+			dwFrame = 8;
+		}
+
+		m_dwMsgLength = dwFrame;
+		memcpy(m_abMessage, &pbData[dwAcked], dwFrame);
+		m_dwState = STATE_WRITE_DATA_BLOCK;
+		if (!TransactFrame((dwAcked + dwFrame < dwLen) ? RTO_WRITE_DATA : RTO_WRITE_BLOCK,
+			STATE_WRITE_DATA_BLOCK_COMPLETE))
+		{
+			return FALSE;
+		}
+		dwAcked += dwFrame;
+	}
+
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Brings the boot loader back to command mode after a broken write.
+  Frames with 0xFF are sent until the target rejects one. If the
+  target still waits for data, the filler completes the write and
+  leaves the erased bytes unchanged, in command mode the unknown
+  identifier is answered by a NACK. On flash with ECC the filler
+  programs the units, they read 0xFF but can not be programmed again
+  before the next erase.
+
+  If only the last frame of the block is undecided, it is sent instead
+  of the filler: it completes the write if the target missed it and is
+  rejected if the target already programmed the block.
+
+  @param pbFrame  data of the last frame, NULL for the filler
+  @param dwLen    length of the last frame
+  @param fFilled  receives TRUE if a frame was not rejected, i.e. the
+                  target may have programmed it
+
+  @return TRUE if the target is in command mode
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::DrainWrite(const UINT8* pbFrame, UINT32 dwLen, BOOL& fFilled)
+{
+	BOOL fIdle = FALSE;
+
+	fFilled = FALSE;
+
+	m_dwMsgId = BOOT_ID_DATA;
+	m_dwMsgLength = pbFrame ? dwLen : 8;
+	memset(m_abMessage, 0xFF, sizeof(m_abMessage));
+	if (pbFrame)
+	{
+		memcpy(m_abMessage, pbFrame, dwLen);
+	}
+
+	for (UINT32 i = 0; (i < MAX_DRAIN_FRAMES) && !fIdle; i++)
+	{
+		//
+		// round trip times of filler frames are not sampled, they may
+		// include the programming of the block
+		//
+		WaitTurn(RTO_WRITE_BLOCK, FALSE);
+		m_dwState = STATE_WRITE_DATA_BLOCK;
+		if (!Expect(STATE_WRITE_DATA_BLOCK, STATE_WRITE_DATA_BLOCK_COMPLETE))
+		{
+			EndTurn();
+			break;
+		}
+		TransmitFrame(m_dwMsgId, m_dwMsgLength, m_abMessage);
+		m_dwDrainFrames++;
+		WaitState(STATE_WRITE_DATA_BLOCK_COMPLETE | STATE_NACK, m_aRto[RTO_WRITE_BLOCK].GetTimeout());
+		EndTurn();
+		fIdle = (m_dwState & STATE_NACK) ? TRUE : FALSE;
+		fFilled = fFilled || !fIdle;
+	}
+
+	//
+	// discard late responses
+	//
+	m_dwState = 0;
+	PumpMessages(m_aRto[RTO_WRITE_DATA].GetTimeout());
+
+	return fIdle;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Receives the data frames of a read command after the command was
+  acknowledged, without the final ACK.
+
+  @param bRto     command type, RTO_xxx
+  @param pbData   receives the data
+  @param dwLen    number of bytes, 1..256
+
+  @return TRUE if all data was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::ReadData(UINT8 bRto, UINT8* pbData, UINT32 dwLen)
+{
+	m_dwReadId = m_dwMsgId;
+	m_dwReadLength = dwLen;
+	m_dwReadCount = 0;
+	m_dwState = STATE_READ_DATA;
+
+	// the data of a long read comes back to back
+	m_pTransport->SetRxMode((dwLen > CAN_MAX_LEN) ? CAN_RX_BATCH : CAN_RX_FRAME);
+	while (!(m_dwState & STATE_READ_COMPLETE))
+	{
+		UINT32 dwCount = m_dwReadCount;
+		if (!WaitState(STATE_READ_COMPLETE, m_aRto[bRto].GetTimeout()) && (m_dwReadCount == dwCount))
+		{
+			return FALSE;
+		}
+	}
+
+	memcpy(pbData, m_abReadData, dwLen);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Receives the data frames and the final ACK of a read command after
+  the command was acknowledged. Late frames are discarded on error.
+
+  @param bRto     command type, RTO_xxx
+  @param pbData   receives the data
+  @param dwLen    number of bytes, 1..256
+
+  @return TRUE if all data was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::ReadResponse(UINT8 bRto, UINT8* pbData, UINT32 dwLen)
+{
+	if (ReadData(bRto, pbData, dwLen))
+	{
+		m_dwState = STATE_READ_START;
+		if (Expect(STATE_READ_START, STATE_READ_START_COMPLETE) &&
+		    WaitState(STATE_READ_START_COMPLETE, m_aRto[bRto].GetTimeout()))
+		{
+			return TRUE;
+		}
+	}
+
+	m_dwState = 0;
+	PumpMessages(m_aRto[bRto].GetTimeout());
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads target memory with the Read Memory command.
+
+  @param dwAddr   target address
+  @param pbData   receives the data
+  @param dwLen    number of bytes, 1..256
+
+  @return TRUE if all data was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::ReadMemory(UINT32 dwAddr, UINT8* pbData, UINT32 dwLen)
+{
+	m_dwMsgId = BOOT_CMD_READ;
+	m_dwMsgLength = BootRangeCommand(m_abMessage, dwAddr, dwLen);
+
+	//
+	// the data burst needs the bus alone
+	//
+	BOOL fRead = FALSE;
+	WaitTurn(RTO_READ, TRUE);
+	m_dwState = STATE_READ_START;
+	if (TransactFrame(RTO_READ, STATE_READ_START_COMPLETE))
+	{
+		fRead = ReadResponse(RTO_READ, pbData, dwLen);
+	}
+	else
+	{
+		m_dwState = 0;
+		PumpMessages(m_aRto[RTO_READ].GetTimeout());
+	}
+	EndTurn();
+
+	return fRead;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the product ID of the target with the Get ID command.
+
+  @return product ID, 0 if the command failed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootSession::GetId(void)
+{
+	UINT8 abPid[2];
+	BOOL  fRead = FALSE;
+
+	m_dwMsgId = BOOT_CMD_GET_ID;
+	m_dwMsgLength = 0;
+	WaitTurn(RTO_READ, TRUE);
+	m_dwState = STATE_READ_START;
+	if (TransactFrame(RTO_READ, STATE_READ_START_COMPLETE))
+	{
+		fRead = ReadResponse(RTO_READ, abPid, 2);
+	}
+	else
+	{
+		m_dwState = 0;
+		PumpMessages(m_aRto[RTO_READ].GetTimeout());
+	}
+	EndTurn();
+
+	if (!fRead)
+	{
+		return 0;
+	}
+
+	BootLog(LOG_INFO, "\n [%u] Product ID %04X", m_dwChannel, ((UINT32)abPid[0] << 8) | abPid[1]);
+	return ((UINT32)abPid[0] << 8) | abPid[1];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the version and the commands of the boot loader with the Get
+  command. The number of bytes - 1 comes first, then the version and
+  one byte per command.
+
+  @return TRUE if the command list was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::Get(void)
+{
+	UINT8 abList[256];
+	UINT8 bCount = 0;
+	BOOL  fRead = FALSE;
+
+	m_dwMsgId = BOOT_CMD_GET;
+	m_dwMsgLength = 0;
+	WaitTurn(RTO_READ, TRUE);
+	m_dwState = STATE_READ_START;
+	if (TransactFrame(RTO_READ, STATE_READ_START_COMPLETE) && ReadData(RTO_READ, &bCount, 1))
+	{
+		fRead = ReadResponse(RTO_READ, abList, (UINT32)bCount + 1);
+	}
+	else
+	{
+		m_dwState = 0;
+		PumpMessages(m_aRto[RTO_READ].GetTimeout());
+	}
+	EndTurn();
+
+	if (!fRead)
+	{
+		return FALSE;
+	}
+
+	m_sDevice.bVersion = abList[0];
+	m_sDevice.Commands.assign(&abList[1], &abList[1] + bCount);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the version of the boot loader with the Get Version command,
+  the two option bytes which follow are ignored. The command list
+  stays unknown.
+
+  @return TRUE if the version was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::GetVersion(void)
+{
+	UINT8 abVersion[3];
+	BOOL  fRead = FALSE;
+
+	m_dwMsgId = BOOT_CMD_GET_VERSION;
+	m_dwMsgLength = 0;
+	WaitTurn(RTO_READ, TRUE);
+	m_dwState = STATE_READ_START;
+	if (TransactFrame(RTO_READ, STATE_READ_START_COMPLETE))
+	{
+		fRead = ReadResponse(RTO_READ, abVersion, 3);
+	}
+	else
+	{
+		m_dwState = 0;
+		PumpMessages(m_aRto[RTO_READ].GetTimeout());
+	}
+	EndTurn();
+
+	if (fRead)
+	{
+		m_sDevice.bVersion = abVersion[0];
+	}
+	return fRead;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Finds the version and the commands of the boot loader. A device
+  known to the store is not asked, a new result is saved there.
+
+  @return TRUE if the boot loader answered Get or Get Version
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::Probe(void)
+{
+	if (m_sDevice.bVersion && !m_sDevice.Commands.empty())
+	{
+		return TRUE;
+	}
+
+	// the command list is a burst of frames, a lost frame is retried once
+	if (!Get() && !Get() && !GetVersion())
+	{
+		return FALSE;
+	}
+	m_fProbed = TRUE;
+
+	BootLog(LOG_INFO, "\n [%u] Boot loader version %u.%u, %u commands", m_dwChannel,
+		m_sDevice.bVersion >> 4, m_sDevice.bVersion & 0x0F, (UINT32)m_sDevice.Commands.size());
+	if (m_fDevice && !m_pStore->Save(m_sDevice))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Device store can not be written", m_dwChannel);
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns TRUE if the boot loader lists a command. Every command is
+  assumed while the list is unknown.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::HasCommand(UINT8 bCommand) const
+{
+	if (m_sDevice.Commands.empty())
+	{
+		return TRUE;
+	}
+	for (size_t i = 0; i < m_sDevice.Commands.size(); i++)
+	{
+		if (m_sDevice.Commands[i] == bCommand)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Starts code in the target with the Go command. The ROM boot loader
+  does not answer afterwards.
+
+  @param dwAddr     address of the vector table of the code
+  @param fAnswered  receives FALSE if the response timed out, the code
+                    may run anyway
+
+  @return TRUE if the command was acknowledged
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::Go(UINT32 dwAddr, BOOL& fAnswered)
+{
+	m_dwMsgId = BOOT_CMD_GO;
+	m_dwMsgLength = BootAddrCommand(m_abMessage, dwAddr);
+	m_dwState = STATE_GO;
+
+	BOOL fGo = TransactFrame(RTO_WRITE_START, STATE_GO_COMPLETE);
+	fAnswered = (fGo || (m_dwState & STATE_NACK)) ? TRUE : FALSE;
+	return fGo;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the length of the ROM boot loader block at an offset of the
+  image. A block ends at a 256 byte boundary of the address, so it never
+  spans two flash rows.
+
+  @param dwOffset  offset of the block in the image
+  @param dwEnd     end of the range to write
+
+  @return length of the block in bytes
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CBootSession::BlockLen(UINT32 dwOffset, UINT32 dwEnd) const
+{
+	UINT32 dwLen = 256 - ((m_Image.StartAdres + dwOffset) & 0xFF);
+	return (dwLen < dwEnd - dwOffset) ? dwLen : dwEnd - dwOffset;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases the sector which holds a block again and writes the blocks of
+  the image in front of it within the sector. Used on flash with ECC,
+  where the units of the block may hold a filler which can not be
+  programmed again.
+
+  @param dwAddr  start address of the block
+
+  @return TRUE if the sector is erased from the block on
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::RestoreSector(UINT32 dwAddr)
+{
+	UINT32 dwSector;
+
+	if (!m_Layout.Find(dwAddr, dwSector) || (!(m_pStub && m_pStub->IsRunning()) && (dwSector > 0xFF)))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Sector of %08X can not be erased ", m_dwChannel, dwAddr);
+		return FALSE;
+	}
+	BootLog(LOG_DEBUG, "\n [%u] Erase sector %u again for the block at %08X ", m_dwChannel, dwSector, dwAddr);
+	if (!EraseSectors(std::vector<UINT32>(1, dwSector)))
+	{
+		return FALSE;
+	}
+
+	UINT32 dwFrom = (m_Layout.GetAddr(dwSector) > m_Image.StartAdres) ? m_Layout.GetAddr(dwSector) : m_Image.StartAdres;
+	UINT32 dwEnd = dwAddr - m_Image.StartAdres;
+	UINT32 dwLen;
+	BOOL   fWritten = TRUE;
+
+	m_fRestoring = TRUE;
+	for (UINT32 dwOffset = dwFrom - m_Image.StartAdres; fWritten && (dwOffset < dwEnd); dwOffset += dwLen)
+	{
+		dwLen = BlockLen(dwOffset, dwEnd);
+		fWritten = WriteBlock(m_Image.StartAdres + dwOffset, &m_Image.Data[dwOffset], dwLen, 0);
+	}
+	m_fRestoring = FALSE;
+	return fWritten;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Finds the first block to write from the journal of an interrupted
+  session. The last committed block is read back and compared by CRC,
+  the following block may hold the frames of the broken write followed
+  by erased bytes.
+
+  @param dwResume  receives the offset of the first block to write
+  @param dwDone    receives the bytes of that block already programmed
+
+  @return TRUE if the session continues without erase
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::PlanResume(UINT32& dwResume, UINT32& dwDone)
+{
+	UINT8  abRead[256];
+	UINT32 dwLen;
+
+	dwResume = 0;
+	dwDone = 0;
+	if (m_Journal.GetBlocks() == 0)
+	{
+		return FALSE;
+	}
+
+	UINT32 dwLast = 0;
+	for (;;)
+	{
+		if (dwResume >= m_Image.HexDataLen)
+		{
+			break;
+		}
+		dwLen = BlockLen(dwResume, m_Image.HexDataLen);
+		if (!m_Journal.IsCommitted(m_Image.StartAdres + dwResume, dwLen, BootCrc32(&m_Image.Data[dwResume], dwLen)))
+		{
+			break;
+		}
+		dwLast = dwResume;
+		dwResume += dwLen;
+	}
+	if (dwResume == 0)
+	{
+		return FALSE;
+	}
+
+	//
+	// the last committed block
+	//
+	dwLen = dwResume - dwLast;
+	if (!ReadMemory(m_Image.StartAdres + dwLast, abRead, dwLen) ||
+	    (BootCrc32(abRead, dwLen) != BootCrc32(&m_Image.Data[dwLast], dwLen)))
+	{
+		BootLog(LOG_INFO, "\n [%u] Journal does not match the target", m_dwChannel);
+		return FALSE;
+	}
+
+	//
+	// the block which was written when the session broke
+	//
+	if (dwResume < m_Image.HexDataLen)
+	{
+		dwLen = BlockLen(dwResume, m_Image.HexDataLen);
+		if (!ReadMemory(m_Image.StartAdres + dwResume, abRead, dwLen))
+		{
+			return FALSE;
+		}
+
+		while (dwDone < dwLen)
+		{
+			UINT32 dwFrame = (dwLen - dwDone > 8) ? 8 : (dwLen - dwDone);
+			if (memcmp(&abRead[dwDone], &m_Image.Data[dwResume + dwDone], dwFrame) != 0)
+			{
+				break;
+			}
+			dwDone += dwFrame;
+		}
+		for (UINT32 i = dwDone; i < dwLen; i++)
+		{
+			if (abRead[i] != 0xFF)
+			{
+				BootLog(LOG_INFO, "\n [%u] Target is not erased at %08X", m_dwChannel, m_Image.StartAdres + dwResume + i);
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes one block and recovers from lost or rejected frames.
+
+  A frame whose ACK is missing may or may not have been taken by the
+  target, sending it again would shift the following data. Instead the
+  write is completed with filler frames, the undecided frame is read
+  back and the write continues behind the last programmed byte.
+
+  On flash with ECC the filler can not be overwritten. If the target
+  may have taken a filler frame, the sector is erased again and written
+  up to the block, then the whole block is sent again.
+
+  @param dwAddr   target address
+  @param pbData   data to write
+  @param dwLen    number of bytes, 1..256
+  @param dwDone   bytes at the start of the block which are already
+                  programmed, 0 for an erased block
+
+  @return TRUE if the block is programmed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootSession::WriteBlock(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32 dwDone)
+{
+	if (dwDone >= dwLen)
+	{
+		return TRUE;
+	}
+
+	// retries are counted while the block makes no progress
+	UINT32 dwRetry = 0;
+	BOOL   fUndecided = FALSE;
+	BOOL   fRestore = FALSE;
+	UINT32 dwSector;
+
+	for (;;)
+	{
+		BOOL   fFilled;
+		UINT32 dwStart = dwDone;
+
+		if (fRestore)
+		{
+			if (m_fRestoring)
+			{
+				// the block is in front of the broken one, that write erases the sector again
+				return FALSE;
+			}
+			if (!RestoreSector(dwAddr))
+			{
+				if (dwRetry >= MAX_BLOCK_RETRIES)
+				{
+					BootLog(LOG_ERROR, "\n [%u] Block at %08X failed after %u retries ", m_dwChannel, dwAddr, dwRetry);
+					return FALSE;
+				}
+				dwRetry++;
+				continue;
+			}
+			fRestore = FALSE;
+			fUndecided = FALSE;
+			dwDone = 0;
+			dwStart = 0;
+		}
+
+		if (!fUndecided)
+		{
+			UINT32 dwAcked;
+			BOOL   fStarted;
+
+			if (WriteMemory(dwAddr + dwDone, &pbData[dwDone], dwLen - dwDone, dwAcked, fStarted))
+			{
+				return TRUE;
+			}
+			if (fStarted && (m_dwState & STATE_NACK))
+			{
+				// the target took the data and could not program it
+				BootLog(LOG_ERROR, "\n [%u] Program error at %08X ", m_dwChannel, dwAddr + dwDone);
+				if (!m_Layout.HasEcc() || !m_Layout.Find(dwAddr, dwSector))
+				{
+					return FALSE;
+				}
+				fRestore = TRUE;
+			}
+
+			if (dwRetry >= MAX_BLOCK_RETRIES)
+			{
+				BootLog(LOG_ERROR, "\n [%u] Block at %08X failed after %u retries ", m_dwChannel, dwAddr, dwRetry);
+				return FALSE;
+			}
+			dwRetry++;
+			m_dwBlockRetries++;
+			if (fRestore)
+			{
+				continue;
+			}
+			BootLog(LOG_DEBUG, "\n [%u] Recover block at %08X, %u bytes acknowledged ", m_dwChannel, dwAddr + dwDone, dwAcked);
+
+			//
+			// the bytes before the undecided frame are programmed as soon
+			// as the target leaves the write, the frame itself holds
+			// either the data or still 0xFF
+			//
+			UINT32 dwRest = dwLen - dwDone - dwAcked;
+			BOOL   fLast = fStarted && (dwRest <= 8);
+			BOOL   fIdle = DrainWrite(fLast ? &pbData[dwLen - dwRest] : NULL, dwRest, fFilled);
+
+			// the filler only stays in the flash, the stub is written to RAM
+			fRestore = fFilled && !fLast && m_Layout.HasEcc() && m_Layout.Find(dwAddr, dwSector);
+			if (fStarted)
+			{
+				dwDone += dwAcked;
+				fUndecided = TRUE;
+			}
+			if (!fIdle || !fUndecided || fRestore)
+			{
+				continue;
+			}
+		}
+		else
+		{
+			if (dwRetry >= MAX_BLOCK_RETRIES)
+			{
+				BootLog(LOG_ERROR, "\n [%u] Block at %08X failed after %u retries ", m_dwChannel, dwAddr, dwRetry);
+				return FALSE;
+			}
+			dwRetry++;
+
+			// the target may still wait for data of the broken write
+			BOOL fIdle = DrainWrite(NULL, 0, fFilled);
+			fRestore = fFilled && m_Layout.HasEcc() && m_Layout.Find(dwAddr, dwSector);
+			if (!fIdle || fRestore)
+			{
+				continue;
+			}
+		}
+
+		if (dwDone < dwLen)
+		{
+			UINT32 dwFrame = dwLen - dwDone;
+			UINT8  abRead[8];
+			BOOL   fData = TRUE;
+			BOOL   fBlank = TRUE;
+
+			if (dwFrame > 8)
+			{
+				dwFrame = 8;
+			}
+			m_dwReadBacks++;
+			if (!ReadMemory(dwAddr + dwDone, abRead, dwFrame))
+			{
+				// undecided, the next attempt reads again
+				continue;
+			}
+			for (UINT32 i = 0; i < dwFrame; i++)
+			{
+				fData = fData && (abRead[i] == pbData[dwDone + i]);
+				fBlank = fBlank && (abRead[i] == 0xFF);
+			}
+
+			if (fData)
+			{
+				dwDone += dwFrame;
+			}
+			else if (!fBlank)
+			{
+				BootLog(LOG_ERROR, "\n [%u] Verify error at %08X ", m_dwChannel, dwAddr + dwDone);
+				return FALSE;
+			}
+		}
+		fUndecided = FALSE;
+
+		if (dwDone >= dwLen)
+		{
+			return TRUE;
+		}
+		if (dwDone > dwStart)
+		{
+			dwRetry = 0;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Runs the sessions in parallel, one thread per session. Returns when
+  all sessions are finished.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootRunSessions(std::vector<CBootSession*>& Sessions)
+{
+	if (Sessions.size() == 1)
+	{
+		Sessions[0]->Run();
+		return;
+	}
+
+	std::vector<std::thread> Threads;
+	for (size_t i = 0; i < Sessions.size(); i++)
+	{
+		Threads.push_back(std::thread(&CBootSession::Run, Sessions[i]));
+	}
+	for (size_t i = 0; i < Threads.size(); i++)
+	{
+		Threads[i].join();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Adds the identifiers of a session with the ID base to an acceptance
+  filter: the responses of the boot loader and of the stub, and the
+  commands and data frames of the host, whose transmit echo carries
+  the time stamp of the frame on the bus.
+
+  @param dwIdBase  ID base of the node or of a broadcast group
+  @param Filter    filter of the channel
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootSessionIds(UINT32 dwIdBase, CCanFilter& Filter)
+{
+	for (UINT32 i = 0; i < sizeof(abSessionIds); i++)
+	{
+		Filter.Add(dwIdBase + abSessionIds[i]);
+	}
+	for (UINT32 i = 0; i < STUB_SEQ_MOD; i++)
+	{
+		Filter.Add(dwIdBase + STUB_ID_DATA + i);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the receive mode for the response of a command type.
+
+  @param bRto  command type, RTO_xxx
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 BootRxMode(UINT8 bRto)
+{
+	return abRxMode[bRto];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sets up the response timeouts of all command types.
+
+  @param paRto  RTO_COUNT estimators, indexed by RTO_xxx
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootRtoInit(CRtoEstimator* paRto)
+{
+	for (UINT32 i = 0; i < RTO_COUNT; i++)
+	{
+		paRto[i] = CRtoEstimator(adwRtoLimits[i][0], adwRtoLimits[i][1], adwRtoLimits[i][2]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Enters the responses of the connect sequence in the dispatch table,
+  after retiring all earlier entries. Both the sync and Get Version
+  stay expected, the answer can be to an earlier frame.
+
+  @param Dispatch   dispatch table of the session
+  @param dwIdBase   ID base of the target
+  @param dwChannel  number of the channel, used in messages
+
+  @return TRUE if both responses were entered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootExpectSync(CBootDispatch& Dispatch, UINT32 dwIdBase, UINT32 dwChannel)
+{
+	Dispatch.Retire();
+	if (!Dispatch.Expect(dwIdBase + BOOT_ID_SYNC, STATE_INIT_BOOT_LOADER, STATE_BOOT_LOADER_STARTED) ||
+	    !Dispatch.Expect(dwIdBase + BOOT_CMD_GET_VERSION, STATE_INIT_BOOT_LOADER, STATE_BOOT_LOADER_STARTED))
+	{
+		BootLog(LOG_ERROR, "\n [%u] No dispatch entry for the sync ", dwChannel);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Builds a frame, writes it to the trace log and sends it. All engines
+  of the protocol send their frames through here.
+
+  @param pTransport  channel to the target
+  @param dwChannel   number of the channel, used in messages
+  @param dwMsgId     identifier including the ID base
+  @param bFlags      CAN_FLAG_xxx
+  @param dwLen       payload length, up to the max. payload of the channel
+  @param pbData      payload
+
+  @return result of ICanTransport::Send()
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootSendFrame(ICanTransport* pTransport, UINT32 dwChannel, UINT32 dwMsgId, UINT8 bFlags,
+                   UINT32 dwLen, const UINT8* pbData)
+{
+	CanFrame sFrame = {};
+
+	sFrame.dwMsgId = dwMsgId;
+	sFrame.bLen = (UINT8)dwLen;
+	sFrame.bFlags = bFlags;
+	if (dwLen)
+	{
+		memcpy(sFrame.abData, pbData, dwLen);
+	}
+
+	BootLogData(LOG_TRACE, sFrame.abData, sFrame.bLen,
+		"\n[%u] Tx    ID: %3X      Len: %1u  Data:", dwChannel, sFrame.dwMsgId, dwLen);
+
+	return pTransport->Send(sFrame);
+}
@@ -0,0 +1,298 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Flashing session with one STM32 boot loader (AN3154).
+
+  @note
+	A session keeps all protocol state of one target: the pending
+	command, the response state, timeout estimation, recovery counters
+	and the progress journal. It talks to the target only through its
+	transport, so any number of sessions can run in parallel, each on
+	its own thread and channel. The image is shared read only.
+
+	Several targets can share one bus if each one uses its own ID base,
+	the sessions of these targets run in parallel on the same channel.
+	While one target erases or programs, the bus carries the frames of
+	the others. Identical nodes can instead receive the image once by
+	broadcast (BootBroadcast.hpp), their sessions then only repair the
+	blocks a node missed.
+
+	Optionally the session uploads a fast loader stub into the RAM of
+	the target and writes the image through it (BootStub.hpp). The ROM
+	boot loader is still used to connect, erase and resume.
+
+	The flash layout of the target (BootGeometry.hpp) is selected by the
+	product ID. A full flash erases only the sectors of the image if
+	this is faster than a mass erase, the blocks of the ROM boot loader
+	end at 256 byte boundaries and are padded to the programming unit.
+
+	A delta flash erases and writes only the sectors which differ from
+	the installed image (BootDelta.hpp). The installed image is given
+	as a file or reported sector by sector by the running stub. A
+	delta flash can simply be repeated, so it does not use the journal.
+
+	Before the erase the session predicts its duration from the plan,
+	the bit rate and the latencies measured while connecting, and the
+	bus time alone as the ceiling of the bus (BootEta.hpp). While the
+	image is written it reports the remaining time.
+
+	With a device store (BootDevice.hpp) the session reads the unique
+	ID of the target and keeps what it wrote there. A later delta flash
+	of the same device takes the installed sectors from the store.
+
+	After connecting the session asks the boot loader for its version
+	and commands with Get, or Get Version if Get fails. A command which
+	is not listed is not used: without Go there is no stub, without
+	Read Memory no resume. The result is kept in the device store, a
+	known device is not asked again. Get ID is always sent, the unique
+	ID address depends on it.
+
+	A response finds the pending command by its identifier in a small
+	table (BootDispatch.hpp), late and unsolicited frames are counted.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTSESSION_HPP_
+#define _BOOTSESSION_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootRto.hpp"
+#include "BootDelta.hpp"
+#include "BootDevice.hpp"
+#include "BootDispatch.hpp"
+#include "BootEta.hpp"
+#include "BootJournal.hpp"
+#include "BootProfile.hpp"
+#include "BootScheduler.hpp"
+#include "CanFilter.hpp"
+#include "CanTransport.hpp"
+#include "HexFile.hpp"
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// result of a session, used as exit code of the application
+//
+#define SESSION_OK                      0
+#define SESSION_NOT_STARTED             4       // boot loader does not answer
+#define SESSION_ERASE_ERROR             5       // mass erase failed
+#define SESSION_WRITE_ERROR             6       // block could not be written
+#define SESSION_STUB_ERROR              7       // stub was started but does not answer
+
+//
+// response timeouts per command type, adapted to the measured round trip
+// times. Initial values are the former fixed timeouts.
+//
+#define RTO_ERASE                       0       // ACK of the erase command
+#define RTO_ERASE_DONE                  1       // second ACK at the end of the erase
+#define RTO_WRITE_START                 2       // ACK of the write memory command
+#define RTO_WRITE_DATA                  3       // ACK of a data frame
+#define RTO_WRITE_BLOCK                 4       // ACK of the last frame, includes programming
+#define RTO_READ                        5       // ACK of the read memory command
+#define RTO_STUB_CMD                    6       // status of a stub command
+#define RTO_STUB_DATA                   7       // progress of a stub data stream
+#define RTO_STUB_STORE                  8       // end of a stub block, may wait for the programming
+                                                // of the block before, at least 100 ms
+#define RTO_COUNT                       9
+
+//
+// time to wait for the boot loader while the target comes out of reset,
+// the frames of the connect sequence are in BootProtocol.hpp
+//
+#define CONNECT_WAIT_US                 200000  // default time to wait for the boot loader
+
+class CBootStub;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class flashes one image to one target.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootSession
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootSession(UINT32 dwChannel, ICanTransport* pTransport, const HexData& Image);
+	~CBootSession();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void SetJournal(const char* pszFile) { m_strJournal = pszFile; }
+	void SetRxTrace(BOOL fTrace)         { m_fRxTrace = fTrace;     }
+	void SetIdBase (UINT32 dwIdBase)     { m_dwIdBase = dwIdBase;   }
+	void SetConnectWait(UINT32 dwWaitUs) { m_dwConnectWaitUs = dwWaitUs; }
+	void SetScheduler(CBootScheduler* pScheduler, UINT32 dwSlot);
+	void SetStub   (const char* pszDir, BOOL fFd, BOOL fCompress);
+	void SetStubWindow(UINT32 dwFrames);
+	void SetDelta  (const HexData* pBase, UINT32 dwSectorSize);
+	void SetMassErase(BOOL fMassErase)   { m_fMassErase = fMassErase; }
+	void SetDeviceStore(const CBootDeviceStore* pStore) { m_pStore = pStore; }
+
+	int  Run   (void);
+	void Report(void);
+
+	UINT32 GetChannel (void) const { return m_dwChannel;  }
+	UINT32 GetIdBase  (void) const { return m_dwIdBase;   }
+	int    GetResult  (void) const { return m_iResult;    }
+	UINT64 GetDuration(void) const { return m_qwDuration; }
+	UINT32 GetWritten (void) const { return m_dwWritten;  }
+
+	const CBootProfile& GetProfile(void) const { return m_Profile; }
+
+  private:
+	// the broadcast and the stub use the commands of the session
+	friend class CBootBroadcast;
+	friend class CBootStub;
+
+	//---------------------------------------------------------------
+	// frame exchange
+	//---------------------------------------------------------------
+	void TransmitFrame  (UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData);
+	void ProcessResponse(const CanFrame& sFrame);
+	void PumpMessages   (UINT32 dwTimeUs);
+	BOOL WaitState      (UINT32 dwMask, UINT32 dwTimeoutUs);
+	BOOL TransactFrame  (UINT8 bRto, UINT32 dwMask);
+	BOOL Expect         (UINT32 dwWait, UINT32 dwDone);
+	void WaitTurn       (UINT8 bRto, BOOL fExclusive);
+	void EndTurn        (void);
+	void AddProfile     (UINT32 dwPhase, UINT64 qwSent, UINT32 dwTxId, UINT64 qwRxBus);
+
+	//---------------------------------------------------------------
+	// boot loader commands
+	//---------------------------------------------------------------
+	int    Flash       (void);
+	BOOL   Connect     (void);
+	BOOL   MassErase   (void);
+	BOOL   ErasePages  (const UINT8* pbPages, UINT32 dwCount);
+	BOOL   WaitErase   (UINT64 qwEraseStart);
+	BOOL   WriteMemory (UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32& dwAcked, BOOL& fStarted);
+	BOOL   DrainWrite  (const UINT8* pbFrame, UINT32 dwLen, BOOL& fFilled);
+	BOOL   ReadData    (UINT8 bRto, UINT8* pbData, UINT32 dwLen);
+	BOOL   ReadResponse(UINT8 bRto, UINT8* pbData, UINT32 dwLen);
+	BOOL   ReadMemory  (UINT32 dwAddr, UINT8* pbData, UINT32 dwLen);
+	UINT32 GetId       (void);
+	BOOL   Get         (void);
+	BOOL   GetVersion  (void);
+	BOOL   Probe       (void);
+	BOOL   HasCommand  (UINT8 bCommand) const;
+	BOOL   Go          (UINT32 dwAddr, BOOL& fAnswered);
+
+	//---------------------------------------------------------------
+	// image transfer
+	//---------------------------------------------------------------
+	BOOL WriteBlock  (UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen, UINT32 dwDone);
+	UINT32 BlockLen  (UINT32 dwOffset, UINT32 dwEnd) const;
+	BOOL RestoreSector(UINT32 dwAddr);
+	BOOL PlanResume  (UINT32& dwResume, UINT32& dwDone);
+	void PlanLayout  (UINT32 dwPid);
+	int  PlanDelta   (UINT32 dwPid, std::vector<ImageRange>& Ranges);
+	BOOL EraseSectors(const std::vector<UINT32>& Sectors);
+	int  WriteImage  (UINT32 dwPid, const std::vector<ImageRange>& Ranges, UINT32 dwResume, UINT32 dwDone);
+
+	//---------------------------------------------------------------
+	// prediction
+	//---------------------------------------------------------------
+	void PlanEta     (const std::vector<ImageRange>& Ranges, UINT32 dwFrom, const std::vector<UINT32>& Sectors,
+	                  BOOL fMassErase);
+	void PlanRomBlock(UINT32 dwPhase, UINT32 dwLen, BOOL fFlash);
+	void ShowProgress(UINT32 dwDone);
+
+	//---------------------------------------------------------------
+	// device store
+	//---------------------------------------------------------------
+	void LoadDevice (UINT32 dwPid);
+	void ForgetImage(void);
+	void SaveImage  (UINT32 dwImageCrc);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	UINT32         m_dwChannel;         // number of the channel, used in messages
+	ICanTransport* m_pTransport;        // channel to the target
+	UINT32         m_dwIdBase;          // added to all identifiers of the target
+	CBootScheduler* m_pScheduler;       // shared with the sessions on the same bus, or NULL
+	UINT32         m_dwSlot;            // slot of the session in the scheduler
+	BOOL           m_fTurn;             // the session holds a turn of the scheduler
+	const HexData& m_Image;             // image to write, shared by all sessions
+	BOOL           m_fRxTrace;          // log received frames
+
+	UINT8          m_abMessage[8];      // data of the pending command
+	UINT32         m_dwMsgLength;       // length of the pending command
+	UINT32         m_dwMsgId;           // identifier of the pending command
+	UINT32         m_dwState;           // response state, STATE_xxx
+	UINT64         m_qwStateTime;       // time of the frame which changed the state
+	UINT64         m_qwStateBusTime;    // bus time stamp of that frame, 0 = none
+	CBootDispatch  m_Dispatch;          // pending requests by response identifier
+
+	UINT8          m_abReadData[256];   // data of the pending read command
+	UINT32         m_dwReadLength;      // length of the pending read
+	UINT32         m_dwReadCount;       // bytes received for the pending read
+	UINT32         m_dwReadId;          // identifier of the data frames
+
+	CRtoEstimator  m_aRto[RTO_COUNT];   // response timeouts per command type
+
+	UINT32         m_dwBlockRetries;    // number of write block recoveries
+	UINT32         m_dwDrainFrames;     // filler frames sent to end a broken write
+	UINT32         m_dwReadBacks;       // frames checked by read memory
+	BOOL           m_fRestoring;        // the blocks in front of a broken block are written again
+	UINT32         m_dwConnectWaitUs;   // time to wait for the boot loader
+	UINT64         m_qwReadyTime;       // time until the boot loader answered
+	UINT32         m_dwSyncFrames;      // frames sent until the boot loader answered
+	UINT64         m_qwConnectTime;     // duration of connect and probe
+	BOOL           m_fProbed;           // version and commands were asked in this session
+
+	CBootStub*     m_pStub;             // fast loader, NULL = ROM boot loader only
+	CBootDelta*    m_pDelta;            // sectors of a delta flash, NULL = whole image
+	BOOL           m_fDelta;            // a delta flash is planned after connecting
+	const HexData* m_pBase;             // installed image of the delta flash, or NULL
+	UINT32         m_dwSectorSize;      // uniform sectors of this size, 0 = from the layout
+	CFlashLayout   m_Layout;            // sectors of the flash of the target
+	BOOL           m_fMassErase;        // a full flash always erases the whole flash
+
+	const CBootDeviceStore* m_pStore;   // state of the devices, NULL = not used
+	DeviceState    m_sDevice;           // state of the target, version and commands
+	                                    // also without the store
+	BOOL           m_fDevice;           // the unique ID of the target is known
+
+	CBootJournal   m_Journal;           // progress of the session
+	std::string    m_strJournal;        // path of the journal, empty if disabled
+
+	BOOL           m_fStarted;          // session time is measured
+	UINT64         m_qwStart;           // transport time at session start
+	UINT64         m_qwDuration;        // duration of the session
+	UINT32         m_dwWritten;         // bytes written in this session
+	int            m_iResult;           // SESSION_xxx
+	UINT32         m_dwPid;             // product ID of the target, 0 = unknown
+	CBootProfile   m_Profile;           // latencies per protocol phase
+	CBootEta       m_Eta;               // predicted duration of the session
+	UINT32         m_dwEtaBytes;        // bytes to write in this session
+	UINT32         m_dwEtaStep;         // tenths of the bytes the remaining time was reported for
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void BootRunSessions(std::vector<CBootSession*>& Sessions);
+void BootSessionIds (UINT32 dwIdBase, CCanFilter& Filter);
+UINT32 BootRxMode   (UINT8 bRto);
+void BootRtoInit    (CRtoEstimator* paRto);
+BOOL BootExpectSync (CBootDispatch& Dispatch, UINT32 dwIdBase, UINT32 dwChannel);
+BOOL BootSendFrame  (ICanTransport* pTransport, UINT32 dwChannel, UINT32 dwMsgId, UINT8 bFlags,
+                     UINT32 dwLen, const UINT8* pbData);
+
+#endif //_BOOTSESSION_HPP_
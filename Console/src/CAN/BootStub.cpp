@@ -0,0 +1,1165 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Fast loader stub in the RAM of the target.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootStub.hpp"
+#include "BootLog.hpp"
+#include "BootCrc.hpp"
+#include "BootLz.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define MAX_STUB_RETRIES                8       // attempts per command or stream without progress
+#define MAX_STUB_IMAGE                  0x8000  // max. size of a stub image
+#define SIM_STUB_LEN                    1024    // size of the built in image
+#define SIM_STUB_BUFFER                 0x800   // block size of the built in image
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+//
+// stub images per product ID, loaded behind the RAM used by the ROM
+// boot loader (AN2606)
+//
+static const StubEntry asStubs[] = {
+	{ 0x418, "STM32F105/107",  "stub_f1cl.bin", 0x20001000 },
+	{ 0x430, "STM32F1 XL",     "stub_f1xl.bin", 0x20001000 },
+	{ 0x411, "STM32F2",        "stub_f2.bin",   0x20004000 },
+	{ 0x413, "STM32F405/407",  "stub_f4.bin",   0x20004000 },
+	{ 0x419, "STM32F42x/43x",  "stub_f4.bin",   0x20004000 },
+	{ 0x421, "STM32F446",      "stub_f4.bin",   0x20004000 },
+	{ 0x449, "STM32F74x/75x",  "stub_f7.bin",   0x20004000 },
+	{ 0x451, "STM32F76x/77x",  "stub_f7.bin",   0x20004000 }
+};
+
+//
+// lengths of CAN FD frames above 8 bytes
+//
+static const UINT8 abFdLen[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Finds the stub of a target.
+
+  @param dwPid  product ID reported by Get ID
+
+  @return entry of the registry, NULL if there is no stub for the target
+
+*/
+//////////////////////////////////////////////////////////////////////////
+const StubEntry* BootStubFind(UINT32 dwPid)
+{
+	for (size_t i = 0; i < sizeof(asStubs) / sizeof(asStubs[0]); i++)
+	{
+		if (asStubs[i].dwPid == dwPid)
+		{
+			return &asStubs[i];
+		}
+	}
+	return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Loads and checks a stub image.
+
+  @param pEntry   entry of the registry
+  @param pszDir   directory of the image files
+  @param Image    receives the image
+  @param sHeader  receives the header of the image
+
+  @return TRUE if the image is valid
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL BootStubLoad(const StubEntry* pEntry, const char* pszDir, std::vector<UINT8>& Image, StubHeader& sHeader)
+{
+	std::string strFile = std::string(pszDir) + "/" + pEntry->pszFile;
+
+	FILE* pFile = fopen(strFile.c_str(), "rb");
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	Image.resize(MAX_STUB_IMAGE);
+	Image.resize(fread(Image.data(), 1, MAX_STUB_IMAGE, pFile));
+	fclose(pFile);
+
+	if (!StubGetHeader(Image.data(), (UINT32)Image.size(), sHeader))
+	{
+		return FALSE;
+	}
+	Image.resize(sHeader.dwImageLen);
+
+	UINT32 dwBody = STUB_HEADER_OFFSET + STUB_HEADER_LEN;
+	return (BootCrc32(&Image[dwBody], sHeader.dwImageLen - dwBody) == sHeader.dwCrc) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Builds the placeholder image for the simulated target. It carries
+  the vector table and the header of a real stub, the code is not
+  executed. The simulated stub decompresses blocks.
+
+  @param pEntry   entry of the registry
+  @param fFd      the stub takes CAN FD frames
+  @param Image    receives the image
+  @param sHeader  receives the header of the image
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void BootStubMakeImage(const StubEntry* pEntry, BOOL fFd, std::vector<UINT8>& Image, StubHeader& sHeader)
+{
+	UINT32 adwWords[7];
+	UINT32 dwBody = STUB_HEADER_OFFSET + STUB_HEADER_LEN;
+
+	// thumb NOPs
+	Image.assign(SIM_STUB_LEN, 0x00);
+	for (UINT32 i = dwBody; i + 1 < SIM_STUB_LEN; i += 2)
+	{
+		Image[i + 1] = 0xBF;
+	}
+
+	sHeader.dwMagic = STUB_MAGIC;
+	sHeader.wVersion = STUB_VERSION;
+	sHeader.wFlags = STUB_FLAG_LZ | (fFd ? STUB_FLAG_FD : 0);
+	sHeader.dwBufferSize = SIM_STUB_BUFFER;
+	sHeader.dwImageLen = SIM_STUB_LEN;
+	sHeader.dwCrc = BootCrc32(&Image[dwBody], SIM_STUB_LEN - dwBody);
+
+	adwWords[0] = pEntry->dwLoadAddr + SIM_STUB_LEN + 2 * SIM_STUB_BUFFER + 0x400;  // stack
+	adwWords[1] = (pEntry->dwLoadAddr + dwBody) | 1;                                  // reset, thumb
+	adwWords[2] = sHeader.dwMagic;
+	adwWords[3] = sHeader.wVersion | ((UINT32)sHeader.wFlags << 16);
+	adwWords[4] = sHeader.dwBufferSize;
+	adwWords[5] = sHeader.dwImageLen;
+	adwWords[6] = sHeader.dwCrc;
+	for (UINT32 i = 0; i < 7; i++)
+	{
+		Image[4 * i + 0] = (UINT8)adwWords[i];
+		Image[4 * i + 1] = (UINT8)(adwWords[i] >> 8);
+		Image[4 * i + 2] = (UINT8)(adwWords[i] >> 16);
+		Image[4 * i + 3] = (UINT8)(adwWords[i] >> 24);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Constructor.
+
+  @param pSession  session of the target, must live as long as the stub
+  @param pszDir    directory of the stub images, NULL for the built in
+                   image of the simulated target
+  @param fFd       use CAN FD if the stub and the transport support it
+  @param fCompress compress the blocks if the stub supports it
+
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootStub::CBootStub(CBootSession* pSession, const char* pszDir, BOOL fFd, BOOL fCompress)
+	: m_Window(STUB_ACK_FRAMES, STUB_WINDOW_FRAMES)
+{
+	m_pSession = pSession;
+	m_strDir = pszDir ? pszDir : "";
+	m_fSimulated = pszDir ? FALSE : TRUE;
+	m_fFd = fFd;
+	m_fCompress = fCompress;
+	m_iLoad = -1;
+	m_iStart = -1;
+	m_pEntry = NULL;
+
+	memset(&m_sHeader, 0, sizeof(m_sHeader));
+	m_dwFrameLen = CAN_MAX_LEN;
+	m_bFlags = 0;
+	m_fLz = FALSE;
+	m_qwStatusTime = 0;
+	m_qwStatusBusTime = 0;
+	m_wStatusTag = 0;
+
+	memset(m_aqwSent, 0, sizeof(m_aqwSent));
+	memset(m_adwFlight, 0, sizeof(m_adwFlight));
+	m_dwPendingOffset = 0;
+	m_dwPendingLen = 0;
+
+	m_dwBlocks = 0;
+	m_dwDataFrames = 0;
+	m_dwLzBlocks = 0;
+	m_dwStreamBytes = 0;
+	m_dwGaps = 0;
+	m_dwStreamTimeouts = 0;
+	m_dwCrcErrors = 0;
+	m_qwUploadTime = 0;
+	m_qwWriteTime = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sets the max. number of data frames in flight while a block is
+  streamed, the congestion window stays below. The stub reports its
+  progress every STUB_ACK_FRAMES frames and tells a gap from a repeated
+  frame by the sequence number, so the window stays between the two.
+
+  @param dwFrames  STUB_ACK_FRAMES .. STUB_WINDOW_FRAMES, other values
+                   are limited
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootStub::SetWindow(UINT32 dwFrames)
+{
+	if (dwFrames > STUB_WINDOW_FRAMES)
+	{
+		dwFrames = STUB_WINDOW_FRAMES;
+	}
+	m_Window.SetMax(dwFrames);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Loads the stub image of the target and selects the frames of the
+  transfer, nothing is sent yet. Later calls return the result of the
+  first one.
+
+  @param dwPid  product ID of the target
+
+  @return STUB_START_OK or STUB_START_UNAVAILABLE
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootStub::Load(UINT32 dwPid)
+{
+	UINT32 dwChannel = m_pSession->m_dwChannel;
+
+	if (m_iLoad >= 0)
+	{
+		return m_iLoad;
+	}
+	m_iLoad = STUB_START_UNAVAILABLE;
+
+	m_pEntry = BootStubFind(dwPid);
+	if (!m_pEntry)
+	{
+		BootLog(LOG_INFO, "\n [%u] No stub for product ID %04X", dwChannel, dwPid);
+		return m_iLoad;
+	}
+	if (m_fSimulated)
+	{
+		BootStubMakeImage(m_pEntry, m_fFd, m_Image, m_sHeader);
+	}
+	else if (!BootStubLoad(m_pEntry, m_strDir.c_str(), m_Image, m_sHeader))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Stub image for product ID %04X is missing or invalid", dwChannel, dwPid);
+		m_pEntry = NULL;
+		return m_iLoad;
+	}
+
+	if (m_fFd && (m_sHeader.wFlags & STUB_FLAG_FD) && (m_pSession->m_pTransport->GetMaxLen() >= CAN_FD_MAX_LEN))
+	{
+		m_dwFrameLen = CAN_FD_MAX_LEN;
+		m_bFlags = CAN_FLAG_FD;
+	}
+	m_fLz = (m_fCompress && (m_sHeader.wFlags & STUB_FLAG_LZ)) ? TRUE : FALSE;
+
+	m_iLoad = STUB_START_OK;
+	return m_iLoad;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Uploads the stub of the target and starts it. The ROM boot loader
+  must be connected. Later calls return the result of the first one.
+
+  @param dwPid  product ID of the target
+
+  @return STUB_START_xxx
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootStub::Start(UINT32 dwPid)
+{
+	if (m_iStart < 0)
+	{
+		m_iStart = Upload(dwPid);
+	}
+	return m_iStart;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Uploads the stub of the target and starts it.
+
+  @param dwPid  product ID of the target
+
+  @return STUB_START_xxx
+
+*/
+//////////////////////////////////////////////////////////////////////////
+int CBootStub::Upload(UINT32 dwPid)
+{
+	UINT32 dwChannel = m_pSession->m_dwChannel;
+	UINT64 qwStart = m_pSession->m_pTransport->GetTime();
+
+	if (Load(dwPid) != STUB_START_OK)
+	{
+		return STUB_START_UNAVAILABLE;
+	}
+
+	//
+	// upload with the ROM boot loader
+	//
+	for (UINT32 dwOffset = 0; dwOffset < m_Image.size(); dwOffset += 256)
+	{
+		UINT32 dwLen = (UINT32)m_Image.size() - dwOffset;
+		if (dwLen > 256)
+		{
+			dwLen = 256;
+		}
+		if (!m_pSession->WriteBlock(m_pEntry->dwLoadAddr + dwOffset, &m_Image[dwOffset], dwLen, 0))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub upload failed", dwChannel);
+			return STUB_START_UNAVAILABLE;
+		}
+	}
+
+	//
+	// if Go or its ACK is lost, the ROM boot loader answers Go again
+	// or the stub answers a probe
+	//
+	BOOL fRunning = FALSE;
+	for (UINT32 dwRetry = 0; !fRunning && (dwRetry < MAX_STUB_RETRIES); dwRetry++)
+	{
+		BOOL fAnswered;
+		if (m_pSession->Go(m_pEntry->dwLoadAddr, fAnswered))
+		{
+			//
+			// the stub reports when it is ready, if this report is lost
+			// it still answers a flush
+			//
+			UINT8  bAck;
+			UINT8  bEvent;
+			UINT32 dwParam;
+			UINT64 qwDeadline = m_pSession->m_pTransport->GetTime() + m_pSession->m_aRto[RTO_STUB_CMD].GetTimeout();
+			while (!fRunning && WaitStatus(qwDeadline, bAck, bEvent, dwParam))
+			{
+				fRunning = ((bAck == STUB_ACK) && (bEvent == STUB_EV_READY)) ? TRUE : FALSE;
+			}
+			if (!fRunning && !Flush())
+			{
+				return STUB_START_FAILED;
+			}
+			fRunning = TRUE;
+		}
+		else if (fAnswered)
+		{
+			BootLog(LOG_ERROR, "\n [%u] Go to the stub rejected", dwChannel);
+			return STUB_START_UNAVAILABLE;
+		}
+		else
+		{
+			fRunning = Probe();
+		}
+	}
+	if (!fRunning)
+	{
+		return STUB_START_FAILED;
+	}
+
+	m_qwUploadTime = m_pSession->m_pTransport->GetTime() - qwStart;
+	BootLog(LOG_INFO, "\n [%u] Stub for product ID %04X started, %u byte blocks, %u byte frames", dwChannel,
+		dwPid, m_sHeader.dwBufferSize, m_dwFrameLen);
+	return STUB_START_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes ranges of the image through the running stub. The blocks end
+  at multiples of the buffer size from the start of the image, so they
+  cover whole blocks of the journal, and at the end of each range.
+
+  @param Ranges    parts of the image to write, ascending
+  @param dwResume  offset of the first journal block to write
+  @param dwDone    bytes of that block which are already programmed
+
+  @return TRUE if the ranges are programmed
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::Write(const std::vector<ImageRange>& Ranges, UINT32 dwResume, UINT32 dwDone)
+{
+	const HexData& Image = m_pSession->m_Image;
+	UINT64 qwStart = m_pSession->m_pTransport->GetTime();
+	UINT32 dwOffset;
+
+	m_dwPendingLen = 0;
+	for (size_t r = 0; r < Ranges.size(); r++)
+	{
+		UINT32 dwRangeEnd = Ranges[r].dwOffset + Ranges[r].dwLen;
+		dwOffset = (Ranges[r].dwOffset > dwResume + dwDone) ? Ranges[r].dwOffset : (dwResume + dwDone);
+		while (dwOffset < dwRangeEnd)
+		{
+			UINT32 dwEnd = (dwOffset / m_sHeader.dwBufferSize + 1) * m_sHeader.dwBufferSize;
+			if (dwEnd > dwRangeEnd)
+			{
+				dwEnd = dwRangeEnd;
+			}
+
+			BootLog(LOG_DEBUG, "\n [%u] Stub block %08X, %u bytes", m_pSession->m_dwChannel,
+				Image.StartAdres + dwOffset, dwEnd - dwOffset);
+
+			//
+			// the session keeps the turn of a shared bus for the whole block
+			//
+			m_pSession->WaitTurn(RTO_STUB_STORE, FALSE);
+			BOOL fStored = WriteBlock(dwOffset, &Image.Data[dwOffset], dwEnd - dwOffset);
+			m_pSession->EndTurn();
+			if (!fStored)
+			{
+				return FALSE;
+			}
+			dwOffset = dwEnd;
+		}
+	}
+
+	m_pSession->WaitTurn(RTO_STUB_STORE, FALSE);
+	BOOL fFlushed = Flush();
+	m_pSession->EndTurn();
+	if (!fFlushed)
+	{
+		return FALSE;
+	}
+
+	//
+	// the stub checked the CRC of each block before programming, now
+	// the flash itself is checked
+	//
+	m_pSession->m_Eta.Begin(ETA_CHECK, m_pSession->m_pTransport->GetTime());
+	for (size_t r = 0; r < Ranges.size(); r++)
+	{
+		UINT32 dwRangeEnd = Ranges[r].dwOffset + Ranges[r].dwLen;
+		dwOffset = (Ranges[r].dwOffset > dwResume + dwDone) ? Ranges[r].dwOffset : (dwResume + dwDone);
+		while (dwOffset < dwRangeEnd)
+		{
+			UINT32 dwEnd = (dwOffset / m_sHeader.dwBufferSize + 1) * m_sHeader.dwBufferSize;
+			if (dwEnd > dwRangeEnd)
+			{
+				dwEnd = dwRangeEnd;
+			}
+
+			m_pSession->WaitTurn(RTO_STUB_CMD, FALSE);
+			BOOL fChecked = CheckBlock(dwOffset, dwEnd - dwOffset);
+			m_pSession->EndTurn();
+			if (!fChecked)
+			{
+				return FALSE;
+			}
+			dwOffset = dwEnd;
+		}
+	}
+
+	m_qwWriteTime = m_pSession->m_pTransport->GetTime() - qwStart;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reports the transfer statistics of the stub.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootStub::Report(void)
+{
+	UINT32 dwChannel = m_pSession->m_dwChannel;
+	UINT32 dwWriteMs = (UINT32)(m_qwWriteTime / 1000);
+
+	if (m_dwBlocks == 0)
+	{
+		return;
+	}
+
+	BootLog(LOG_INFO, "\n [%u] Stub: upload %u ms, write %u ms, %u bytes/s", dwChannel,
+		(UINT32)(m_qwUploadTime / 1000), dwWriteMs, dwWriteMs ? (UINT32)((UINT64)m_pSession->m_dwWritten * 1000 / dwWriteMs) : 0);
+	BootLog(LOG_INFO, "\n [%u] Stub: %u blocks, %u data frames of %u bytes", dwChannel,
+		m_dwBlocks, m_dwDataFrames, m_dwFrameLen);
+	BootLog(LOG_INFO, "\n [%u] Stub: %u blocks compressed, %u bytes streamed for %u bytes", dwChannel,
+		m_dwLzBlocks, m_dwStreamBytes, m_pSession->m_dwWritten);
+	BootLog(LOG_INFO, "\n [%u] Stub recovery: %u gaps, %u stream timeouts, %u CRC errors", dwChannel,
+		m_dwGaps, m_dwStreamTimeouts, m_dwCrcErrors);
+	BootLog(LOG_INFO, "\n [%u] Stub window: %u frames at the end, largest %u, max. %u", dwChannel,
+		m_Window.Get(), m_Window.GetLargest(), m_Window.GetMax());
+	BootLog(LOG_INFO, "\n [%u] Stub window: halved %u times after loss, %u after delay, %u resets", dwChannel,
+		m_Window.GetLossCuts(), m_Window.GetRttCuts(), m_Window.GetResets());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmits a frame to the stub. Data frames are bulk data, they are
+  sent as CAN FD frames if the stub takes them.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootStub::TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData)
+{
+	BootSendFrame(m_pSession->m_pTransport, m_pSession->m_dwChannel, m_pSession->m_dwIdBase + dwMsgId,
+		(dwMsgId >= STUB_ID_DATA) ? (UINT8)(m_bFlags | CAN_FLAG_BULK) : 0, dwLen, pbData);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Waits for the next status frame of the stub, other frames are
+  discarded. The time of the frame is kept in m_qwStatusTime, bytes 6
+  and 7 in m_wStatusTag.
+
+  @param qwDeadline  transport time to give up
+  @param bAck        receives STUB_ACK or STUB_NACK
+  @param bEvent      receives the event, STUB_EV_xxx
+  @param dwParam     receives the parameter, up to 4 bytes, 0 if none
+
+  @return TRUE if a status frame was received
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::WaitStatus(UINT64 qwDeadline, UINT8& bAck, UINT8& bEvent, UINT32& dwParam)
+{
+	ICanTransport* pTransport = m_pSession->m_pTransport;
+	CanFrame sFrame;
+
+	for (;;)
+	{
+		UINT64 qwNow = pTransport->GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			return FALSE;
+		}
+		if (!pTransport->Receive(sFrame, (UINT32)(qwDeadline - qwNow)))
+		{
+			continue;
+		}
+
+		if (m_pSession->m_fRxTrace)
+		{
+			BootLogData(LOG_TRACE, sFrame.abData, sFrame.bLen,
+				"\n[%u] Time: %10u  ID: %3X Sim  Len: %1u  Data:", m_pSession->m_dwChannel, (UINT32)sFrame.qwTime, sFrame.dwMsgId, sFrame.bLen);
+		}
+		if ((sFrame.dwMsgId == m_pSession->m_dwIdBase + STUB_ID_STATUS) && (sFrame.bLen >= 2))
+		{
+			bAck = sFrame.abData[0];
+			bEvent = sFrame.abData[1];
+			dwParam = 0;
+			for (UINT8 i = 2; (i < sFrame.bLen) && (i < 6); i++)
+			{
+				dwParam = (dwParam << 8) | sFrame.abData[i];
+			}
+			m_qwStatusTime = sFrame.qwTime;
+			m_qwStatusBusTime = sFrame.qwBusTime;
+			m_wStatusTag = (sFrame.bLen >= 8) ? (UINT16)((sFrame.abData[6] << 8) | sFrame.abData[7]) : 0;
+			return TRUE;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a command to the stub and waits for its status. The command is
+  repeated on timeout, all commands can be repeated. Status frames with
+  other events are late answers and ignored.
+
+  @param bRto     command type, RTO_xxx
+  @param pbCmd    command and parameters
+  @param dwLen    length of the command
+  @param bEvent   event of the expected ACK
+  @param bAck     receives STUB_ACK or STUB_NACK
+  @param bResult  receives the event of the status
+  @param dwParam  receives the parameter of the status
+
+  @return TRUE if the command was answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::Command(UINT8 bRto, const UINT8* pbCmd, UINT32 dwLen, UINT8 bEvent,
+                        UINT8& bAck, UINT8& bResult, UINT32& dwParam)
+{
+	CRtoEstimator& Rto = m_pSession->m_aRto[bRto];
+
+	for (UINT32 dwRetry = 0; dwRetry < MAX_STUB_RETRIES; dwRetry++)
+	{
+		UINT64 qwSent = m_pSession->m_pTransport->GetTime();
+		UINT32 dwTimeout = Rto.GetTimeout();
+
+		m_pSession->m_pTransport->SetRxMode(BootRxMode(bRto));
+		TransmitFrame(STUB_ID_CMD, dwLen, pbCmd);
+		while (WaitStatus(qwSent + dwTimeout, bAck, bResult, dwParam))
+		{
+			if ((bAck == STUB_NACK) || (bResult == bEvent))
+			{
+				if (dwRetry == 0)
+				{
+					Rto.AddSample((UINT32)(m_qwStatusTime - qwSent));
+					m_pSession->AddProfile((bRto == RTO_STUB_STORE) ? PROFILE_STUB_STORE : PROFILE_STUB_CMD, qwSent,
+						m_pSession->m_dwIdBase + STUB_ID_CMD, m_qwStatusBusTime);
+				}
+				return TRUE;
+			}
+		}
+
+		Rto.Backoff();
+		BootLog(LOG_DEBUG, "\n [%u] Stub timeout after %u us (command %02X) ", m_pSession->m_dwChannel, dwTimeout, pbCmd[0]);
+	}
+
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks once if the stub runs, without retries.
+
+  @return TRUE if the stub answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::Probe(void)
+{
+	UINT8  bCmd = STUB_OP_FLUSH;
+	UINT8  bAck;
+	UINT8  bEvent;
+	UINT32 dwParam;
+	UINT64 qwDeadline = m_pSession->m_pTransport->GetTime() + m_pSession->m_aRto[RTO_STUB_STORE].GetTimeout();
+
+	TransmitFrame(STUB_ID_CMD, 1, &bCmd);
+	while (WaitStatus(qwDeadline, bAck, bEvent, dwParam))
+	{
+		if ((bAck == STUB_ACK) && (bEvent == STUB_EV_FLUSHED))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Waits until the stub has programmed all blocks and commits the last
+  block to the journal.
+
+  @return TRUE if the stub answered
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::Flush(void)
+{
+	UINT8  bCmd = STUB_OP_FLUSH;
+	UINT8  bAck;
+	UINT8  bEvent;
+	UINT32 dwParam;
+
+	if (!Command(RTO_STUB_STORE, &bCmd, 1, STUB_EV_FLUSHED, bAck, bEvent, dwParam) || (bAck != STUB_ACK))
+	{
+		return FALSE;
+	}
+	CommitBlock();
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Streams the data of a block which was started by STUB_OP_BLOCK. Up
+  to the congestion window of frames are in flight. A gap reported by
+  the stub or a missing progress report sends the frames again from the
+  offset the stub expects and shrinks the window.
+
+  @param pbData  data of the block
+  @param dwLen   length of the block, up to the buffer size of the stub
+
+  @return TRUE if the stub received the whole block in order
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::StreamBlock(const UINT8* pbData, UINT32 dwLen)
+{
+	ICanTransport* pTransport = m_pSession->m_pTransport;
+	CRtoEstimator& Rto = m_pSession->m_aRto[RTO_STUB_DATA];
+
+	UINT32 dwFrames = (dwLen + m_dwFrameLen - 1) / m_dwFrameLen;
+	UINT32 dwNext = 0;                  // next frame to send
+	UINT32 dwAcked = 0;                 // frames the stub received in order
+	UINT32 dwRestart = dwFrames;        // frame sent again after the last gap
+	UINT32 dwRetry = 0;                 // timeouts without progress
+	UINT32 dwSent = 0;                  // frames sent at least once
+	UINT32 dwFresh = 0;                 // frames from here on were sent once
+	UINT32 dwStale = 0;                 // frames behind the last gap the stub has still to drop
+	UINT64 qwResume = 0;                // the stub has dropped them at this time
+
+	pTransport->SetRxMode(BootRxMode(RTO_STUB_DATA));
+	while (dwAcked < dwFrames)
+	{
+		//
+		// the frames behind a gap are still in the receive FIFO of the
+		// stub, frames sent again before it dropped them would overrun
+		// the FIFO and start the next gap
+		//
+		BOOL fDrain = (pTransport->GetTime() < qwResume) ? TRUE : FALSE;
+		while (!fDrain && (dwNext < dwFrames) && (dwNext - dwAcked < m_Window.Get()))
+		{
+			UINT8  abFrame[CAN_FD_MAX_LEN];
+			UINT32 dwOffset = dwNext * m_dwFrameLen;
+			UINT32 dwFrame = dwLen - dwOffset;
+			if (dwFrame > m_dwFrameLen)
+			{
+				dwFrame = m_dwFrameLen;
+			}
+			memcpy(abFrame, &pbData[dwOffset], dwFrame);
+
+			// a CAN FD frame above 8 bytes has one of the fixed lengths
+			UINT32 dwSend = dwFrame;
+			for (UINT32 i = 0; (dwSend > CAN_MAX_LEN) && (i < sizeof(abFdLen)); i++)
+			{
+				if (abFdLen[i] >= dwFrame)
+				{
+					dwSend = abFdLen[i];
+					break;
+				}
+			}
+			memset(&abFrame[dwFrame], 0xFF, dwSend - dwFrame);
+
+			m_aqwSent[dwNext % STUB_SEQ_MOD] = pTransport->GetTime();
+			m_adwFlight[dwNext % STUB_SEQ_MOD] = dwNext - dwAcked + 1;
+			TransmitFrame(STUB_ID_DATA + dwNext % STUB_SEQ_MOD, dwSend, abFrame);
+			m_dwDataFrames++;
+			dwNext++;
+			if (dwNext > dwSent)
+			{
+				dwSent = dwNext;
+			}
+		}
+
+		UINT8  bAck;
+		UINT8  bEvent;
+		UINT32 dwParam;
+		UINT32 dwTimeout = Rto.GetTimeout();
+		UINT64 qwDeadline = pTransport->GetTime() + dwTimeout;
+		if (fDrain && (qwResume < qwDeadline))
+		{
+			qwDeadline = qwResume;
+		}
+		if (!WaitStatus(qwDeadline, bAck, bEvent, dwParam))
+		{
+			if (qwDeadline == qwResume)
+			{
+				continue;
+			}
+			Rto.Backoff();
+			m_Window.OnTimeout(Rto.GetSrtt(), pTransport->GetTime());
+			m_dwStreamTimeouts++;
+			if (++dwRetry > MAX_STUB_RETRIES)
+			{
+				BootLog(LOG_ERROR, "\n [%u] Stub stream stalled after %u us ", m_pSession->m_dwChannel, dwTimeout);
+				return FALSE;
+			}
+			dwNext = dwAcked;
+			dwRestart = dwAcked;
+			dwFresh = dwSent;
+			dwStale = 0;
+			qwResume = 0;
+			continue;
+		}
+
+		if ((bAck == STUB_ACK) && (bEvent == STUB_EV_PROGRESS))
+		{
+			//
+			// after a restart the progress may cover frames which were in
+			// flight before it, the stream goes on behind them
+			//
+			UINT32 dwReceived = (dwParam + m_dwFrameLen - 1) / m_dwFrameLen;
+			if ((dwReceived > dwAcked) && (dwReceived <= dwSent))
+			{
+				//
+				// only frames sent once give a round trip time; the window
+				// takes it up to the time stamp of the report, the timeout
+				// up to now, it also covers the receive latency of the
+				// host, e.g. the batch wait of CAN_RX_BATCH; a report
+				// comes only every STUB_ACK_FRAMES frames, this is the
+				// granularity of the timeout
+				//
+				if (dwReceived > dwFresh)
+				{
+					UINT32 dwSeq = (dwReceived - 1) % STUB_SEQ_MOD;
+					UINT32 dwRtt = (UINT32)(m_qwStatusTime - m_aqwSent[dwSeq]);
+					if (m_Window.OnRtt(dwRtt, m_adwFlight[dwSeq], Rto.GetSrtt(), m_qwStatusTime))
+					{
+						BootLog(LOG_DEBUG, "\n [%u] Stub window %u after a round trip of %u us for %u frames ", m_pSession->m_dwChannel,
+							m_Window.Get(), dwRtt, m_adwFlight[dwSeq]);
+					}
+					Rto.SetGranularity(STUB_ACK_FRAMES * m_Window.GetFrameUs());
+					Rto.AddSample((UINT32)(pTransport->GetTime() - m_aqwSent[dwSeq]));
+					m_pSession->AddProfile(PROFILE_STUB_DATA, m_aqwSent[dwSeq], m_pSession->m_dwIdBase + STUB_ID_DATA + dwSeq,
+						m_qwStatusBusTime);
+				}
+				m_Window.OnProgress(dwReceived - dwAcked);
+				dwAcked = dwReceived;
+				dwStale = 0;
+				qwResume = 0;
+				if (dwNext < dwReceived)
+				{
+					dwNext = dwReceived;
+				}
+				dwRetry = 0;
+			}
+		}
+		else if ((bAck == STUB_NACK) && (bEvent == STUB_EV_GAP))
+		{
+			//
+			// the stub repeats the gap every STUB_ACK_FRAMES frames it
+			// drops; as long as these can be the frames which were in
+			// flight behind the lost one, the frames are already sent
+			// again, a further repeat means they were lost as well
+			//
+			UINT32 dwReceived = dwParam / m_dwFrameLen;
+			if ((dwReceived < dwAcked) || (dwReceived > dwSent))
+			{
+				continue;
+			}
+			if ((dwReceived == dwRestart) && dwStale)
+			{
+				dwStale = (dwStale > STUB_ACK_FRAMES) ? dwStale - STUB_ACK_FRAMES : 0;
+				continue;
+			}
+
+			//
+			// the frames in flight before the last restart arrived after
+			// all, the stub rejects the ones sent again and takes the
+			// frames behind them; sending again from here would start the
+			// next round of repeated frames
+			//
+			if ((dwReceived > dwRestart) && (dwReceived <= dwFresh))
+			{
+				dwStale = 0;
+				qwResume = 0;
+				dwAcked = dwReceived;
+				if (dwNext < dwReceived)
+				{
+					dwNext = dwReceived;
+				}
+				continue;
+			}
+			m_dwGaps++;
+			m_Window.OnLoss(m_adwFlight[dwReceived % STUB_SEQ_MOD], Rto.GetSrtt(), m_qwStatusTime);
+			BootLog(LOG_DEBUG, "\n [%u] Stub gap at %u of %u bytes ", m_pSession->m_dwChannel, dwParam, dwLen);
+			dwStale = dwNext - dwReceived - 1;
+			if (dwStale > m_Window.GetCeiling())
+			{
+				dwStale = m_Window.GetCeiling();
+			}
+			qwResume = m_qwStatusTime + (UINT64)dwStale * m_Window.GetFrameUs();
+			dwAcked = dwReceived;
+			dwNext = dwReceived;
+			dwRestart = dwReceived;
+			dwFresh = dwSent;
+		}
+	}
+
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes one block through the stub, compressed if this saves frames.
+  The block is sent again if the stub reports a CRC error.
+
+  @param dwOffset  offset of the block in the image
+  @param pbData    data of the block
+  @param dwLen     length of the block, up to the buffer size of the stub
+
+  @return TRUE if the stub stored the block
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::WriteBlock(UINT32 dwOffset, const UINT8* pbData, UINT32 dwLen)
+{
+	UINT32 dwChannel = m_pSession->m_dwChannel;
+	UINT32 dwAddr = m_pSession->m_Image.StartAdres + dwOffset;
+	UINT32 dwCrc = BootCrc32(pbData, dwLen);
+	UINT8  abCmd[7];
+	UINT8  bAck;
+	UINT8  bEvent;
+	UINT32 dwParam;
+
+	const UINT8* pbStream = pbData;
+	UINT32       dwStream = dwLen;
+	UINT8        bOp = STUB_OP_BLOCK;
+	std::vector<UINT8> Lz;
+	if (m_fLz)
+	{
+		BootLzCompress(pbData, dwLen, Lz);
+		if ((Lz.size() + m_dwFrameLen - 1) / m_dwFrameLen < (dwLen + m_dwFrameLen - 1) / m_dwFrameLen)
+		{
+			pbStream = Lz.data();
+			dwStream = (UINT32)Lz.size();
+			bOp = STUB_OP_BLOCK_LZ;
+		}
+	}
+
+	for (UINT32 dwRetry = 0; dwRetry < MAX_STUB_RETRIES; dwRetry++)
+	{
+		abCmd[0] = bOp;
+		abCmd[1] = (UINT8)(dwAddr >> 24);
+		abCmd[2] = (UINT8)(dwAddr >> 16);
+		abCmd[3] = (UINT8)(dwAddr >> 8);
+		abCmd[4] = (UINT8)dwAddr;
+		abCmd[5] = (UINT8)(dwStream >> 8);
+		abCmd[6] = (UINT8)dwStream;
+		if (!Command(RTO_STUB_CMD, abCmd, 7, STUB_EV_BLOCK, bAck, bEvent, dwParam))
+		{
+			return FALSE;
+		}
+		if (bAck != STUB_ACK)
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub rejects block at %08X, %u bytes (error %02X) ", dwChannel, dwAddr, dwLen, bEvent);
+			return FALSE;
+		}
+
+		if (!StreamBlock(pbStream, dwStream))
+		{
+			return FALSE;
+		}
+
+		abCmd[0] = STUB_OP_END;
+		abCmd[1] = (UINT8)(dwCrc >> 24);
+		abCmd[2] = (UINT8)(dwCrc >> 16);
+		abCmd[3] = (UINT8)(dwCrc >> 8);
+		abCmd[4] = (UINT8)dwCrc;
+		if (!Command(RTO_STUB_STORE, abCmd, 5, STUB_EV_STORED, bAck, bEvent, dwParam))
+		{
+			return FALSE;
+		}
+		if (bAck == STUB_ACK)
+		{
+			// the stub programs this block, so the one before is done
+			CommitBlock();
+			m_dwPendingOffset = dwOffset;
+			m_dwPendingLen = dwLen;
+			m_pSession->ShowProgress(m_pSession->m_dwWritten + m_dwPendingLen);
+			m_dwBlocks++;
+			m_dwStreamBytes += dwStream;
+			if (bOp == STUB_OP_BLOCK_LZ)
+			{
+				m_dwLzBlocks++;
+			}
+			return TRUE;
+		}
+
+		if (bEvent == STUB_EV_CRC)
+		{
+			m_dwCrcErrors++;
+			m_Window.OnLoss(0, m_pSession->m_aRto[RTO_STUB_DATA].GetSrtt(), m_qwStatusTime);
+		}
+		else if (bEvent != STUB_EV_GAP)
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub failed to program block at %08X (error %02X) ", dwChannel, dwAddr, bEvent);
+			return FALSE;
+		}
+		BootLog(LOG_DEBUG, "\n [%u] Stub block at %08X sent again (error %02X) ", dwChannel, dwAddr, bEvent);
+	}
+
+	BootLog(LOG_ERROR, "\n [%u] Stub block at %08X failed ", dwChannel, dwAddr);
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Writes the block stored before to the journal, it is programmed now.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootStub::CommitBlock(void)
+{
+	const HexData& Image = m_pSession->m_Image;
+
+	if (m_dwPendingLen == 0)
+	{
+		return;
+	}
+
+	for (UINT32 dwOffset = m_dwPendingOffset & ~0xFF; dwOffset < m_dwPendingOffset + m_dwPendingLen; dwOffset += 256)
+	{
+		UINT32 dwLen = Image.HexDataLen - dwOffset;
+		if (dwLen > 256)
+		{
+			dwLen = 256;
+		}
+		m_pSession->m_Journal.Commit(Image.StartAdres + dwOffset, dwLen, BootCrc32(&Image.Data[dwOffset], dwLen));
+	}
+	m_pSession->m_dwWritten += m_dwPendingLen;
+	m_dwPendingLen = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a command for an address range and waits for its status.
+  Answers with the address of another range are late answers to an
+  earlier command and ignored, the command is repeated if its own
+  answer does not follow.
+
+  @param bOp      STUB_OP_CHECK or STUB_OP_ERASE
+  @param bRto     command type, RTO_xxx
+  @param bEvent   event of the expected ACK
+  @param dwAddr   start address
+  @param dwLen    length in bytes, up to 16 MB
+  @param dwParam  receives the parameter of the status
+
+  @return TRUE if the stub acknowledged the command
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::RangeCommand(UINT8 bOp, UINT8 bRto, UINT8 bEvent, UINT32 dwAddr, UINT32 dwLen, UINT32& dwParam)
+{
+	UINT16 wTag = (UINT16)(dwAddr >> 8);
+	UINT8  abCmd[8];
+	UINT8  bAck;
+	UINT8  bResult;
+
+	abCmd[0] = bOp;
+	abCmd[1] = (UINT8)(dwAddr >> 24);
+	abCmd[2] = (UINT8)(dwAddr >> 16);
+	abCmd[3] = (UINT8)(dwAddr >> 8);
+	abCmd[4] = (UINT8)dwAddr;
+	abCmd[5] = (UINT8)(dwLen >> 16);
+	abCmd[6] = (UINT8)(dwLen >> 8);
+	abCmd[7] = (UINT8)dwLen;
+	for (UINT32 dwRetry = 0; ; dwRetry++)
+	{
+		if ((dwRetry == MAX_STUB_RETRIES) || !Command(bRto, abCmd, 8, bEvent, bAck, bResult, dwParam))
+		{
+			BootLog(LOG_ERROR, "\n [%u] Stub does not answer command %02X at %08X ", m_pSession->m_dwChannel, bOp, dwAddr);
+			return FALSE;
+		}
+
+		// the answer to this command follows within the timeout of the command
+		UINT64 qwDeadline = m_pSession->m_pTransport->GetTime() + m_pSession->m_aRto[bRto].GetTimeout();
+		while ((bAck == STUB_ACK) && ((bResult != bEvent) || (m_wStatusTag != wTag)))
+		{
+			if (!WaitStatus(qwDeadline, bAck, bResult, dwParam))
+			{
+				break;
+			}
+		}
+		if ((bAck != STUB_ACK) || ((bResult == bEvent) && (m_wStatusTag == wTag)))
+		{
+			break;
+		}
+
+		// a late answer to an earlier command came first and this one was lost
+		m_pSession->m_aRto[bRto].Backoff();
+		BootLog(LOG_DEBUG, "\n [%u] Stub repeats command %02X at %08X ", m_pSession->m_dwChannel, bOp, dwAddr);
+	}
+	if (bAck != STUB_ACK)
+	{
+		BootLog(LOG_ERROR, "\n [%u] Stub rejects the range at %08X (error %02X) ", m_pSession->m_dwChannel, dwAddr, bResult);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reads the CRC of a flash range.
+
+  @param dwAddr  start address
+  @param dwLen   length in bytes
+  @param dwCrc   receives the CRC-32 of the range
+
+  @return TRUE if the stub reported the CRC
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::QueryCrc(UINT32 dwAddr, UINT32 dwLen, UINT32& dwCrc)
+{
+	m_pSession->WaitTurn(RTO_STUB_CMD, FALSE);
+	BOOL fQueried = RangeCommand(STUB_OP_CHECK, RTO_STUB_CMD, STUB_EV_CHECK, dwAddr, dwLen, dwCrc);
+	m_pSession->EndTurn();
+	return fQueried;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Erases the sectors of a flash range.
+
+  @param dwAddr  start address of a sector
+  @param dwLen   length of whole sectors
+
+  @return TRUE if the range is erased
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::Erase(UINT32 dwAddr, UINT32 dwLen)
+{
+	UINT32 dwSectors;
+
+	m_pSession->WaitTurn(RTO_ERASE_DONE, FALSE);
+	BOOL fErased = RangeCommand(STUB_OP_ERASE, RTO_ERASE_DONE, STUB_EV_ERASED, dwAddr, dwLen, dwSectors);
+	m_pSession->EndTurn();
+	return fErased;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Compares the CRC of a programmed block with the image.
+
+  @param dwOffset  offset of the block in the image
+  @param dwLen     length of the block
+
+  @return TRUE if the flash holds the block
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootStub::CheckBlock(UINT32 dwOffset, UINT32 dwLen)
+{
+	const HexData& Image = m_pSession->m_Image;
+	UINT32 dwAddr = Image.StartAdres + dwOffset;
+	UINT32 dwCrc;
+
+	if (!RangeCommand(STUB_OP_CHECK, RTO_STUB_CMD, STUB_EV_CHECK, dwAddr, dwLen, dwCrc))
+	{
+		return FALSE;
+	}
+	if (dwCrc != BootCrc32(&Image.Data[dwOffset], dwLen))
+	{
+		BootLog(LOG_ERROR, "\n [%u] Verify error in block at %08X ", m_pSession->m_dwChannel, dwAddr);
+		return FALSE;
+	}
+	return TRUE;
+}
@@ -0,0 +1,180 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Fast loader stub in the RAM of the target.
+
+  @note
+	The ROM boot loader acknowledges every data frame, one frame of 8
+	bytes per round trip limits the throughput whatever the host does.
+	The stub is uploaded with Write Memory and started with Go. It
+	receives each block as a stream of data frames with sequence numbers
+	and a CRC at the end, and programs a block while the next one is
+	received (StubProtocol.hpp).
+
+	The stub images are built per STM32 family and found by the product
+	ID of the target. They are not part of this project; the simulated
+	target takes a built in placeholder image with the same header.
+
+	A block is written to the journal when the stub reports the next
+	block stored or all blocks flushed, the block is programmed then.
+
+	For a delta flash the stub also reports the CRC of the installed
+	sectors and erases the changed ones, the ROM boot loader is gone
+	once the stub runs.
+
+	Each block is compressed if the stub can decompress it and the
+	stream needs fewer frames than the plain data. On a classic bus
+	the frames are the whole cost. When all blocks are programmed, the
+	CRC of each block is checked by the stub.
+
+	The number of data frames in flight follows a congestion window
+	(BootWindow.hpp). It grows while the stub reports its progress in
+	time and shrinks on gaps, CRC errors, timeouts and a rising round
+	trip time, so the stream takes what the bus and the stub can carry.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTSTUB_HPP_
+#define _BOOTSTUB_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootSession.hpp"
+#include "BootDelta.hpp"
+#include "BootWindow.hpp"
+#include "StubProtocol.hpp"
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// result of CBootStub::Start()
+//
+#define STUB_START_OK                   0       // the stub runs
+#define STUB_START_UNAVAILABLE          1       // no stub, the ROM boot loader still runs
+#define STUB_START_FAILED               2       // Go was sent, but the stub does not answer
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// stub image of a family of targets
+//
+typedef struct {
+	UINT32      dwPid;                  // product ID reported by Get ID
+	const char* pszFamily;              // used in messages
+	const char* pszFile;                // file name of the image
+	UINT32      dwLoadAddr;             // RAM address behind the RAM of the ROM boot loader
+} StubEntry;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class uploads the stub through the ROM boot loader of a session
+  and writes the image of the session through the stub.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootStub
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootStub(CBootSession* pSession, const char* pszDir, BOOL fFd, BOOL fCompress);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	int  Load     (UINT32 dwPid);
+	int  Start    (UINT32 dwPid);
+	BOOL Write    (const std::vector<ImageRange>& Ranges, UINT32 dwResume, UINT32 dwDone);
+	BOOL QueryCrc (UINT32 dwAddr, UINT32 dwLen, UINT32& dwCrc);
+	BOOL Erase    (UINT32 dwAddr, UINT32 dwLen);
+	BOOL IsRunning(void) const { return (m_iStart == STUB_START_OK) ? TRUE : FALSE; }
+	void SetWindow(UINT32 dwFrames);
+	void Report   (void);
+
+	UINT32 GetImageLen (void) const { return (UINT32)m_Image.size(); }
+	UINT32 GetBlockSize(void) const { return m_sHeader.dwBufferSize; }
+	UINT32 GetFrameLen (void) const { return m_dwFrameLen; }
+	UINT32 GetWindow   (void) const { return m_Window.GetMax(); }
+	BOOL   IsFd        (void) const { return (m_bFlags & CAN_FLAG_FD) ? TRUE : FALSE; }
+
+  private:
+	//---------------------------------------------------------------
+	// frame exchange
+	//---------------------------------------------------------------
+	void TransmitFrame(UINT32 dwMsgId, UINT32 dwLen, const UINT8* pbData);
+	BOOL WaitStatus   (UINT64 qwDeadline, UINT8& bAck, UINT8& bEvent, UINT32& dwParam);
+	BOOL Command      (UINT8 bRto, const UINT8* pbCmd, UINT32 dwLen, UINT8 bEvent,
+	                   UINT8& bAck, UINT8& bResult, UINT32& dwParam);
+	BOOL RangeCommand (UINT8 bOp, UINT8 bRto, UINT8 bEvent, UINT32 dwAddr, UINT32 dwLen, UINT32& dwParam);
+
+	//---------------------------------------------------------------
+	// stub commands
+	//---------------------------------------------------------------
+	int  Upload     (UINT32 dwPid);
+	BOOL Probe      (void);
+	BOOL Flush      (void);
+	BOOL StreamBlock(const UINT8* pbData, UINT32 dwLen);
+	BOOL WriteBlock (UINT32 dwOffset, const UINT8* pbData, UINT32 dwLen);
+	void CommitBlock(void);
+	BOOL CheckBlock (UINT32 dwOffset, UINT32 dwLen);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CBootSession*  m_pSession;          // ROM boot loader, transport and journal
+	std::string    m_strDir;            // directory of the stub images
+	BOOL           m_fSimulated;        // take the built in image
+	BOOL           m_fFd;               // CAN FD is requested
+	BOOL           m_fCompress;         // compression is allowed
+	CBootWindow    m_Window;            // data frames in flight
+
+	int            m_iLoad;             // result of the first Load(), -1 = not loaded
+	int            m_iStart;            // result of the first Start(), -1 = not started
+	const StubEntry* m_pEntry;          // stub of the target, NULL = none
+
+	std::vector<UINT8> m_Image;         // stub image
+	StubHeader     m_sHeader;           // header of the stub image
+	UINT32         m_dwFrameLen;        // bytes per data frame
+	UINT8          m_bFlags;            // CAN_FLAG_xxx of the data frames
+	BOOL           m_fLz;               // blocks are compressed if it pays
+	UINT64         m_qwStatusTime;      // time of the last status frame
+	UINT64         m_qwStatusBusTime;   // bus time stamp of the last status frame, 0 = none
+	UINT16         m_wStatusTag;        // bytes 6 and 7 of the last status frame
+
+	UINT64         m_aqwSent[STUB_SEQ_MOD]; // send time per sequence number
+	UINT32         m_adwFlight[STUB_SEQ_MOD]; // frames in flight when the frame was sent
+	UINT32         m_dwPendingOffset;   // image offset of the block stored last
+	UINT32         m_dwPendingLen;      // length of the block stored last, 0 = none
+
+	UINT32         m_dwBlocks;          // blocks stored by the stub
+	UINT32         m_dwDataFrames;      // data frames sent
+	UINT32         m_dwLzBlocks;        // blocks sent compressed
+	UINT32         m_dwStreamBytes;     // bytes of the block streams, compressed or not
+	UINT32         m_dwGaps;            // gaps reported by the stub
+	UINT32         m_dwStreamTimeouts;  // streams restarted after a timeout
+	UINT32         m_dwCrcErrors;       // blocks sent again after a CRC error
+	UINT64         m_qwUploadTime;      // duration of upload and start
+	UINT64         m_qwWriteTime;       // duration of the write through the stub
+};
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+const StubEntry* BootStubFind(UINT32 dwPid);
+BOOL BootStubLoad     (const StubEntry* pEntry, const char* pszDir, std::vector<UINT8>& Image, StubHeader& sHeader);
+void BootStubMakeImage(const StubEntry* pEntry, BOOL fFd, std::vector<UINT8>& Image, StubHeader& sHeader);
+
+#endif //_BOOTSTUB_HPP_
@@ -0,0 +1,797 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Unit tests of the building blocks of the flashing protocol.
+
+  @note
+	Each test checks one module on its own, without a bus, a target or
+	a session, against values worked out by hand from its rules. A
+	failed check prints its file, line and expression and the test run
+	goes on, the program ends with exit code 1 if any check failed, so
+	it can run as a build step:
+
+	  VCIBootTest [name ...]
+
+	runs the named tests, all of them without a name.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootDispatch.hpp"
+#include "BootGeometry.hpp"
+#include "BootLz.hpp"
+#include "BootProtocol.hpp"
+#include "BootRto.hpp"
+#include "BootWindow.hpp"
+#include "CanFilter.hpp"
+#include "CanTiming.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define ARRAY_COUNT(a)          (sizeof(a) / sizeof((a)[0]))
+
+// counts a check, prints the expression if it fails
+#define TEST_CHECK(c)           TestCheck((c) ? TRUE : FALSE, __FILE__, __LINE__, #c)
+
+// compares two integers, prints both values if they differ
+#define TEST_EQUAL(a, b)        TestEqual((UINT64)(a), (UINT64)(b), __FILE__, __LINE__, #a, #b)
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	const char* pszName;                // name on the command line
+	void      (*pfnTest)(void);         // runs the checks of the test
+} UnitTest;
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void TestCheck(BOOL fOk, const char* pszFile, int iLine, const char* pszExpr);
+void TestEqual(UINT64 qwA, UINT64 qwB, const char* pszFile, int iLine, const char* pszA, const char* pszB);
+void TestRto  (void);
+void TestLz   (void);
+void TestErase(void);
+void TestTiming(void);
+void TestFilter(void);
+void TestDispatch(void);
+void TestWindow(void);
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+static const UnitTest asTests[] =
+{
+	{ "rto",      TestRto      },
+	{ "lz",       TestLz       },
+	{ "erase",    TestErase    },
+	{ "timing",   TestTiming   },
+	{ "filter",   TestFilter   },
+	{ "dispatch", TestDispatch },
+	{ "window",   TestWindow   },
+};
+
+static UINT32 dwChecks = 0;             // checks done
+static UINT32 dwFailed = 0;             // checks failed
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Main entry point of the unit tests.
+
+  @return 0 if all checks passed, 1 if one failed or a name is unknown
+*/
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	UINT32 dwTests = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		UINT32 n;
+		for (n = 0; n < ARRAY_COUNT(asTests); n++)
+		{
+			if (strcmp(argv[i], asTests[n].pszName) == 0)
+			{
+				break;
+			}
+		}
+		if (n == ARRAY_COUNT(asTests))
+		{
+			printf("unknown test %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (UINT32 n = 0; n < ARRAY_COUNT(asTests); n++)
+	{
+		BOOL fRun = (argc < 2);
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], asTests[n].pszName) == 0)
+			{
+				fRun = TRUE;
+			}
+		}
+		if (fRun)
+		{
+			UINT32 dwBefore = dwFailed;
+			asTests[n].pfnTest();
+			printf("%-10s %s\n", asTests[n].pszName, (dwFailed == dwBefore) ? "ok" : "FAILED");
+			dwTests++;
+		}
+	}
+
+	printf("%u tests, %u checks, %u failed\n", dwTests, dwChecks, dwFailed);
+	return dwFailed ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Counts a check and prints it if it failed.
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestCheck(BOOL fOk, const char* pszFile, int iLine, const char* pszExpr)
+{
+	dwChecks++;
+	if (!fOk)
+	{
+		dwFailed++;
+		printf("%s(%d): check failed: %s\n", pszFile, iLine, pszExpr);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Counts a comparison and prints both values if they differ.
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestEqual(UINT64 qwA, UINT64 qwB, const char* pszFile, int iLine, const char* pszA, const char* pszB)
+{
+	dwChecks++;
+	if (qwA != qwB)
+	{
+		dwFailed++;
+		printf("%s(%d): check failed: %s == %s (%llu != %llu)\n",
+		       pszFile, iLine, pszA, pszB, (unsigned long long)qwA, (unsigned long long)qwB);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the response timeout of RFC 6298: the first sample sets SRTT
+  to R and RTTVAR to R/2, each further one moves RTTVAR by 1/4 of
+  |SRTT - R| and SRTT by 1/8 of R, the timeout is SRTT plus the larger
+  of 4 * RTTVAR and the granularity. Backoff doubles the timeout until
+  the next sample, the bounds and the slack apply to the result.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestRto(void)
+{
+	// initial timeout until the first sample
+	CRtoEstimator Rto(100000, 2000, 1000000);
+	TEST_EQUAL(Rto.GetTimeout(), 100000);
+	TEST_EQUAL(Rto.GetSamples(), 0);
+
+	// first sample: 10000 + 4 * 5000
+	Rto.AddSample(10000);
+	TEST_EQUAL(Rto.GetSrtt(), 10000);
+	TEST_EQUAL(Rto.GetRttVar(), 5000);
+	TEST_EQUAL(Rto.GetTimeout(), 30000);
+
+	// RTTVAR is updated with the old SRTT:
+	// 3/4 * 5000 + 1/4 * 8000 = 5750, 7/8 * 10000 + 1/8 * 18000 = 11000
+	Rto.AddSample(18000);
+	TEST_EQUAL(Rto.GetRttVar(), 5750);
+	TEST_EQUAL(Rto.GetSrtt(), 11000);
+	TEST_EQUAL(Rto.GetTimeout(), 34000);
+	TEST_EQUAL(Rto.GetMaxRtt(), 18000);
+	TEST_EQUAL(Rto.GetSamples(), 2);
+
+	// a steady round trip time lets the variation decay
+	for (UINT32 i = 0; i < 100; i++)
+	{
+		Rto.AddSample(11000);
+	}
+	TEST_EQUAL(Rto.GetSrtt(), 11000);
+	TEST_CHECK(Rto.GetRttVar() < 10);
+	TEST_CHECK(Rto.GetTimeout() < 11040);
+
+	// backoff doubles until the next sample
+	CRtoEstimator Back(100000, 2000, 1000000);
+	Back.AddSample(10000);
+	Back.Backoff();
+	TEST_EQUAL(Back.GetTimeout(), 60000);
+	Back.Backoff();
+	TEST_EQUAL(Back.GetTimeout(), 120000);
+	TEST_EQUAL(Back.GetTimeouts(), 2);
+	for (UINT32 i = 0; i < 40; i++)
+	{
+		Back.Backoff();
+	}
+	TEST_EQUAL(Back.GetTimeout(), 1000000);
+	TEST_EQUAL(Back.GetTimeouts(), 42);
+	Back.AddSample(10000);
+	TEST_EQUAL(Back.GetTimeout(), 10000 + 4 * 3750);
+
+	// lower bound: 100 + 4 * 50 is raised to the minimum
+	CRtoEstimator Min(100000, 2000, 1000000);
+	Min.AddSample(100);
+	TEST_EQUAL(Min.GetTimeout(), 2000);
+
+	// upper bound: 900000 + 4 * 450000 is cut to the maximum
+	CRtoEstimator Max(100000, 2000, 1000000);
+	Max.AddSample(900000);
+	TEST_EQUAL(Max.GetTimeout(), 1000000);
+
+	// the granularity bounds the variation term from below
+	CRtoEstimator Gran(100000, 0, 1000000);
+	Gran.SetGranularity(5000);
+	Gran.AddSample(1000);
+	TEST_EQUAL(Gran.GetTimeout(), 1000 + 5000);
+	Gran.AddSample(1000);
+	TEST_EQUAL(Gran.GetRttVar(), 375);
+	TEST_EQUAL(Gran.GetTimeout(), 1000 + 5000);
+
+	// the slack is added after the lower bound and cut by the upper one
+	CRtoEstimator Slack(100000, 2000, 1000000);
+	Slack.SetSlack(4000);
+	Slack.AddSample(100);
+	TEST_EQUAL(Slack.GetTimeout(), 2000 + 4000);
+	Slack.AddSample(900000);
+	TEST_EQUAL(Slack.GetTimeout(), 1000000);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks that BootLzDecompress restores what BootLzCompress packed, for
+  empty and short blocks without a match, runs which the matches
+  overlap, literals and matches with length bytes of 255, random data
+  and a block of LZ_MAX_LEN. A stream which is cut, too long for the
+  buffer or refers before its start is rejected.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestLz(void)
+{
+	static const UINT32 adwLen[] = { 0, 1, 12, 13, 18, 300, 4096, LZ_MAX_LEN };
+	std::vector<UINT8> Data;
+	std::vector<UINT8> Stream;
+	std::vector<UINT8> Out;
+	UINT32 dwSeed = 0x12345678;
+
+	for (UINT32 n = 0; n < ARRAY_COUNT(adwLen); n++)
+	{
+		// kind 0: one byte repeated, 1: a counter, 2: random, 3: code-like mix
+		for (UINT32 dwKind = 0; dwKind < 4; dwKind++)
+		{
+			Data.resize(adwLen[n]);
+			for (UINT32 i = 0; i < adwLen[n]; i++)
+			{
+				dwSeed = dwSeed * 1103515245 + 12345;
+				switch (dwKind)
+				{
+					case 0:  Data[i] = 0xFF;                  break;
+					case 1:  Data[i] = (UINT8)i;              break;
+					case 2:  Data[i] = (UINT8)(dwSeed >> 16); break;
+					default: Data[i] = ((i / 64) & 1) ? (UINT8)(i & 0x0F) : (UINT8)(dwSeed >> 16); break;
+				}
+			}
+
+			BootLzCompress(Data.data(), adwLen[n], Stream);
+			TEST_EQUAL(((UINT32)Stream[0] << 8) | Stream[1], adwLen[n]);
+			TEST_CHECK(BootLzDecompress(Stream.data(), (UINT32)Stream.size(), Out, LZ_MAX_LEN));
+			TEST_CHECK(Out == Data);
+
+			// the buffer of the stub must hold the whole block, a stream
+			// without its last byte is incomplete
+			if (adwLen[n] > 0)
+			{
+				TEST_CHECK(!BootLzDecompress(Stream.data(), (UINT32)Stream.size(), Out, adwLen[n] - 1));
+				TEST_CHECK(!BootLzDecompress(Stream.data(), (UINT32)Stream.size() - 1, Out, LZ_MAX_LEN));
+			}
+		}
+	}
+
+	// a run packs into one match which overlaps its own output
+	Data.assign(4096, 0x5A);
+	BootLzCompress(Data.data(), (UINT32)Data.size(), Stream);
+	TEST_CHECK(Stream.size() < 40);
+
+	// a stream shorter than the header and a token is corrupt
+	UINT8 abShort[] = { 0x00, 0x00 };
+	TEST_CHECK(!BootLzDecompress(abShort, sizeof(abShort), Out, LZ_MAX_LEN));
+
+	// a match at offset 0 or before the first byte is corrupt
+	UINT8 abZero[] = { 0x00, 0x08, 0x40, 'a', 'b', 'c', 'd', 0x00, 0x00 };
+	TEST_CHECK(!BootLzDecompress(abZero, sizeof(abZero), Out, LZ_MAX_LEN));
+	UINT8 abBefore[] = { 0x00, 0x08, 0x40, 'a', 'b', 'c', 'd', 0x05, 0x00 };
+	TEST_CHECK(!BootLzDecompress(abBefore, sizeof(abBefore), Out, LZ_MAX_LEN));
+	UINT8 abGood[] = { 0x00, 0x08, 0x40, 'a', 'b', 'c', 'd', 0x04, 0x00 };
+	TEST_CHECK(BootLzDecompress(abGood, sizeof(abGood), Out, LZ_MAX_LEN));
+	TEST_CHECK((Out.size() == 8) && (memcmp(Out.data(), "abcdabcd", 8) == 0));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the erase planner on the sectors of an F4, a dual bank F4, an
+  F1 and a uniform layout: the sectors which the range touches are
+  erased one by one while their typical erase time stays below a mass
+  erase, otherwise and for a range outside the flash the plan is
+  empty.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestErase(void)
+{
+	CFlashLayout Layout;
+	std::vector<UINT32> Sectors;
+
+	TEST_CHECK(!Layout.SetPart(0x123, 0));
+
+	// F405/407: 4 * 16 KB, 64 KB, 7 * 128 KB
+	TEST_CHECK(Layout.SetPart(0x413, 0));
+	TEST_EQUAL(Layout.GetSectors(), 12);
+	TEST_EQUAL(Layout.GetAddr(4), 0x08010000);
+	TEST_EQUAL(Layout.GetSize(4), 0x10000);
+	TEST_EQUAL(Layout.GetAddr(5), 0x08020000);
+	TEST_EQUAL(Layout.GetFlashSize(), 0x100000);
+
+	TEST_CHECK(Layout.PlanErase(0x08000000, 20 * 1024, Sectors));
+	TEST_CHECK(Sectors == std::vector<UINT32>({ 0, 1 }));
+
+	// two bytes across the end of sector 3
+	TEST_CHECK(Layout.PlanErase(0x0800FFFF, 2, Sectors));
+	TEST_CHECK(Sectors == std::vector<UINT32>({ 3, 4 }));
+
+	// 512 KB take 5.12 s sector by sector, a mass erase 8 s
+	TEST_CHECK(Layout.PlanErase(0x08000000, 0x80000, Sectors));
+	TEST_CHECK(Sectors == std::vector<UINT32>({ 0, 1, 2, 3, 4, 5, 6, 7 }));
+
+	// the whole flash takes 10.24 s sector by sector
+	TEST_CHECK(!Layout.PlanErase(0x08000000, 0x100000, Sectors));
+	TEST_CHECK(Sectors.empty());
+
+	// empty ranges and ranges outside the flash
+	TEST_CHECK(!Layout.PlanErase(0x08000000, 0, Sectors));
+	TEST_CHECK(!Layout.PlanErase(0x07FFFFFF, 2, Sectors));
+	TEST_CHECK(!Layout.PlanErase(0x080FFFFF, 2, Sectors));
+	TEST_CHECK(Sectors.empty());
+
+	// a smaller device of the family ends after sector 7
+	TEST_CHECK(Layout.SetPart(0x413, 0x80000));
+	TEST_EQUAL(Layout.GetSectors(), 8);
+	TEST_CHECK(!Layout.PlanErase(0x08080000, 1, Sectors));
+
+	// F42x/43x: the second bank repeats the sectors, numbered on
+	TEST_CHECK(Layout.SetPart(0x419, 0));
+	TEST_EQUAL(Layout.GetSectors(), 24);
+	TEST_EQUAL(Layout.GetAddr(12), 0x08100000);
+	TEST_EQUAL(Layout.GetSize(12), 0x4000);
+	TEST_CHECK(Layout.PlanErase(0x080FFFFF, 2, Sectors));
+	TEST_CHECK(Sectors == std::vector<UINT32>({ 11, 12 }));
+
+	// F1 medium density: a page takes 20 ms, a mass erase 40 ms
+	TEST_CHECK(Layout.SetPart(0x410, 0));
+	TEST_EQUAL(Layout.GetSectors(), 128);
+	TEST_CHECK(Layout.PlanErase(0x08000400, 1024, Sectors));
+	TEST_CHECK(Sectors == std::vector<UINT32>({ 1 }));
+	TEST_CHECK(!Layout.PlanErase(0x08000400, 1025, Sectors));
+	TEST_CHECK(Sectors.empty());
+
+	// uniform sectors have no erase times to plan with
+	Layout.SetUniform(2048, 0x10000);
+	TEST_EQUAL(Layout.GetSectors(), 32);
+	TEST_CHECK(!Layout.PlanErase(0x08000000, 1, Sectors));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the bit lengths of frames: the stuff bits of frames of all
+  zeros, the worst case of classic frames from the literature (55 bits
+  without, 135 bits with 8 data bytes, intermission included) and that
+  no stuffed frame is longer than the worst case of its length. The
+  durations round up to whole nanoseconds.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestTiming(void)
+{
+	static const UINT32 adwFdLen[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+	CanFrame sFrame;
+	CanBits  sBits;
+	CanBits  sMax;
+
+	// classic, 19 zeros and a CRC of zeros: a stuff bit after every 5
+	memset(&sFrame, 0, sizeof(sFrame));
+	CanFrameBits(sFrame, FALSE, sBits);
+	TEST_EQUAL(sBits.dwStuff, 6);
+	TEST_EQUAL(sBits.dwNominal, 34 + 6 + 13);
+	TEST_EQUAL(sBits.dwData, 0);
+
+	// worst case of classic frames
+	CanFrameBitsMax(0, FALSE, sMax);
+	TEST_EQUAL(sMax.dwNominal, 55);
+	CanFrameBitsMax(8, FALSE, sMax);
+	TEST_EQUAL(sMax.dwNominal, 135);
+	TEST_EQUAL(sMax.dwStuff, 24);
+	TEST_EQUAL(sMax.dwData, 0);
+
+	// CAN FD without data: 14 zeros with 2 stuff bits and FDF, res, BRS
+	// go with the nominal bit rate, ESI and DLC with one stuff bit and
+	// the CRC of 17 bits with 6 fixed stuff bits with the data bit rate
+	sFrame.bFlags = CAN_FLAG_FD;
+	CanFrameBits(sFrame, TRUE, sBits);
+	TEST_EQUAL(sBits.dwNominal, 14 + 2 + 3 + 13);
+	TEST_EQUAL(sBits.dwData, 5 + 1 + 4 + 17 + 6);
+	TEST_EQUAL(sBits.dwStuff, 2 + 1 + 6);
+
+	// a CAN FD frame on a bus without data bit rate is a classic frame
+	CanFrameBits(sFrame, FALSE, sBits);
+	TEST_EQUAL(sBits.dwNominal, 34 + 6 + 13);
+	TEST_EQUAL(sBits.dwData, 0);
+
+	// no frame is longer than the worst case, without the stuff bits
+	// both have the same length
+	UINT32 dwSeed = 0x12345678;
+	for (UINT32 n = 0; n < ARRAY_COUNT(adwFdLen); n++)
+	{
+		for (UINT32 dwRun = 0; dwRun < 64; dwRun++)
+		{
+			BOOL fFd = (adwFdLen[n] > CAN_MAX_LEN) || (dwRun & 1);
+
+			dwSeed = dwSeed * 1103515245 + 12345;
+			sFrame.dwMsgId = (dwRun < 2) ? 0x000 : (dwRun < 4) ? 0x7FF : (dwSeed >> 16) & 0x7FF;
+			sFrame.bLen = (UINT8)adwFdLen[n];
+			sFrame.bFlags = fFd ? CAN_FLAG_FD : 0;
+			for (UINT32 i = 0; i < adwFdLen[n]; i++)
+			{
+				dwSeed = dwSeed * 1103515245 + 12345;
+				sFrame.abData[i] = (dwRun < 4) ? (UINT8)((dwRun & 2) ? 0xFF : 0x00) : (UINT8)(dwSeed >> 16);
+			}
+
+			CanFrameBits(sFrame, fFd, sBits);
+			CanFrameBitsMax(adwFdLen[n], fFd, sMax);
+			TEST_CHECK(sBits.dwStuff <= sMax.dwStuff);
+			TEST_CHECK(sBits.dwNominal + sBits.dwData <= sMax.dwNominal + sMax.dwData);
+			TEST_EQUAL(sBits.dwNominal + sBits.dwData - sBits.dwStuff, sMax.dwNominal + sMax.dwData - sMax.dwStuff);
+		}
+	}
+
+	// durations: 135 bits at 500 kbit/s, 32 + 33 bits at 500 kbit/s
+	// and 2 Mbit/s, a partial nanosecond counts as a whole one
+	CanFrameBitsMax(8, FALSE, sMax);
+	TEST_EQUAL(CanBitsTimeNs(sMax, 500000, 2000000), 270000);
+	sBits.dwNominal = 32;
+	sBits.dwData = 33;
+	TEST_EQUAL(CanBitsTimeNs(sBits, 500000, 2000000), 64000 + 16500);
+	TEST_EQUAL(CanBitsTimeNs(sBits, 500000, 0), 130000);
+	sBits.dwNominal = 1;
+	sBits.dwData = 0;
+	TEST_EQUAL(CanBitsTimeNs(sBits, 3, 0), 333333334);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the acceptance filter: open until the first identifier, then
+  exactly the added standard identifiers, including those at the
+  borders of the words of the bitmap, and the added extended ones. A
+  random set is compared with every standard identifier.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestFilter(void)
+{
+	CCanFilter Filter;
+	std::vector<UINT32> Ids;
+
+	// an empty filter accepts all frames
+	TEST_CHECK(Filter.IsOpen());
+	TEST_CHECK(Filter.Accepts(0x000));
+	TEST_CHECK(Filter.Accepts(0x7FF));
+	TEST_CHECK(Filter.Accepts(0x1FFFFFFF));
+	Filter.GetIds(Ids);
+	TEST_CHECK(Ids.empty());
+
+	// the first identifier closes it
+	Filter.Add(0x79);
+	TEST_CHECK(!Filter.IsOpen());
+	TEST_CHECK(Filter.Accepts(0x79));
+	TEST_CHECK(!Filter.Accepts(0x78));
+	TEST_CHECK(!Filter.Accepts(0x7A));
+	TEST_CHECK(!Filter.Accepts(0x79 + CAN_STD_IDS));
+
+	// borders of the words of the bitmap, an identifier added twice
+	Filter.Add(0x000);
+	Filter.Add(0x01F);
+	Filter.Add(0x020);
+	Filter.Add(0x7FF);
+	Filter.Add(0x020);
+	TEST_CHECK(Filter.Accepts(0x000) && Filter.Accepts(0x01F) && Filter.Accepts(0x020) && Filter.Accepts(0x7FF));
+	TEST_CHECK(!Filter.Accepts(0x001) && !Filter.Accepts(0x01E) && !Filter.Accepts(0x021) && !Filter.Accepts(0x7FE));
+	TEST_CHECK(!Filter.HasExt());
+	Filter.GetIds(Ids);
+	TEST_CHECK(Ids == std::vector<UINT32>({ 0x000, 0x01F, 0x020, 0x079, 0x7FF }));
+
+	// extended identifiers are not part of the standard list
+	Filter.Add(0x800);
+	Filter.Add(0x1FFFFFFF);
+	TEST_CHECK(Filter.HasExt());
+	TEST_CHECK(Filter.Accepts(0x800));
+	TEST_CHECK(Filter.Accepts(0x1FFFFFFF));
+	TEST_CHECK(!Filter.Accepts(0x801));
+	TEST_CHECK(!Filter.Accepts(0x1FFFFFFE));
+	Filter.GetIds(Ids);
+	TEST_EQUAL(Ids.size(), 5);
+
+	// clear opens the filter again
+	Filter.Clear();
+	TEST_CHECK(Filter.IsOpen());
+	TEST_CHECK(!Filter.HasExt());
+	TEST_CHECK(Filter.Accepts(0x123));
+	Filter.GetIds(Ids);
+	TEST_CHECK(Ids.empty());
+
+	// a random set against all standard identifiers
+	std::vector<BOOL> Model(CAN_STD_IDS, FALSE);
+	UINT32 dwSeed = 0x12345678;
+	for (UINT32 i = 0; i < 200; i++)
+	{
+		dwSeed = dwSeed * 1103515245 + 12345;
+		UINT32 dwMsgId = (dwSeed >> 16) % CAN_STD_IDS;
+		Filter.Add(dwMsgId);
+		Model[dwMsgId] = TRUE;
+	}
+	UINT32 dwMismatch = 0;
+	UINT32 dwCount = 0;
+	for (UINT32 dwMsgId = 0; dwMsgId < CAN_STD_IDS; dwMsgId++)
+	{
+		if (Filter.Accepts(dwMsgId) != Model[dwMsgId])
+		{
+			dwMismatch++;
+		}
+		dwCount += Model[dwMsgId] ? 1 : 0;
+	}
+	TEST_EQUAL(dwMismatch, 0);
+	Filter.GetIds(Ids);
+	TEST_EQUAL(Ids.size(), dwCount);
+	for (size_t i = 1; i < Ids.size(); i++)
+	{
+		TEST_CHECK(Ids[i - 1] < Ids[i]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the dispatch table: a response completes its request once,
+  a NACK or a foreign byte does not complete it and a retired request
+  takes late frames. The identifiers of 32 nodes collide in the table
+  and each finds its own request. When the table is full a new
+  identifier takes the entry retired longest ago, never a pending one.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestDispatch(void)
+{
+	CBootDispatch Dispatch;
+	UINT32 dwState;
+
+	// one request: ACK once, then late
+	TEST_CHECK(Dispatch.Expect(BOOT_CMD_WRITE, STATE_WRITE_START, STATE_WRITE_START_COMLETE));
+	dwState = STATE_WRITE_START | STATE_BOOT_LOADER_STARTED;
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, BOOT_ACK, dwState), DISPATCH_ACK);
+	TEST_EQUAL(dwState, STATE_WRITE_START_COMLETE | STATE_BOOT_LOADER_STARTED);
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, BOOT_ACK, dwState), DISPATCH_LATE);
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_ERASE, BOOT_ACK, dwState), DISPATCH_UNSOLICITED);
+
+	// the wait bits tell the write command from its data frames
+	TEST_CHECK(Dispatch.Expect(BOOT_CMD_WRITE, STATE_WRITE_DATA_BLOCK, STATE_WRITE_DATA_BLOCK_COMPLETE));
+	dwState = STATE_WRITE_START;
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, BOOT_ACK, dwState), DISPATCH_LATE);
+	TEST_EQUAL(dwState, STATE_WRITE_START);
+
+	// a data byte stays late, a NACK completes without the done bits
+	dwState = STATE_WRITE_DATA_BLOCK;
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, 0x55, dwState), DISPATCH_LATE);
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, BOOT_NACK, dwState), DISPATCH_NACK);
+	TEST_EQUAL(dwState, STATE_WRITE_DATA_BLOCK);
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_WRITE, BOOT_ACK, dwState), DISPATCH_LATE);
+
+	// a retired request only takes late frames
+	TEST_CHECK(Dispatch.Expect(BOOT_CMD_GO, STATE_GO, STATE_GO_COMPLETE));
+	Dispatch.Retire();
+	dwState = STATE_GO;
+	TEST_EQUAL(Dispatch.Dispatch(BOOT_CMD_GO, BOOT_ACK, dwState), DISPATCH_LATE);
+	TEST_EQUAL(dwState, STATE_GO);
+
+	TEST_EQUAL(Dispatch.GetMatched(), 2);
+	TEST_EQUAL(Dispatch.GetLate(), 5);
+	TEST_EQUAL(Dispatch.GetUnsolicited(), 1);
+
+	// the same command of 32 nodes, the ID bases differ in the upper
+	// bits only: all pending at once, each ACK finds its own request
+	CBootDispatch Full;
+	UINT32 adwId[DISPATCH_SLOTS];
+	for (UINT32 i = 0; i < DISPATCH_SLOTS; i++)
+	{
+		adwId[i] = i * CAN_ID_RANGE + BOOT_CMD_WRITE;
+		TEST_CHECK(Full.Expect(adwId[i], 0x01, (i + 1) << 8));
+	}
+	TEST_CHECK(Full.Expect(adwId[3], 0x01, 4 << 8));
+	TEST_CHECK(!Full.Expect(DISPATCH_SLOTS * CAN_ID_RANGE + BOOT_CMD_WRITE, 0x01, 0));
+	for (UINT32 i = 0; i < DISPATCH_SLOTS; i++)
+	{
+		dwState = 0x01;
+		TEST_EQUAL(Full.Dispatch(adwId[i], BOOT_ACK, dwState), DISPATCH_ACK);
+		TEST_EQUAL(dwState, (i + 1) << 8);
+	}
+
+	// all retired: a new identifier takes the entry of the oldest
+	// request, node 0, whose frames are unsolicited from then on, the
+	// other nodes still find their entries
+	for (UINT32 i = 0; i < DISPATCH_SLOTS; i++)
+	{
+		TEST_CHECK(Full.Expect(adwId[i], 0x01, 0x02));
+	}
+	Full.Retire();
+	UINT32 dwNew = DISPATCH_SLOTS * CAN_ID_RANGE + BOOT_CMD_WRITE;
+	TEST_CHECK(Full.Expect(dwNew, 0x01, 0x02));
+	dwState = 0x01;
+	TEST_EQUAL(Full.Dispatch(adwId[0], BOOT_ACK, dwState), DISPATCH_UNSOLICITED);
+	for (UINT32 i = 1; i < DISPATCH_SLOTS; i++)
+	{
+		TEST_EQUAL(Full.Dispatch(adwId[i], BOOT_ACK, dwState), DISPATCH_LATE);
+	}
+	TEST_EQUAL(Full.Dispatch(dwNew, BOOT_ACK, dwState), DISPATCH_ACK);
+	TEST_EQUAL(dwState, 0x02);
+
+	// a pending request keeps its entry: node 5 is entered again, 31
+	// new identifiers take the other entries, then the table is full
+	Full.Retire();
+	TEST_CHECK(Full.Expect(adwId[5], 0x01, 0x04));
+	for (UINT32 i = 1; i < DISPATCH_SLOTS; i++)
+	{
+		TEST_CHECK(Full.Expect(dwNew + i * CAN_ID_RANGE, 0x01, 0x02));
+	}
+	TEST_CHECK(!Full.Expect(dwNew + DISPATCH_SLOTS * CAN_ID_RANGE, 0x01, 0x02));
+	dwState = 0x01;
+	TEST_EQUAL(Full.Dispatch(adwId[5], BOOT_ACK, dwState), DISPATCH_ACK);
+	TEST_EQUAL(dwState, 0x04);
+	TEST_EQUAL(Full.Dispatch(adwId[6], BOOT_ACK, dwState), DISPATCH_UNSOLICITED);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks the congestion window between 4 and 32 frames: slow start by
+  the frames received, one frame per window of frames above SSTHRESH,
+  halving on a loss at most once per SRTT, the ceiling one frame below
+  an overrun and its probe, the reset on a timeout and the cut after a
+  whole window of samples above the round trip time before.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void TestWindow(void)
+{
+	// slow start up to the maximum
+	CBootWindow Window(4, 32);
+	TEST_EQUAL(Window.Get(), 4);
+	TEST_EQUAL(Window.GetCeiling(), 32);
+	Window.OnProgress(4);
+	TEST_EQUAL(Window.Get(), 8);
+	Window.OnProgress(8);
+	TEST_EQUAL(Window.Get(), 16);
+	Window.OnProgress(100);
+	TEST_EQUAL(Window.Get(), 32);
+	TEST_EQUAL(Window.GetLargest(), 32);
+
+	// a loss of an unknown frame halves it, not again within SRTT
+	TEST_CHECK(Window.OnLoss(0, 1000, 0));
+	TEST_EQUAL(Window.Get(), 16);
+	TEST_EQUAL(Window.GetCeiling(), 32);
+	TEST_CHECK(!Window.OnLoss(0, 1000, 999));
+	TEST_EQUAL(Window.Get(), 16);
+
+	// above SSTHRESH a window of frames adds one frame
+	Window.OnProgress(16);
+	TEST_EQUAL(Window.Get(), 17);
+	Window.OnProgress(8);
+	TEST_EQUAL(Window.Get(), 17);
+
+	// halving ends at the minimum: 17 -> 8.5 -> 4.25 -> 4
+	TEST_CHECK(Window.OnLoss(0, 1000, 1000));
+	TEST_EQUAL(Window.Get(), 8);
+	TEST_CHECK(Window.OnLoss(0, 1000, 2000));
+	TEST_CHECK(Window.OnLoss(0, 1000, 3000));
+	TEST_CHECK(!Window.OnLoss(0, 1000, 4000));
+	TEST_EQUAL(Window.Get(), 4);
+	TEST_EQUAL(Window.GetLossCuts(), 4);
+
+	// a timeout starts over at the minimum, slow start ends at half
+	// the window before
+	CBootWindow Reset(4, 32);
+	Reset.OnProgress(12);
+	Reset.OnTimeout(1000, 0);
+	TEST_EQUAL(Reset.Get(), 4);
+	TEST_EQUAL(Reset.GetResets(), 1);
+	Reset.OnProgress(8);
+	TEST_EQUAL(Reset.Get(), 8);
+	Reset.OnProgress(8);
+	TEST_EQUAL(Reset.Get(), 9);
+
+	// the maximum is never below the minimum
+	Reset.SetMax(6);
+	TEST_EQUAL(Reset.Get(), 6);
+	TEST_EQUAL(Reset.GetMax(), 6);
+	Reset.SetMax(2);
+	TEST_EQUAL(Reset.Get(), 4);
+	TEST_EQUAL(Reset.GetMax(), 4);
+
+	// an overrun with 20 frames in flight: the window stays at 19
+	// until WINDOW_PROBE_FRAMES frames went through at it
+	CBootWindow Probe(4, 32);
+	Probe.OnProgress(100);
+	TEST_CHECK(Probe.OnLoss(20, 1000, 0));
+	TEST_EQUAL(Probe.Get(), 16);
+	TEST_EQUAL(Probe.GetCeiling(), 19);
+	UINT32 dwAtCeiling = 0;
+	for (UINT32 i = 0; (i < 1000) && (Probe.GetCeiling() == 19); i++)
+	{
+		Probe.OnProgress(4);
+		TEST_CHECK(Probe.Get() <= 19);
+		dwAtCeiling += (Probe.Get() == 19) ? 4 : 0;
+	}
+	TEST_EQUAL(Probe.GetCeiling(), 20);
+	TEST_EQUAL(dwAtCeiling, WINDOW_PROBE_FRAMES);
+	for (UINT32 i = 0; i < 10; i++)
+	{
+		Probe.OnProgress(4);
+	}
+	TEST_EQUAL(Probe.Get(), 20);
+
+	// round trip times per frame: 100 us, then a window with one
+	// sample of 100 us among 1000 us, neither shrinks it, a whole
+	// window of 5000 us does
+	CBootWindow Rtt(4, 32);
+	Rtt.OnProgress(12);
+	TEST_EQUAL(Rtt.Get(), 16);
+	TEST_CHECK(!Rtt.OnRtt(1000000, 2, 1000, 10000));
+	for (UINT32 i = 0; i < 4; i++)
+	{
+		TEST_CHECK(!Rtt.OnRtt(1600, 16, 1000, 10000));
+	}
+	TEST_EQUAL(Rtt.GetFrameUs(), 100);
+	TEST_CHECK(!Rtt.OnRtt(16000, 16, 1000, 10000));
+	TEST_CHECK(!Rtt.OnRtt(16000, 16, 1000, 10000));
+	TEST_CHECK(!Rtt.OnRtt(16000, 16, 1000, 10000));
+	TEST_CHECK(!Rtt.OnRtt(1600, 16, 1000, 10000));
+	TEST_EQUAL(Rtt.Get(), 16);
+	TEST_CHECK(!Rtt.OnRtt(80000, 16, 1000, 10000));
+	TEST_CHECK(!Rtt.OnRtt(80000, 16, 1000, 10000));
+	TEST_CHECK(!Rtt.OnRtt(80000, 16, 1000, 10000));
+	TEST_CHECK(Rtt.OnRtt(80000, 16, 1000, 10000));
+	TEST_EQUAL(Rtt.Get(), 8);
+	TEST_EQUAL(Rtt.GetRttCuts(), 1);
+	TEST_EQUAL(Rtt.GetLossCuts(), 0);
+}
@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Basic data types shared by the boot loader modules.
+
+  @note
+	The modules which do not talk to the VCI directly are kept free of
+	Windows dependencies, so they can also be built on other hosts.
+	On Windows the types come from <windows.h>, elsewhere they are
+	declared here with the same names.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTTYPES_HPP_
+#define _BOOTTYPES_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+typedef uint8_t   UINT8;
+typedef uint16_t  UINT16;
+typedef uint32_t  UINT32;
+typedef uint64_t  UINT64;
+typedef int32_t   INT32;
+typedef int64_t   INT64;
+typedef int       BOOL;
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#endif
+
+#endif //_BOOTTYPES_HPP_
@@ -0,0 +1,240 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Congestion window of the data frames streamed to the stub.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "BootWindow.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor. The window starts at the minimum.
+
+  @param dwMinFrames
+	lower bound of the window
+  @param dwMaxFrames
+	upper bound of the window, at least the lower bound
+*/
+//////////////////////////////////////////////////////////////////////////
+CBootWindow::CBootWindow(UINT32 dwMinFrames, UINT32 dwMaxFrames)
+{
+	m_dwMin = dwMinFrames * WINDOW_SCALE;
+	m_dwMax = (dwMaxFrames > dwMinFrames) ? dwMaxFrames * WINDOW_SCALE : m_dwMin;
+	m_dwCwnd = m_dwMin;
+	m_dwSsthresh = m_dwMax;
+	m_dwCeiling = m_dwMax;
+	m_dwProbe = 0;
+	m_dwFrameUs = 0;
+	m_dwFrameVar = 0;
+	m_dwRoundMin = 0;
+	m_dwRoundRef = 0;
+	m_dwRoundSamples = 0;
+	m_qwHold = 0;
+	m_dwLargest = dwMinFrames;
+	m_dwLossCuts = 0;
+	m_dwRttCuts = 0;
+	m_dwResets = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sets the upper bound of the window, the window shrinks to it if it is
+  larger. The bound is not set below the lower bound.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootWindow::SetMax(UINT32 dwMaxFrames)
+{
+	m_dwMax = dwMaxFrames * WINDOW_SCALE;
+	if (m_dwMax < m_dwMin)
+	{
+		m_dwMax = m_dwMin;
+	}
+	if (m_dwCwnd > m_dwMax)
+	{
+		m_dwCwnd = m_dwMax;
+	}
+	m_dwSsthresh = m_dwMax;
+	m_dwCeiling = m_dwMax;
+	m_dwProbe = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Called when the stub received frames in order. The window grows by
+  the frames received up to the slow start threshold, by one frame per
+  window of frames received above, up to the ceiling. The ceiling rises
+  by one frame after WINDOW_PROBE_FRAMES frames at it.
+
+  @param dwFrames  frames received since the last progress
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootWindow::OnProgress(UINT32 dwFrames)
+{
+	UINT64 qwCwnd = m_dwCwnd;
+
+	if (m_dwCwnd < m_dwSsthresh)
+	{
+		qwCwnd += (UINT64)dwFrames * WINDOW_SCALE;
+		if (qwCwnd > m_dwSsthresh)
+		{
+			qwCwnd = m_dwSsthresh;
+		}
+	}
+	else
+	{
+		qwCwnd += (UINT64)dwFrames * WINDOW_SCALE * WINDOW_SCALE / m_dwCwnd;
+	}
+
+	if (qwCwnd >= m_dwCeiling)
+	{
+		qwCwnd = m_dwCeiling;
+		m_dwProbe += dwFrames;
+		if ((m_dwProbe >= WINDOW_PROBE_FRAMES) && (m_dwCeiling < m_dwMax))
+		{
+			m_dwCeiling += WINDOW_SCALE;
+			m_dwProbe = 0;
+		}
+	}
+	m_dwCwnd = (qwCwnd > m_dwMax) ? m_dwMax : (UINT32)qwCwnd;
+	if (Get() > m_dwLargest)
+	{
+		m_dwLargest = Get();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a round trip time per frame in flight. After a window of samples
+  the lowest of them is checked against the smoothed time plus four
+  times its variation at the end of the window before. The round trip
+  of fewer frames than the minimum of the window, e.g. at the end of a
+  block, is mostly the fixed delay of the stub, it is left out.
+
+  @param dwRttUs   round trip time of a frame sent once
+  @param dwFrames  frames in flight when the frame was sent, including it
+  @param dwSrtt    smoothed round trip time
+  @param qwNow     transport time
+
+  @return TRUE if the window shrank
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootWindow::OnRtt(UINT32 dwRttUs, UINT32 dwFrames, UINT32 dwSrtt, UINT64 qwNow)
+{
+	if (dwFrames * WINDOW_SCALE < m_dwMin)
+	{
+		return FALSE;
+	}
+
+	UINT32 dwFrameUs = dwRttUs / dwFrames;
+	if (!m_dwRoundSamples || (dwFrameUs < m_dwRoundMin))
+	{
+		m_dwRoundMin = dwFrameUs;
+	}
+	m_dwRoundSamples++;
+
+	// smoothed like the round trip time of RFC 6298
+	if (m_dwFrameUs)
+	{
+		UINT32 dwDiff = (dwFrameUs > m_dwFrameUs) ? dwFrameUs - m_dwFrameUs : m_dwFrameUs - dwFrameUs;
+		m_dwFrameVar = m_dwFrameVar - (m_dwFrameVar >> 2) + (dwDiff >> 2);
+		m_dwFrameUs = m_dwFrameUs - (m_dwFrameUs >> 3) + (dwFrameUs >> 3);
+	}
+	else
+	{
+		m_dwFrameUs = dwFrameUs;
+		m_dwFrameVar = dwFrameUs / 2;
+	}
+
+	// each sample stands for the frames of one progress report
+	if (m_dwRoundSamples * m_dwMin < m_dwCwnd)
+	{
+		return FALSE;
+	}
+	BOOL fSlower = (m_dwRoundRef && (m_dwRoundMin > m_dwRoundRef)) ? TRUE : FALSE;
+	m_dwRoundRef = m_dwFrameUs + 4 * m_dwFrameVar;
+	m_dwRoundSamples = 0;
+	if (!fSlower || !Shrink(dwSrtt, qwNow))
+	{
+		return FALSE;
+	}
+	m_dwRttCuts++;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Called when the stub reported a gap or a CRC error. The ceiling drops
+  one frame below the frames in flight when the lost frame was sent.
+
+  @param dwFrames  frames in flight when the lost frame was sent,
+                   including it, 0 if not known
+  @param dwSrtt    smoothed round trip time
+  @param qwNow     transport time
+
+  @return TRUE if the window shrank
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootWindow::OnLoss(UINT32 dwFrames, UINT32 dwSrtt, UINT64 qwNow)
+{
+	UINT32 dwCeiling = (dwFrames > 1) ? (dwFrames - 1) * WINDOW_SCALE : m_dwCeiling;
+	if (dwCeiling < m_dwMin)
+	{
+		dwCeiling = m_dwMin;
+	}
+	if (dwCeiling < m_dwCeiling)
+	{
+		m_dwCeiling = dwCeiling;
+	}
+	m_dwProbe = 0;
+
+	if (!Shrink(dwSrtt, qwNow))
+	{
+		return FALSE;
+	}
+	m_dwLossCuts++;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Called when the progress of the stream timed out. The window starts
+  over at the minimum, the slow start ends at half the window before.
+
+  @param dwSrtt  smoothed round trip time
+  @param qwNow   transport time
+*/
+//////////////////////////////////////////////////////////////////////////
+void CBootWindow::OnTimeout(UINT32 dwSrtt, UINT64 qwNow)
+{
+	m_dwSsthresh = (m_dwCwnd / 2 > m_dwMin) ? m_dwCwnd / 2 : m_dwMin;
+	m_dwCwnd = m_dwMin;
+	m_qwHold = qwNow + dwSrtt;
+	m_dwResets++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Halves the window unless it is at the minimum or shrank less than
+  one round trip ago.
+
+  @return TRUE if the window shrank
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CBootWindow::Shrink(UINT32 dwSrtt, UINT64 qwNow)
+{
+	if ((m_dwCwnd <= m_dwMin) || (qwNow < m_qwHold))
+	{
+		return FALSE;
+	}
+	m_dwSsthresh = (m_dwCwnd / 2 > m_dwMin) ? m_dwCwnd / 2 : m_dwMin;
+	m_dwCwnd = m_dwSsthresh;
+	m_qwHold = qwNow + dwSrtt;
+	return TRUE;
+}
@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Congestion window of the data frames streamed to the stub.
+
+  @note
+	The window follows RFC 5681 (TCP congestion control), in frames
+	instead of bytes:
+	  progress of n frames  CWND = CWND + n          below SSTHRESH
+	                        CWND = CWND + n / CWND   above
+	  gap, CRC error        SSTHRESH = CWND / 2, CWND = SSTHRESH
+	  stream timeout        SSTHRESH = CWND / 2, CWND = minimum
+	A gap is mostly an overrun of the receive FIFO of the stub, i.e. the
+	frames in flight when the lost frame was sent did not fit. The window
+	does not grow to this number again, it stays one frame below until
+	WINDOW_PROBE_FRAMES frames went through at this ceiling without a
+	loss, then it tries one frame more. So the window settles just
+	below the depth of the FIFO, whatever the configured maximum is.
+	The round trip time grows with the frames in flight, they queue up
+	in front of the stub. Divided by the frames in flight when the frame
+	was sent it is the time the bus and the stub take per frame, it is
+	smoothed like the SRTT and RTTVAR of RFC 6298. When even the lowest
+	sample of a whole window lies above SRTT + 4 * RTTVAR of the window
+	before, the bus got busy or the stub slow, it halves the window like
+	a loss. A single late progress report does not. The window shrinks
+	at most once per SRTT, the frames in flight when it shrank report
+	the same loss again.
+
+	The window stays between STUB_ACK_FRAMES, the stub reports its
+	progress every STUB_ACK_FRAMES frames, and the configured maximum.
+	It starts at the minimum with SSTHRESH at the maximum.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _BOOTWINDOW_HPP_
+#define _BOOTWINDOW_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define WINDOW_SCALE            16      // fixed point fraction of a frame
+#define WINDOW_PROBE_FRAMES     1024    // frames at the ceiling before it is raised
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class adapts the number of data frames in flight to the loss and
+  the latency of the stream.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CBootWindow
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CBootWindow(UINT32 dwMinFrames, UINT32 dwMaxFrames);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void   SetMax    (UINT32 dwMaxFrames);
+	void   OnProgress(UINT32 dwFrames);
+	BOOL   OnRtt     (UINT32 dwRttUs, UINT32 dwFrames, UINT32 dwSrtt, UINT64 qwNow);
+	BOOL   OnLoss    (UINT32 dwFrames, UINT32 dwSrtt, UINT64 qwNow);
+	void   OnTimeout (UINT32 dwSrtt, UINT64 qwNow);
+
+	UINT32 Get        (void) const { return m_dwCwnd / WINDOW_SCALE; }
+	UINT32 GetMax     (void) const { return m_dwMax / WINDOW_SCALE; }
+	UINT32 GetCeiling (void) const { return m_dwCeiling / WINDOW_SCALE; }
+	UINT32 GetFrameUs (void) const { return m_dwFrameUs;  }
+	UINT32 GetLargest (void) const { return m_dwLargest;  }
+	UINT32 GetLossCuts(void) const { return m_dwLossCuts; }
+	UINT32 GetRttCuts (void) const { return m_dwRttCuts;  }
+	UINT32 GetResets  (void) const { return m_dwResets;   }
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	BOOL   Shrink(UINT32 dwSrtt, UINT64 qwNow);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	UINT32 m_dwCwnd;                    // window in 1/WINDOW_SCALE frames
+	UINT32 m_dwSsthresh;                // slow start threshold in 1/WINDOW_SCALE frames
+	UINT32 m_dwMin;                     // lower bound of the window
+	UINT32 m_dwMax;                     // upper bound of the window
+	UINT32 m_dwCeiling;                 // upper bound below the last overrun
+	UINT32 m_dwProbe;                   // frames received at the ceiling since the last loss
+	UINT32 m_dwFrameUs;                 // smoothed round trip time per frame in flight, 0 = no sample
+	UINT32 m_dwFrameVar;                // its smoothed variation
+	UINT32 m_dwRoundMin;                // lowest time per frame of the current window of samples
+	UINT32 m_dwRoundRef;                // limit of the window, 0 = no window completed
+	UINT32 m_dwRoundSamples;            // samples of the current window
+	UINT64 m_qwHold;                    // the window does not shrink again before this time
+	UINT32 m_dwLargest;                 // largest window in frames
+	UINT32 m_dwLossCuts;                // halved after a gap or CRC error
+	UINT32 m_dwRttCuts;                 // halved after a rising round trip time
+	UINT32 m_dwResets;                  // back to the minimum after a timeout
+};
+
+#endif //_BOOTWINDOW_HPP_
@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Acceptance filter for the identifiers of the boot loader sessions.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "CanFilter.hpp"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor. The filter is open.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanFilter::CCanFilter(void)
+{
+	Clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Removes all identifiers, the filter is open again.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanFilter::Clear(void)
+{
+	m_fOpen = TRUE;
+	memset(m_adwStdIds, 0, sizeof(m_adwStdIds));
+	m_ExtIds.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds an identifier, identifiers above 0x7FF are extended ones.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanFilter::Add(UINT32 dwMsgId)
+{
+	m_fOpen = FALSE;
+	if (dwMsgId < CAN_STD_IDS)
+	{
+		m_adwStdIds[dwMsgId / 32] |= (UINT32)1 << (dwMsgId % 32);
+	}
+	else
+	{
+		m_ExtIds.insert(dwMsgId);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns TRUE if a frame with the identifier passes the filter.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanFilter::Accepts(UINT32 dwMsgId) const
+{
+	if (m_fOpen)
+	{
+		return TRUE;
+	}
+	if (dwMsgId < CAN_STD_IDS)
+	{
+		return (m_adwStdIds[dwMsgId / 32] >> (dwMsgId % 32)) & 1;
+	}
+	return (m_ExtIds.find(dwMsgId) != m_ExtIds.end()) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the standard identifiers of the filter in ascending order.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanFilter::GetIds(std::vector<UINT32>& Ids) const
+{
+	Ids.clear();
+	for (UINT32 dwMsgId = 0; dwMsgId < CAN_STD_IDS; dwMsgId++)
+	{
+		if ((m_adwStdIds[dwMsgId / 32] >> (dwMsgId % 32)) & 1)
+		{
+			Ids.push_back(dwMsgId);
+		}
+	}
+}
@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Acceptance filter for the identifiers of the boot loader sessions.
+
+  @note
+	A channel receives every frame on the bus unless its controller
+	filters them, on a busy bus most of them belong to other devices.
+	The filter holds exactly the identifiers the sessions of a channel
+	use. It is programmed into the controller where the adapter allows
+	it and also checked on the host for every received frame, so the
+	receive thread drops foreign frames before they are queued, even
+	if the controller filter is not available.
+
+	Standard identifiers are kept in a bitmap, extended identifiers in
+	a hash set, the check costs the same for any number of sessions.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _CANFILTER_HPP_
+#define _CANFILTER_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+#include <unordered_set>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define CAN_STD_IDS                     0x800   // number of standard identifiers
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is a set of identifiers. An empty filter is open and
+  accepts all frames, the first identifier closes it.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCanFilter
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CCanFilter(void);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void   Add    (UINT32 dwMsgId);
+	void   Clear  (void);
+	BOOL   Accepts(UINT32 dwMsgId) const;
+	void   GetIds (std::vector<UINT32>& Ids) const;
+
+	BOOL   IsOpen (void) const { return m_fOpen; }
+	BOOL   HasExt (void) const { return !m_ExtIds.empty(); }
+
+  private:
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	BOOL     m_fOpen;                            // no identifier is added, all frames pass
+	UINT32   m_adwStdIds[CAN_STD_IDS / 32];      // bitmap of the standard identifiers
+	std::unordered_set<UINT32> m_ExtIds;         // extended identifiers
+};
+
+#endif //_CANFILTER_HPP_
@@ -0,0 +1,264 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Shares one CAN channel between the sessions of several boot loader
+  nodes on the same bus.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "CanMux.hpp"
+
+#include <chrono>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanMuxPort::CCanMuxPort(CCanMux* pMux, UINT32 dwIdBase)
+{
+	m_pMux = pMux;
+	m_dwIdBase = dwIdBase;
+	m_dwRxMode = CAN_RX_FRAME;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends a frame on the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMuxPort::Send(const CanFrame& sFrame)
+{
+	return m_pMux->Send(sFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Waits up to dwTimeoutUs for the next frame of the node.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMuxPort::Receive(CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	return m_pMux->Receive(this, sFrame, dwTimeoutUs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the time of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CCanMuxPort::GetTime(void)
+{
+	return m_pMux->GetTime();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the max. payload of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CCanMuxPort::GetMaxLen(void)
+{
+	return m_pMux->GetMaxLen();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the transmit time stamp of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CCanMuxPort::GetTxTime(UINT32 dwMsgId)
+{
+	return m_pMux->GetTxTime(dwMsgId);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the bit rates of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMuxPort::GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate)
+{
+	return m_pMux->GetBitRate(dwBitRate, dwDataBitRate);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Selects the receive mode of the node.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanMuxPort::SetRxMode(UINT32 dwMode)
+{
+	m_pMux->SetRxMode(this, dwMode);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the receive statistics of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMuxPort::GetRxStats(CanRxStats* pStats)
+{
+	return m_pMux->GetRxStats(pStats);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the fill level of the transmit FIFO of the shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMuxPort::GetTxQueued(UINT32& dwFrames)
+{
+	return m_pMux->GetTxQueued(dwFrames);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+
+  @param pTransport  the shared channel, must live as long as the
+                     multiplexer
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanMux::CCanMux(ICanTransport* pTransport)
+{
+	m_pTransport = pTransport;
+	m_fReading = FALSE;
+	m_dwUnmatched = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Destructor. Deletes the ports.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanMux::~CCanMux()
+{
+	for (size_t i = 0; i < m_Ports.size(); i++)
+	{
+		delete m_Ports[i];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds the port of the node with the given ID base. The port is owned
+  by the multiplexer. Must be called before the ports are used.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanMuxPort* CCanMux::AddPort(UINT32 dwIdBase)
+{
+	CCanMuxPort* pPort = new CCanMuxPort(this, dwIdBase);
+
+	m_Ports.push_back(pPort);
+	return pPort;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends a frame, the sessions of the nodes transmit one at a time.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMux::Send(const CanFrame& sFrame)
+{
+	std::lock_guard<std::mutex> Lock(m_TxMutex);
+
+	return m_pTransport->Send(sFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the next frame of a port. If no other port reads the channel
+  the caller reads it until its own timeout and queues the frames of
+  the other nodes, otherwise it waits until the reader hands over a
+  frame or gives up the channel.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanMux::Receive(CCanMuxPort* pPort, CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	std::unique_lock<std::mutex> Lock(m_RxMutex);
+	UINT64 qwDeadline = m_pTransport->GetTime() + dwTimeoutUs;
+
+	for (;;)
+	{
+		if (!pPort->m_RxQueue.empty())
+		{
+			sFrame = pPort->m_RxQueue.front();
+			pPort->m_RxQueue.pop_front();
+			return TRUE;
+		}
+
+		UINT64 qwNow = m_pTransport->GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			return FALSE;
+		}
+
+		if (m_fReading)
+		{
+			m_RxCond.wait_for(Lock, std::chrono::microseconds(qwDeadline - qwNow));
+			continue;
+		}
+
+		//
+		// read the channel without holding the lock
+		//
+		CanFrame sRxFrame;
+		BOOL     fReceived;
+
+		m_fReading = TRUE;
+		Lock.unlock();
+		fReceived = m_pTransport->Receive(sRxFrame, (UINT32)(qwDeadline - qwNow));
+		Lock.lock();
+		m_fReading = FALSE;
+
+		if (fReceived)
+		{
+			BOOL fMatched = FALSE;
+			for (size_t i = 0; i < m_Ports.size(); i++)
+			{
+				if ((sRxFrame.dwMsgId & ~(CAN_ID_RANGE - 1)) == m_Ports[i]->m_dwIdBase)
+				{
+					m_Ports[i]->m_RxQueue.push_back(sRxFrame);
+					fMatched = TRUE;
+				}
+			}
+			if (!fMatched)
+			{
+				m_dwUnmatched++;
+			}
+		}
+		m_RxCond.notify_all();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Selects the receive mode of a node. The channel takes the mode with
+  the lowest latency of all nodes, CAN_RX_POLL before CAN_RX_FRAME
+  before CAN_RX_BATCH.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanMux::SetRxMode(CCanMuxPort* pPort, UINT32 dwMode)
+{
+	std::lock_guard<std::mutex> Lock(m_RxMutex);
+	UINT32 dwChannel = CAN_RX_BATCH;
+
+	pPort->m_dwRxMode = dwMode;
+	for (size_t i = 0; i < m_Ports.size(); i++)
+	{
+		if (m_Ports[i]->m_dwRxMode > dwChannel)
+		{
+			dwChannel = m_Ports[i]->m_dwRxMode;
+		}
+	}
+	m_pTransport->SetRxMode(dwChannel);
+}
@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Shares one CAN channel between the sessions of several boot loader
+  nodes on the same bus.
+
+  @note
+	Each node uses its own ID base (see CAN_ID_RANGE). A port of the
+	multiplexer is the transport of one session: it sends on the
+	channel and receives the frames of its identifier range only.
+	The channel is read by one of the waiting sessions at a time, which
+	hands the frames of the other nodes over to their ports.
+	The channel runs the receive mode with the lowest latency any port
+	selected.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _CANMUX_HPP_
+#define _CANMUX_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+class CCanMux;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is the transport of one node on a shared channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCanMuxPort : public ICanTransport
+{
+  public:
+	//---------------------------------------------------------------
+	// ICanTransport
+	//---------------------------------------------------------------
+	virtual BOOL   Send(const CanFrame& sFrame);
+	virtual BOOL   Receive(CanFrame& sFrame, UINT32 dwTimeoutUs);
+	virtual UINT64 GetTime(void);
+	virtual UINT32 GetMaxLen(void);
+	virtual UINT64 GetTxTime(UINT32 dwMsgId);
+	virtual BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate);
+	virtual void   SetRxMode(UINT32 dwMode);
+	virtual BOOL   GetRxStats(CanRxStats* pStats);
+	virtual BOOL   GetTxQueued(UINT32& dwFrames);
+
+  private:
+	friend class CCanMux;
+
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CCanMuxPort(CCanMux* pMux, UINT32 dwIdBase);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CCanMux*             m_pMux;        // multiplexer of the channel
+	UINT32               m_dwIdBase;    // identifier range of the node
+	UINT32               m_dwRxMode;    // receive mode of the node, CAN_RX_xxx
+	std::deque<CanFrame> m_RxQueue;     // frames received for the node
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class distributes the frames of one channel to the ports of the
+  nodes by their ID base.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCanMux
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CCanMux(ICanTransport* pTransport);
+	~CCanMux();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	CCanMuxPort* AddPort(UINT32 dwIdBase);
+
+	UINT32 GetUnmatched(void) const { return m_dwUnmatched; }
+
+  private:
+	friend class CCanMuxPort;
+
+	//---------------------------------------------------------------
+	// called by the ports
+	//---------------------------------------------------------------
+	BOOL   Send   (const CanFrame& sFrame);
+	BOOL   Receive(CCanMuxPort* pPort, CanFrame& sFrame, UINT32 dwTimeoutUs);
+	void   SetRxMode(CCanMuxPort* pPort, UINT32 dwMode);
+	BOOL   GetRxStats(CanRxStats* pStats) { return m_pTransport->GetRxStats(pStats); }
+	BOOL   GetTxQueued(UINT32& dwFrames) { return m_pTransport->GetTxQueued(dwFrames); }
+	UINT64 GetTime(void) { return m_pTransport->GetTime(); }
+	UINT32 GetMaxLen(void) { return m_pTransport->GetMaxLen(); }
+	UINT64 GetTxTime(UINT32 dwMsgId) { return m_pTransport->GetTxTime(dwMsgId); }
+	BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate) { return m_pTransport->GetBitRate(dwBitRate, dwDataBitRate); }
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	ICanTransport*            m_pTransport;  // the shared channel
+	std::mutex                m_TxMutex;     // serializes the transmission
+	std::mutex                m_RxMutex;     // protects the receive queues
+	std::condition_variable   m_RxCond;      // signals new frames or a free reader
+	BOOL                      m_fReading;    // a port reads the channel
+	UINT32                    m_dwUnmatched; // frames of no known node
+	std::vector<CCanMuxPort*> m_Ports;       // ports by node
+};
+
+#endif //_CANMUX_HPP_
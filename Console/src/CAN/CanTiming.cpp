@@ -0,0 +1,209 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Bit lengths and durations of CAN frames.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "CanTiming.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define CAN_CRC15_POLY                  0x4599  // CRC of a classic frame
+
+//
+// bits which are not stuffed
+//
+#define CAN_TAIL_BITS                   (1 + 1 + 1 + 7 + 3) // CRC and ACK delimiter, ACK, EOF, intermission
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// bit stream with dynamic stuffing and the CRC of a classic frame
+//
+typedef struct {
+	UINT32 dwBits;                      // bits including stuff bits
+	UINT32 dwStuff;                     // stuff bits
+	UINT32 dwLevel;                     // level of the last bit
+	UINT32 dwRun;                       // equal bits in a row
+	UINT32 dwCrc;                       // CRC-15 of the bits before stuffing
+} StuffState;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds dwCount bits of dwValue, most significant bit first.
+*/
+//////////////////////////////////////////////////////////////////////////
+static void PutBits(StuffState& sState, UINT32 dwValue, UINT32 dwCount)
+{
+	while (dwCount--)
+	{
+		UINT32 dwBit = (dwValue >> dwCount) & 1;
+
+		if ((dwBit ^ (sState.dwCrc >> 14)) & 1)
+		{
+			sState.dwCrc = ((sState.dwCrc << 1) ^ CAN_CRC15_POLY) & 0x7FFF;
+		}
+		else
+		{
+			sState.dwCrc = (sState.dwCrc << 1) & 0x7FFF;
+		}
+
+		sState.dwBits++;
+		if ((sState.dwRun != 0) && (dwBit == sState.dwLevel))
+		{
+			sState.dwRun++;
+		}
+		else
+		{
+			sState.dwLevel = dwBit;
+			sState.dwRun = 1;
+		}
+
+		// the stuff bit starts the next run
+		if (sState.dwRun == 5)
+		{
+			sState.dwBits++;
+			sState.dwStuff++;
+			sState.dwLevel ^= 1;
+			sState.dwRun = 1;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the length of a frame with its stuff bits. Frames without
+  CAN_FLAG_FD or on a bus without data bit rate are classic frames.
+
+  @param sFrame  standard frame
+  @param fFd     the bus has a data bit rate
+  @param sBits   bits of the frame
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CanFrameBits(const CanFrame& sFrame, BOOL fFd, CanBits& sBits)
+{
+	StuffState sState = { 0, 0, 0, 0, 0 };
+	UINT32     dwLen = sFrame.bLen;
+
+	// SOF, identifier, RTR or RRS, IDE
+	PutBits(sState, 0, 1);
+	PutBits(sState, sFrame.dwMsgId & 0x7FF, 11);
+	PutBits(sState, 0, 2);
+
+	if (!(sFrame.bFlags & CAN_FLAG_FD) || !fFd)
+	{
+		// r0, DLC, data and CRC are stuffed
+		PutBits(sState, 0, 1);
+		PutBits(sState, dwLen, 4);
+		for (UINT32 i = 0; i < dwLen; i++)
+		{
+			PutBits(sState, sFrame.abData[i], 8);
+		}
+		UINT32 dwCrc = sState.dwCrc;
+		PutBits(sState, dwCrc, 15);
+
+		sBits.dwNominal = sState.dwBits + CAN_TAIL_BITS;
+		sBits.dwData = 0;
+		sBits.dwStuff = sState.dwStuff;
+		return;
+	}
+
+	// FDF, res, BRS with the nominal bit rate
+	PutBits(sState, 0x05, 3);
+	UINT32 dwNominal = sState.dwBits;
+
+	// ESI, DLC and data
+	UINT32 dwDlc = dwLen;
+	if (dwLen > 8)
+	{
+		dwDlc = (dwLen <= 24) ? 9 + (dwLen - 12) / 4 : 13 + (dwLen - 32) / 16;
+	}
+	PutBits(sState, 0, 1);
+	PutBits(sState, dwDlc, 4);
+	for (UINT32 i = 0; i < dwLen; i++)
+	{
+		PutBits(sState, sFrame.abData[i], 8);
+	}
+
+	// stuff count and CRC with a fixed stuff bit before and after every
+	// four bits
+	UINT32 dwCrcBits = 4 + ((dwLen > 16) ? 21 : 17);
+	UINT32 dwFixed = 1 + (dwCrcBits - 1) / 4;
+
+	sBits.dwNominal = dwNominal + CAN_TAIL_BITS;
+	sBits.dwData = sState.dwBits - dwNominal + dwCrcBits + dwFixed;
+	sBits.dwStuff = sState.dwStuff + dwFixed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the length of a frame with the largest possible number of
+  stuff bits.
+
+  @param dwLen  payload bytes
+  @param fFd    CAN FD frame with bit rate switch
+  @param sBits  bits of the frame
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CanFrameBitsMax(UINT32 dwLen, BOOL fFd, CanBits& sBits)
+{
+	if (!fFd)
+	{
+		UINT32 dwStuffed = 34 + 8 * dwLen;
+		sBits.dwStuff = (dwStuffed - 1) / 4;
+		sBits.dwNominal = dwStuffed + sBits.dwStuff + CAN_TAIL_BITS;
+		sBits.dwData = 0;
+		return;
+	}
+
+	// SOF .. BRS, the stuff bits of the arbitration go with the nominal
+	// bit rate
+	UINT32 dwHead = 17;
+	UINT32 dwHeadStuff = (dwHead - 1) / 4;
+	UINT32 dwCrcBits = 4 + ((dwLen > 16) ? 21 : 17);
+	UINT32 dwFixed = 1 + (dwCrcBits - 1) / 4;
+	UINT32 dwBody = 5 + 8 * dwLen;
+	UINT32 dwBodyStuff = (dwHead + dwBody - 1) / 4 - dwHeadStuff;
+
+	sBits.dwNominal = dwHead + dwHeadStuff + CAN_TAIL_BITS;
+	sBits.dwData = dwBody + dwBodyStuff + dwCrcBits + dwFixed;
+	sBits.dwStuff = dwHeadStuff + dwBodyStuff + dwFixed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Returns the duration of the bits in nanoseconds.
+
+  @param sBits          bits of a frame
+  @param dwBitRate      nominal bit rate in bit/s
+  @param dwDataBitRate  data bit rate in bit/s, only used for data bits
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CanBitsTimeNs(const CanBits& sBits, UINT32 dwBitRate, UINT32 dwDataBitRate)
+{
+	UINT64 qwNs = ((UINT64)sBits.dwNominal * 1000000000 + dwBitRate - 1) / dwBitRate;
+
+	if (sBits.dwData)
+	{
+		UINT32 dwRate = dwDataBitRate ? dwDataBitRate : dwBitRate;
+		qwNs += ((UINT64)sBits.dwData * 1000000000 + dwRate - 1) / dwRate;
+	}
+	return qwNs;
+}
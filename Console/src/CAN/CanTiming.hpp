@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Bit lengths and durations of CAN frames.
+
+  @note
+	A frame is counted from the start of frame bit to the end of the
+	intermission, i.e. until the next frame can start. The bits before
+	the bit rate switch of a CAN FD frame and its end (CRC delimiter,
+	ACK, end of frame, intermission) are nominal bits, the bits between
+	them data bits. A classic frame has only nominal bits.
+
+	CanFrameBits() stuffs the actual frame: a stuff bit of the opposite
+	level follows five equal bits from the start of frame up to the CRC
+	of a classic frame and up to the data of a CAN FD frame. The stuff
+	count and CRC of a CAN FD frame have fixed stuff bits. Only standard
+	identifiers are used on this bus.
+
+	CanFrameBitsMax() counts the worst case of the same frame length,
+	one stuff bit after every four bits.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _CANTIMING_HPP_
+#define _CANTIMING_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// error flag, error delimiter and intermission after a bit error
+//
+#define CAN_ERROR_FRAME_BITS            (6 + 8 + 3)
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT32 dwNominal;                   // bits with the nominal bit rate
+	UINT32 dwData;                      // bits with the data bit rate
+	UINT32 dwStuff;                     // stuff bits included in both
+} CanBits;
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+void   CanFrameBits   (const CanFrame& sFrame, BOOL fFd, CanBits& sBits);
+void   CanFrameBitsMax(UINT32 dwLen, BOOL fFd, CanBits& sBits);
+UINT64 CanBitsTimeNs  (const CanBits& sBits, UINT32 dwBitRate, UINT32 dwDataBitRate);
+
+#endif //_CANTIMING_HPP_
@@ -0,0 +1,191 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transport interface between the boot loader protocol and a CAN
+  channel (VCI adapter or simulated bus).
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _CANTRANSPORT_HPP_
+#define _CANTRANSPORT_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// identifiers per boot loader node. A node answers the standard
+// identifiers (0x79, 0x43, 0x31, 0x04, ...) plus its ID base, which is
+// a multiple of this range, so up to 16 nodes share an 11 bit bus.
+//
+#define CAN_ID_RANGE                    0x80
+
+//
+// no ID base, e.g. a node without broadcast group
+//
+#define CAN_ID_NONE                     0xFFFFFFFF
+
+//
+// payload of a classic CAN frame and of a CAN FD frame
+//
+#define CAN_MAX_LEN                     8
+#define CAN_FD_MAX_LEN                  64
+
+#define CAN_FLAG_FD                     0x01    // CAN FD frame with bit rate switch
+#define CAN_FLAG_BULK                   0x02    // bulk data, may wait behind other frames on the host
+
+//
+// receive modes of a channel
+//
+#define CAN_RX_BATCH                    0       // wake up for several frames or after a latency bound
+#define CAN_RX_FRAME                    1       // wake up for every frame
+#define CAN_RX_POLL                     2       // poll the receive FIFO without sleeping
+#define CAN_RX_MODES                    3
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT64 qwTime;                      // time stamp in us on the transport clock
+	UINT64 qwBusTime;                   // time stamp of the adapter on the transport clock, 0 = none
+	UINT32 dwMsgId;                     // CAN message identifier
+	UINT8  bLen;                        // number of payload bytes
+	UINT8  bFlags;                      // CAN_FLAG_xxx
+	UINT8  abData[CAN_FD_MAX_LEN];      // payload
+} CanFrame;
+
+//
+// statistics of a receive mode
+//
+typedef struct {
+	UINT64 qwTime;                      // time the channel was in the mode in us
+	UINT32 dwWakeups;                   // the host woke up with received frames
+	UINT32 dwFrames;                    // frames handed to the protocol
+	UINT64 qwLatency;                   // sum of the delays from the end of a frame on the bus to the protocol in us
+} CanRxStats;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This interface is woken by a transport when a received frame is
+  queued, so an event loop can block until one of its transports has a
+  frame. Notify() is called on the receive thread of the transport.
+*/
+//////////////////////////////////////////////////////////////////////////
+class ICanRxNotify
+{
+  public:
+	virtual ~ICanRxNotify() {}
+
+	virtual void   Notify(void) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This interface is implemented by every CAN channel the protocol can
+  run on. All times are in microseconds on the clock of the transport,
+  which is the host clock for real adapters and the simulated clock
+  for the simulator. Time stamps of the adapter are converted to the
+  transport clock.
+*/
+//////////////////////////////////////////////////////////////////////////
+class ICanTransport
+{
+  public:
+	virtual ~ICanTransport() {}
+
+	//---------------------------------------------------------------
+	// Queues a frame for transmission.
+	//---------------------------------------------------------------
+	virtual BOOL   Send(const CanFrame& sFrame) = 0;
+
+	//---------------------------------------------------------------
+	// Waits up to dwTimeoutUs for the next received frame.
+	// Returns FALSE if no frame arrived in time.
+	//---------------------------------------------------------------
+	virtual BOOL   Receive(CanFrame& sFrame, UINT32 dwTimeoutUs) = 0;
+
+	//---------------------------------------------------------------
+	// Returns the current time of the transport clock.
+	//---------------------------------------------------------------
+	virtual UINT64 GetTime(void) = 0;
+
+	//---------------------------------------------------------------
+	// Called when the session on the transport is finished. Shared
+	// transports stop waiting for this user.
+	//---------------------------------------------------------------
+	virtual void   Detach(void) {}
+
+	//---------------------------------------------------------------
+	// Returns the max. payload of a frame, CAN_FD_MAX_LEN if the
+	// channel runs CAN FD.
+	//---------------------------------------------------------------
+	virtual UINT32 GetMaxLen(void) { return CAN_MAX_LEN; }
+
+	//---------------------------------------------------------------
+	// Returns the time the last frame with this identifier was sent
+	// on the bus, 0 if the adapter reports no transmit time stamps.
+	//---------------------------------------------------------------
+	virtual UINT64 GetTxTime(UINT32 dwMsgId) { (void)dwMsgId; return 0; }
+
+	//---------------------------------------------------------------
+	// Returns the bit rates of the channel in bit/s, the data bit rate
+	// is 0 without CAN FD. Returns FALSE if they are not known.
+	//---------------------------------------------------------------
+	virtual BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate)
+	{
+		(void)dwBitRate; (void)dwDataBitRate; return FALSE;
+	}
+
+	//---------------------------------------------------------------
+	// Selects how the channel waits for received frames, CAN_RX_xxx.
+	// Channels start with CAN_RX_FRAME.
+	//---------------------------------------------------------------
+	virtual void   SetRxMode(UINT32 dwMode) { (void)dwMode; }
+
+	//---------------------------------------------------------------
+	// Returns the statistics of the CAN_RX_MODES receive modes.
+	// Returns FALSE if the channel keeps none.
+	//---------------------------------------------------------------
+	virtual BOOL   GetRxStats(CanRxStats* pStats) { (void)pStats; return FALSE; }
+
+	//---------------------------------------------------------------
+	// Returns the number of frames in the transmit FIFO of the
+	// adapter which are not on the bus yet. Returns FALSE if the
+	// channel can not tell.
+	//---------------------------------------------------------------
+	virtual BOOL   GetTxQueued(UINT32& dwFrames) { (void)dwFrames; return FALSE; }
+
+	//---------------------------------------------------------------
+	// Lets the transport clock run on without blocking while the
+	// caller waits for a frame up to qwDeadline, for an event loop
+	// which polls Receive() with timeout 0. Returns FALSE if the
+	// clock runs on by itself, e.g. the host clock of an adapter.
+	//---------------------------------------------------------------
+	virtual BOOL   Advance(UINT64 qwDeadline) { (void)qwDeadline; return FALSE; }
+
+	//---------------------------------------------------------------
+	// Wakes pNotify whenever a received frame is queued, NULL stops
+	// it. A channel has one notify at a time. Returns FALSE if the
+	// channel can not notify, an event loop keeps polling it then.
+	//---------------------------------------------------------------
+	virtual BOOL   SetRxNotify(ICanRxNotify* pNotify) { (void)pNotify; return FALSE; }
+
+	//---------------------------------------------------------------
+	// Returns the time in us after which the transport must be polled
+	// again even without a received frame, e.g. to refill the
+	// transmit FIFO of the adapter, 0 if it only waits for frames.
+	//---------------------------------------------------------------
+	virtual UINT32 GetPollWait(void) { return 0; }
+};
+
+#endif //_CANTRANSPORT_HPP_
@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmit queue of the host in front of the transmit FIFO of an
+  adapter.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "CanTxQueue.hpp"
+#include "CanTiming.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanTxPort::CCanTxPort(CCanTxQueue* pQueue, ICanTransport* pTransport)
+{
+	m_pQueue = pQueue;
+	m_pTransport = pTransport;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends a frame through the transmit queue.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanTxPort::Send(const CanFrame& sFrame)
+{
+	return m_pQueue->Send(this, sFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Waits up to dwTimeoutUs for the next frame of the session. While bulk
+  data waits on the host the wait is cut into slices, the FIFO of the
+  adapter is refilled after each of them.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanTxPort::Receive(CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	UINT64 qwDeadline = m_pTransport->GetTime() + dwTimeoutUs;
+
+	for (;;)
+	{
+		UINT32 dwWait = m_pQueue->Pump(this);
+		UINT64 qwNow = m_pTransport->GetTime();
+		UINT32 dwLeft = (qwDeadline > qwNow) ? (UINT32)(qwDeadline - qwNow) : 0;
+		if ((dwWait == 0) || (dwWait >= dwLeft))
+		{
+			return m_pTransport->Receive(sFrame, dwLeft);
+		}
+		if (m_pTransport->Receive(sFrame, dwWait))
+		{
+			return TRUE;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends the bulk data the session left in the queue and detaches the
+  transport of the session.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanTxPort::Detach(void)
+{
+	m_pQueue->Flush(this);
+	m_pTransport->Detach();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Refills the FIFO and lets the clock of the transport run on, at most
+  until the FIFO is half empty.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanTxPort::Advance(UINT64 qwDeadline)
+{
+	UINT32 dwWait = m_pQueue->Pump(this);
+	UINT64 qwNow = m_pTransport->GetTime();
+	if (dwWait && (qwNow + dwWait < qwDeadline))
+	{
+		qwDeadline = qwNow + dwWait;
+	}
+	return m_pTransport->Advance(qwDeadline);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Refills the FIFO of the adapter for an event loop which is about to
+  block.
+
+  @return time until the FIFO is half empty in us, 0 if no bulk data
+          waits
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CCanTxPort::GetPollWait(void)
+{
+	UINT32 dwWait = m_pQueue->Pump(this);
+	UINT32 dwInner = m_pTransport->GetPollWait();
+	return (dwInner && (!dwWait || (dwInner < dwWait))) ? dwInner : dwWait;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanTxQueue::CCanTxQueue()
+{
+	m_nNext = 0;
+	m_dwHeld = 0;
+	m_dwFrameUs = 0;
+	m_dwControlFrames = 0;
+	m_dwBulkFrames = 0;
+	m_dwMaxAhead = 0;
+	m_dwMaxHeld = 0;
+}
+
+CCanTxQueue::~CCanTxQueue()
+{
+	for (size_t i = 0; i < m_Ports.size(); i++)
+	{
+		delete m_Ports[i];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds the port of a session. All transports behind the queue must send
+  through the same adapter.
+
+  @param pTransport  transport of the session, must live as long as the
+                     queue
+*/
+//////////////////////////////////////////////////////////////////////////
+CCanTxPort* CCanTxQueue::AddPort(ICanTransport* pTransport)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	CCanTxPort* pPort = new CCanTxPort(this, pTransport);
+	m_Ports.push_back(pPort);
+	return pPort;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Sends a frame of a port. A control frame goes to the adapter at once,
+  a bulk frame waits until there is room for it in the FIFO.
+
+  @return FALSE if the adapter rejected a control frame
+
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CCanTxQueue::Send(CCanTxPort* pPort, const CanFrame& sFrame)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	if (!(sFrame.bFlags & CAN_FLAG_BULK))
+	{
+		UINT32 dwQueued;
+		if (pPort->m_pTransport->GetTxQueued(dwQueued) && (dwQueued > m_dwMaxAhead))
+		{
+			m_dwMaxAhead = dwQueued;
+		}
+		m_dwControlFrames++;
+		return pPort->m_pTransport->Send(sFrame);
+	}
+
+	CCanTxPort::TxEntry sEntry;
+	sEntry.qwQueued = pPort->m_pTransport->GetTime();
+	sEntry.sFrame = sFrame;
+	pPort->m_Bulk.push_back(sEntry);
+	m_dwHeld++;
+	Refill(pPort->m_pTransport);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Refills the FIFO of the adapter for the thread of a port.
+
+  @return time until the FIFO is half empty in us, 0 if no bulk data
+          waits
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CCanTxQueue::Pump(CCanTxPort* pPort)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	return Refill(pPort->m_pTransport);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends the bulk data of a port which ends, without waiting for room
+  in the FIFO.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CCanTxQueue::Flush(CCanTxPort* pPort)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	while (!pPort->m_Bulk.empty())
+	{
+		pPort->m_pTransport->Send(pPort->m_Bulk.front().sFrame);
+		pPort->m_Bulk.pop_front();
+		m_dwHeld--;
+		m_dwBulkFrames++;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Moves bulk frames of the ports in turn to the FIFO of the adapter
+  until it holds TXQUEUE_BURST frames. Called with the mutex locked.
+
+  @param pTransport  transport which reports the fill level of the FIFO
+
+  @return time until the FIFO is half empty in us, 0 if no bulk data
+          waits
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CCanTxQueue::Refill(ICanTransport* pTransport)
+{
+	if (m_dwHeld == 0)
+	{
+		return 0;
+	}
+
+	UINT32 dwQueued = 0;
+	BOOL   fLevel = pTransport->GetTxQueued(dwQueued);
+	UINT64 qwNow = pTransport->GetTime();
+	while (m_dwHeld && (!fLevel || (dwQueued < TXQUEUE_BURST)))
+	{
+		while (m_Ports[m_nNext]->m_Bulk.empty())
+		{
+			m_nNext = (m_nNext + 1) % m_Ports.size();
+		}
+		CCanTxPort* pPort = m_Ports[m_nNext];
+		m_nNext = (m_nNext + 1) % m_Ports.size();
+
+		const CCanTxPort::TxEntry& sEntry = pPort->m_Bulk.front();
+		if (qwNow - sEntry.qwQueued > m_dwMaxHeld)
+		{
+			m_dwMaxHeld = (UINT32)(qwNow - sEntry.qwQueued);
+		}
+		pPort->m_pTransport->Send(sEntry.sFrame);
+		pPort->m_Bulk.pop_front();
+		m_dwHeld--;
+		m_dwBulkFrames++;
+		dwQueued++;
+	}
+	if (m_dwHeld == 0)
+	{
+		return 0;
+	}
+
+	// the longest frame the channel carries
+	if (m_dwFrameUs == 0)
+	{
+		UINT32 dwBitRate;
+		UINT32 dwDataBitRate;
+		m_dwFrameUs = TXQUEUE_FRAME_US;
+		if (pTransport->GetBitRate(dwBitRate, dwDataBitRate))
+		{
+			CanBits sBits;
+			CanFrameBitsMax(pTransport->GetMaxLen(), dwDataBitRate ? TRUE : FALSE, sBits);
+			m_dwFrameUs = (UINT32)((CanBitsTimeNs(sBits, dwBitRate, dwDataBitRate) + 999) / 1000);
+		}
+	}
+	return m_dwFrameUs * (dwQueued - TXQUEUE_BURST / 2);
+}
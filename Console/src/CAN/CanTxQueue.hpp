@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmit queue of the host in front of the transmit FIFO of an
+  adapter.
+
+  @note
+	The transmit FIFO of the adapter sends in order. A stub stream of
+	every node on a channel fills it with data frames, a command, a
+	sync or an abort then waits behind all of them, up to the size of
+	the FIFO (128 frames of a VCI channel).
+
+	Frames marked with CAN_FLAG_BULK wait in the queue of their port
+	instead. The queue keeps at most TXQUEUE_BURST frames in the FIFO
+	of the adapter and refills it from the ports in turn, one frame per
+	port, so the nodes share the bandwidth. All other frames are
+	control frames, they go to the adapter at once, ahead of the bulk
+	data which still waits on the host. Receive() of a port wakes up
+	while bulk data waits, when the FIFO is half empty, and refills it.
+
+	A channel which does not report the fill level of its FIFO gets
+	every frame at once, like without the queue.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _CANTXQUEUE_HPP_
+#define _CANTXQUEUE_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define TXQUEUE_BURST           8       // max. bulk frames in the FIFO of the adapter
+#define TXQUEUE_FRAME_US        1000    // duration of a frame if the bit rate is unknown
+
+class CCanTxQueue;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is the transport of one session behind the transmit queue.
+  It sends through the queue, everything else goes to the transport of
+  the session.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCanTxPort : public ICanTransport
+{
+  public:
+	//---------------------------------------------------------------
+	// ICanTransport
+	//---------------------------------------------------------------
+	virtual BOOL   Send(const CanFrame& sFrame);
+	virtual BOOL   Receive(CanFrame& sFrame, UINT32 dwTimeoutUs);
+	virtual void   Detach(void);
+	virtual BOOL   Advance(UINT64 qwDeadline);
+	virtual BOOL   SetRxNotify(ICanRxNotify* pNotify) { return m_pTransport->SetRxNotify(pNotify); }
+	virtual UINT32 GetPollWait(void);
+
+	virtual UINT64 GetTime(void) { return m_pTransport->GetTime(); }
+	virtual UINT32 GetMaxLen(void) { return m_pTransport->GetMaxLen(); }
+	virtual UINT64 GetTxTime(UINT32 dwMsgId) { return m_pTransport->GetTxTime(dwMsgId); }
+	virtual BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate) { return m_pTransport->GetBitRate(dwBitRate, dwDataBitRate); }
+	virtual void   SetRxMode(UINT32 dwMode) { m_pTransport->SetRxMode(dwMode); }
+	virtual BOOL   GetRxStats(CanRxStats* pStats) { return m_pTransport->GetRxStats(pStats); }
+	virtual BOOL   GetTxQueued(UINT32& dwFrames) { return m_pTransport->GetTxQueued(dwFrames); }
+
+  private:
+	friend class CCanTxQueue;
+
+	//---------------------------------------------------------------
+	// data types
+	//---------------------------------------------------------------
+	typedef struct {
+		UINT64   qwQueued;                  // transport time the frame was sent by the session
+		CanFrame sFrame;                    // the frame
+	} TxEntry;
+
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CCanTxPort(CCanTxQueue* pQueue, ICanTransport* pTransport);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CCanTxQueue*        m_pQueue;       // transmit queue of the channel
+	ICanTransport*      m_pTransport;   // transport of the session
+	std::deque<TxEntry> m_Bulk;         // bulk frames waiting for the FIFO
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class feeds the transmit FIFO of one adapter from the ports of
+  its sessions. The ports are used by the threads of the sessions,
+  each of them refills the FIFO.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CCanTxQueue
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CCanTxQueue();
+	~CCanTxQueue();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	CCanTxPort* AddPort(ICanTransport* pTransport);
+
+	UINT32 GetControlFrames(void) const { return m_dwControlFrames; }
+	UINT32 GetBulkFrames   (void) const { return m_dwBulkFrames;    }
+	UINT32 GetMaxAhead     (void) const { return m_dwMaxAhead;      }
+	UINT32 GetMaxHeld      (void) const { return m_dwMaxHeld;       }
+
+  private:
+	friend class CCanTxPort;
+
+	//---------------------------------------------------------------
+	// called by the ports
+	//---------------------------------------------------------------
+	BOOL   Send (CCanTxPort* pPort, const CanFrame& sFrame);
+	UINT32 Pump (CCanTxPort* pPort);
+	void   Flush(CCanTxPort* pPort);
+
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	UINT32 Refill(ICanTransport* pTransport);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	std::mutex               m_Mutex;           // protects the queues of the ports
+	std::vector<CCanTxPort*> m_Ports;           // ports by session
+	size_t                   m_nNext;           // port which sends the next bulk frame
+	UINT32                   m_dwHeld;          // bulk frames waiting in the ports
+	UINT32                   m_dwFrameUs;       // duration of the longest frame, 0 = not known yet
+
+	UINT32                   m_dwControlFrames; // control frames sent
+	UINT32                   m_dwBulkFrames;    // bulk frames sent
+	UINT32                   m_dwMaxAhead;      // max. frames in the FIFO ahead of a control frame
+	UINT32                   m_dwMaxHeld;       // max. time a bulk frame waited on the host in us
+};
+
+#endif //_CANTXQUEUE_HPP_
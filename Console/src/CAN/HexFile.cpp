@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Intel hex file reader.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "HexFile.hpp"
+
+#include <iostream>
+#include <fstream>
+
+int GetRecordFromString(HexRecord& hexrec, std::string hexstr) {
+	UINT16 Len = hexstr.length();
+	if (Len < 11)
+		return 0;
+	if (hexstr.substr(0, 1) != ":")
+		return 0;
+	UINT8 reclen = std::stoi(hexstr.substr(1, 2), nullptr, 16);
+	if (Len < reclen * 2 + 11)
+		return 0;
+	hexrec.RecLen = reclen;
+	hexrec.MemOffset = std::stoi(hexstr.substr(3, 4), nullptr, 16);
+	hexrec.RecType = std::stoi(hexstr.substr(7, 2), nullptr, 16);
+	for (UINT16 i = 0; i < hexrec.RecLen; i++)
+		hexrec.Data_Or_Info[i] = std::stoi(hexstr.substr(9 + 2 * i, 2), nullptr, 16);
+	hexrec.crc8 = std::stoi(hexstr.substr(9 + 2 * hexrec.RecLen, 2), nullptr, 16);
+	return 1;
+}
+
+int GetHexRecordsFromFile(std::string Filename, HexData& hData) {
+	UINT16 i, j, RecCount;
+	std::vector<std::string> lines;
+	std::string line;
+	std::ifstream in(Filename);
+	if (!in.is_open())
+	{
+		in.close();
+		return 0;
+	}
+	else
+	{
+		while (std::getline(in, line))
+		{
+			std::cout << line << std::endl;
+			lines.push_back(line);
+		}
+		in.close();
+	}
+	RecCount = lines.size();
+	HexRecord tmp_record;
+	hData.HexDataLen = 0;
+	for (i = 0; i < RecCount; i++) {
+		if (GetRecordFromString(tmp_record, lines.at(i))) {
+			hData.records.push_back(tmp_record);
+			if (tmp_record.RecType == 0x00)
+			{
+				hData.HexDataLen += tmp_record.RecLen;
+				for (j = 0; j < tmp_record.RecLen; j++)
+					hData.Data.push_back(tmp_record.Data_Or_Info[j]);
+			}
+
+			if (tmp_record.RecType == 0x04)
+				hData.StartAdres = (tmp_record.Data_Or_Info[0] << 24) + (tmp_record.Data_Or_Info[1] << 16);
+			if (tmp_record.RecType == 0x05)
+				hData.LinStartAdres = (tmp_record.Data_Or_Info[0] << 24) + (tmp_record.Data_Or_Info[1] << 16) + (tmp_record.Data_Or_Info[2] << 8) + (tmp_record.Data_Or_Info[3]);
+		}
+		else {
+			hData.records.clear();
+			hData.HexDataLen = 0;
+			hData.StartAdres = 0;
+			hData.LinStartAdres = 0;
+			hData.Data.clear();
+			break;
+		}
+	}
+	lines.clear();
+	if (i == RecCount)
+		return 1;
+	return 0;
+}
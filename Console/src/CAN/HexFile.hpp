@@ -0,0 +1,57 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Intel hex file reader.
+
+  @note
+	The data records of the file are concatenated into one image which
+	starts at the address of the extended linear address record. The
+	image is read once and shared read only by all sessions.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _HEXFILE_HPP_
+#define _HEXFILE_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+#define MAX_REC_DATA_LENGTH     16
+
+typedef struct {
+	UINT8 RecLen;
+	UINT16 MemOffset;
+	UINT8 RecType;
+	UINT8 Data_Or_Info[MAX_REC_DATA_LENGTH];
+	UINT8 crc8;
+}HexRecord;
+
+typedef struct {
+	std::vector<HexRecord> records;
+	UINT32 HexDataLen = 0;
+	UINT32 StartAdres = 0;
+	UINT32 LinStartAdres = 0;
+	std::vector<UINT8> Data;
+}HexData;
+
+//////////////////////////////////////////////////////////////////////////
+// function prototypes
+//////////////////////////////////////////////////////////////////////////
+
+int GetRecordFromString(HexRecord& hexrec, std::string hexstr);
+int GetHexRecordsFromFile(std::string Filename, HexData& hData);
+
+#endif //_HEXFILE_HPP_
@@ -0,0 +1,761 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Simulated CAN bus with any number of boot loader targets and host
+  ports.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "SimBus.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+//
+// identifiers of other devices, none of them is used by a session
+// with any ID base
+//
+static const UINT32 adwLoadIds[] = {
+	0x018, 0x0A5, 0x0F0, 0x130, 0x1A0, 0x256, 0x2E6, 0x33A, 0x3E9, 0x4F0, 0x575, 0x5D2, 0x6F1, 0x7A0
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimPort::CSimPort(CSimBus* pBus, UINT32 dwIdBase)
+{
+	m_pBus = pBus;
+	m_dwIdBase = dwIdBase;
+	m_fAttached = TRUE;
+	m_fWaiting = FALSE;
+	m_qwDeadline = 0;
+	m_dwRxMode = CAN_RX_FRAME;
+	m_qwRxRead = 0;
+	m_qwRxModeStart = 0;
+	memset(m_aRxStats, 0, sizeof(m_aRxStats));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a frame for the bus. The clock is not advanced, the frame is
+  queued like in the transmit FIFO of an adapter.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::Send(const CanFrame& sFrame)
+{
+	return m_pBus->Send(this, sFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the next frame for this port if it arrives within the
+  timeout. Blocks until the simulated clock reaches the frame or the
+  timeout.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::Receive(CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	return m_pBus->Receive(this, sFrame, dwTimeoutUs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Waits for a frame without blocking: the simulated clock runs on as
+  soon as all ports wait.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::Advance(UINT64 qwDeadline)
+{
+	m_pBus->Advance(this, qwDeadline);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the simulated time in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CSimPort::GetTime(void)
+{
+	return m_pBus->Now();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Removes the port from the time keeping, the clock no longer waits
+  for it.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimPort::Detach(void)
+{
+	m_pBus->Detach(this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the max. payload, CAN FD frames need a data bit rate.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CSimPort::GetMaxLen(void)
+{
+	return m_pBus->m_sCfg.dwDataBitRate ? CAN_FD_MAX_LEN : CAN_MAX_LEN;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the end of the last frame the port sent with an identifier.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CSimPort::GetTxTime(UINT32 dwMsgId)
+{
+	std::lock_guard<std::mutex> Lock(m_pBus->m_Mutex);
+
+	std::map<UINT32, UINT64>::const_iterator it = m_TxTime.find(dwMsgId);
+	return (it != m_TxTime.end()) ? it->second : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the bit rates of the simulated bus.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate)
+{
+	dwBitRate = m_pBus->m_sCfg.dwBitRate;
+	dwDataBitRate = m_pBus->m_sCfg.dwDataBitRate;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Selects the receive mode, CAN_RX_xxx.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimPort::SetRxMode(UINT32 dwMode)
+{
+	std::lock_guard<std::mutex> Lock(m_pBus->m_Mutex);
+
+	if ((dwMode < CAN_RX_MODES) && (dwMode != m_dwRxMode))
+	{
+		m_aRxStats[m_dwRxMode].qwTime += m_pBus->m_qwNow - m_qwRxModeStart;
+		m_qwRxModeStart = m_pBus->m_qwNow;
+		m_dwRxMode = dwMode;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the statistics of the receive modes up to now.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::GetRxStats(CanRxStats* pStats)
+{
+	std::lock_guard<std::mutex> Lock(m_pBus->m_Mutex);
+
+	memcpy(pStats, m_aRxStats, sizeof(m_aRxStats));
+	pStats[m_dwRxMode].qwTime += m_pBus->m_qwNow - m_qwRxModeStart;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the frames of the host which wait for the bus. All ports
+  share the transmit FIFO of one adapter.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimPort::GetTxQueued(UINT32& dwFrames)
+{
+	std::lock_guard<std::mutex> Lock(m_pBus->m_Mutex);
+
+	dwFrames = 0;
+	for (size_t i = 0; i < m_pBus->m_TxQueue.size(); i++)
+	{
+		if (!m_pBus->m_TxQueue[i].fFromTarget)
+		{
+			dwFrames++;
+		}
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor.
+
+  @param sCfg  bit rate, loss, cut and load of the bus, the timing of
+               the targets is given with AddTarget()
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimBus::CSimBus(const SimConfig& sCfg)
+	: m_sCfg(sCfg)
+{
+	m_qwNow = 0;
+	m_qwBusFree = 0;
+	m_qwBusyTime = 0;
+	m_dwRandom = sCfg.dwSeed ? sCfg.dwSeed : 1;
+	m_dwFramesSent = 0;
+	m_dwFramesLost = 0;
+	m_dwErrorFrames = 0;
+	m_dwLoadFrames = 0;
+	m_dwHostFrames = 0;
+	m_dwFiltered = 0;
+	for (UINT32 i = 0; i < 2; i++)
+	{
+		m_adwTxFrames[i] = 0;
+		m_aqwTxLatency[i] = 0;
+		m_adwTxMaxLatency[i] = 0;
+	}
+	m_dwSeq = 0;
+	m_dwAttached = 0;
+	m_dwWaiting = 0;
+
+	if (m_sCfg.dwLoadPct > 99)
+	{
+		m_sCfg.dwLoadPct = 99;
+	}
+	if (m_sCfg.dwLoadPct)
+	{
+		QueueLoad(0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Destructor. Deletes the targets and the ports.
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimBus::~CSimBus()
+{
+	for (size_t i = 0; i < m_Targets.size(); i++)
+	{
+		delete m_Targets[i];
+	}
+	for (size_t i = 0; i < m_Ports.size(); i++)
+	{
+		delete m_Ports[i];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a simulated boot loader which answers on the identifiers of
+  sCfg.dwIdBase. Must be called before the ports are used.
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimTarget* CSimBus::AddTarget(const SimConfig& sCfg)
+{
+	CSimTarget* pTarget = new CSimTarget(sCfg);
+
+	m_Targets.push_back(pTarget);
+	return pTarget;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a host port which receives the identifiers of dwIdBase, or all
+  identifiers for CAN_ID_NONE. The port is owned by the bus. Must be
+  called before the ports are used.
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimPort* CSimBus::AddPort(UINT32 dwIdBase)
+{
+	CSimPort* pPort = new CSimPort(this, dwIdBase);
+
+	m_Ports.push_back(pPort);
+	m_dwAttached++;
+	return pPort;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the duration of a frame in microseconds, from the start of
+  frame to the end of the intermission.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CSimBus::GetFrameTime(const CanFrame& sFrame) const
+{
+	CanBits sBits;
+
+	CanFrameBits(sFrame, m_sCfg.dwDataBitRate ? TRUE : FALSE, sBits);
+	return (UINT32)((CanBitsTimeNs(sBits, m_sCfg.dwBitRate, m_sCfg.dwDataBitRate) + 999) / 1000);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the next number of the loss and error generator.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CSimBus::Random(void)
+{
+	// xorshift32
+	m_dwRandom ^= m_dwRandom << 13;
+	m_dwRandom ^= m_dwRandom >> 17;
+	m_dwRandom ^= m_dwRandom << 5;
+	return m_dwRandom;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Loss injection. Returns TRUE if the current frame is to be dropped.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimBus::LoseFrame(void)
+{
+	// the cable is pulled
+	if ((m_sCfg.dwCutFrames != 0) && (m_dwFramesSent > m_sCfg.dwCutFrames))
+	{
+		m_dwFramesLost++;
+		return TRUE;
+	}
+
+	if (m_sCfg.dwLossPpm == 0)
+	{
+		return FALSE;
+	}
+
+	if ((Random() % 1000000) < m_sCfg.dwLossPpm)
+	{
+		m_dwFramesLost++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Error injection. Returns the time the bus is busy with the current
+  frame up to a bit error and the following error frame, or 0 if the
+  frame is sent without error. The error hits any bit before the end
+  of frame with the same probability.
+
+  @param dwFrameTime  duration of the whole frame
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT32 CSimBus::ErrorTime(UINT32 dwFrameTime)
+{
+	if ((m_sCfg.dwErrorPpm == 0) || ((Random() % 1000000) >= m_sCfg.dwErrorPpm))
+	{
+		return 0;
+	}
+
+	m_dwErrorFrames++;
+
+	// the error frame is sent with the nominal bit rate
+	UINT32 dwErrorFrame = (CAN_ERROR_FRAME_BITS * 1000000 + m_sCfg.dwBitRate - 1) / m_sCfg.dwBitRate;
+	return 1 + (UINT32)(((UINT64)(dwFrameTime - 1) * (Random() % 1000)) / 1000) + dwErrorFrame;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a frame which is ready for transmission at qwReady.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::Queue(UINT64 qwReady, const CanFrame& sFrame, BOOL fFromTarget, CSimPort* pPort)
+{
+	TxEntry sEntry;
+
+	sEntry.qwReady = qwReady;
+	sEntry.dwSeq = m_dwSeq++;
+	sEntry.fFromTarget = fFromTarget;
+	sEntry.fLoad = FALSE;
+	sEntry.pPort = pPort;
+	sEntry.sFrame = sFrame;
+	m_TxQueue.push_back(sEntry);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Queues the next frame of the other devices. The gaps between their
+  frames are random, on average the frames take the configured share
+  of the bus time.
+
+  @param qwAfter  end of the previous frame of the other devices
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::QueueLoad(UINT64 qwAfter)
+{
+	CanFrame sFrame;
+
+	memset(&sFrame, 0, sizeof(sFrame));
+	sFrame.dwMsgId = adwLoadIds[Random() % (sizeof(adwLoadIds) / sizeof(adwLoadIds[0]))];
+	sFrame.bLen = CAN_MAX_LEN;
+	for (UINT32 i = 0; i < CAN_MAX_LEN; i++)
+	{
+		sFrame.abData[i] = (UINT8)Random();
+	}
+
+	UINT64 qwGap = ((UINT64)GetFrameTime(sFrame) * (100 - m_sCfg.dwLoadPct)) / m_sCfg.dwLoadPct;
+	Queue(qwAfter + (qwGap * 2 * (Random() % 1000)) / 1000, sFrame, TRUE, NULL);
+	m_TxQueue.back().fLoad = TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Delivers a frame at the end of its transmission. Frames of the host
+  go to the targets, which only take their own identifiers, frames of
+  the targets go to the port with the same ID base.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::Deliver(const CanFrame& sFrame)
+{
+	for (size_t i = 0; i < m_Targets.size(); i++)
+	{
+		m_Replies.clear();
+		m_Targets[i]->OnFrame(sFrame, m_Replies);
+		for (size_t j = 0; j < m_Replies.size(); j++)
+		{
+			Queue(m_Replies[j].qwTime, m_Replies[j], TRUE, NULL);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the time the host of a port reads its oldest frame, ~0 if
+  the port has none.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CSimBus::ReadyTime(const CSimPort* pPort) const
+{
+	if (pPort->m_RxQueue.empty())
+	{
+		return ~(UINT64)0;
+	}
+
+	// read together with an earlier frame
+	UINT64 qwReady = pPort->m_RxQueue.front().qwTime;
+	if (qwReady <= pPort->m_qwRxRead)
+	{
+		return qwReady;
+	}
+
+	if (pPort->m_dwRxMode == CAN_RX_BATCH)
+	{
+		qwReady += SIM_RX_LATENCY_US;
+		if (pPort->m_RxQueue.size() >= SIM_RX_BATCH)
+		{
+			qwReady = std::min(qwReady, pPort->m_RxQueue[SIM_RX_BATCH - 1].qwTime);
+		}
+	}
+	if (pPort->m_dwRxMode != CAN_RX_POLL)
+	{
+		qwReady += m_sCfg.dwWakeupUs;
+	}
+	return qwReady;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Advances the clock to the next event until at least one waiting port
+  can return. Called with the mutex locked when all attached ports
+  wait in Receive().
+
+  The next frame on the bus is chosen when the bus becomes free: of all
+  frames which are ready by then the lowest identifier wins the
+  arbitration. The frames of the host leave its transmit FIFO in the
+  order they were sent. A receive timeout or a wake up of the host
+  before the end of that frame stops the clock there, the frame is
+  still sent at the next step. A frame hit
+  by a bit error stays queued for the next arbitration.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::Step(void)
+{
+	for (;;)
+	{
+		UINT64 qwDeadline = ~(UINT64)0;
+		for (size_t i = 0; i < m_Ports.size(); i++)
+		{
+			if (m_Ports[i]->m_fWaiting)
+			{
+				qwDeadline = std::min(qwDeadline, std::min(m_Ports[i]->m_qwDeadline, ReadyTime(m_Ports[i])));
+			}
+		}
+
+		//
+		// arbitration
+		//
+		size_t nNext = m_TxQueue.size();
+		UINT64 qwStart = 0;
+		UINT64 qwEnd = 0;
+		if (!m_TxQueue.empty())
+		{
+			qwStart = m_TxQueue[0].qwReady;
+			for (size_t i = 1; i < m_TxQueue.size(); i++)
+			{
+				if (m_TxQueue[i].qwReady < qwStart)
+				{
+					qwStart = m_TxQueue[i].qwReady;
+				}
+			}
+			if (qwStart < m_qwBusFree)
+			{
+				qwStart = m_qwBusFree;
+			}
+
+			//
+			// the host sends from one transmit FIFO, only its oldest
+			// frame takes part in the arbitration
+			//
+			size_t nHost = m_TxQueue.size();
+			for (size_t i = 0; i < m_TxQueue.size(); i++)
+			{
+				if (!m_TxQueue[i].fFromTarget &&
+				    ((nHost == m_TxQueue.size()) || (m_TxQueue[i].dwSeq < m_TxQueue[nHost].dwSeq)))
+				{
+					nHost = i;
+				}
+			}
+
+			for (size_t i = 0; i < m_TxQueue.size(); i++)
+			{
+				const TxEntry& sEntry = m_TxQueue[i];
+				if ((sEntry.qwReady > qwStart) || (!sEntry.fFromTarget && (i != nHost)))
+				{
+					continue;
+				}
+				if ((nNext == m_TxQueue.size()) ||
+				    (sEntry.sFrame.dwMsgId < m_TxQueue[nNext].sFrame.dwMsgId) ||
+				    ((sEntry.sFrame.dwMsgId == m_TxQueue[nNext].sFrame.dwMsgId) &&
+				     (sEntry.dwSeq < m_TxQueue[nNext].dwSeq)))
+				{
+					nNext = i;
+				}
+			}
+			qwEnd = qwStart + GetFrameTime(m_TxQueue[nNext].sFrame);
+		}
+
+		UINT32 dwError = 0;
+		if ((nNext < m_TxQueue.size()) && (qwEnd <= qwDeadline))
+		{
+			dwError = ErrorTime((UINT32)(qwEnd - qwStart));
+		}
+
+		if (dwError)
+		{
+			// the frame stays queued and is sent again
+			m_qwBusyTime += dwError;
+			m_qwBusFree = qwStart + dwError;
+			if (m_qwBusFree > m_qwNow)
+			{
+				m_qwNow = m_qwBusFree;
+			}
+		}
+		else if ((nNext < m_TxQueue.size()) && (qwEnd <= qwDeadline))
+		{
+			TxEntry sEntry = m_TxQueue[nNext];
+			m_TxQueue.erase(m_TxQueue.begin() + nNext);
+
+			m_qwBusyTime += qwEnd - qwStart;
+			m_qwBusFree = qwEnd;
+			if (qwEnd > m_qwNow)
+			{
+				m_qwNow = qwEnd;
+			}
+			m_dwFramesSent++;
+
+			sEntry.sFrame.qwTime = qwEnd;
+			sEntry.sFrame.qwBusTime = qwEnd;
+			if (sEntry.pPort)
+			{
+				// a frame of the host is ready when it was sent
+				UINT32 dwClass = (sEntry.sFrame.bFlags & CAN_FLAG_BULK) ? 1 : 0;
+				UINT32 dwLatency = (UINT32)(qwEnd - sEntry.qwReady);
+				sEntry.pPort->m_TxTime[sEntry.sFrame.dwMsgId] = qwEnd;
+				m_adwTxFrames[dwClass]++;
+				m_aqwTxLatency[dwClass] += dwLatency;
+				if (m_adwTxMaxLatency[dwClass] < dwLatency)
+				{
+					m_adwTxMaxLatency[dwClass] = dwLatency;
+				}
+			}
+			if (sEntry.fLoad)
+			{
+				m_dwLoadFrames++;
+				QueueLoad(qwEnd);
+			}
+			if (!LoseFrame())
+			{
+				if (sEntry.fFromTarget && !m_Filter.Accepts(sEntry.sFrame.dwMsgId))
+				{
+					m_dwFiltered++;
+				}
+				else if (sEntry.fFromTarget)
+				{
+					m_dwHostFrames++;
+					for (size_t i = 0; i < m_Ports.size(); i++)
+					{
+						CSimPort* pPort = m_Ports[i];
+						if ((pPort->m_dwIdBase == CAN_ID_NONE) ||
+						    ((sEntry.sFrame.dwMsgId & ~(CAN_ID_RANGE - 1)) == pPort->m_dwIdBase))
+						{
+							pPort->m_RxQueue.push_back(sEntry.sFrame);
+						}
+					}
+				}
+				else
+				{
+					Deliver(sEntry.sFrame);
+				}
+			}
+		}
+		else if (qwDeadline > m_qwNow)
+		{
+			m_qwNow = qwDeadline;
+		}
+
+		//
+		// release the ports with a frame or an expired timeout
+		//
+		BOOL fReleased = FALSE;
+		for (size_t i = 0; i < m_Ports.size(); i++)
+		{
+			CSimPort* pPort = m_Ports[i];
+			BOOL      fReady = (ReadyTime(pPort) <= m_qwNow) ? TRUE : FALSE;
+			if (pPort->m_fWaiting && (fReady || (pPort->m_qwDeadline <= m_qwNow)))
+			{
+				if (fReady)
+				{
+					pPort->m_aRxStats[pPort->m_dwRxMode].dwWakeups++;
+				}
+				pPort->m_fWaiting = FALSE;
+				m_dwWaiting--;
+				fReleased = TRUE;
+			}
+		}
+		if (fReleased)
+		{
+			m_Cond.notify_all();
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a frame of a port, it is ready at the current time.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimBus::Send(CSimPort* pPort, const CanFrame& sFrame)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	Queue(m_qwNow, sFrame, FALSE, pPort);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Waits for a frame of the port. The thread of the last port which
+  starts to wait advances the clock for all of them.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimBus::Receive(CSimPort* pPort, CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	std::unique_lock<std::mutex> Lock(m_Mutex);
+
+	if ((ReadyTime(pPort) > m_qwNow) && (dwTimeoutUs != 0) && pPort->m_fAttached)
+	{
+		pPort->m_qwDeadline = m_qwNow + dwTimeoutUs;
+		pPort->m_fWaiting = TRUE;
+		m_dwWaiting++;
+		while (pPort->m_fWaiting)
+		{
+			if (m_dwWaiting == m_dwAttached)
+			{
+				Step();
+			}
+			else
+			{
+				m_Cond.wait(Lock);
+			}
+		}
+	}
+
+	if (ReadyTime(pPort) > m_qwNow)
+	{
+		return FALSE;
+	}
+	sFrame = pPort->m_RxQueue.front();
+	pPort->m_RxQueue.pop_front();
+	pPort->m_qwRxRead = m_qwNow;
+
+	CanRxStats& sStats = pPort->m_aRxStats[pPort->m_dwRxMode];
+	sStats.dwFrames++;
+	sStats.qwLatency += m_qwNow - sFrame.qwBusTime;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Marks the port as waiting up to the deadline like Receive() does,
+  but returns at once. The last port which starts to wait advances the
+  clock until one of the ports is released, all ports are served by
+  the thread of an event loop then.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::Advance(CSimPort* pPort, UINT64 qwDeadline)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	if ((ReadyTime(pPort) <= m_qwNow) || (qwDeadline <= m_qwNow) || !pPort->m_fAttached)
+	{
+		return;
+	}
+	if (!pPort->m_fWaiting)
+	{
+		pPort->m_qwDeadline = qwDeadline;
+		pPort->m_fWaiting = TRUE;
+		m_dwWaiting++;
+	}
+	if (m_dwWaiting == m_dwAttached)
+	{
+		Step();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the simulated time in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CSimBus::Now(void)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	return m_qwNow;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Removes a port from the time keeping. A waiting port may now be the
+  last one, so the waiting threads are woken up.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimBus::Detach(CSimPort* pPort)
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+
+	if (pPort->m_fAttached)
+	{
+		pPort->m_fAttached = FALSE;
+		m_dwAttached--;
+		m_Cond.notify_all();
+	}
+}
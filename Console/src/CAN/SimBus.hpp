@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Simulated CAN bus with any number of boot loader targets and host
+  ports.
+
+  @note
+	Time is simulated. The clock only advances when every attached host
+	port waits in Receive(), then it jumps to the next event: the end of
+	a frame on the bus or the earliest receive timeout. Sessions on
+	several threads therefore see one consistent bus and a run is
+	independent of the host speed.
+
+	Frames which are ready at the same time are arbitrated by their
+	identifier, the lowest identifier is sent first. All ports share the
+	transmit FIFO of one host adapter. A frame occupies the bus for its
+	exact length with the stuff bits of its identifier and data
+	(CanTiming.hpp).
+
+	A bit error destroys a frame for all receivers: the bus carries the
+	frame up to the error and an error frame, then the sender takes part
+	in the next arbitration again, like the automatic retransmission of
+	a CAN controller. A lost frame in turn is sent completely, but no
+	receiver takes it, like an overrun of the receive FIFO.
+	Received frames carry the end of the frame as bus time stamp, the
+	ports report the end of their sent frames like the transmit echo of
+	an adapter.
+	CAN FD frames switch to the data bit rate after the arbitration.
+
+	Other devices may load the bus with frames of foreign identifiers at
+	random times. They take part in the arbitration like the frames of
+	the targets, the targets ignore them. The host adapter receives all
+	frames which pass its acceptance filter, those of other devices
+	are dropped there if the filter holds the session identifiers only.
+
+	A port gets a received frame when the host wakes up for it. In the
+	batch mode the host wakes up for SIM_RX_BATCH frames or when the
+	oldest one waited SIM_RX_LATENCY_US, in the poll mode there is no
+	wake up delay. All frames received until the wake up are read
+	together.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIMBUS_HPP_
+#define _SIMBUS_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanFilter.hpp"
+#include "CanTiming.hpp"
+#include "SimTarget.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define SIM_RX_BATCH            16      // frames per wake up in the batch mode
+#define SIM_RX_LATENCY_US       1000    // max. wait for a partial batch
+
+class CSimBus;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is the connection of one host session to the simulated
+  bus. The port receives the frames within the identifier range of its
+  target, i.e. identifiers with the same ID base. A port with the ID
+  base CAN_ID_NONE receives the frames of all targets.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CSimPort : public ICanTransport
+{
+  public:
+	//---------------------------------------------------------------
+	// ICanTransport
+	//---------------------------------------------------------------
+	virtual BOOL   Send(const CanFrame& sFrame);
+	virtual BOOL   Receive(CanFrame& sFrame, UINT32 dwTimeoutUs);
+	virtual UINT64 GetTime(void);
+	virtual void   Detach(void);
+	virtual UINT32 GetMaxLen(void);
+	virtual UINT64 GetTxTime(UINT32 dwMsgId);
+	virtual BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate);
+	virtual void   SetRxMode(UINT32 dwMode);
+	virtual BOOL   GetRxStats(CanRxStats* pStats);
+	virtual BOOL   GetTxQueued(UINT32& dwFrames);
+	virtual BOOL   Advance(UINT64 qwDeadline);
+
+  private:
+	friend class CSimBus;
+
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CSimPort(CSimBus* pBus, UINT32 dwIdBase);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CSimBus*             m_pBus;        // bus the port is attached to
+	UINT32               m_dwIdBase;    // identifier range of the port
+	BOOL                 m_fAttached;   // port takes part in the time keeping
+	BOOL                 m_fWaiting;    // port waits for a frame or its timeout
+	UINT64               m_qwDeadline;  // end of the pending receive
+	std::deque<CanFrame> m_RxQueue;     // frames received by the port
+	std::map<UINT32, UINT64> m_TxTime;  // end of the last frame sent per identifier
+	UINT32               m_dwRxMode;    // CAN_RX_xxx
+	UINT64               m_qwRxRead;    // frames received up to this time were read by the host
+	UINT64               m_qwRxModeStart; // time the receive mode was selected
+	CanRxStats           m_aRxStats[CAN_RX_MODES]; // statistics per receive mode
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class connects simulated targets and host ports. Frames can be
+  lost or destroyed by bit errors with the configured probabilities.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CSimBus
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CSimBus(const SimConfig& sCfg);
+	~CSimBus();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	CSimTarget* AddTarget(const SimConfig& sCfg);
+	CSimPort*   AddPort  (UINT32 dwIdBase);
+	void        SetFilter(const CCanFilter& Filter) { m_Filter = Filter; }
+
+	//---------------------------------------------------------------
+	// statistics
+	//---------------------------------------------------------------
+	UINT32      GetTargetCount(void) const { return (UINT32)m_Targets.size(); }
+	CSimTarget& GetTarget(UINT32 dwIndex)  { return *m_Targets[dwIndex]; }
+	UINT32      GetFramesSent(void) const  { return m_dwFramesSent; }
+	UINT32      GetFramesLost(void) const  { return m_dwFramesLost; }
+	UINT32      GetErrorFrames(void) const { return m_dwErrorFrames; }
+	UINT32      GetLoadFrames(void) const  { return m_dwLoadFrames; }
+	UINT32      GetHostFrames(void) const  { return m_dwHostFrames; }
+	UINT32      GetFiltered  (void) const  { return m_dwFiltered;   }
+	UINT64      GetBusyTime  (void) const  { return m_qwBusyTime;   }
+	UINT64      GetTime      (void) const  { return m_qwNow;        }
+	UINT32      GetTxFrames    (BOOL fBulk) const { return m_adwTxFrames[fBulk ? 1 : 0];    }
+	UINT64      GetTxLatency   (BOOL fBulk) const { return m_aqwTxLatency[fBulk ? 1 : 0];   }
+	UINT32      GetTxMaxLatency(BOOL fBulk) const { return m_adwTxMaxLatency[fBulk ? 1 : 0]; }
+
+  private:
+	friend class CSimPort;
+
+	//---------------------------------------------------------------
+	// data types
+	//---------------------------------------------------------------
+	typedef struct {
+		UINT64   qwReady;                   // time the frame is ready to send
+		UINT32   dwSeq;                     // order of submission
+		BOOL     fFromTarget;               // sent by a target, received by the ports
+		BOOL     fLoad;                     // sent by another device
+		CSimPort* pPort;                    // port which sent the frame, NULL = a target
+		CanFrame sFrame;                    // the frame
+	} TxEntry;
+
+	//---------------------------------------------------------------
+	// called by the ports
+	//---------------------------------------------------------------
+	BOOL   Send   (CSimPort* pPort, const CanFrame& sFrame);
+	BOOL   Receive(CSimPort* pPort, CanFrame& sFrame, UINT32 dwTimeoutUs);
+	UINT64 Now    (void);
+	void   Detach (CSimPort* pPort);
+	void   Advance(CSimPort* pPort, UINT64 qwDeadline);
+
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	UINT32 GetFrameTime(const CanFrame& sFrame) const;
+	UINT32 Random(void);
+	BOOL   LoseFrame(void);
+	UINT32 ErrorTime(UINT32 dwFrameTime);
+	void   Queue(UINT64 qwReady, const CanFrame& sFrame, BOOL fFromTarget, CSimPort* pPort);
+	void   QueueLoad(UINT64 qwAfter);
+	void   Step(void);
+	void   Deliver(const CanFrame& sFrame);
+	UINT64 ReadyTime(const CSimPort* pPort) const;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	SimConfig                m_sCfg;         // bus parameters
+	std::mutex               m_Mutex;        // protects the bus state
+	std::condition_variable  m_Cond;         // signals a step of the clock
+	UINT64                   m_qwNow;        // simulated time
+	UINT64                   m_qwBusFree;    // end of the last frame on the bus
+	UINT64                   m_qwBusyTime;   // sum of all frame durations
+	UINT32                   m_dwRandom;     // state of the loss and error generator
+	UINT32                   m_dwFramesSent; // frames put on the bus
+	UINT32                   m_dwFramesLost; // frames dropped by loss injection
+	UINT32                   m_dwErrorFrames; // frames destroyed by a bit error
+	UINT32                   m_dwLoadFrames; // frames of other devices put on the bus
+	UINT32                   m_dwHostFrames; // frames received by the host adapter
+	UINT32                   m_dwFiltered;   // frames dropped by the acceptance filter
+	UINT32                   m_adwTxFrames[2];     // frames of the host, control and CAN_FLAG_BULK
+	UINT64                   m_aqwTxLatency[2];    // sum of their delays from Send() to the end on the bus
+	UINT32                   m_adwTxMaxLatency[2]; // max. delay from Send() to the end on the bus
+	UINT32                   m_dwSeq;        // next submission number
+	UINT32                   m_dwAttached;   // ports taking part in the time keeping
+	UINT32                   m_dwWaiting;    // attached ports waiting in Receive()
+	std::vector<TxEntry>     m_TxQueue;      // frames waiting for the bus
+	std::vector<CSimTarget*> m_Targets;      // simulated boot loaders
+	std::vector<CSimPort*>   m_Ports;        // host ports
+	std::vector<CanFrame>    m_Replies;      // scratch buffer for target replies
+	CCanFilter               m_Filter;       // acceptance filter of the host adapter
+};
+
+#endif //_SIMBUS_HPP_
@@ -0,0 +1,860 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Simulated STM32 CAN boot loader.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "SimTarget.hpp"
+#include "BootCrc.hpp"
+#include "BootDevice.hpp"
+#include "BootLz.hpp"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define SIM_STATE_RESET         0       // waiting for the sync frame
+#define SIM_STATE_IDLE          1       // waiting for a command
+#define SIM_STATE_WRITE_DATA    2       // receiving the data of a write
+#define SIM_STATE_STUB          3       // the fast loader stub runs
+#define SIM_STATE_HALTED        4       // Go to code which is not simulated
+#define SIM_STATE_ERASE_PAGES   5       // receiving the page numbers of an erase
+
+#define SIM_ID_SYNC             0x79
+#define SIM_ID_GET              0x00
+#define SIM_ID_GET_VERSION      0x01
+#define SIM_ID_GET_ID           0x02
+#define SIM_ID_READ             0x11
+#define SIM_ID_GO               0x21
+#define SIM_ID_WRITE            0x31
+#define SIM_ID_ERASE            0x43
+#define SIM_ID_DATA             0x04
+
+#define SIM_BL_VERSION          0x20    // reported boot loader version
+
+//////////////////////////////////////////////////////////////////////////
+// static data
+//////////////////////////////////////////////////////////////////////////
+
+// command list reported by Get, the commands of AN3154
+static const UINT8 abSimCommands[] = {
+	0x00, 0x01, 0x02, 0x11, 0x21, 0x31, 0x43, 0x63, 0x73, 0x82, 0x92
+};
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Fills in the default simulation parameters: 125 kbit/s classic CAN
+  and timing in the range of an STM32F1 with 1 MB flash and 64 KB RAM.
+*/
+//////////////////////////////////////////////////////////////////////////
+void SimDefaultConfig(SimConfig& sCfg)
+{
+	sCfg.dwBitRate = 125000;
+	sCfg.dwDataBitRate = 0;
+	sCfg.dwResponseUs = 150;
+	sCfg.dwWakeUs = 0;
+	sCfg.dwEraseUs = 2000000;
+	sCfg.dwPageSize = 0x800;
+	sCfg.dwPageEraseUs = 20000;
+	sCfg.dwProgramUs = 5000;
+	sCfg.dwLossPpm = 0;
+	sCfg.dwErrorPpm = 0;
+	sCfg.dwSeed = 1;
+	sCfg.dwFlashBase = 0x08000000;
+	sCfg.dwFlashSize = 0x100000;
+	sCfg.dwRamBase = 0x20000000;
+	sCfg.dwRamSize = 0x10000;
+	sCfg.dwPid = 0x430;
+	sCfg.dwUidAddr = 0x1FFFF7E8;
+	sCfg.dwSizeAddr = 0x1FFFF7E0;
+	sCfg.dwCutFrames = 0;
+	sCfg.dwLoadPct = 0;
+	sCfg.dwWakeupUs = 0;
+	sCfg.dwIdBase = 0;
+	sCfg.dwGroupBase = CAN_ID_NONE;
+	sCfg.fGroupPacer = FALSE;
+	sCfg.dwStubFrameUs = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Configures the target as the part with a product ID: flash size,
+  system memory addresses and erase times from the geometry table.
+  Only the product ID changes for a part which is not in the table.
+*/
+//////////////////////////////////////////////////////////////////////////
+void SimConfigPart(SimConfig& sCfg, UINT32 dwPid)
+{
+	const FlashGeometry* pGeometry = BootGeometryFind(dwPid);
+
+	sCfg.dwPid = dwPid;
+	if (pGeometry)
+	{
+		sCfg.dwFlashSize = pGeometry->dwFlashSize;
+		sCfg.dwUidAddr = BootDeviceUidAddr(dwPid);
+		sCfg.dwSizeAddr = pGeometry->dwSizeAddr;
+		sCfg.dwEraseUs = pGeometry->dwMassEraseUs;
+		sCfg.dwPageEraseUs = (UINT32)((UINT64)pGeometry->dwEraseUsPerKb * sCfg.dwPageSize / 1024);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor. The flash is erased, the boot loader waits for the sync
+  frame.
+*/
+//////////////////////////////////////////////////////////////////////////
+CSimTarget::CSimTarget(const SimConfig& sCfg)
+	: m_sCfg(sCfg)
+	, m_Flash(sCfg.dwFlashSize, 0xFF)
+	, m_Ram(sCfg.dwRamSize, 0x00)
+{
+	// lot number, wafer and position of the die
+	UINT32 dwUid = sCfg.dwSeed * 0x9E3779B1 + sCfg.dwIdBase;
+	for (UINT32 i = 0; i < sizeof(m_abUid); i++)
+	{
+		dwUid = dwUid * 1103515245 + 12345;
+		m_abUid[i] = (UINT8)(dwUid >> 16);
+	}
+	m_abSize[0] = (UINT8)(sCfg.dwFlashSize >> 10);
+	m_abSize[1] = (UINT8)(sCfg.dwFlashSize >> 18);
+	if (!m_Layout.SetPart(sCfg.dwPid, sCfg.dwFlashSize))
+	{
+		m_Layout.SetUniform(sCfg.dwPageSize, sCfg.dwFlashSize);
+	}
+	if (m_Layout.HasEcc())
+	{
+		m_Programmed.assign(sCfg.dwFlashSize / m_Layout.GetWriteUnit(), 0);
+	}
+
+	m_bState = SIM_STATE_RESET;
+	m_qwBusyUntil = 0;
+	m_qwRxDone = 0;
+	m_dwWriteAddr = 0;
+	m_dwWriteLen = 0;
+	m_dwWriteCount = 0;
+	m_dwFlashWrites = 0;
+
+	memset(&m_sStub, 0, sizeof(m_sStub));
+	m_fBlock = FALSE;
+	m_fBlockLz = FALSE;
+	m_dwBlockAddr = 0;
+	m_dwBlockLen = 0;
+	m_dwBlockCount = 0;
+	m_dwBlockFrames = 0;
+	m_fGap = FALSE;
+	m_dwGapFrames = 0;
+	m_dwStored = 0;
+	m_dwLastCrc = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Appends a reply frame which is ready for transmission at qwTime.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::Reply(UINT64 qwTime, UINT32 dwMsgId, const UINT8* pbData, UINT8 bLen,
+                       std::vector<CanFrame>& Replies)
+{
+	CanFrame sReply = {};
+
+	sReply.qwTime = qwTime;
+	sReply.dwMsgId = m_sCfg.dwIdBase + dwMsgId;
+	sReply.bLen = bLen;
+	for (UINT8 i = 0; i < bLen; i++)
+	{
+		sReply.abData[i] = pbData[i];
+	}
+	Replies.push_back(sReply);
+}
+
+void CSimTarget::ReplyByte(UINT64 qwTime, UINT32 dwMsgId, UINT8 bByte,
+                           std::vector<CanFrame>& Replies)
+{
+	Reply(qwTime, dwMsgId, &bByte, 1, Replies);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Appends a status frame of the stub with a 16 bit parameter.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::ReplyStatus(UINT64 qwTime, UINT8 bAck, UINT8 bEvent, UINT32 dwParam,
+                             std::vector<CanFrame>& Replies)
+{
+	UINT8 abStatus[4] = { bAck, bEvent, (UINT8)(dwParam >> 8), (UINT8)dwParam };
+	Reply(qwTime, STUB_ID_STATUS, abStatus, 4, Replies);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the flash or RAM at an address, NULL if the range is not
+  within one of them.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT8* CSimTarget::GetMemory(UINT32 dwAddr, UINT32 dwLen, BOOL& fFlash)
+{
+	fFlash = TRUE;
+	if ((dwAddr >= m_sCfg.dwFlashBase) && (dwAddr + dwLen <= m_sCfg.dwFlashBase + m_sCfg.dwFlashSize))
+	{
+		return &m_Flash[dwAddr - m_sCfg.dwFlashBase];
+	}
+
+	fFlash = FALSE;
+	if ((dwAddr >= m_sCfg.dwRamBase) && (dwAddr + dwLen <= m_sCfg.dwRamBase + m_sCfg.dwRamSize))
+	{
+		return &m_Ram[dwAddr - m_sCfg.dwRamBase];
+	}
+	return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Programs a range of the flash, programming can only clear bits. A
+  write unit of more than one byte which is not erased, or with ECC
+  was programmed since its erase, rejects the whole range, nothing is
+  programmed then.
+
+  @return FALSE if a write unit was programmed before
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimTarget::ProgramFlash(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen)
+{
+	UINT32 dwOffset = dwAddr - m_sCfg.dwFlashBase;
+	UINT32 dwUnit = m_Layout.GetWriteUnit();
+
+	for (UINT32 i = dwOffset / dwUnit; (dwUnit > 1) && (i <= (dwOffset + dwLen - 1) / dwUnit); i++)
+	{
+		BOOL fErased = m_Programmed.empty() || !m_Programmed[i];
+		for (UINT32 j = 0; j < dwUnit; j++)
+		{
+			fErased = fErased && (m_Flash[i * dwUnit + j] == 0xFF);
+		}
+		if (!fErased)
+		{
+			return FALSE;
+		}
+	}
+	for (UINT32 i = dwOffset / dwUnit; (i <= (dwOffset + dwLen - 1) / dwUnit) && !m_Programmed.empty(); i++)
+	{
+		m_Programmed[i] = 1;
+	}
+	for (UINT32 i = 0; i < dwLen; i++)
+	{
+		m_Flash[dwOffset + i] &= pbData[i];
+	}
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Erases a range of the flash, it starts and ends at sector boundaries.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::EraseFlash(UINT32 dwAddr, UINT32 dwLen)
+{
+	UINT32 dwOffset = dwAddr - m_sCfg.dwFlashBase;
+
+	memset(&m_Flash[dwOffset], 0xFF, dwLen);
+	if (!m_Programmed.empty())
+	{
+		UINT32 dwUnit = m_Layout.GetWriteUnit();
+		memset(&m_Programmed[dwOffset / dwUnit], 0, dwLen / dwUnit);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Processes a frame received by the target.
+
+  @param sBusFrame
+	received frame, qwTime is the end of the frame on the bus
+  @param Replies
+	receives the reply frames with the time they are ready to send
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::OnFrame(const CanFrame& sBusFrame, std::vector<CanFrame>& Replies)
+{
+	UINT32 dwBase = sBusFrame.dwMsgId & ~(CAN_ID_RANGE - 1);
+
+	if ((dwBase != m_sCfg.dwIdBase) && (dwBase != m_sCfg.dwGroupBase))
+	{
+		return;
+	}
+	if ((m_bState == SIM_STATE_HALTED) || ((m_bState == SIM_STATE_STUB) && (dwBase != m_sCfg.dwIdBase)))
+	{
+		return;
+	}
+	if (sBusFrame.qwTime < m_sCfg.dwWakeUs)
+	{
+		// still in reset
+		return;
+	}
+
+	//
+	// the commands are handled with the standard identifiers
+	//
+	CanFrame sFrame = sBusFrame;
+	sFrame.dwMsgId -= dwBase;
+
+	//
+	// commands arriving while flash is busy are handled afterwards
+	//
+	UINT64 qwStart = (sFrame.qwTime > m_qwBusyUntil) ? sFrame.qwTime : m_qwBusyUntil;
+	UINT64 qwReply = qwStart + m_sCfg.dwResponseUs;
+
+	switch (m_bState)
+	{
+	case SIM_STATE_RESET:
+		if (sFrame.dwMsgId == SIM_ID_SYNC)
+		{
+			ReplyByte(qwReply, SIM_ID_SYNC, SIM_ACK, Replies);
+			m_bState = SIM_STATE_IDLE;
+		}
+		break;
+
+	case SIM_STATE_IDLE:
+		switch (sFrame.dwMsgId)
+		{
+		case SIM_ID_SYNC:
+			// already synchronized, acknowledge again
+			ReplyByte(qwReply, SIM_ID_SYNC, SIM_ACK, Replies);
+			break;
+
+		case SIM_ID_GET:
+		{
+			// byte count - 1, version and commands, one byte per frame
+			UINT8 bCount = (UINT8)sizeof(abSimCommands);
+			UINT8 bVersion = SIM_BL_VERSION;
+			ReplyByte(qwReply, SIM_ID_GET, SIM_ACK, Replies);
+			ReplyByte(qwReply, SIM_ID_GET, bCount, Replies);
+			ReplyByte(qwReply, SIM_ID_GET, bVersion, Replies);
+			for (UINT32 i = 0; i < sizeof(abSimCommands); i++)
+			{
+				ReplyByte(qwReply, SIM_ID_GET, abSimCommands[i], Replies);
+			}
+			ReplyByte(qwReply, SIM_ID_GET, SIM_ACK, Replies);
+			break;
+		}
+
+		case SIM_ID_GET_VERSION:
+		{
+			UINT8 abVersion[3] = { SIM_BL_VERSION, 0x00, 0x00 };
+			ReplyByte(qwReply, SIM_ID_GET_VERSION, SIM_ACK, Replies);
+			Reply(qwReply, SIM_ID_GET_VERSION, abVersion, 3, Replies);
+			ReplyByte(qwReply, SIM_ID_GET_VERSION, SIM_ACK, Replies);
+			break;
+		}
+
+		case SIM_ID_GET_ID:
+		{
+			UINT8 abPid[2] = { (UINT8)(m_sCfg.dwPid >> 8), (UINT8)m_sCfg.dwPid };
+			ReplyByte(qwReply, SIM_ID_GET_ID, SIM_ACK, Replies);
+			Reply(qwReply, SIM_ID_GET_ID, abPid, 2, Replies);
+			ReplyByte(qwReply, SIM_ID_GET_ID, SIM_ACK, Replies);
+			break;
+		}
+
+		case SIM_ID_ERASE:
+			if ((sFrame.bLen == 1) && (sFrame.abData[0] == 0xFF))
+			{
+				// mass erase, second ACK when done
+				ReplyByte(qwReply, SIM_ID_ERASE, SIM_ACK, Replies);
+				m_qwBusyUntil = qwReply + m_sCfg.dwEraseUs;
+				EraseFlash(m_sCfg.dwFlashBase, (UINT32)m_Flash.size());
+				ReplyByte(m_qwBusyUntil, SIM_ID_ERASE, SIM_ACK, Replies);
+			}
+			else if (sFrame.bLen == 1)
+			{
+				// page erase, the page numbers follow
+				m_dwWriteLen = (UINT32)sFrame.abData[0] + 1;
+				m_dwWriteCount = 0;
+				m_bState = SIM_STATE_ERASE_PAGES;
+				ReplyByte(qwReply, SIM_ID_ERASE, SIM_ACK, Replies);
+			}
+			else
+			{
+				ReplyByte(qwReply, SIM_ID_ERASE, SIM_NACK, Replies);
+			}
+			break;
+
+		case SIM_ID_READ:
+		{
+			UINT32 dwAddr = ((UINT32)sFrame.abData[0] << 24) | ((UINT32)sFrame.abData[1] << 16) |
+			                ((UINT32)sFrame.abData[2] << 8) | sFrame.abData[3];
+			UINT32 dwLen = (UINT32)sFrame.abData[4] + 1;
+			BOOL   fFlash;
+			UINT8* pbMemory = GetMemory(dwAddr, dwLen, fFlash);
+
+			if (!pbMemory && (dwAddr >= m_sCfg.dwUidAddr) && (dwAddr + dwLen <= m_sCfg.dwUidAddr + sizeof(m_abUid)))
+			{
+				pbMemory = &m_abUid[dwAddr - m_sCfg.dwUidAddr];
+			}
+			if (!pbMemory && (dwAddr >= m_sCfg.dwSizeAddr) && (dwAddr + dwLen <= m_sCfg.dwSizeAddr + sizeof(m_abSize)))
+			{
+				pbMemory = &m_abSize[dwAddr - m_sCfg.dwSizeAddr];
+			}
+			if ((sFrame.bLen == 5) && pbMemory)
+			{
+				// data in frames of up to 8 bytes between two ACKs
+				ReplyByte(qwReply, SIM_ID_READ, SIM_ACK, Replies);
+				for (UINT32 i = 0; i < dwLen; i += 8)
+				{
+					UINT32 dwFrame = (dwLen - i > 8) ? 8 : (dwLen - i);
+					Reply(qwReply, SIM_ID_READ, &pbMemory[i], (UINT8)dwFrame, Replies);
+				}
+				ReplyByte(qwReply, SIM_ID_READ, SIM_ACK, Replies);
+			}
+			else
+			{
+				ReplyByte(qwReply, SIM_ID_READ, SIM_NACK, Replies);
+			}
+			break;
+		}
+
+		case SIM_ID_WRITE:
+		{
+			UINT32 dwAddr = ((UINT32)sFrame.abData[0] << 24) | ((UINT32)sFrame.abData[1] << 16) |
+			                ((UINT32)sFrame.abData[2] << 8) | sFrame.abData[3];
+			UINT32 dwLen = (UINT32)sFrame.abData[4] + 1;
+			BOOL   fFlash;
+
+			if ((sFrame.bLen == 5) && GetMemory(dwAddr, dwLen, fFlash))
+			{
+				m_dwWriteAddr = dwAddr;
+				m_dwWriteLen = dwLen;
+				m_dwWriteCount = 0;
+				m_bState = SIM_STATE_WRITE_DATA;
+				if (fFlash)
+				{
+					m_dwFlashWrites++;
+				}
+				ReplyByte(qwReply, SIM_ID_WRITE, SIM_ACK, Replies);
+			}
+			else
+			{
+				ReplyByte(qwReply, SIM_ID_WRITE, SIM_NACK, Replies);
+			}
+			break;
+		}
+
+		case SIM_ID_GO:
+		{
+			UINT32 dwAddr = ((UINT32)sFrame.abData[0] << 24) | ((UINT32)sFrame.abData[1] << 16) |
+			                ((UINT32)sFrame.abData[2] << 8) | sFrame.abData[3];
+			BOOL   fFlash;
+
+			if ((sFrame.bLen == 4) && GetMemory(dwAddr, 8, fFlash))
+			{
+				ReplyByte(qwReply, SIM_ID_GO, SIM_ACK, Replies);
+				StartStub(dwAddr, qwReply, Replies);
+			}
+			else
+			{
+				ReplyByte(qwReply, SIM_ID_GO, SIM_NACK, Replies);
+			}
+			break;
+		}
+
+		default:
+			ReplyByte(qwReply, sFrame.dwMsgId, SIM_NACK, Replies);
+			break;
+		}
+		break;
+
+	case SIM_STATE_WRITE_DATA:
+		if (sFrame.dwMsgId == SIM_ID_DATA)
+		{
+			for (UINT8 i = 0; (i < sFrame.bLen) && (m_dwWriteCount < m_dwWriteLen); i++)
+			{
+				m_abWrite[m_dwWriteCount++] = sFrame.abData[i];
+			}
+
+			if (m_dwWriteCount < m_dwWriteLen)
+			{
+				if ((dwBase != m_sCfg.dwGroupBase) || m_sCfg.fGroupPacer)
+				{
+					ReplyByte(qwReply, SIM_ID_WRITE, SIM_ACK, Replies);
+				}
+			}
+			else
+			{
+				// RAM is written at once
+				BOOL   fFlash;
+				BOOL   fWritten = TRUE;
+				UINT8* pbMemory = GetMemory(m_dwWriteAddr, m_dwWriteLen, fFlash);
+				if (fFlash)
+				{
+					fWritten = ProgramFlash(m_dwWriteAddr, m_abWrite, m_dwWriteLen);
+					m_qwBusyUntil = qwReply + m_sCfg.dwProgramUs;
+				}
+				else
+				{
+					memcpy(pbMemory, m_abWrite, m_dwWriteLen);
+				}
+				m_bState = SIM_STATE_IDLE;
+				ReplyByte(fFlash ? m_qwBusyUntil : qwReply, SIM_ID_WRITE, fWritten ? SIM_ACK : SIM_NACK, Replies);
+			}
+		}
+		break;
+
+	case SIM_STATE_ERASE_PAGES:
+		if (sFrame.dwMsgId == SIM_ID_ERASE)
+		{
+			for (UINT8 i = 0; (i < sFrame.bLen) && (m_dwWriteCount < m_dwWriteLen); i++)
+			{
+				m_abWrite[m_dwWriteCount++] = sFrame.abData[i];
+			}
+			if (m_dwWriteCount < m_dwWriteLen)
+			{
+				break;
+			}
+
+			BOOL   fErased = TRUE;
+			UINT64 qwEraseUs = 0;
+			for (UINT32 i = 0; i < m_dwWriteLen; i++)
+			{
+				BOOL   fFlash;
+				UINT8* pbPage = NULL;
+				if (m_abWrite[i] < m_Layout.GetSectors())
+				{
+					UINT32 dwSize = m_Layout.GetSize(m_abWrite[i]);
+					pbPage = GetMemory(m_Layout.GetAddr(m_abWrite[i]), dwSize, fFlash);
+					if (pbPage && fFlash)
+					{
+						EraseFlash(m_Layout.GetAddr(m_abWrite[i]), dwSize);
+						qwEraseUs += (UINT64)m_sCfg.dwPageEraseUs * dwSize / m_sCfg.dwPageSize;
+						continue;
+					}
+				}
+				fErased = FALSE;
+			}
+			m_qwBusyUntil = qwReply + qwEraseUs;
+			m_bState = SIM_STATE_IDLE;
+			ReplyByte(m_qwBusyUntil, SIM_ID_ERASE, fErased ? SIM_ACK : SIM_NACK, Replies);
+		}
+		break;
+
+	case SIM_STATE_STUB:
+		// the stub receives while the flash is programmed
+		if (m_sCfg.dwStubFrameUs)
+		{
+			// the frame waits behind the ones in the FIFO, a full FIFO overruns
+			qwStart = (sFrame.qwTime > m_qwRxDone) ? sFrame.qwTime : m_qwRxDone;
+			if (qwStart - sFrame.qwTime > (UINT64)m_sCfg.dwStubFrameUs * SIM_STUB_RX_FIFO)
+			{
+				break;
+			}
+			m_qwRxDone = qwStart + m_sCfg.dwStubFrameUs;
+			OnStubFrame(sFrame, m_qwRxDone + m_sCfg.dwResponseUs, Replies);
+			break;
+		}
+		OnStubFrame(sFrame, sFrame.qwTime + m_sCfg.dwResponseUs, Replies);
+		break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Handles Go to an address which was acknowledged. The stub runs if
+  RAM at the address holds an image with a valid header and CRC, it
+  reports its parameters when it is ready.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::StartStub(UINT32 dwAddr, UINT64 qwReply, std::vector<CanFrame>& Replies)
+{
+	BOOL   fFlash;
+	UINT8* pbImage = GetMemory(dwAddr, STUB_HEADER_OFFSET + STUB_HEADER_LEN, fFlash);
+
+	m_bState = SIM_STATE_HALTED;
+	if (fFlash || !pbImage)
+	{
+		return;
+	}
+
+	UINT32 dwAvail = m_sCfg.dwRamBase + m_sCfg.dwRamSize - dwAddr;
+	if (!StubGetHeader(pbImage, dwAvail, m_sStub) ||
+	    (BootCrc32(pbImage + STUB_HEADER_OFFSET + STUB_HEADER_LEN,
+	               m_sStub.dwImageLen - STUB_HEADER_OFFSET - STUB_HEADER_LEN) != m_sStub.dwCrc))
+	{
+		return;
+	}
+	m_bState = SIM_STATE_STUB;
+	m_StubBuffer.assign(m_sStub.dwBufferSize, 0xFF);
+	m_fBlock = FALSE;
+	m_dwStored = 0;
+
+	UINT8 abReady[6] = { STUB_ACK, STUB_EV_READY, (UINT8)m_sStub.wVersion,
+	                     (UINT8)(m_sStub.wFlags >> 8), (UINT8)m_sStub.wFlags, (UINT8)(m_sStub.dwBufferSize >> 8) };
+	Reply(qwReply + m_sCfg.dwResponseUs, STUB_ID_STATUS, abReady, 6, Replies);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Processes a frame received by the running stub.
+
+  @param sFrame   received frame with the standard identifier
+  @param qwReply  earliest time of a reply
+  @param Replies  receives the reply frames
+*/
+//////////////////////////////////////////////////////////////////////////
+void CSimTarget::OnStubFrame(const CanFrame& sFrame, UINT64 qwReply, std::vector<CanFrame>& Replies)
+{
+	//
+	// data frame, the sequence number must follow the last one
+	//
+	if ((sFrame.dwMsgId >= STUB_ID_DATA) && (sFrame.dwMsgId < STUB_ID_DATA + STUB_SEQ_MOD))
+	{
+		if (!m_fBlock || ((sFrame.bFlags & CAN_FLAG_FD) && !(m_sStub.wFlags & STUB_FLAG_FD)))
+		{
+			return;
+		}
+		if (m_dwBlockCount >= m_dwBlockLen)
+		{
+			// the host missed the last progress
+			if ((++m_dwGapFrames % STUB_ACK_FRAMES) == 1)
+			{
+				ReplyStatus(qwReply, STUB_ACK, STUB_EV_PROGRESS, m_dwBlockCount, Replies);
+			}
+			return;
+		}
+		if (sFrame.dwMsgId - STUB_ID_DATA != m_dwBlockFrames % STUB_SEQ_MOD)
+		{
+			// one NACK per gap, repeated while the old stream goes on
+			if (!m_fGap || ((++m_dwGapFrames % STUB_ACK_FRAMES) == 0))
+			{
+				ReplyStatus(qwReply, STUB_NACK, STUB_EV_GAP, m_dwBlockCount, Replies);
+			}
+			m_fGap = TRUE;
+			return;
+		}
+
+		for (UINT8 i = 0; (i < sFrame.bLen) && (m_dwBlockCount < m_dwBlockLen); i++)
+		{
+			m_StubBuffer[m_dwBlockCount++] = sFrame.abData[i];
+		}
+		m_dwBlockFrames++;
+		m_fGap = FALSE;
+		m_dwGapFrames = 0;
+		if (((m_dwBlockFrames % STUB_ACK_FRAMES) == 0) || (m_dwBlockCount >= m_dwBlockLen))
+		{
+			ReplyStatus(qwReply, STUB_ACK, STUB_EV_PROGRESS, m_dwBlockCount, Replies);
+		}
+		return;
+	}
+
+	if ((sFrame.dwMsgId != STUB_ID_CMD) || (sFrame.bLen == 0))
+	{
+		return;
+	}
+
+	switch (sFrame.abData[0])
+	{
+	case STUB_OP_BLOCK:
+	case STUB_OP_BLOCK_LZ:
+	{
+		UINT32 dwAddr = ((UINT32)sFrame.abData[1] << 24) | ((UINT32)sFrame.abData[2] << 16) |
+		                ((UINT32)sFrame.abData[3] << 8) | sFrame.abData[4];
+		UINT32 dwLen = ((UINT32)sFrame.abData[5] << 8) | sFrame.abData[6];
+		BOOL   fLz = (sFrame.abData[0] == STUB_OP_BLOCK_LZ) ? TRUE : FALSE;
+		BOOL   fFlash;
+
+		// the length of a compressed block is checked at its end
+		if ((sFrame.bLen != 7) || (dwLen == 0) || (dwLen > m_sStub.dwBufferSize) ||
+		    (fLz && !(m_sStub.wFlags & STUB_FLAG_LZ)) ||
+		    !GetMemory(dwAddr, fLz ? 1 : dwLen, fFlash) || !fFlash)
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+			break;
+		}
+		m_fBlock = TRUE;
+		m_fBlockLz = fLz;
+		m_dwBlockAddr = dwAddr;
+		m_dwBlockLen = dwLen;
+		m_dwBlockCount = 0;
+		m_dwBlockFrames = 0;
+		m_fGap = FALSE;
+		m_dwGapFrames = 0;
+		ReplyStatus(qwReply, STUB_ACK, STUB_EV_BLOCK, 0, Replies);
+		break;
+	}
+
+	case STUB_OP_END:
+	{
+		UINT32 dwCrc = ((UINT32)sFrame.abData[1] << 24) | ((UINT32)sFrame.abData[2] << 16) |
+		               ((UINT32)sFrame.abData[3] << 8) | sFrame.abData[4];
+
+		if (!m_fBlock)
+		{
+			// the answer to the last block was lost
+			if ((m_dwStored > 0) && (dwCrc == m_dwLastCrc))
+			{
+				ReplyStatus(qwReply, STUB_ACK, STUB_EV_STORED, m_dwStored - 1, Replies);
+			}
+			else
+			{
+				ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+			}
+			break;
+		}
+		if (m_dwBlockCount < m_dwBlockLen)
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_GAP, m_dwBlockCount, Replies);
+			break;
+		}
+		m_fBlock = FALSE;
+
+		std::vector<UINT8> Data(m_StubBuffer.begin(), m_StubBuffer.begin() + m_dwBlockLen);
+		if (m_fBlockLz && !BootLzDecompress(&m_StubBuffer[0], m_dwBlockLen, Data, m_sStub.dwBufferSize))
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_CRC, 0, Replies);
+			break;
+		}
+		if (BootCrc32(Data.data(), (UINT32)Data.size()) != dwCrc)
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_CRC, 0, Replies);
+			break;
+		}
+
+		//
+		// the buffer is free when the programming of the block starts,
+		// that is after the programming of the block before
+		//
+		BOOL   fFlash;
+		UINT8* pbFlash = GetMemory(m_dwBlockAddr, (UINT32)Data.size(), fFlash);
+		if (!pbFlash || !fFlash)
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+			break;
+		}
+		UINT64 qwStart = (qwReply > m_qwBusyUntil) ? qwReply : m_qwBusyUntil;
+		if (!ProgramFlash(m_dwBlockAddr, &Data[0], (UINT32)Data.size()))
+		{
+			ReplyStatus(qwStart, STUB_NACK, STUB_EV_PROGRAM, 0, Replies);
+			break;
+		}
+		m_qwBusyUntil = qwStart + (UINT64)m_sCfg.dwProgramUs * ((Data.size() + 255) / 256);
+		m_dwStored++;
+		m_dwLastCrc = dwCrc;
+		ReplyStatus(qwStart, STUB_ACK, STUB_EV_STORED, m_dwStored - 1, Replies);
+		break;
+	}
+
+	case STUB_OP_FLUSH:
+	{
+		UINT64 qwDone = (qwReply > m_qwBusyUntil) ? qwReply : m_qwBusyUntil;
+		ReplyStatus(qwDone, STUB_ACK, STUB_EV_FLUSHED, m_dwStored, Replies);
+		break;
+	}
+
+	case STUB_OP_CHECK:
+	{
+		UINT32 dwAddr = ((UINT32)sFrame.abData[1] << 24) | ((UINT32)sFrame.abData[2] << 16) |
+		                ((UINT32)sFrame.abData[3] << 8) | sFrame.abData[4];
+		UINT32 dwLen = ((UINT32)sFrame.abData[5] << 16) | ((UINT32)sFrame.abData[6] << 8) | sFrame.abData[7];
+		BOOL   fFlash;
+		UINT8* pbFlash = GetMemory(dwAddr, dwLen, fFlash);
+
+		if ((sFrame.bLen != 8) || !pbFlash || !fFlash)
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+			break;
+		}
+
+		// the flash is read when the programming is done
+		UINT32 dwCrc = BootCrc32(pbFlash, dwLen);
+		UINT8  abStatus[8] = { STUB_ACK, STUB_EV_CHECK, (UINT8)(dwCrc >> 24), (UINT8)(dwCrc >> 16),
+		                       (UINT8)(dwCrc >> 8), (UINT8)dwCrc, (UINT8)(dwAddr >> 16), (UINT8)(dwAddr >> 8) };
+		Reply((qwReply > m_qwBusyUntil) ? qwReply : m_qwBusyUntil, STUB_ID_STATUS, abStatus, 8, Replies);
+		break;
+	}
+
+	case STUB_OP_ERASE:
+	{
+		UINT32 dwAddr = ((UINT32)sFrame.abData[1] << 24) | ((UINT32)sFrame.abData[2] << 16) |
+		                ((UINT32)sFrame.abData[3] << 8) | sFrame.abData[4];
+		UINT32 dwLen = ((UINT32)sFrame.abData[5] << 16) | ((UINT32)sFrame.abData[6] << 8) | sFrame.abData[7];
+		BOOL   fFlash;
+		UINT8* pbFlash = GetMemory(dwAddr, dwLen, fFlash);
+		UINT32 dwFirst, dwLast;
+
+		// the range covers whole sectors
+		if ((sFrame.bLen != 8) || !pbFlash || !fFlash || (dwLen == 0) ||
+		    !m_Layout.Find(dwAddr, dwFirst) || (m_Layout.GetAddr(dwFirst) != dwAddr) ||
+		    !m_Layout.Find(dwAddr + dwLen - 1, dwLast) || (m_Layout.GetAddr(dwLast) + m_Layout.GetSize(dwLast) != dwAddr + dwLen))
+		{
+			ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+			break;
+		}
+
+		// the erase starts when the programming is done
+		UINT32 dwPages = dwLast - dwFirst + 1;
+		UINT64 qwStart = (qwReply > m_qwBusyUntil) ? qwReply : m_qwBusyUntil;
+		EraseFlash(dwAddr, dwLen);
+		m_qwBusyUntil = qwStart + (UINT64)m_sCfg.dwPageEraseUs * dwLen / m_sCfg.dwPageSize;
+		UINT8  abStatus[8] = { STUB_ACK, STUB_EV_ERASED, (UINT8)(dwPages >> 24), (UINT8)(dwPages >> 16),
+		                       (UINT8)(dwPages >> 8), (UINT8)dwPages, (UINT8)(dwAddr >> 16), (UINT8)(dwAddr >> 8) };
+		Reply(m_qwBusyUntil, STUB_ID_STATUS, abStatus, 8, Replies);
+		break;
+	}
+
+	default:
+		ReplyStatus(qwReply, STUB_NACK, STUB_EV_RANGE, 0, Replies);
+		break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Loads the flash contents from a file written by SaveFlash, so a
+  session can continue on the flash of an earlier run. A missing file
+  leaves the flash erased.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimTarget::LoadFlash(const char* pszFile)
+{
+	FILE* pFile = fopen(pszFile, "rb");
+
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	size_t nRead = fread(&m_Flash[0], 1, m_Flash.size(), pFile);
+	fclose(pFile);
+
+	// a blank write unit counts as erased
+	if (!m_Programmed.empty())
+	{
+		memset(&m_Programmed[0], 0, m_Programmed.size());
+	}
+	return (nRead == m_Flash.size()) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Saves the flash contents to a file.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CSimTarget::SaveFlash(const char* pszFile) const
+{
+	FILE* pFile = fopen(pszFile, "wb");
+
+	if (!pFile)
+	{
+		return FALSE;
+	}
+
+	size_t nWritten = fwrite(&m_Flash[0], 1, m_Flash.size(), pFile);
+	fclose(pFile);
+	return (nWritten == m_Flash.size()) ? TRUE : FALSE;
+}
@@ -0,0 +1,177 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Simulated STM32 CAN boot loader.
+
+  @note
+	The simulator allows to run the flasher without an adapter and
+	without a target. The targets are connected to the host by the
+	simulated bus (SimBus.hpp), which keeps the simulated clock.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIMTARGET_HPP_
+#define _SIMTARGET_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootGeometry.hpp"
+#include "CanTransport.hpp"
+#include "StubProtocol.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define SIM_ACK                 0x79    // acknowledge byte
+#define SIM_NACK                0x1F    // not acknowledge byte
+#define SIM_STUB_RX_FIFO        6       // frames in the receive FIFOs of the stub (2 x 3 of bxCAN)
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	UINT32 dwBitRate;                   // bus bit rate in bit/s
+	UINT32 dwDataBitRate;               // CAN FD data bit rate in bit/s, 0 = classic CAN
+	UINT32 dwResponseUs;                // command processing time of the target
+	UINT32 dwWakeUs;                    // the target ignores all frames until this time
+	UINT32 dwEraseUs;                   // duration of a mass erase
+	UINT32 dwPageSize;                  // erase unit of the flash in bytes
+	UINT32 dwPageEraseUs;               // duration of a page erase
+	UINT32 dwProgramUs;                 // programming time of one write block
+	UINT32 dwLossPpm;                   // frame loss probability in parts per million
+	UINT32 dwErrorPpm;                  // probability of a bit error per frame in parts per million
+	UINT32 dwSeed;                      // seed of the loss injection
+	UINT32 dwFlashBase;                 // start address of the flash
+	UINT32 dwFlashSize;                 // size of the flash in bytes
+	UINT32 dwRamBase;                   // start address of the RAM
+	UINT32 dwRamSize;                   // size of the RAM in bytes
+	UINT32 dwPid;                       // product ID reported by Get ID
+	UINT32 dwUidAddr;                   // address of the 96 bit unique ID
+	UINT32 dwSizeAddr;                  // register with the flash size in KB
+	UINT32 dwCutFrames;                 // all frames after this number are lost, 0 = never
+	UINT32 dwLoadPct;                   // share of the bus taken by frames of other devices in percent
+	UINT32 dwWakeupUs;                  // the host wakes up for received frames, not in the poll mode
+	UINT32 dwIdBase;                    // added to all identifiers, multiple of CAN_ID_RANGE
+	UINT32 dwGroupBase;                 // ID base of broadcast commands, CAN_ID_NONE = none
+	BOOL   fGroupPacer;                 // acknowledges every data frame sent to the group
+	UINT32 dwStubFrameUs;               // the stub takes a frame from its receive FIFO in us, 0 = at once
+} SimConfig;
+
+void SimDefaultConfig(SimConfig& sCfg);
+void SimConfigPart   (SimConfig& sCfg, UINT32 dwPid);
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class models the command handling of the STM32 ROM boot loader
+  on CAN (AN3154): sync, Get, Get Version, Get ID, mass and page erase,
+  Read Memory and Write Memory. The page numbers of a page erase follow
+  the command in frames of up to 8 bytes, the second ACK comes when the
+  pages are erased.
+  Responses use the identifier of the command, data frames of a write
+  are sent with identifier 0x04 and acknowledged one by one. All
+  identifiers are offset by the ID base of the target, frames of other
+  ID ranges are ignored. A target in a broadcast group also takes the
+  commands with the ID base of the group, it answers them with its own
+  ID base. Data frames sent to the group are acknowledged only by the
+  pacer of the group, the last frame of a write by every target.
+
+  The target comes out of reset at a configured time and ignores all
+  frames before. Read Memory also returns the unique ID of the device, which is
+  derived from the seed and the ID base, and the flash size register.
+  The flash has the sectors of the part in the geometry table, or pages
+  of the configured size for an unknown product ID; the erase time grows
+  with the size of a sector. A write unit of more than one byte which
+  is not erased can not be programmed, a unit with ECC (the double word
+  of an L4) not even after a program with 0xFF. Write Memory also takes RAM
+  addresses. Go (0x21) to RAM starts the
+  fast loader stub (StubProtocol.hpp) if RAM holds a valid stub image,
+  the code itself is not executed. The model of the stub receives the
+  block streams, decompresses them, checks the CRC and programs a block
+  while the next one is received. A stub which needs time per frame
+  loses the frames which arrive while its receive FIFO is full. It also
+  reports the CRC of a flash range and erases pages. Go to anything else leaves the target
+  silent.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CSimTarget
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor
+	//---------------------------------------------------------------
+	CSimTarget(const SimConfig& sCfg);
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	void OnFrame(const CanFrame& sFrame, std::vector<CanFrame>& Replies);
+
+	const std::vector<UINT8>& GetFlash(void) const { return m_Flash; }
+	UINT32 GetFlashWrites(void) const { return m_dwFlashWrites; }
+	BOOL LoadFlash(const char* pszFile);
+	BOOL SaveFlash(const char* pszFile) const;
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	void Reply(UINT64 qwTime, UINT32 dwMsgId, const UINT8* pbData, UINT8 bLen,
+	           std::vector<CanFrame>& Replies);
+	void ReplyByte(UINT64 qwTime, UINT32 dwMsgId, UINT8 bByte,
+	               std::vector<CanFrame>& Replies);
+	void ReplyStatus(UINT64 qwTime, UINT8 bAck, UINT8 bEvent, UINT32 dwParam,
+	                 std::vector<CanFrame>& Replies);
+	UINT8* GetMemory(UINT32 dwAddr, UINT32 dwLen, BOOL& fFlash);
+	BOOL   ProgramFlash(UINT32 dwAddr, const UINT8* pbData, UINT32 dwLen);
+	void   EraseFlash  (UINT32 dwAddr, UINT32 dwLen);
+
+	//---------------------------------------------------------------
+	// fast loader stub
+	//---------------------------------------------------------------
+	void StartStub  (UINT32 dwAddr, UINT64 qwReply, std::vector<CanFrame>& Replies);
+	void OnStubFrame(const CanFrame& sFrame, UINT64 qwReply, std::vector<CanFrame>& Replies);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	SimConfig          m_sCfg;          // timing and memory configuration
+	std::vector<UINT8> m_Flash;         // flash contents
+	std::vector<UINT8> m_Ram;           // RAM contents
+	UINT8              m_abUid[12];     // unique ID of the device
+	UINT8              m_abSize[2];     // flash size register
+	CFlashLayout       m_Layout;        // sectors of the flash
+	std::vector<UINT8> m_Programmed;    // per write unit with ECC: programmed since the erase
+	UINT8              m_bState;        // protocol state
+	UINT64             m_qwBusyUntil;   // end of the running erase/program
+	UINT64             m_qwRxDone;      // the stub has taken all frames from its receive FIFO
+	UINT32             m_dwWriteAddr;   // address of the pending write
+	UINT32             m_dwWriteLen;    // length of the pending write or number of pages to erase
+	UINT32             m_dwWriteCount;  // bytes received for the pending write or page erase
+	UINT8              m_abWrite[256];  // data of the pending write or page numbers
+	UINT32             m_dwFlashWrites; // Write Memory commands to the flash taken
+
+	StubHeader         m_sStub;         // header of the running stub
+	std::vector<UINT8> m_StubBuffer;    // receive buffer of the stub
+	BOOL               m_fBlock;        // the stub receives a block
+	BOOL               m_fBlockLz;      // the block is compressed
+	UINT32             m_dwBlockAddr;   // address of the block
+	UINT32             m_dwBlockLen;    // length of the block as sent
+	UINT32             m_dwBlockCount;  // bytes received in order
+	UINT32             m_dwBlockFrames; // data frames received in order
+	BOOL               m_fGap;          // a frame of the block is missing
+	UINT32             m_dwGapFrames;   // frames received behind the gap
+	UINT32             m_dwStored;      // blocks handed over to programming
+	UINT32             m_dwLastCrc;     // CRC of the last stored block
+};
+
+#endif //_SIMTARGET_HPP_
@@ -0,0 +1,171 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Protocol of the RAM fast loader stub, shared by the host and the
+  simulated target.
+
+  @note
+	The stub is uploaded into RAM with Write Memory and started with Go
+	(0x21). Go loads the stack pointer from the first word of the image
+	and jumps to the reset vector in the second word, the stub header
+	follows at offset 8. The ROM boot loader is gone afterwards.
+
+	The stub receives a block of up to its buffer size as a stream of
+	data frames without a response per frame. Each data frame carries a
+	sequence number in the low bits of its identifier, the stub detects
+	a lost frame by the gap and answers with the offset it expects, again
+	every STUB_ACK_FRAMES frames it drops behind the gap. The
+	in-order offset is reported every STUB_ACK_FRAMES frames, the host
+	keeps up to STUB_WINDOW_FRAMES frames in flight. With fewer frames
+	in flight than sequence numbers an old frame can not be taken for
+	the expected one. Data frames behind the complete block repeat the
+	last progress status.
+
+	The end of a block carries the CRC-32 of the block (BootCrc.hpp).
+	The stub programs a block while it receives the next one, so the
+	programming time overlaps the transfer.
+
+	A stub with STUB_FLAG_LZ also takes compressed blocks (BootLz.hpp).
+	The stream is received like a plain block and decompressed into the
+	program buffer at the end, the CRC is the one of the decompressed
+	data. STUB_OP_CHECK returns the CRC of a flash range, so the host
+	verifies the programmed blocks without reading them back. The
+	answer repeats the address, a late answer to a repeated query is
+	not taken for the next one. STUB_OP_ERASE erases the sectors of a
+	range, which must start and end at sector boundaries; it answers
+	like STUB_OP_CHECK when the erase is done.
+
+	All identifiers are offset by the ID base of the node. The status
+	identifier is the lowest one, so the responses win the arbitration
+	against the data stream.
+
+	Status frame: ACK/NACK, event, up to four parameter bytes. The
+	parameters of commands and status frames are big endian like the
+	addresses of the ROM boot loader commands.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _STUBPROTOCOL_HPP_
+#define _STUBPROTOCOL_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "BootTypes.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+//
+// stub image
+//
+#define STUB_MAGIC                      0x42555453      // "STUB"
+#define STUB_VERSION                    1
+#define STUB_HEADER_OFFSET              8               // behind stack pointer and reset vector
+#define STUB_HEADER_LEN                 20
+
+#define STUB_FLAG_FD                    0x0001          // stub runs CAN FD
+#define STUB_FLAG_LZ                    0x0002          // stub decompresses blocks
+
+#define STUB_ACK                        0x79            // like the ROM boot loader
+#define STUB_NACK                       0x1F
+
+//
+// identifiers
+//
+#define STUB_ID_STATUS                  0x10            // stub -> host
+#define STUB_ID_CMD                     0x12            // host -> stub
+#define STUB_ID_DATA                    0x40            // host -> stub, plus sequence number
+
+#define STUB_SEQ_MOD                    16              // sequence numbers of the data frames
+#define STUB_WINDOW_FRAMES              12              // max. data frames in flight
+#define STUB_ACK_FRAMES                 4               // data frames per progress status
+
+//
+// commands
+//
+#define STUB_OP_BLOCK                   0x01            // address (4), length (2): start a block
+#define STUB_OP_END                     0x02            // CRC (4): end of the block data
+#define STUB_OP_FLUSH                   0x03            // wait until all blocks are programmed
+#define STUB_OP_BLOCK_LZ                0x04            // address (4), stream length (2): start a compressed block
+#define STUB_OP_CHECK                   0x05            // address (4), length (3): CRC of the flash
+#define STUB_OP_ERASE                   0x06            // address (4), length (3): erase the sectors of the range
+
+//
+// status events, with ACK
+//
+#define STUB_EV_READY                   0x00            // version, flags (2), buffer size / 256
+#define STUB_EV_BLOCK                   0x01            // block started
+#define STUB_EV_PROGRESS                0x02            // bytes received in order (2)
+#define STUB_EV_STORED                  0x03            // CRC is correct, programmed blocks (2)
+#define STUB_EV_FLUSHED                 0x04            // programmed blocks (2)
+#define STUB_EV_CHECK                   0x05            // CRC of the flash range (4), address bits 8..23 (2)
+#define STUB_EV_ERASED                  0x06            // sectors erased (4), address bits 8..23 (2)
+
+//
+// status events, with NACK
+//
+#define STUB_EV_GAP                     0x10            // frame lost, bytes received in order (2)
+#define STUB_EV_CRC                     0x11            // CRC is wrong or the stream is corrupt, the block is dropped
+#define STUB_EV_RANGE                   0x12            // address or length is rejected
+#define STUB_EV_PROGRAM                 0x13            // programming failed
+
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
+
+//
+// header of the stub image, little endian like the Cortex-M code
+//
+typedef struct {
+	UINT32 dwMagic;                     // STUB_MAGIC
+	UINT16 wVersion;                    // STUB_VERSION
+	UINT16 wFlags;                      // STUB_FLAG_xxx
+	UINT32 dwBufferSize;                // max. bytes per block, multiple of 256
+	UINT32 dwImageLen;                  // length of the whole image
+	UINT32 dwCrc;                       // CRC-32 of the image behind the header
+} StubHeader;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reads a little endian word of the stub image.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 StubGetLe32(const UINT8* pb)
+{
+	return (UINT32)pb[0] | ((UINT32)pb[1] << 8) | ((UINT32)pb[2] << 16) | ((UINT32)pb[3] << 24);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reads the stub header of an image. The CRC is checked by the caller.
+
+  @return FALSE if the image is too short or no stub of this version
+*/
+//////////////////////////////////////////////////////////////////////////
+inline BOOL StubGetHeader(const UINT8* pbImage, UINT32 dwLen, StubHeader& sHeader)
+{
+	if (dwLen < STUB_HEADER_OFFSET + STUB_HEADER_LEN)
+	{
+		return FALSE;
+	}
+
+	const UINT8* pb = pbImage + STUB_HEADER_OFFSET;
+	sHeader.dwMagic = StubGetLe32(pb);
+	sHeader.wVersion = (UINT16)(pb[4] | (pb[5] << 8));
+	sHeader.wFlags = (UINT16)(pb[6] | (pb[7] << 8));
+	sHeader.dwBufferSize = StubGetLe32(pb + 8);
+	sHeader.dwImageLen = StubGetLe32(pb + 12);
+	sHeader.dwCrc = StubGetLe32(pb + 16);
+
+	return ((sHeader.dwMagic == STUB_MAGIC) && (sHeader.wVersion == STUB_VERSION) &&
+	        (sHeader.dwImageLen >= STUB_HEADER_OFFSET + STUB_HEADER_LEN) && (sHeader.dwImageLen <= dwLen) &&
+	        (sHeader.dwBufferSize >= 256) && (sHeader.dwBufferSize <= 0x8000)) ? TRUE : FALSE;
+}
+
+#endif //_STUBPROTOCOL_HPP_
@@ -18,165 +18,73 @@
 // HMS Technology Center Ravensburg GmbH, all rights reserved
 //////////////////////////////////////////////////////////////////////////
 
+
 //////////////////////////////////////////////////////////////////////////
 // include files
 //////////////////////////////////////////////////////////////////////////
 #include "vcisdk.h"
 
-#include <process.h>
 #include <stdio.h>
 #include <conio.h>
-#include "SocketSelectDlg.hpp"
-#include <iostream>
-#include <fstream>
+#include "BootBroadcast.hpp"
+#include "BootCoSession.hpp"
+#include "BootLog.hpp"
+#include "BootSession.hpp"
+#include "CanMux.hpp"
+#include "CanTxQueue.hpp"
+#include "HexFile.hpp"
+#include "SimBus.hpp"
+#include "VciTransport.hpp"
+#include "VciReactor.hpp"
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
 //////////////////////////////////////////////////////////////////////////
-// global variables
+// constants and macros
 //////////////////////////////////////////////////////////////////////////
 
-static IBalObject* pBalObject = 0;     // bus access object
-
-static LONG           lSocketNo = 0;     // socket number
-static LONG           lBusCtlNo = 0;     // controller number
-
-static ICanControl* pCanControl = 0;    // control interface
-static ICanChannel* pCanChn = 0;        // channel interface
-
-static LONG           lMustQuit = 0;      // quit flag for the receive thread
-
-static HANDLE         hEventReader = 0;
-static PFIFOREADER    pReader = 0;
-
-static PFIFOWRITER    pWriter = 0;
+#define MAX_CHANNELS            16
+#define MAX_NODES               16      // nodes per channel, 2048 / CAN_ID_RANGE
 
-static UINT8 Message[8];
-static UINT32 MsgLength;
-static UINT32 MsgId;
-static UINT32 state;
-
-#define STATE_INIT_BOOT_LOADER          0x0001
-#define STATE_BOOT_LOADER_STARTED       0x0002
-#define STATE_INIT_ERASE                0x0004
-#define STATE_INIT_ERASE_OK             0x0008
-#define STATE_ERASE_COMPLETE            0x0010
-#define STATE_WRITE_START               0x0020
-#define STATE_WRITE_START_COMLETE       0x0040
-#define STATE_WRITE_DATA_BLOCK          0x0080
-#define STATE_WRITE_DATA_BLOCK_COMPLETE 0x0100
-
-#define MAX_COMAND_TIME                 100
-#define MAX_ERASE_TIME                  (30000/1000)
-
-
-#define MAX_REC_DATA_LENGTH     16
-
-typedef struct {
-	UINT8 RecLen;
-	UINT16 MemOffset;
-	UINT8 RecType;
-	UINT8 Data_Or_Info[MAX_REC_DATA_LENGTH];
-	UINT8 crc8;
-}HexRecord;
-
-int GetRecordFromString(HexRecord& hexrec, std::string hexstr) {
-	UINT16 Len = hexstr.length();
-	if (Len < 11)
-		return 0;
-	if (hexstr.substr(0, 1) != ":")
-		return 0;
-	UINT8 reclen = std::stoi(hexstr.substr(1, 2), nullptr, 16);
-	if (Len < reclen * 2 + 11)
-		return 0;
-	hexrec.RecLen = reclen;
-	hexrec.MemOffset = std::stoi(hexstr.substr(3, 4), nullptr, 16);
-	hexrec.RecType = std::stoi(hexstr.substr(7, 2), nullptr, 16);
-	for (UINT16 i = 0; i < hexrec.RecLen; i++)
-		hexrec.Data_Or_Info[i] = std::stoi(hexstr.substr(9 + 2 * i, 2), nullptr, 16);
-	hexrec.crc8 = std::stoi(hexstr.substr(9 + 2 * hexrec.RecLen, 2), nullptr, 16);
-	return 1;
-}
+//////////////////////////////////////////////////////////////////////////
+// data types
+//////////////////////////////////////////////////////////////////////////
 
 typedef struct {
-	std::vector<HexRecord> records;
-	UINT32 HexDataLen = 0;
-	UINT32 StartAdres = 0;
-	UINT32 LinStartAdres = 0;
-	std::vector<UINT8> Data;
-}HexData;
-
-static HexData HData;
-
-int GetHexRecordsFromFile(std::string Filename, HexData& hData) {
-	UINT16 i, j, RecCount;
-	std::vector<std::string> lines;
-	std::string line;
-	std::ifstream in(Filename);
-	if (!in.is_open())
-	{
-		in.close();
-		return 0;
-	}
-	else
-	{
-		while (std::getline(in, line))
-		{
-			std::cout << line << std::endl;
-			lines.push_back(line);
-		}
-		in.close();
-	}
-	RecCount = lines.size();
-	HexRecord tmp_record;
-	hData.HexDataLen = 0;
-	for (i = 0; i < RecCount; i++) {
-		if (GetRecordFromString(tmp_record, lines.at(i))) {
-			hData.records.push_back(tmp_record);
-			if (tmp_record.RecType == 0x00)
-			{
-				hData.HexDataLen += tmp_record.RecLen;
-				for (j = 0; j < tmp_record.RecLen; j++)
-					hData.Data.push_back(tmp_record.Data_Or_Info[j]);
-			}
-
-			if (tmp_record.RecType == 0x04)
-				hData.StartAdres = (tmp_record.Data_Or_Info[0] << 24) + (tmp_record.Data_Or_Info[1] << 16);
-			if (tmp_record.RecType == 0x05)
-				hData.LinStartAdres = (tmp_record.Data_Or_Info[0] << 24) + (tmp_record.Data_Or_Info[1] << 16) + (tmp_record.Data_Or_Info[2] << 8) + (tmp_record.Data_Or_Info[3]);
-		}
-		else {
-			hData.records.clear();
-			hData.HexDataLen = 0;
-			hData.StartAdres = 0;
-			hData.LinStartAdres = 0;
-			hData.Data.clear();
-			break;
-		}
-	}
-	lines.clear();
-	if (i == RecCount)
-		return 1;
-	return 0;
-}
+	LONG lDevice;                       // index in the device list, -1 = dialog
+	LONG lCtrlNo;                       // controller on the device
+} ChannelSpec;
 
+//////////////////////////////////////////////////////////////////////////
+// global variables
+//////////////////////////////////////////////////////////////////////////
 
+static HexData HData;                   // image, shared by all sessions
+static HexData BaseData;                // installed image of a delta flash
+
+static std::vector<CBootSession*>  Sessions;      // one session per node and channel
+static std::vector<CBootCoSession*> CoSessions;   // the same as coroutines with -coro
+static CBootLoop                   CoLoop;        // runs the coroutine sessions on the main thread
+static std::vector<CVciTransport*> VciTransports; // adapters in use
+static CVciReactor                 VciReactor;    // receive thread of all adapters
+static std::vector<CCanMux*>       CanMuxes;      // adapters shared by several nodes
+static std::vector<CCanTxQueue*>   TxQueues;      // transmit queue per channel
+static std::vector<CBootScheduler*> Schedulers;   // turns of the nodes per channel
+static std::vector<CBootBroadcast*> Broadcasts;   // one group stream per channel
+static std::vector<CSimBus*>       SimBuses;      // simulated buses with their boot loaders
+static std::string                 strSimFlash;   // file with the flash of the simulated target
+static std::string                 strProfile;    // file of the latency profile, empty = none
 
 //////////////////////////////////////////////////////////////////////////
 // function prototypes
 //////////////////////////////////////////////////////////////////////////
 
-HRESULT SelectDevice(BOOL fUserSelect);
-
-HRESULT CheckBalFeatures(LONG lCtrlNo);
-HRESULT InitSocket(LONG lCtrlNo);
-
 void    FinalizeApp(void);
-
-void    TransmitViaPutDataEntry(UINT32 MsgId, UINT payloadLen, UINT8* Msg);
-void    TransmitViaWriter();
-
-void    ReceiveThread(void* Param);
+UINT32  ParseChannels(const char* pszList, ChannelSpec* pChannels);
+UINT32  ParseNodes(const char* pszList, UINT32* pdwIdBase);
+std::string ChannelFile(const std::string& strFile, UINT32 dwChannel);
 
 //////////////////////////////////////////////////////////////////////////
 /**
@@ -185,846 +93,588 @@ void    ReceiveThread(void* Param);
 //////////////////////////////////////////////////////////////////////////
 int main(int argc, char* argv[])
 {
-	HRESULT hResult;
-	state = 0;
-	if (argc > 1) {
-		if (GetHexRecordsFromFile(argv[1], HData))
+	HRESULT     hResult = VCI_OK;
+	UINT8       bLogLevel = LOG_TRACE;
+	BOOL        fSimulate = FALSE;
+	SimConfig   sSimCfg;
+	BOOL        fJournal = TRUE;
+	std::string strJournal;
+	ChannelSpec aChannels[MAX_CHANNELS] = { { 0, 0 } };
+	UINT32      dwChannels = 1;
+	UINT32      adwIdBase[MAX_NODES] = { 0 };
+	UINT32      dwNodes = 1;
+	UINT32      dwGroupBase = CAN_ID_NONE;
+	BOOL        fStub = FALSE;
+	std::string strStubDir;
+	BOOL        fFd = FALSE;
+	BOOL        fCompress = TRUE;
+	BOOL        fDelta = FALSE;
+	UINT32      dwSectorSize = 0;
+	BOOL        fMassErase = FALSE;
+	BOOL        fFilter = TRUE;
+	BOOL        fTxQueue = TRUE;
+	std::string strBase;
+	std::string strStore;
+	UINT32      dwConnectWaitUs = CONNECT_WAIT_US;
+	BOOL        fCoro = FALSE;
+
+	//
+	// optional parameters following the hex file name:
+	//   -v<n>       verbosity 0 = off, 1 = errors, 2 = info, 3 = blocks, 4 = frames
+	//   -ch=<d>[:<c>],...  channels to flash in parallel, device index and
+	//               controller, default 0:0, -1 selects with a dialog
+	//   -nodes=<b>,...  ID bases (hex) of the nodes on each channel, which
+	//               are flashed in parallel, default 0
+	//   -broadcast=<b>  the nodes also listen to ID base b (hex), the image
+	//               is sent once to all nodes of a channel, the first
+	//               node acknowledges the data frames for the group
+	//   -stub[=<dir>]  write through a fast loader stub in RAM, the stub
+	//               images are in <dir>, the simulator has its own
+	//   -fd[=<r>]   send the data to the stub with CAN FD, the simulated
+	//               bus uses a data bit rate of r kbit/s, default 2000
+	//   -nolz       send the data to the stub uncompressed
+	//   -delta[=<n>]  erase and write only the sectors which differ from
+	//               the installed image, sectors of n bytes or by the flash
+	//               layout of the target; the running stub reports the
+	//               installed sectors
+	//   -base=<file>  hex file of the installed image, implies -delta
+	//   -store=<dir>  keep the state of each device in <dir>, a delta
+	//               flash takes the installed sectors from there
+	//   -wait=<ms>  time to wait for the boot loader, default 200, sync
+	//               frames are repeated while the target comes out of reset
+	//   -sim        run against the simulated boot loader instead of an adapter
+	//   -loss=<p>   simulator only: lose p percent of the frames
+	//   -errors=<p> simulator only: a bit error destroys p percent of the
+	//               frames, the sender repeats them after the error frame
+	//   -cut=<n>    simulator only: lose all frames after the first n
+	//   -load=<p>   simulator only: other devices take p percent of the bus
+	//   -slowstub=<us>  simulator only: the stub takes a frame from its
+	//               receive FIFO every us, frames arriving while the FIFO
+	//               is full are lost
+	//   -wakeup=<us>  simulator only: the host wakes up us after a frame
+	//               arrived, except while it polls
+	//   -nofilter   receive all frames, not only the identifiers of the
+	//               sessions
+	//   -notxqueue  hand the data of the stub to the adapter at once,
+	//               commands wait behind it in the transmit FIFO
+	//   -wake=<ms>  simulator only: the target comes out of reset after ms
+	//   -simflash=<file>  simulator only: keep the target flash in a file
+	//   -journal=<file>   progress journal, default <hex file>.jnl
+	//   -nojournal  always start over with a full erase
+	//   -profile=<file>  write the latencies of all sessions per protocol
+	//               phase to a JSON file
+	//   -mass       erase the whole flash even if erasing the sectors of
+	//               the image is faster
+	//   -pid=<p>    simulator only: the target reports product ID p (hex)
+	//               and has the flash of that part, default 430
+	//   -coro       run the sessions of all channels as coroutines on the
+	//               main thread instead of a thread each, one node per
+	//               channel and the ROM boot loader only: the stub, delta
+	//               flash, journal and device store are not used
+	//
+	// sessions are numbered channel * nodes + node, journal and flash
+	// files of session n > 0 get the suffix .<n>
+	//
+	SimDefaultConfig(sSimCfg);
+	for (int i = 2; i < argc; i++)
+	{
+		if ((argv[i][0] == '-') && (argv[i][1] == 'v') && (argv[i][2] >= '0') && (argv[i][2] <= '4'))
+		{
+			bLogLevel = (UINT8)(argv[i][2] - '0');
+		}
+		else if (strncmp(argv[i], "-ch=", 4) == 0)
 		{
-			printf("\n Load hexfile.......OK");
-			printf("\n Initializes the CAN with 125 kBaud");
-			hResult = SelectDevice(FALSE);
-			if (VCI_OK == hResult)
+			dwChannels = ParseChannels(argv[i] + 4, aChannels);
+		}
+		else if (strncmp(argv[i], "-nodes=", 7) == 0)
+		{
+			dwNodes = ParseNodes(argv[i] + 7, adwIdBase);
+		}
+		else if (strncmp(argv[i], "-broadcast=", 11) == 0)
+		{
+			if (ParseNodes(argv[i] + 11, &dwGroupBase) != 1)
 			{
-				printf("\n Select Adapter.......... OK !");
-				// This step is not necessary but shows how to get/check BAL features
-				hResult = CheckBalFeatures(lBusCtlNo);
-				if (VCI_OK == hResult)
-				{
-					printf("\n CheckBalFeatures......... OK !");
-				}
-				else
-				{
-					printf("\n CheckBalFeatures......... 0x%08lX !", hResult);
-				}
-
-				printf("\n Initialize CAN...");
-				hResult = InitSocket(lBusCtlNo);
-				if (VCI_OK == hResult)
-				{
-					printf("\n Initialize CAN............ OK !");
-
-					//
-					// start the receive thread
-					//
-					_beginthread(ReceiveThread, 0, NULL);
-
-
-
-					//-------- init Boot_Loader ----------
-					MsgId = 0x79;
-					MsgLength = 0;
-					state = STATE_INIT_BOOT_LOADER;
-					TransmitViaPutDataEntry(MsgId, MsgLength, Message);
-					Sleep(100);
-					if (!(state & STATE_BOOT_LOADER_STARTED))
-					{
-						MsgId = 0x01;
-						TransmitViaPutDataEntry(MsgId, MsgLength, Message);
-						Sleep(100);
-					}
-					if (state & STATE_BOOT_LOADER_STARTED)
-					{
-						printf("\n BootLoader started........OK");
-						//----------- erase -------------
-						printf("\n Erase all memory start.....please wait\n");
-						MsgId = 0x43;
-						MsgLength = 1;
-						Message[0] = 0xFF;
-						state = STATE_INIT_ERASE;
-						TransmitViaPutDataEntry(MsgId, MsgLength, Message);
-						Sleep(100);
-						if (state & STATE_INIT_ERASE_OK)
-						{
-							for (UINT16 i = 0; i < MAX_ERASE_TIME; i++)
-							{
-								if (state & STATE_ERASE_COMPLETE)
-								{
-									break;
-								}
-								Sleep(1000);
-								printf(" %d", i);
-							}
-						}
-						if (state & STATE_ERASE_COMPLETE)
-						{
-							printf("\n Erase memory complete\n");
-							//---------------- write hex--------------
-							UINT16 count = (HData.HexDataLen >> 8);
-							UINT16 NBytes = 256;
-							UINT16 countlocal = NBytes >> 3;
-							UINT16 NByteslocal = 8;
-							for (UINT16 k = 0; k <= count; k++)
-							{
-								printf("\n Write memory %d block  ", k + 1);
-								state = STATE_WRITE_START;
-								MsgId = 0x31;
-								MsgLength = 5;
-								UINT32 Adres = HData.StartAdres + (k << 8);
-								Message[0] = Adres >> 24;
-								Message[1] = Adres >> 16;
-								Message[2] = Adres >> 8;
-								Message[3] = Adres;
-								if (k != count)
-								{
-									NBytes = 256;
-									Message[4] = NBytes - 1;
-									countlocal = NBytes >> 3;
-								}
-
-								else
-								{
-									NBytes = (HData.HexDataLen - (count << 8));
-									Message[4] = NBytes - 1;
-									countlocal = NBytes >> 3;
-									if (NBytes - (countlocal << 3) > 0)
-										countlocal++;
-								}
-
-								TransmitViaPutDataEntry(MsgId, MsgLength, Message);
-								for (UINT16 i = 0; i < MAX_COMAND_TIME; i++)
-								{
-									if (state & STATE_WRITE_START_COMLETE)
-									{
-										break;
-									}
-									Sleep(1);
-								}
-								if (state & STATE_WRITE_START_COMLETE)
-								{
-									printf(" Started\n");
-									MsgId = 0x04;
-									MsgLength = 8;
-									for (UINT16 n = 0; n < countlocal; n++) {
-										NByteslocal = 8;
-										if (n == countlocal - 1)
-											NByteslocal = (NBytes - ((countlocal - 1) << 3));
-										printf("\n%d ", n + 1);
-										for (UINT16 m = 0; m < NByteslocal; m++)
-											Message[m] = HData.Data[m + (n << 3) + (k << 8)];
-										state = STATE_WRITE_DATA_BLOCK;
-										TransmitViaPutDataEntry(MsgId, MsgLength, Message);
-										for (UINT16 i = 0; i < MAX_COMAND_TIME; i++)
-										{
-											if (state & STATE_WRITE_DATA_BLOCK_COMPLETE)
-											{
-												break;
-											}
-											Sleep(1);
-										}
-										if (!(state & STATE_WRITE_DATA_BLOCK_COMPLETE))
-										{
-											printf("Write error");
-											FinalizeApp();
-											return 6;
-										}
-									}
-								}
-								else
-								{
-									printf("error");
-									FinalizeApp();
-									return 6;
-								}
-							}
-							printf("\n Write memory complete");
-							FinalizeApp();
-							return 0;
-						}
-						else
-						{
-							printf("\n Erase memory error\n");
-							FinalizeApp();
-							return 5;
-						}
-					}
-					else
-					{
-						printf("\n Error BootLoader notstarted");
-						FinalizeApp();
-						return 4;
-					}
-
-
-
-
-
-				}
-				else
-				{
-					printf("\n No CAN To USB Devices found");
-					FinalizeApp();
-					return 3;
-				}
-			}
-			else {
-				printf("\n Error initialize CAN");
-				FinalizeApp();
-				return 2;
+				dwChannels = 0;
 			}
 		}
-		else
+		else if (strncmp(argv[i], "-stub", 5) == 0)
 		{
-			printf("\n Invalid hexfile parametrs \n");
-			return 1;
+			fStub = TRUE;
+			strStubDir = (argv[i][5] == '=') ? argv[i] + 6 : ".";
 		}
-	}
-	else
-	{
-		printf("\n Error input parametrs");
-		return 1;
-	}
-
-	FinalizeApp();
-	printf("\n exit");
-	return 0;
-}
-
-//////////////////////////////////////////////////////////////////////////
-/**
-  Selects the first CAN adapter.
-
-  @param fUserSelect
-	If this parameter is set to TRUE the functions display a dialog box which
-	allows the user to select the device.
-
-  @return
-	VCI_OK on success, otherwise an Error code
-*/
-//////////////////////////////////////////////////////////////////////////
-HRESULT SelectDevice(BOOL fUserSelect)
-{
-	HRESULT hResult; // error code
-
-	if (fUserSelect == FALSE)
-	{
-		IVciDeviceManager* pDevMgr = 0;    // device manager
-		IVciEnumDevice* pEnum = 0;    // enumerator handle
-		VCIDEVICEINFO       sInfo;          // device info
-
-		hResult = VciGetDeviceManager(&pDevMgr);
-		if (hResult == VCI_OK)
+		else if (strncmp(argv[i], "-fd", 3) == 0)
 		{
-			hResult = pDevMgr->EnumDevices(&pEnum);
+			fFd = TRUE;
+			sSimCfg.dwDataBitRate = (argv[i][3] == '=') ? (UINT32)atol(argv[i] + 4) * 1000 : 2000000;
 		}
-
-		//
-		// retrieve information about the first
-		// device within the device list
-		//
-		if (hResult == VCI_OK)
+		else if (strcmp(argv[i], "-nolz") == 0)
 		{
-			hResult = pEnum->Next(1, &sInfo, NULL);
-
-			//
-			// close the device list (no longer needed)
-			//
-			pEnum->Release();
-			pEnum = NULL;
+			fCompress = FALSE;
 		}
-
-		//
-		// open the first device via device manager and get the bal object
-		//
-		if (hResult == VCI_OK)
+		else if (strncmp(argv[i], "-delta", 6) == 0)
 		{
-			IVciDevice* pDevice;
-			hResult = pDevMgr->OpenDevice(sInfo.VciObjectId, &pDevice);
-
-			if (hResult == VCI_OK)
-			{
-				hResult = pDevice->OpenComponent(CLSID_VCIBAL, IID_IBalObject, (void**)&pBalObject);
-
-				pDevice->Release();
-			}
+			fDelta = TRUE;
+			dwSectorSize = (argv[i][6] == '=') ? (UINT32)atol(argv[i] + 7) : 0;
 		}
-
-		//
-		// always select controller 0
-		//
-		lBusCtlNo = 0;
-
-		//
-		// close device manager
-		//
-		if (pDevMgr)
+		else if (strncmp(argv[i], "-base=", 6) == 0)
 		{
-			pDevMgr->Release();
-			pDevMgr = NULL;
+			fDelta = TRUE;
+			strBase = argv[i] + 6;
 		}
-	}
-	else
-	{
-		//
-		// open a device selected by the user
-		//
-		hResult = SocketSelectDlg(NULL, VCI_BUS_CAN, &pBalObject, &lSocketNo, &lBusCtlNo);
-	}
-
-	//DisplayError(NULL, hResult);
-	return hResult;
-}
-
-
-//////////////////////////////////////////////////////////////////////////
-/**
-
-  Checks BAL features
-
-  @param lCtrlNo
-	controller number to check the features
-
-  @return
-	VCI_OK on success, otherwise an Error code
-
-*/////////////////////////////////////////////////////////////////////////
-HRESULT CheckBalFeatures(LONG lCtrlNo)
-{
-	HRESULT hResult = E_FAIL;
-
-	if (pBalObject)
-	{
-		// check if controller supports CANFD
-		BALFEATURES features = { 0 };
-		hResult = pBalObject->GetFeatures(&features);
-		if (VCI_OK == hResult)
+		else if (strncmp(argv[i], "-store=", 7) == 0)
 		{
-			// check if controller number is valid
-			if (lCtrlNo >= features.BusSocketCount)
-			{
-				// As we select the controller via the selection dialog, we should never get here.
-				printf("\n Invalid controller number. !");
-				return VCI_E_UNEXPECTED;
-			}
-
-			// check for the expected controller type
-			if (VCI_BUS_TYPE(features.BusSocketType[lCtrlNo]) != VCI_BUS_CAN)
-			{
-				// Invalid controller type selected
-				printf("\n Invalid controller type selected !");
-				return VCI_E_UNEXPECTED;
-			}
+			strStore = argv[i] + 7;
 		}
-		else
+		else if (strncmp(argv[i], "-wait=", 6) == 0)
+		{
+			dwConnectWaitUs = (UINT32)atol(argv[i] + 6) * 1000;
+		}
+		else if (strncmp(argv[i], "-wake=", 6) == 0)
+		{
+			sSimCfg.dwWakeUs = (UINT32)atol(argv[i] + 6) * 1000;
+		}
+		else if (strcmp(argv[i], "-mass") == 0)
+		{
+			fMassErase = TRUE;
+		}
+		else if (strncmp(argv[i], "-pid=", 5) == 0)
 		{
-			printf("\n pBalObject->GetFeatures failed: 0x%08lX !", hResult);
+			SimConfigPart(sSimCfg, (UINT32)strtoul(argv[i] + 5, NULL, 16));
+		}
+		else if (strcmp(argv[i], "-sim") == 0)
+		{
+			fSimulate = TRUE;
+		}
+		else if (strncmp(argv[i], "-loss=", 6) == 0)
+		{
+			sSimCfg.dwLossPpm = (UINT32)(atof(argv[i] + 6) * 10000.0);
+		}
+		else if (strncmp(argv[i], "-errors=", 8) == 0)
+		{
+			sSimCfg.dwErrorPpm = (UINT32)(atof(argv[i] + 8) * 10000.0);
+		}
+		else if (strncmp(argv[i], "-cut=", 5) == 0)
+		{
+			sSimCfg.dwCutFrames = (UINT32)atol(argv[i] + 5);
+		}
+		else if (strncmp(argv[i], "-load=", 6) == 0)
+		{
+			sSimCfg.dwLoadPct = (UINT32)atol(argv[i] + 6);
+		}
+		else if (strncmp(argv[i], "-slowstub=", 10) == 0)
+		{
+			sSimCfg.dwStubFrameUs = (UINT32)atol(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "-wakeup=", 8) == 0)
+		{
+			sSimCfg.dwWakeupUs = (UINT32)atol(argv[i] + 8);
+		}
+		else if (strcmp(argv[i], "-nofilter") == 0)
+		{
+			fFilter = FALSE;
+		}
+		else if (strcmp(argv[i], "-notxqueue") == 0)
+		{
+			fTxQueue = FALSE;
+		}
+		else if (strncmp(argv[i], "-simflash=", 10) == 0)
+		{
+			strSimFlash = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "-journal=", 9) == 0)
+		{
+			strJournal = argv[i] + 9;
+		}
+		else if (strcmp(argv[i], "-nojournal") == 0)
+		{
+			fJournal = FALSE;
+		}
+		else if (strncmp(argv[i], "-profile=", 9) == 0)
+		{
+			strProfile = argv[i] + 9;
+		}
+		else if (strcmp(argv[i], "-coro") == 0)
+		{
+			fCoro = TRUE;
 		}
 	}
 
-	return hResult;
-}
-
-
-//////////////////////////////////////////////////////////////////////////
-/**
-  Opens the specified socket, creates a message channel, initializes
-  and starts the CAN controller.
-
-  @param dwCanNo
-	Number of the CAN controller to open.
-
-  @return
-	VCI_OK on success, otherwise an Error code
-
-  @note
-	If <dwCanNo> is set to 0xFFFFFFFF, the function shows a dialog box
-	which allows the user to select the VCI device and CAN controller.
-*/
-//////////////////////////////////////////////////////////////////////////
-HRESULT InitSocket(LONG lCtrlNo)
-{
-	HRESULT hResult = E_FAIL;
-
-	if (pBalObject != NULL)
+	// the group needs its own ID base
+	for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
 	{
-		//
-		// check controller capabilities create a message channel
-		//
-		ICanSocket* pCanSocket = 0;
-		hResult = pBalObject->OpenSocket(lCtrlNo, IID_ICanSocket, (void**)&pCanSocket);
-		if (hResult == VCI_OK)
+		if (adwIdBase[dwNode] == dwGroupBase)
 		{
-			// check capabilities
-			CANCAPABILITIES capabilities = { 0 };
-			hResult = pCanSocket->GetCapabilities(&capabilities);
-			if (VCI_OK == hResult)
-			{
-				//
-				// This sample expects that standard and extended mode are
-				// supported simultaneously. See use of
-				// CAN_OPMODE_STANDARD | CAN_OPMODE_EXTENDED in InitLine() below
-				//
-				if (capabilities.dwFeatures & CAN_FEATURE_STDANDEXT)
-				{
-					// supports simultaneous standard and extended -> ok
-				}
-				else
-				{
-					printf("\n Simultaneous standard and extended mode feature not supported !");
-					hResult = VCI_E_NOT_SUPPORTED;
-				}
-			}
-			else
-			{
-				// should not occurr
-				printf("\n pCanSocket->GetCapabilities failed: 0x%08lX !", hResult);
-			}
-
-			//
-			// create a message channel
-			//
-			if (VCI_OK == hResult)
-			{
-				hResult = pCanSocket->CreateChannel(FALSE, &pCanChn);
-			}
-
-			pCanSocket->Release();
+			dwNodes = 0;
 		}
+	}
 
-		//
-		// initialize the message channel
-		//
-		if (hResult == VCI_OK)
-		{
-			UINT16 wRxFifoSize = 1024;
-			UINT16 wRxThreshold = 1;
-			UINT16 wTxFifoSize = 128;
-			UINT16 wTxThreshold = 1;
-
-			hResult = pCanChn->Initialize(wRxFifoSize, wTxFifoSize);
-			if (hResult == VCI_OK)
-			{
-				hResult = pCanChn->GetReader(&pReader);
-				if (hResult == VCI_OK)
-				{
-					pReader->SetThreshold(wRxThreshold);
-
-					hEventReader = CreateEvent(NULL, FALSE, FALSE, NULL);
-					pReader->AssignEvent(hEventReader);
-				}
-			}
+	// the coroutine sessions neither take turns on a shared bus nor broadcast
+	if (fCoro && ((dwNodes > 1) || (dwGroupBase != CAN_ID_NONE)))
+	{
+		dwNodes = 0;
+	}
 
-			if (hResult == VCI_OK)
-			{
-				hResult = pCanChn->GetWriter(&pWriter);
-				if (hResult == VCI_OK)
-				{
-					pWriter->SetThreshold(wTxThreshold);
-				}
-			}
+	if (argc > 1) {
+		if (!fJournal)
+		{
+			strJournal.clear();
 		}
-
-		//
-		// activate the CAN channel
-		//
-		if (hResult == VCI_OK)
+		else if (strJournal.empty())
 		{
-			hResult = pCanChn->Activate();
+			strJournal = std::string(argv[1]) + ".jnl";
 		}
 
-		//
-		// Open the CAN control interface
-		//
-		// During the programs lifetime we have multiple options:
-		// 1) Open the control interface and keep it open
-		//     -> No other programm is able to get the control interface and change the line settings
-		// 2) Try to get the control interface and change the settings only when we get it
-		//     -> Other programs can change the settings by getting the control interface
-		//
-		if (hResult == VCI_OK)
+		if (GetHexRecordsFromFile(argv[1], HData) && (dwChannels > 0) && (dwNodes > 0) &&
+		    (strBase.empty() || GetHexRecordsFromFile(strBase, BaseData)))
 		{
-			hResult = pBalObject->OpenSocket(lCtrlNo, IID_ICanControl, (void**)&pCanControl);
+			BootLogStart(bLogLevel);
+			BootLog(LOG_INFO, "\n Load hexfile.......OK");
+
+			// shared by all sessions, a session loads one file per device
+			CBootDeviceStore DeviceStore(strStore.c_str());
 
 			//
-			// initialize the CAN controller
+			// open a transport per channel, a channel with several nodes
+			// is shared by their sessions
 			//
-			if (hResult == VCI_OK)
+			for (UINT32 dwChannel = 0; dwChannel < dwChannels; dwChannel++)
 			{
-				CANINITLINE init = {
-				  CAN_OPMODE_STANDARD |
-				  CAN_OPMODE_EXTENDED | CAN_OPMODE_ERRFRAME,      // opmode
-				  0,                                              // bReserved
-				  CAN_BT0_125KB, CAN_BT1_125KB                    // bt0, bt1
-				};
-
-				hResult = pCanControl->InitLine(&init);
-				if (hResult != VCI_OK)
+				ICanTransport* apTransport[MAX_NODES];
+
+				// the channel receives the identifiers of its sessions only
+				CCanFilter Filter;
+				for (UINT32 dwNode = 0; fFilter && (dwNode < dwNodes); dwNode++)
 				{
-					printf("\n pCanControl->InitLine failed: 0x%08lX !", hResult);
+					BootSessionIds(adwIdBase[dwNode], Filter);
+				}
+				if (fFilter && (dwGroupBase != CAN_ID_NONE))
+				{
+					BootSessionIds(dwGroupBase, Filter);
 				}
 
-				//
-				// set the acceptance filter
-				//
-				if (hResult == VCI_OK)
+				if (fSimulate)
+				{
+					SimConfig sCfg = sSimCfg;
+					sCfg.dwSeed = sSimCfg.dwSeed + dwChannel;
+
+					BootLog(LOG_INFO, "\n [%u] Simulated bus with %u boot loaders, frame loss %u ppm", dwChannel, dwNodes, sCfg.dwLossPpm);
+					BootLog(LOG_INFO, ", bit errors %u ppm", sCfg.dwErrorPpm);
+					BootLog(LOG_INFO, ", load %u %%", sCfg.dwLoadPct);
+					CSimBus* pSimBus = new CSimBus(sCfg);
+					SimBuses.push_back(pSimBus);
+					pSimBus->SetFilter(Filter);
+
+					// the group stream receives the responses of all nodes on one port
+					CSimPort* pGroupPort = NULL;
+					if (dwGroupBase != CAN_ID_NONE)
+					{
+						pGroupPort = pSimBus->AddPort(CAN_ID_NONE);
+					}
+					for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
+					{
+						sCfg.dwIdBase = adwIdBase[dwNode];
+						sCfg.dwGroupBase = dwGroupBase;
+						sCfg.fGroupPacer = (dwNode == 0) ? TRUE : FALSE;
+						CSimTarget* pTarget = pSimBus->AddTarget(sCfg);
+						if (!strSimFlash.empty())
+						{
+							pTarget->LoadFlash(ChannelFile(strSimFlash, dwChannel * dwNodes + dwNode).c_str());
+						}
+						apTransport[dwNode] = pGroupPort ? pGroupPort : pSimBus->AddPort(adwIdBase[dwNode]);
+					}
+				}
+				else
 				{
-					hResult = pCanControl->SetAccFilter(CAN_FILTER_STD, CAN_ACC_CODE_ALL, CAN_ACC_MASK_ALL);
+					BootLog(LOG_INFO, "\n [%u] Initializes the CAN with 125 kBaud", dwChannel);
+					CVciTransport* pVciTransport = new CVciTransport();
+					VciTransports.push_back(pVciTransport);
 
-					//
-					// set the acceptance filter
-					//
-					if (hResult == VCI_OK)
+					hResult = pVciTransport->SelectDevice(aChannels[dwChannel].lDevice, aChannels[dwChannel].lCtrlNo);
+					if (VCI_OK != hResult)
 					{
-						hResult = pCanControl->SetAccFilter(CAN_FILTER_EXT, CAN_ACC_CODE_ALL, CAN_ACC_MASK_ALL);
+						BootLog(LOG_ERROR, "\n Error initialize CAN");
+						FinalizeApp();
+						return 2;
 					}
 
+					BootLog(LOG_INFO, "\n Select Adapter.......... OK !");
+					// This step is not necessary but shows how to get/check BAL features
+					hResult = pVciTransport->CheckBalFeatures(pVciTransport->GetCtrlNo());
+					if (VCI_OK == hResult)
+					{
+						BootLog(LOG_INFO, "\n CheckBalFeatures......... OK !");
+					}
+					else
+					{
+						BootLog(LOG_ERROR, "\n CheckBalFeatures......... 0x%08lX !", hResult);
+					}
+
+					BootLog(LOG_INFO, "\n Initialize CAN...");
+					pVciTransport->SetFilter(Filter);
+					hResult = pVciTransport->InitSocket(pVciTransport->GetCtrlNo());
 					if (VCI_OK != hResult)
 					{
-						printf("\n pCanControl->SetAccFilter failed: 0x%08lX !", hResult);
+						BootLog(LOG_ERROR, "\n No CAN To USB Devices found");
+						FinalizeApp();
+						return 3;
 					}
+					BootLog(LOG_INFO, "\n Initialize CAN............ OK !");
 
 					//
-					// SetAccFilter() returns VCI_E_INVALID_STATE if already controller is started. 
-					// We ignore this because the controller could already be started
-					// by another application.
+					// the reactor reads the receive FIFOs of all channels
 					//
-					if (VCI_E_INVALID_STATE == hResult)
+					pVciTransport->Start(&VciReactor);
+
+					if ((dwNodes == 1) || (dwGroupBase != CAN_ID_NONE))
 					{
-						hResult = VCI_OK;
+						for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
+						{
+							apTransport[dwNode] = pVciTransport;
+						}
+					}
+					else
+					{
+						CCanMux* pCanMux = new CCanMux(pVciTransport);
+						CanMuxes.push_back(pCanMux);
+						for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
+						{
+							apTransport[dwNode] = pCanMux->AddPort(adwIdBase[dwNode]);
+						}
 					}
 				}
 
 				//
-				// start the CAN controller
+				// bulk data of the sessions waits on the host, their
+				// commands go ahead of it, nodes with the same transport
+				// share a port
 				//
-				if (hResult == VCI_OK)
+				if (fTxQueue)
 				{
-					hResult = pCanControl->StartLine();
-					if (hResult != VCI_OK)
+					CCanTxQueue* pTxQueue = new CCanTxQueue();
+					TxQueues.push_back(pTxQueue);
+					for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
 					{
-						printf("\n pCanControl->StartLine failed: 0x%08lX !", hResult);
+						ICanTransport* pTransport = apTransport[dwNode];
+						apTransport[dwNode] = pTxQueue->AddPort(pTransport);
+						for (UINT32 j = dwNode + 1; j < dwNodes; j++)
+						{
+							if (apTransport[j] == pTransport)
+							{
+								apTransport[j] = apTransport[dwNode];
+							}
+						}
 					}
 				}
 
-				printf("\n Got Control interface. Settings applied !");
-			}
-			else
-			{
-				//
-				// If we can't get the control interface it is occupied by another application.
-				// This means the application is in charge of the controller parameters.
-				// We live with it and move on.
-				// 
-				printf("\n Control interface occupied. Settings not applied: 0x%08lX !", hResult);
-				hResult = VCI_OK;
-			}
-		}
-	}
-	else
-	{
-		hResult = VCI_E_INVHANDLE;
-	}
-
-	DisplayError(NULL, hResult);
-	return hResult;
-}
-
-//////////////////////////////////////////////////////////////////////////
-/**
-
-  Transmit message via PutDataEntry
-
-*/////////////////////////////////////////////////////////////////////////
-void TransmitViaPutDataEntry(UINT32 MsgId, UINT payloadLen, UINT8* Msg)
-{
-	CANMSG  sCanMsg = { 0 };
-
-	// length of message payload
-	//UINT payloadLen = 8;
-
-	sCanMsg.dwTime = 0;
-	sCanMsg.dwMsgId = MsgId;    // CAN message identifier
-
-	sCanMsg.uMsgInfo.Bytes.bType = CAN_MSGTYPE_DATA;
-	// Flags:
-	// srr = 1
-	sCanMsg.uMsgInfo.Bytes.bFlags = CAN_MAKE_MSGFLAGS(CAN_LEN_TO_SDLC(payloadLen), 0, 1, 0, 0);
-	// Flags2:
-	// Set bFlags2 to 0
-	sCanMsg.uMsgInfo.Bytes.bFlags2 = CAN_MAKE_MSGFLAGS2(0, 0, 0, 0, 0);
-
-	for (UINT i = 0; i < payloadLen; i++)
-	{
-		sCanMsg.abData[i] = Msg[i];
-	}
-
-	// write a single CAN message into the transmit FIFO
-	while (VCI_E_TXQUEUE_FULL == pWriter->PutDataEntry(&sCanMsg))
-	{
-		Sleep(1);
-	}
-}
-
-//////////////////////////////////////////////////////////////////////////
-/**
-
-  Transmit CAN via Writer API (AcquireWrite/ReleaseWrite)
-   with ID 0x100.
+				CBootScheduler* pScheduler = NULL;
+				CBootBroadcast* pBroadcast = NULL;
+				if (dwGroupBase != CAN_ID_NONE)
+				{
+					pBroadcast = new CBootBroadcast(dwChannel, apTransport[0], HData, dwGroupBase);
+					pBroadcast->SetRxTrace(fSimulate);
+					Broadcasts.push_back(pBroadcast);
+				}
+				else if (dwNodes > 1)
+				{
+					pScheduler = new CBootScheduler(dwNodes);
+					Schedulers.push_back(pScheduler);
+				}
 
-*/////////////////////////////////////////////////////////////////////////
-void TransmitViaWriter()
-{
-	// use the FIFO interface 
-	// to write multiple messages
-	UINT16  count = 0;
-	PCANMSG pMsg;
+				for (UINT32 dwNode = 0; dwNode < dwNodes; dwNode++)
+				{
+					UINT32 dwSession = dwChannel * dwNodes + dwNode;
 
-	// length of message payload
-	UINT payloadLen = 8;
+					// the loop starts the sessions when it runs
+					if (fCoro)
+					{
+						CBootCoSession* pCoSession = new CBootCoSession(CoLoop, dwSession, apTransport[dwNode], HData);
+						pCoSession->SetIdBase(adwIdBase[dwNode]);
+						pCoSession->SetConnectWait(dwConnectWaitUs);
+						pCoSession->SetMassErase(fMassErase);
+						CoSessions.push_back(pCoSession);
+						CoLoop.Spawn(pCoSession->Run());
+						continue;
+					}
 
-	// aquire write access to FIFO
-	HRESULT hr = pWriter->AcquireWrite((void**)&pMsg, &count);
-	if (VCI_OK == hr)
-	{
-		// number of written messages needed for ReleaseWrite
-		UINT16 written = 0;
+					CBootSession* pSession = new CBootSession(dwSession, apTransport[dwNode], HData);
+					pSession->SetIdBase(adwIdBase[dwNode]);
+					pSession->SetConnectWait(dwConnectWaitUs);
+					pSession->SetMassErase(fMassErase);
+					if (pScheduler)
+					{
+						pSession->SetScheduler(pScheduler, dwNode);
+					}
+					if (!strJournal.empty())
+					{
+						pSession->SetJournal(ChannelFile(strJournal, dwSession).c_str());
+					}
+					pSession->SetRxTrace(fSimulate);
+					if (fStub && !pBroadcast)
+					{
+						pSession->SetStub(fSimulate ? NULL : strStubDir.c_str(), fFd, fCompress);
+					}
+					if (fDelta && !pBroadcast)
+					{
+						pSession->SetDelta(strBase.empty() ? NULL : &BaseData, dwSectorSize);
+					}
+					if (!strStore.empty() && !pBroadcast)
+					{
+						pSession->SetDeviceStore(&DeviceStore);
+					}
+					Sessions.push_back(pSession);
+					if (pBroadcast)
+					{
+						pBroadcast->AddNode(pSession);
+					}
+				}
+			}
 
-		if (count > 0)
-		{
-			pMsg->dwTime = 0;
-			pMsg->dwMsgId = 0x200;
-
-			pMsg->uMsgInfo.Bytes.bType = CAN_MSGTYPE_DATA;
-			// Flags:
-			// srr = 1
-			pMsg->uMsgInfo.Bytes.bFlags = CAN_MAKE_MSGFLAGS(CAN_LEN_TO_SDLC(payloadLen), 0, 1, 0, 0);
-			// Flags2:
-			// Set bFlags2 to 0 because FIFO memory will not be initialized by AquireWrite
-			pMsg->uMsgInfo.Bytes.bFlags2 = CAN_MAKE_MSGFLAGS2(0, 0, 0, 0, 0);
-
-			for (UINT i = 0; i < payloadLen; i++)
+			//
+			// flash all nodes, the result is the first error
+			//
+			if (fCoro)
+			{
+				CoLoop.Run();
+			}
+			else if (Broadcasts.empty())
+			{
+				BootRunSessions(Sessions);
+			}
+			else
 			{
-				pMsg->abData[i] = i;
+				BootRunBroadcasts(Broadcasts);
 			}
 
-			written = 1;
+			int iResult = SESSION_OK;
+			for (size_t i = 0; i < Sessions.size(); i++)
+			{
+				if ((iResult == SESSION_OK) && (Sessions[i]->GetResult() != SESSION_OK))
+				{
+					iResult = Sessions[i]->GetResult();
+				}
+			}
+			for (size_t i = 0; i < CoSessions.size(); i++)
+			{
+				if ((iResult == SESSION_OK) && (CoSessions[i]->GetResult() != SESSION_OK))
+				{
+					iResult = CoSessions[i]->GetResult();
+				}
+			}
+			FinalizeApp();
+			return iResult;
 		}
-
-		// release write access to FIFO
-		hr = pWriter->ReleaseWrite(written);
-		if (VCI_OK != hr)
+		else
 		{
-			printf("\nReleaseWrite failed: 0x%08lX", hr);
+			BootLog(LOG_ERROR, "\n Invalid hexfile parametrs \n");
+			BootLogStop();
+			return 1;
 		}
 	}
 	else
 	{
-		printf("\nAcquireWrite failed: 0x%08lX", hr);
+		BootLog(LOG_ERROR, "\n Error input parametrs");
+		BootLogStop();
+		return 1;
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////
 /**
 
-  Print a message
+  Parses a list of channels "<device>[:<controller>],...".
+
+  @param pszList    list from the command line
+  @param pChannels  receives up to MAX_CHANNELS channels
+
+  @return number of channels, 0 if the list is invalid
 
 */
 //////////////////////////////////////////////////////////////////////////
-void PrintMessage(PCANMSG pCanMsg)
+UINT32 ParseChannels(const char* pszList, ChannelSpec* pChannels)
 {
-	if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_DATA)
-	{
-		//
-		// show data frames
-		//
-		if (pCanMsg->uMsgInfo.Bits.rtr == 0)
-		{
-			UINT j;
-
-			// number of bytes in message payload
-			UINT payloadLen = CAN_SDLC_TO_LEN(pCanMsg->uMsgInfo.Bits.dlc);
+	UINT32 dwCount = 0;
+	char*  pszNext = (char*)pszList;
 
-			printf("\nTime: %10u  ID: %3X %s  Len: %1u  Data:",
-				pCanMsg->dwTime,
-				pCanMsg->dwMsgId,
-				(pCanMsg->uMsgInfo.Bits.ext == 1) ? "Ext" : "Std",
-				payloadLen);
-
-			// print payload bytes
-			if ((state & STATE_INIT_BOOT_LOADER) && (pCanMsg->abData[0] == 0x79))
-			{
-				state &= ~STATE_INIT_BOOT_LOADER;
-				state |= STATE_BOOT_LOADER_STARTED;
-			}
-			else
-			{
-				if ((state & STATE_INIT_ERASE) && (pCanMsg->abData[0] == 0x79))
-				{
-					state &= ~STATE_INIT_ERASE;
-					state |= STATE_INIT_ERASE_OK;
-				}
-				else
-				{
-					if ((state & STATE_INIT_ERASE_OK) && (pCanMsg->abData[0] == 0x79))
-					{
-						state &= ~STATE_INIT_ERASE_OK;
-						state |= STATE_ERASE_COMPLETE;
-					}
-					else
-					{
-						if ((state & STATE_WRITE_START) && (pCanMsg->abData[0] == 0x79))
-						{
-							state &= ~STATE_WRITE_START;
-							state |= STATE_WRITE_START_COMLETE;
-						}
-						else
-						{
-							if ((state & STATE_WRITE_DATA_BLOCK) && (pCanMsg->abData[0] == 0x79))
-							{
-								state &= ~STATE_WRITE_DATA_BLOCK;
-								state |= STATE_WRITE_DATA_BLOCK_COMPLETE;
-							}
-						}
-					}
-				}
-			}
-			for (j = 0; j < payloadLen; j++)
-			{
-				printf(" %.2X", pCanMsg->abData[j]);
-			}
-		}
-		else
-		{
-			printf("\nTime: %10u ID: %3X  DLC: %1u  Remote Frame",
-				pCanMsg->dwTime,
-				pCanMsg->dwMsgId,
-				pCanMsg->uMsgInfo.Bits.dlc);
-		}
-	}
-	else if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_INFO)
+	while (*pszNext && (dwCount < MAX_CHANNELS))
 	{
-		//
-		// show informational frames
-		//
-		switch (pCanMsg->abData[0])
+		char* pszEnd;
+
+		pChannels[dwCount].lDevice = strtol(pszNext, &pszEnd, 10);
+		pChannels[dwCount].lCtrlNo = 0;
+		if (pszEnd == pszNext)
 		{
-		case CAN_INFO_START: printf("\nCAN started..."); break;
-		case CAN_INFO_STOP: printf("\nCAN stopped..."); break;
-		case CAN_INFO_RESET: printf("\nCAN reseted..."); break;
+			return 0;
 		}
-	}
-	else if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_ERROR)
-	{
-		//
-		// show error frames
-		//
-		switch (pCanMsg->abData[0])
+		if (*pszEnd == ':')
 		{
-		case CAN_ERROR_STUFF: printf("\nstuff error...");          break;
-		case CAN_ERROR_FORM: printf("\nform error...");           break;
-		case CAN_ERROR_ACK: printf("\nacknowledgment error..."); break;
-		case CAN_ERROR_BIT: printf("\nbit error...");            break;
-		case CAN_ERROR_CRC: printf("\nCRC error...");            break;
-		case CAN_ERROR_OTHER:
-		default: printf("\nother error...");          break;
+			pszNext = pszEnd + 1;
+			pChannels[dwCount].lCtrlNo = strtol(pszNext, &pszEnd, 10);
+			if (pszEnd == pszNext)
+			{
+				return 0;
+			}
 		}
+		dwCount++;
+
+		pszNext = (*pszEnd == ',') ? pszEnd + 1 : pszEnd;
 	}
+
+	return dwCount;
 }
 
 //////////////////////////////////////////////////////////////////////////
 /**
 
-  Process messages
+  Parses a list of ID bases "<hex>,...". Each base must be a multiple
+  of CAN_ID_RANGE within the 11 bit identifiers.
 
-  @param wLimit  max number of messages to process
+  @param pszList    list from the command line
+  @param pdwIdBase  receives up to MAX_NODES ID bases
 
-  @return VCI_OK if more messages (may be) available
+  @return number of nodes, 0 if the list is invalid
 
 */
 //////////////////////////////////////////////////////////////////////////
-HRESULT ProcessMessages(WORD wLimit)
+UINT32 ParseNodes(const char* pszList, UINT32* pdwIdBase)
 {
-	// parameter checking
-	if (!pReader) return E_UNEXPECTED;
-
-	PCANMSG pCanMsg;
+	UINT32 dwCount = 0;
+	char*  pszNext = (char*)pszList;
 
-	// check if messages available
-	UINT16  wCount = 0;
-	HRESULT hr = pReader->AcquireRead((PVOID*)&pCanMsg, &wCount);
-	if (VCI_OK == hr)
+	while (*pszNext && (dwCount < MAX_NODES))
 	{
-		// limit number of messages to read
-		if (wCount > wLimit)
-		{
-			wCount = wLimit;
-		}
+		char* pszEnd;
 
-		UINT16 iter = wCount;
-		while (iter)
+		pdwIdBase[dwCount] = (UINT32)strtoul(pszNext, &pszEnd, 16);
+		if ((pszEnd == pszNext) ||
+		    (pdwIdBase[dwCount] % CAN_ID_RANGE) ||
+		    (pdwIdBase[dwCount] >= MAX_NODES * CAN_ID_RANGE))
 		{
-			PrintMessage(pCanMsg);
-
-			// process next VCI message
-			iter--;
-			pCanMsg++;
+			return 0;
 		}
-		pReader->ReleaseRead(wCount);
-	}
-	else if (VCI_E_RXQUEUE_EMPTY == hr)
-	{
-		// return error code
-	}
-	else
-	{
-		// ignore all other errors
-		hr = VCI_OK;
+		dwCount++;
+
+		pszNext = (*pszEnd == ',') ? pszEnd + 1 : pszEnd;
 	}
 
-	return hr;
+	return dwCount;
 }
 
-
 //////////////////////////////////////////////////////////////////////////
 /**
-  Receive thread.
-
-  Note:
-	Here console output in the receive thread is used for demonstration purposes.
-	Using console outout in the receive thread involves Asynchronous
-	Local Procedure Calls (ALPC) with the console host application (conhost.exe).
-	So expect console output to be slow.
-	Slow output can stall receive queue handling and finally lead
-	to controller overruns on some CAN interfaces, even with moderate busloads
-	(moderate = 1000 kBit/s, dlc=8, busload >= 30%).
-
-  @param Param
-	ptr on a user defined information
+  Returns the name of a per session file. Session 0 uses the name as
+  given, session n > 0 appends ".<n>".
 */
 //////////////////////////////////////////////////////////////////////////
-void ReceiveThread(void* Param)
+std::string ChannelFile(const std::string& strFile, UINT32 dwChannel)
 {
-	UNREFERENCED_PARAMETER(Param);
-
-	BOOL receiveSignaled = FALSE;
-	BOOL moreMsgMayAvail = FALSE;
+	char szSuffix[16];
 
-	while (lMustQuit == 0)
+	if (dwChannel == 0)
 	{
-		// if no more messages available wait 100msec for reader event
-		if (!moreMsgMayAvail)
-		{
-			receiveSignaled = (WAIT_OBJECT_0 == WaitForSingleObject(hEventReader, 100));
-		}
-
-		// process messages while messages are available
-		if (receiveSignaled || moreMsgMayAvail)
-		{
-			// try to process next chunk of messages (with max 100 msgs)
-			moreMsgMayAvail = (VCI_OK == ProcessMessages(100));
-		}
+		return strFile;
 	}
-
-	_endthread();
+	sprintf(szSuffix, ".%u", (unsigned int)dwChannel);
+	return strFile + szSuffix;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1034,61 +684,137 @@ void ReceiveThread(void* Param)
 //////////////////////////////////////////////////////////////////////////
 void FinalizeApp()
 {
-	//
-	// release reader
-	//
-	if (pReader)
+	for (size_t i = 0; i < Broadcasts.size(); i++)
 	{
-		pReader->Release();
-		pReader = 0;
+		Broadcasts[i]->Report();
+		delete Broadcasts[i];
 	}
+	Broadcasts.clear();
 
 	//
-	// release writer
+	// report the sessions, the throughput of all sessions together is
+	// the written data over the longest session
 	//
-	if (pWriter)
+	if (!strProfile.empty())
 	{
-		pWriter->Release();
-		pWriter = 0;
+		std::vector<const CBootProfile*> Profiles;
+		for (size_t i = 0; i < Sessions.size(); i++)
+		{
+			Profiles.push_back(&Sessions[i]->GetProfile());
+		}
+		if (!BootProfileWrite(strProfile.c_str(), Profiles))
+		{
+			BootLog(LOG_ERROR, "\n Profile not written");
+		}
 	}
 
-	//
-	// release channel interface
-	//
-	if (pCanChn)
+	UINT64 qwLongest = 0;
+	UINT64 qwWritten = 0;
+	for (size_t i = 0; i < Sessions.size(); i++)
+	{
+		Sessions[i]->Report();
+		if (Sessions[i]->GetDuration() > qwLongest)
+		{
+			qwLongest = Sessions[i]->GetDuration();
+		}
+		qwWritten += Sessions[i]->GetWritten();
+		delete Sessions[i];
+	}
+	if (Sessions.size() > 1)
+	{
+		BootLog(LOG_INFO, "\n %u sessions: %u bytes in %u ms, %u bytes/s", (UINT32)Sessions.size(),
+			(UINT32)qwWritten, (UINT32)(qwLongest / 1000),
+			qwLongest ? (UINT32)((qwWritten * 1000000) / qwLongest) : 0);
+	}
+	Sessions.clear();
+
+	for (size_t i = 0; i < CoSessions.size(); i++)
+	{
+		BootLog(LOG_INFO, "\n [%u] Result %u after %u ms", CoSessions[i]->GetChannel(),
+			(UINT32)CoSessions[i]->GetResult(), (UINT32)(CoSessions[i]->GetDuration() / 1000));
+		delete CoSessions[i];
+	}
+	if (!CoSessions.empty())
 	{
-		pCanChn->Release();
-		pCanChn = 0;
+		BootLog(LOG_INFO, "\n Coroutine loop: %u resumes, %u clock advances, %u waits",
+			(UINT32)CoLoop.GetResumes(), (UINT32)CoLoop.GetAdvances(), (UINT32)CoLoop.GetWaits());
 	}
+	CoSessions.clear();
+
+	for (size_t i = 0; i < Schedulers.size(); i++)
+	{
+		BootLog(LOG_INFO, "\n [%u] Scheduler: %u deferred turns", (UINT32)i, Schedulers[i]->GetDeferrals());
+		delete Schedulers[i];
+	}
+	Schedulers.clear();
+
+	for (size_t i = 0; i < TxQueues.size(); i++)
+	{
+		CCanTxQueue* pTxQueue = TxQueues[i];
+		BootLog(LOG_INFO, "\n [%u] Transmit queue: %u control frames, max. %u frames ahead", (UINT32)i,
+			pTxQueue->GetControlFrames(), pTxQueue->GetMaxAhead());
+		BootLog(LOG_INFO, ", %u bulk frames, max. %u us on the host", pTxQueue->GetBulkFrames(), pTxQueue->GetMaxHeld());
+		delete pTxQueue;
+	}
+	TxQueues.clear();
 
 	//
-	// release CAN control object
+	// release the simulator
 	//
-	if (pCanControl)
+	UINT32 dwTarget = 0;
+	for (size_t i = 0; i < SimBuses.size(); i++)
 	{
-		HRESULT hResult = pCanControl->StopLine();
-		if (hResult != VCI_OK)
+		CSimBus* pSimBus = SimBuses[i];
+		UINT64   qwTime = pSimBus->GetTime();
+
+		BootLog(LOG_INFO, "\n [%u] Simulator: %u frames on the bus, %u lost", (UINT32)i,
+			pSimBus->GetFramesSent(), pSimBus->GetFramesLost());
+		BootLog(LOG_INFO, ", %u error frames", pSimBus->GetErrorFrames());
+		BootLog(LOG_INFO, ", bus load %u %%", qwTime ? (UINT32)((pSimBus->GetBusyTime() * 100) / qwTime) : 0);
+		BootLog(LOG_INFO, "\n [%u] Host adapter: %u frames received, %u frames of other devices", (UINT32)i,
+			pSimBus->GetHostFrames(), pSimBus->GetLoadFrames());
+		BootLog(LOG_INFO, ", %u filtered", pSimBus->GetFiltered());
+		UINT32 dwControl = pSimBus->GetTxFrames(FALSE);
+		UINT32 dwBulk = pSimBus->GetTxFrames(TRUE);
+		BootLog(LOG_INFO, "\n [%u] Transmit latency: %u control frames, mean %u us, max. %u us", (UINT32)i, dwControl,
+			dwControl ? (UINT32)(pSimBus->GetTxLatency(FALSE) / dwControl) : 0, pSimBus->GetTxMaxLatency(FALSE));
+		BootLog(LOG_INFO, ", %u bulk frames, mean %u us, max. %u us", dwBulk,
+			dwBulk ? (UINT32)(pSimBus->GetTxLatency(TRUE) / dwBulk) : 0, pSimBus->GetTxMaxLatency(TRUE));
+		for (UINT32 j = 0; j < pSimBus->GetTargetCount(); j++, dwTarget++)
 		{
-			printf("\n pCanControl->StopLine failed: 0x%08lX !", hResult);
-		}
-
-		hResult = pCanControl->ResetLine();
-		if (hResult != VCI_OK)
-		{
-			printf("\n pCanControl->ResetLine failed: 0x%08lX !", hResult);
+			if (!strSimFlash.empty())
+			{
+				pSimBus->GetTarget(j).SaveFlash(ChannelFile(strSimFlash, dwTarget).c_str());
+			}
 		}
-
-		pCanControl->Release();
-		pCanControl = NULL;
+		delete pSimBus;
 	}
+	SimBuses.clear();
 
 	//
-	// release bal object
+	// release the adapters
 	//
-	if (pBalObject)
+	for (size_t i = 0; i < CanMuxes.size(); i++)
 	{
-		pBalObject->Release();
-		pBalObject = NULL;
+		BootLog(LOG_INFO, "\n [%u] Frames of unknown nodes: %u", (UINT32)i, CanMuxes[i]->GetUnmatched());
+		delete CanMuxes[i];
 	}
-}
+	CanMuxes.clear();
+	for (size_t i = 0; i < VciTransports.size(); i++)
+	{
+		BootLog(LOG_INFO, "\n [%u] Frames of other devices: %u", (UINT32)i, VciTransports[i]->GetFiltered());
+		delete VciTransports[i];
+	}
+	VciTransports.clear();
+	if (VciReactor.GetChannels() > 0)
+	{
+		BootLog(LOG_INFO, "\n Receive reactor: %u channels, %u wake-ups",
+			VciReactor.GetChannels(), VciReactor.GetWakeups());
+	}
+	VciReactor.Stop();
 
+	//
+	// write out pending log records
+	//
+	BootLogStop();
+}
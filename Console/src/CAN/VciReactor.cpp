@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reactor which reads the receive FIFOs of many VCI channels.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "VciReactor.hpp"
+
+#include <process.h>
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor. The reactor thread is started with the first channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+CVciReactor::CVciReactor()
+{
+	InitializeCriticalSection(&m_cs);
+	m_dwChanges = 0;
+	m_dwSeen = 0;
+	m_dwMaxChannels = 0;
+
+	m_lMustQuit = 0;
+	m_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hThreadDone = 0;
+	m_dwWakeups = 0;
+}
+
+CVciReactor::~CVciReactor()
+{
+	Stop();
+	CloseHandle(m_hWake);
+	DeleteCriticalSection(&m_cs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Adds a channel after InitSocket succeeded.
+
+  @return
+	FALSE if the reactor waits for the max. number of handles already
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciReactor::Add(CVciTransport* pTransport)
+{
+	EnterCriticalSection(&m_cs);
+	if (m_Channels.size() >= VCI_REACTOR_CHANNELS)
+	{
+		LeaveCriticalSection(&m_cs);
+		return FALSE;
+	}
+	m_Channels.push_back(pTransport);
+	m_dwChanges++;
+	if (m_dwMaxChannels < (UINT32)m_Channels.size())
+	{
+		m_dwMaxChannels = (UINT32)m_Channels.size();
+	}
+	LeaveCriticalSection(&m_cs);
+
+	if (m_hThreadDone == 0)
+	{
+		m_lMustQuit = 0;
+		m_hThreadDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+		_beginthread(ReactorThread, 0, this);
+	}
+	SetEvent(m_hWake);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Removes a channel before its FIFO is released. Returns after the
+  reactor no longer waits for the reader event of the channel.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciReactor::Remove(CVciTransport* pTransport)
+{
+	EnterCriticalSection(&m_cs);
+	UINT32 dwChange = m_dwChanges;
+	for (size_t i = 0; i < m_Channels.size(); i++)
+	{
+		if (m_Channels[i] == pTransport)
+		{
+			m_Channels.erase(m_Channels.begin() + i);
+			dwChange = ++m_dwChanges;
+			break;
+		}
+	}
+	LeaveCriticalSection(&m_cs);
+	SetEvent(m_hWake);
+
+	// wait until the reactor took a copy of the new channel list
+	while (m_hThreadDone && (WAIT_TIMEOUT == WaitForSingleObject(m_hThreadDone, 0)))
+	{
+		EnterCriticalSection(&m_cs);
+		BOOL fSeen = (m_dwSeen == dwChange) || ((INT32)(m_dwSeen - dwChange) > 0);
+		LeaveCriticalSection(&m_cs);
+		if (fSeen)
+		{
+			break;
+		}
+		Sleep(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Stops the reactor thread. The channels are no longer serviced.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciReactor::Stop(void)
+{
+	if (m_hThreadDone)
+	{
+		InterlockedExchange(&m_lMustQuit, 1);
+		SetEvent(m_hWake);
+		WaitForSingleObject(m_hThreadDone, INFINITE);
+		CloseHandle(m_hThreadDone);
+		m_hThreadDone = 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reactor thread.
+
+  @param Param
+	the reactor which owns the thread
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciReactor::ReactorThread(void* Param)
+{
+	CVciReactor* pThis = (CVciReactor*)Param;
+
+	pThis->Loop();
+	SetEvent(pThis->m_hThreadDone);
+
+	_endthread();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Waits for the reader events of all channels and services them until
+  the reactor is stopped. The wait is bounded by the shortest wait one
+  of the channels asks for, e.g. the latency bound of the batch mode.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciReactor::Loop(void)
+{
+	HANDLE         ahEvents[MAXIMUM_WAIT_OBJECTS];
+	CVciTransport* apChannels[VCI_REACTOR_CHANNELS];
+	DWORD          dwWait = VCI_RX_IDLE_MS;
+
+	while (m_lMustQuit == 0)
+	{
+		// copy of the channel list, the wake event comes first
+		EnterCriticalSection(&m_cs);
+		DWORD dwCount = (DWORD)m_Channels.size();
+		ahEvents[0] = m_hWake;
+		for (DWORD i = 0; i < dwCount; i++)
+		{
+			apChannels[i] = m_Channels[i];
+			ahEvents[i + 1] = m_Channels[i]->m_hEventReader;
+		}
+		m_dwSeen = m_dwChanges;
+		LeaveCriticalSection(&m_cs);
+
+		DWORD dwResult = WAIT_TIMEOUT;
+		if (dwWait > 0)
+		{
+			dwResult = WaitForMultipleObjects(dwCount + 1, ahEvents, FALSE, dwWait);
+			if (dwResult == WAIT_OBJECT_0)
+			{
+				// the channel list changed or the reactor is stopped
+				continue;
+			}
+			if (dwResult != WAIT_TIMEOUT)
+			{
+				m_dwWakeups++;
+			}
+		}
+
+		// the wait reports the first signaled event only, the others are checked without waiting
+		dwWait = VCI_RX_IDLE_MS;
+		for (DWORD i = 0; i < dwCount; i++)
+		{
+			BOOL fSignaled = (dwResult == WAIT_OBJECT_0 + 1 + i)
+			              || (WAIT_OBJECT_0 == WaitForSingleObject(ahEvents[i + 1], 0));
+			DWORD dwNext = apChannels[i]->Service(fSignaled);
+			if (dwWait > dwNext)
+			{
+				dwWait = dwNext;
+			}
+		}
+	}
+}
@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Reactor which reads the receive FIFOs of many VCI channels.
+
+  @note
+	A receive thread per channel is cheap for a few controllers, a
+	production line with dozens of channels pays a thread, a stack and
+	a context switch per channel and frame. The reactor waits for the
+	reader events of all its channels in one call and services every
+	channel which is signaled or whose receive mode reads without the
+	event, so the number of receive threads stays one.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _VCIREACTOR_HPP_
+#define _VCIREACTOR_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "VciTransport.hpp"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define VCI_REACTOR_CHANNELS    (MAXIMUM_WAIT_OBJECTS - 1) // one handle wakes the reactor
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  This class is the receive thread of a number of VCI transports. The
+  channel list is changed by the threads which start and close the
+  transports, the reactor thread works on a copy of it which it takes
+  before every wait. Remove() returns after the reactor took a copy
+  without the channel, so the transport may release its FIFO.
+*/
+//////////////////////////////////////////////////////////////////////////
+class CVciReactor
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CVciReactor();
+	~CVciReactor();
+
+	//---------------------------------------------------------------
+	// public methods
+	//---------------------------------------------------------------
+	BOOL   Add       (CVciTransport* pTransport);
+	void   Remove    (CVciTransport* pTransport);
+	void   Stop      (void);
+
+	UINT32 GetChannels(void) const { return m_dwMaxChannels; }
+	UINT32 GetWakeups (void) const { return m_dwWakeups; }
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	void   Loop(void);
+
+	static void ReactorThread(void* Param);
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	CRITICAL_SECTION m_cs;                  // protects the channel list
+	std::vector<CVciTransport*> m_Channels; // channels serviced by the reactor
+	UINT32           m_dwChanges;           // number of changes of the channel list
+	UINT32           m_dwSeen;              // changes the last copy of the list includes
+	UINT32           m_dwMaxChannels;       // max. number of channels at a time
+
+	LONG volatile    m_lMustQuit;           // quit flag for the reactor thread
+	HANDLE           m_hWake;               // interrupts the wait for a new channel list
+	HANDLE           m_hThreadDone;         // set when the reactor thread ends, 0 = not started
+	UINT32           m_dwWakeups;           // waits ended by a reader event
+};
+
+#endif //_VCIREACTOR_HPP_
@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  When the receive FIFO of a VCI channel is read.
+
+  @note
+	The receive thread of a transport and the reactor of many channels
+	follow the same rules, they are kept free of the VCI so the
+	benchmark can check them against the simulated time:
+	  CAN_RX_FRAME  the FIFO signals every frame, it is read when
+	                signaled, the wait ends after VCI_RX_IDLE_MS
+	  CAN_RX_BATCH  the FIFO signals VCI_RX_BATCH frames, it is read
+	                when signaled and after VCI_RX_LATENCY_MS
+	  CAN_RX_POLL   the FIFO is read without waiting
+	The reactor waits for the shortest wait of its channels.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _VCIRXPOLICY_HPP_
+#define _VCIRXPOLICY_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "CanTransport.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define VCI_RX_BATCH            16      // FIFO threshold of the batch mode
+#define VCI_RX_LATENCY_MS       1       // max. wait for a partial batch
+#define VCI_RX_IDLE_MS          100     // max. wait for the reader event
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the number of frames in the FIFO which signal the reader
+  event in a receive mode.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 VciRxThreshold(UINT32 dwMode)
+{
+	return (dwMode == CAN_RX_BATCH) ? VCI_RX_BATCH : 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns TRUE if the FIFO is read after a wait, a partial batch is
+  read after the latency bound, the poll mode reads without sleeping.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline BOOL VciRxMustRead(UINT32 dwMode, BOOL fSignaled)
+{
+	return (fSignaled || (dwMode != CAN_RX_FRAME)) ? TRUE : FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the max. wait in ms for the reader event before the FIFO is
+  read again, 0 = no wait.
+*/
+//////////////////////////////////////////////////////////////////////////
+inline UINT32 VciRxWaitMs(UINT32 dwMode)
+{
+	if (dwMode == CAN_RX_POLL)
+	{
+		return 0;
+	}
+	return (dwMode == CAN_RX_BATCH) ? VCI_RX_LATENCY_MS : VCI_RX_IDLE_MS;
+}
+
+#endif //_VCIRXPOLICY_HPP_
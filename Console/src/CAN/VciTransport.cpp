@@ -0,0 +1,1131 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transport on a CAN controller of an IXXAT adapter (VCI).
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+#include "VciTransport.hpp"
+#include "VciReactor.hpp"
+#include "BootLog.hpp"
+
+#include <process.h>
+#include <string.h>
+#include "SocketSelectDlg.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Selects a CAN adapter.
+
+  @param lDevice
+	Index of the adapter in the device list. If this parameter is set
+	to -1 the functions display a dialog box which allows the user to
+	select the device and controller.
+  @param lCtrlNo
+	Number of the CAN controller on the adapter.
+
+  @return
+	VCI_OK on success, otherwise an Error code
+*/
+//////////////////////////////////////////////////////////////////////////
+HRESULT CVciTransport::SelectDevice(LONG lDevice, LONG lCtrlNo)
+{
+	HRESULT hResult; // error code
+
+	if (lDevice >= 0)
+	{
+		IVciDeviceManager* pDevMgr = 0;    // device manager
+		IVciEnumDevice* pEnum = 0;    // enumerator handle
+		VCIDEVICEINFO       sInfo;          // device info
+
+		hResult = VciGetDeviceManager(&pDevMgr);
+		if (hResult == VCI_OK)
+		{
+			hResult = pDevMgr->EnumDevices(&pEnum);
+		}
+
+		//
+		// retrieve information about the selected
+		// device within the device list
+		//
+		if (hResult == VCI_OK)
+		{
+			for (LONG i = 0; (i <= lDevice) && (hResult == VCI_OK); i++)
+			{
+				hResult = pEnum->Next(1, &sInfo, NULL);
+			}
+
+			//
+			// close the device list (no longer needed)
+			//
+			pEnum->Release();
+			pEnum = NULL;
+		}
+
+		//
+		// open the device via device manager and get the bal object
+		//
+		if (hResult == VCI_OK)
+		{
+			IVciDevice* pDevice;
+			hResult = pDevMgr->OpenDevice(sInfo.VciObjectId, &pDevice);
+
+			if (hResult == VCI_OK)
+			{
+				hResult = pDevice->OpenComponent(CLSID_VCIBAL, IID_IBalObject, (void**)&m_pBalObject);
+
+				pDevice->Release();
+			}
+		}
+
+		m_lBusCtlNo = lCtrlNo;
+
+		//
+		// close device manager
+		//
+		if (pDevMgr)
+		{
+			pDevMgr->Release();
+			pDevMgr = NULL;
+		}
+	}
+	else
+	{
+		//
+		// open a device selected by the user
+		//
+		hResult = SocketSelectDlg(NULL, VCI_BUS_CAN, &m_pBalObject, &m_lSocketNo, &m_lBusCtlNo);
+	}
+
+	//DisplayError(NULL, hResult);
+	return hResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Checks BAL features
+
+  @param lCtrlNo
+	controller number to check the features
+
+  @return
+	VCI_OK on success, otherwise an Error code
+
+*/////////////////////////////////////////////////////////////////////////
+HRESULT CVciTransport::CheckBalFeatures(LONG lCtrlNo)
+{
+	HRESULT hResult = E_FAIL;
+
+	if (m_pBalObject)
+	{
+		// check if controller supports CANFD
+		BALFEATURES features = { 0 };
+		hResult = m_pBalObject->GetFeatures(&features);
+		if (VCI_OK == hResult)
+		{
+			// check if controller number is valid
+			if (lCtrlNo >= features.BusSocketCount)
+			{
+				// As we select the controller via the selection dialog, we should never get here.
+				BootLog(LOG_ERROR, "\n Invalid controller number. !");
+				return VCI_E_UNEXPECTED;
+			}
+
+			// check for the expected controller type
+			if (VCI_BUS_TYPE(features.BusSocketType[lCtrlNo]) != VCI_BUS_CAN)
+			{
+				// Invalid controller type selected
+				BootLog(LOG_ERROR, "\n Invalid controller type selected !");
+				return VCI_E_UNEXPECTED;
+			}
+		}
+		else
+		{
+			BootLog(LOG_ERROR, "\n pBalObject->GetFeatures failed: 0x%08lX !", hResult);
+		}
+	}
+
+	return hResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Opens the specified socket, creates a message channel, initializes
+  and starts the CAN controller.
+
+  @param dwCanNo
+	Number of the CAN controller to open.
+
+  @return
+	VCI_OK on success, otherwise an Error code
+
+  @note
+	If <dwCanNo> is set to 0xFFFFFFFF, the function shows a dialog box
+	which allows the user to select the VCI device and CAN controller.
+*/
+//////////////////////////////////////////////////////////////////////////
+HRESULT CVciTransport::InitSocket(LONG lCtrlNo)
+{
+	HRESULT hResult = E_FAIL;
+
+	if (m_pBalObject != NULL)
+	{
+		//
+		// check controller capabilities create a message channel
+		//
+		ICanSocket* pCanSocket = 0;
+		hResult = m_pBalObject->OpenSocket(lCtrlNo, IID_ICanSocket, (void**)&pCanSocket);
+		if (hResult == VCI_OK)
+		{
+			// check capabilities
+			CANCAPABILITIES capabilities = { 0 };
+			hResult = pCanSocket->GetCapabilities(&capabilities);
+			if (VCI_OK == hResult)
+			{
+				// time stamps of the received messages
+				if (capabilities.dwTscDivisor)
+				{
+					m_dwTscFreq = capabilities.dwClockFreq / capabilities.dwTscDivisor;
+				}
+
+				//
+				// This sample expects that standard and extended mode are
+				// supported simultaneously. See use of
+				// CAN_OPMODE_STANDARD | CAN_OPMODE_EXTENDED in InitLine() below
+				//
+				if (capabilities.dwFeatures & CAN_FEATURE_STDANDEXT)
+				{
+					// supports simultaneous standard and extended -> ok
+				}
+				else
+				{
+					BootLog(LOG_ERROR, "\n Simultaneous standard and extended mode feature not supported !");
+					hResult = VCI_E_NOT_SUPPORTED;
+				}
+			}
+			else
+			{
+				// should not occurr
+				BootLog(LOG_ERROR, "\n pCanSocket->GetCapabilities failed: 0x%08lX !", hResult);
+			}
+
+			//
+			// create a message channel
+			//
+			if (VCI_OK == hResult)
+			{
+				hResult = pCanSocket->CreateChannel(FALSE, &m_pCanChn);
+			}
+
+			pCanSocket->Release();
+		}
+
+		//
+		// initialize the message channel
+		//
+		if (hResult == VCI_OK)
+		{
+			UINT16 wRxFifoSize = 1024;
+			UINT16 wRxThreshold = 1;
+			UINT16 wTxFifoSize = VCI_TX_FIFO_SIZE;
+			UINT16 wTxThreshold = 1;
+
+			hResult = m_pCanChn->Initialize(wRxFifoSize, wTxFifoSize);
+			if (hResult == VCI_OK)
+			{
+				hResult = m_pCanChn->GetReader(&m_pReader);
+				if (hResult == VCI_OK)
+				{
+					m_pReader->SetThreshold(wRxThreshold);
+
+					m_hEventReader = CreateEvent(NULL, FALSE, FALSE, NULL);
+					m_pReader->AssignEvent(m_hEventReader);
+				}
+			}
+
+			if (hResult == VCI_OK)
+			{
+				hResult = m_pCanChn->GetWriter(&m_pWriter);
+				if (hResult == VCI_OK)
+				{
+					m_pWriter->SetThreshold(wTxThreshold);
+				}
+			}
+		}
+
+		//
+		// activate the CAN channel
+		//
+		if (hResult == VCI_OK)
+		{
+			hResult = m_pCanChn->Activate();
+		}
+
+		//
+		// Open the CAN control interface
+		//
+		// During the programs lifetime we have multiple options:
+		// 1) Open the control interface and keep it open
+		//     -> No other programm is able to get the control interface and change the line settings
+		// 2) Try to get the control interface and change the settings only when we get it
+		//     -> Other programs can change the settings by getting the control interface
+		//
+		if (hResult == VCI_OK)
+		{
+			hResult = m_pBalObject->OpenSocket(lCtrlNo, IID_ICanControl, (void**)&m_pCanControl);
+
+			//
+			// initialize the CAN controller
+			//
+			if (hResult == VCI_OK)
+			{
+				CANINITLINE init = {
+				  CAN_OPMODE_STANDARD |
+				  CAN_OPMODE_EXTENDED | CAN_OPMODE_ERRFRAME,      // opmode
+				  0,                                              // bReserved
+				  CAN_BT0_125KB, CAN_BT1_125KB                    // bt0, bt1
+				};
+
+				hResult = m_pCanControl->InitLine(&init);
+				if (hResult != VCI_OK)
+				{
+					BootLog(LOG_ERROR, "\n pCanControl->InitLine failed: 0x%08lX !", hResult);
+				}
+
+				//
+				// set the acceptance filter
+				//
+				if (hResult == VCI_OK)
+				{
+					hResult = SetAccFilter();
+
+					if (VCI_OK != hResult)
+					{
+						BootLog(LOG_ERROR, "\n pCanControl->SetAccFilter failed: 0x%08lX !", hResult);
+					}
+
+					//
+					// SetAccFilter() returns VCI_E_INVALID_STATE if already controller is started. 
+					// We ignore this because the controller could already be started
+					// by another application.
+					//
+					if (VCI_E_INVALID_STATE == hResult)
+					{
+						hResult = VCI_OK;
+					}
+				}
+
+				//
+				// start the CAN controller
+				//
+				if (hResult == VCI_OK)
+				{
+					hResult = m_pCanControl->StartLine();
+					if (hResult != VCI_OK)
+					{
+						BootLog(LOG_ERROR, "\n pCanControl->StartLine failed: 0x%08lX !", hResult);
+					}
+				}
+
+				BootLog(LOG_INFO, "\n Got Control interface. Settings applied !");
+			}
+			else
+			{
+				//
+				// If we can't get the control interface it is occupied by another application.
+				// This means the application is in charge of the controller parameters.
+				// We live with it and move on.
+				// 
+				BootLog(LOG_INFO, "\n Control interface occupied. Settings not applied: 0x%08lX !", hResult);
+				hResult = VCI_OK;
+			}
+		}
+	}
+	else
+	{
+		hResult = VCI_E_INVHANDLE;
+	}
+
+	DisplayError(NULL, hResult);
+	return hResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmit message via PutDataEntry
+
+*/////////////////////////////////////////////////////////////////////////
+void CVciTransport::TransmitViaPutDataEntry(UINT32 MsgId, UINT payloadLen, UINT8* Msg)
+{
+	CANMSG  sCanMsg = { 0 };
+
+	// length of message payload
+	//UINT payloadLen = 8;
+
+	sCanMsg.dwTime = 0;
+	sCanMsg.dwMsgId = MsgId;    // CAN message identifier
+
+	sCanMsg.uMsgInfo.Bytes.bType = CAN_MSGTYPE_DATA;
+	// Flags:
+	// srr = 1
+	sCanMsg.uMsgInfo.Bytes.bFlags = CAN_MAKE_MSGFLAGS(CAN_LEN_TO_SDLC(payloadLen), 0, 1, 0, 0);
+	// Flags2:
+	// Set bFlags2 to 0
+	sCanMsg.uMsgInfo.Bytes.bFlags2 = CAN_MAKE_MSGFLAGS2(0, 0, 0, 0, 0);
+
+	for (UINT i = 0; i < payloadLen; i++)
+	{
+		sCanMsg.abData[i] = Msg[i];
+	}
+
+	// write a single CAN message into the transmit FIFO
+	while (VCI_E_TXQUEUE_FULL == m_pWriter->PutDataEntry(&sCanMsg))
+	{
+		Sleep(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transmit CAN via Writer API (AcquireWrite/ReleaseWrite)
+   with ID 0x100.
+
+*/////////////////////////////////////////////////////////////////////////
+void CVciTransport::TransmitViaWriter()
+{
+	// use the FIFO interface 
+	// to write multiple messages
+	UINT16  count = 0;
+	PCANMSG pMsg;
+
+	// length of message payload
+	UINT payloadLen = 8;
+
+	// aquire write access to FIFO
+	HRESULT hr = m_pWriter->AcquireWrite((void**)&pMsg, &count);
+	if (VCI_OK == hr)
+	{
+		// number of written messages needed for ReleaseWrite
+		UINT16 written = 0;
+
+		if (count > 0)
+		{
+			pMsg->dwTime = 0;
+			pMsg->dwMsgId = 0x200;
+
+			pMsg->uMsgInfo.Bytes.bType = CAN_MSGTYPE_DATA;
+			// Flags:
+			// srr = 1
+			pMsg->uMsgInfo.Bytes.bFlags = CAN_MAKE_MSGFLAGS(CAN_LEN_TO_SDLC(payloadLen), 0, 1, 0, 0);
+			// Flags2:
+			// Set bFlags2 to 0 because FIFO memory will not be initialized by AquireWrite
+			pMsg->uMsgInfo.Bytes.bFlags2 = CAN_MAKE_MSGFLAGS2(0, 0, 0, 0, 0);
+
+			for (UINT i = 0; i < payloadLen; i++)
+			{
+				pMsg->abData[i] = i;
+			}
+
+			written = 1;
+		}
+
+		// release write access to FIFO
+		hr = m_pWriter->ReleaseWrite(written);
+		if (VCI_OK != hr)
+		{
+			BootLog(LOG_ERROR, "\nReleaseWrite failed: 0x%08lX", hr);
+		}
+	}
+	else
+	{
+		BootLog(LOG_ERROR, "\nAcquireWrite failed: 0x%08lX", hr);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Constructor / destructor of the VCI transport.
+*/
+//////////////////////////////////////////////////////////////////////////
+CVciTransport::CVciTransport()
+{
+	m_pBalObject = 0;
+	m_lSocketNo = 0;
+	m_lBusCtlNo = 0;
+	m_pCanControl = 0;
+	m_pCanChn = 0;
+	m_lMustQuit = 0;
+	m_hEventReader = 0;
+	m_hThreadDone = 0;
+	m_pReactor = NULL;
+	m_pReader = 0;
+	m_pWriter = 0;
+
+	InitializeCriticalSection(&m_csQueue);
+	m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_pRxNotify = NULL;
+	m_dwHead = 0;
+	m_dwTail = 0;
+	QueryPerformanceFrequency(&m_liFreq);
+
+	m_dwTscFreq = 0;
+	m_qwTicks = 0;
+	m_qwSyncTime = 0;
+	m_iClockOffset = 0;
+	memset(m_aqwTxTime, 0, sizeof(m_aqwTxTime));
+	m_dwFiltered = 0;
+
+	m_lRxMode = CAN_RX_FRAME;
+	m_lRxApplied = CAN_RX_FRAME;
+	m_qwRxModeStart = GetTime();
+	memset(m_aRxStats, 0, sizeof(m_aRxStats));
+}
+
+CVciTransport::~CVciTransport()
+{
+	Close();
+	CloseHandle(m_hEvent);
+	DeleteCriticalSection(&m_csQueue);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Starts reading the receive FIFO after InitSocket succeeded.
+
+  @param pReactor
+	reactor which services the channel, NULL or a full reactor start
+	a receive thread for the channel
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::Start(CVciReactor* pReactor)
+{
+	if (pReactor && pReactor->Add(this))
+	{
+		m_pReactor = pReactor;
+		return;
+	}
+
+	m_lMustQuit = 0;
+	m_hThreadDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+	_beginthread(ReceiveThread, 0, this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Stops the receive thread and releases the VCI objects.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::Close(void)
+{
+	//
+	// stop the receive thread or leave the reactor
+	//
+	if (m_pReactor)
+	{
+		m_pReactor->Remove(this);
+		m_pReactor = NULL;
+	}
+	if (m_hThreadDone)
+	{
+		InterlockedExchange(&m_lMustQuit, 1);
+		WaitForSingleObject(m_hThreadDone, INFINITE);
+		CloseHandle(m_hThreadDone);
+		m_hThreadDone = 0;
+	}
+
+	//
+	// release reader
+	//
+	if (m_pReader)
+	{
+		m_pReader->Release();
+		m_pReader = 0;
+	}
+
+	//
+	// release writer
+	//
+	if (m_pWriter)
+	{
+		m_pWriter->Release();
+		m_pWriter = 0;
+	}
+
+	//
+	// release channel interface
+	//
+	if (m_pCanChn)
+	{
+		m_pCanChn->Release();
+		m_pCanChn = 0;
+	}
+
+	//
+	// release CAN control object
+	//
+	if (m_pCanControl)
+	{
+		HRESULT hResult = m_pCanControl->StopLine();
+		if (hResult != VCI_OK)
+		{
+			BootLog(LOG_ERROR, "\n pCanControl->StopLine failed: 0x%08lX !", hResult);
+		}
+
+		hResult = m_pCanControl->ResetLine();
+		if (hResult != VCI_OK)
+		{
+			BootLog(LOG_ERROR, "\n pCanControl->ResetLine failed: 0x%08lX !", hResult);
+		}
+
+		m_pCanControl->Release();
+		m_pCanControl = NULL;
+	}
+
+	//
+	// release bal object
+	//
+	if (m_pBalObject)
+	{
+		m_pBalObject->Release();
+		m_pBalObject = NULL;
+	}
+
+	if (m_hEventReader)
+	{
+		CloseHandle(m_hEventReader);
+		m_hEventReader = 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sends a frame via the FIFO writer. The controller runs classic CAN,
+  CAN FD frames are rejected.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::Send(const CanFrame& sFrame)
+{
+	if (!m_pWriter || (sFrame.bFlags & CAN_FLAG_FD) || (sFrame.bLen > CAN_MAX_LEN))
+	{
+		return FALSE;
+	}
+
+	UINT8 abData[CAN_MAX_LEN];
+	memcpy(abData, sFrame.abData, sizeof(abData));
+	TransmitViaPutDataEntry(sFrame.dwMsgId, sFrame.bLen, abData);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the next frame queued by the receive thread. Waits on the
+  queue event, so it returns as soon as a frame arrives, or spins in
+  the poll mode.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::Receive(CanFrame& sFrame, UINT32 dwTimeoutUs)
+{
+	UINT64 qwDeadline = GetTime() + dwTimeoutUs;
+
+	for (;;)
+	{
+		EnterCriticalSection(&m_csQueue);
+		if (m_dwTail != m_dwHead)
+		{
+			sFrame = m_aQueue[m_dwTail % RX_QUEUE_SIZE];
+			m_dwTail++;
+
+			CanRxStats& sStats = m_aRxStats[m_lRxMode];
+			UINT64      qwNow = GetTime();
+			sStats.dwFrames++;
+			if (sFrame.qwBusTime && (qwNow > sFrame.qwBusTime))
+			{
+				sStats.qwLatency += qwNow - sFrame.qwBusTime;
+			}
+			LeaveCriticalSection(&m_csQueue);
+			return TRUE;
+		}
+		LeaveCriticalSection(&m_csQueue);
+
+		UINT64 qwNow = GetTime();
+		if (qwNow >= qwDeadline)
+		{
+			return FALSE;
+		}
+
+		if (m_lRxMode != CAN_RX_POLL)
+		{
+			// round up, WaitForSingleObject has a resolution of 1 ms
+			WaitForSingleObject(m_hEvent, (DWORD)((qwDeadline - qwNow + 999) / 1000));
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Selects the receive mode, CAN_RX_xxx. The receive thread changes the
+  threshold of the FIFO when it wakes up next, it is woken up now.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::SetRxMode(UINT32 dwMode)
+{
+	EnterCriticalSection(&m_csQueue);
+	if ((dwMode < CAN_RX_MODES) && (dwMode != (UINT32)m_lRxMode))
+	{
+		UINT64 qwNow = GetTime();
+		m_aRxStats[m_lRxMode].qwTime += qwNow - m_qwRxModeStart;
+		m_qwRxModeStart = qwNow;
+		InterlockedExchange(&m_lRxMode, (LONG)dwMode);
+		if (m_hEventReader)
+		{
+			SetEvent(m_hEventReader);
+		}
+	}
+	LeaveCriticalSection(&m_csQueue);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the statistics of the receive modes up to now.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::GetRxStats(CanRxStats* pStats)
+{
+	EnterCriticalSection(&m_csQueue);
+	memcpy(pStats, m_aRxStats, sizeof(m_aRxStats));
+	pStats[m_lRxMode].qwTime += GetTime() - m_qwRxModeStart;
+	LeaveCriticalSection(&m_csQueue);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the number of frames in the transmit FIFO.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::GetTxQueued(UINT32& dwFrames)
+{
+	UINT16 wFree = 0;
+
+	if (!m_pWriter || (VCI_OK != m_pWriter->GetFreeCount(&wFree)))
+	{
+		return FALSE;
+	}
+	dwFrames = (wFree < VCI_TX_FIFO_SIZE) ? (UINT32)(VCI_TX_FIFO_SIZE - wFree) : 0;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Sets the notify of an event loop, the receive thread wakes it with
+  every queued frame. The notify is changed under the lock of the
+  queue, so it is not called any more once this returns.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::SetRxNotify(ICanRxNotify* pNotify)
+{
+	EnterCriticalSection(&m_csQueue);
+	m_pRxNotify = pNotify;
+	LeaveCriticalSection(&m_csQueue);
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the host time in microseconds.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CVciTransport::GetTime(void)
+{
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter(&liNow);
+	return (UINT64)((liNow.QuadPart / m_liFreq.QuadPart) * 1000000 +
+	                ((liNow.QuadPart % m_liFreq.QuadPart) * 1000000) / m_liFreq.QuadPart);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the transmit time stamp of the last frame sent with a
+  standard identifier.
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CVciTransport::GetTxTime(UINT32 dwMsgId)
+{
+	UINT64 qwTime = 0;
+
+	if (dwMsgId < VCI_MAX_STD_ID)
+	{
+		EnterCriticalSection(&m_csQueue);
+		qwTime = m_aqwTxTime[dwMsgId];
+		LeaveCriticalSection(&m_csQueue);
+	}
+	return qwTime;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Returns the bit rate the controller was initialized with.
+*/
+//////////////////////////////////////////////////////////////////////////
+BOOL CVciTransport::GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate)
+{
+	dwBitRate = VCI_BIT_RATE;
+	dwDataBitRate = 0;
+	return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Converts a time stamp of the controller to the host clock. Called by
+  the receive thread only.
+
+  @param dwTicks     time stamp of the message
+  @param qwHostTime  host time the message was read
+
+  @return time stamp on the host clock, 0 if the controller has none
+
+*/
+//////////////////////////////////////////////////////////////////////////
+UINT64 CVciTransport::BusTime(UINT32 dwTicks, UINT64 qwHostTime)
+{
+	if (m_dwTscFreq == 0)
+	{
+		return 0;
+	}
+
+	// the 32 bit counter wraps around
+	m_qwTicks += (UINT32)(dwTicks - (UINT32)m_qwTicks);
+	UINT64 qwUs = (m_qwTicks / m_dwTscFreq) * 1000000 + ((m_qwTicks % m_dwTscFreq) * 1000000) / m_dwTscFreq;
+
+	INT64 iOffset = (INT64)(qwHostTime - qwUs);
+	if (m_qwSyncTime)
+	{
+		m_iClockOffset += (INT64)((qwHostTime - m_qwSyncTime) / VCI_DRIFT_DIV);
+	}
+	if (!m_qwSyncTime || (iOffset < m_iClockOffset))
+	{
+		m_iClockOffset = iOffset;
+	}
+	m_qwSyncTime = qwHostTime;
+
+	return (UINT64)((INT64)qwUs + m_iClockOffset);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Programs the acceptance filter of the controller. An open filter
+  passes all frames, else each standard identifier gets an entry of
+  the filter list and extended frames are closed out. If the
+  controller has not enough entries all frames pass the controller
+  and the receive thread drops the foreign ones.
+
+  @return VCI_OK, or the error of the control interface
+
+*/
+//////////////////////////////////////////////////////////////////////////
+HRESULT CVciTransport::SetAccFilter(void)
+{
+	HRESULT hResult = VCI_OK;
+
+	if (!m_Filter.IsOpen())
+	{
+		std::vector<UINT32> Ids;
+		m_Filter.GetIds(Ids);
+
+		hResult = m_pCanControl->SetAccFilter(CAN_FILTER_STD, CAN_ACC_CODE_NONE, CAN_ACC_MASK_NONE);
+		for (size_t i = 0; (i < Ids.size()) && (hResult == VCI_OK); i++)
+		{
+			// identifier and RTR bit must match
+			hResult = m_pCanControl->AddFilterIds(CAN_FILTER_STD, Ids[i] << 1, 0xFFF);
+		}
+		if (hResult == VCI_OK)
+		{
+			hResult = m_Filter.HasExt()
+			        ? m_pCanControl->SetAccFilter(CAN_FILTER_EXT, CAN_ACC_CODE_ALL, CAN_ACC_MASK_ALL)
+			        : m_pCanControl->SetAccFilter(CAN_FILTER_EXT, CAN_ACC_CODE_NONE, CAN_ACC_MASK_NONE);
+		}
+		if ((hResult == VCI_OK) || (hResult == VCI_E_INVALID_STATE))
+		{
+			return hResult;
+		}
+		BootLog(LOG_INFO, "\n Acceptance filter list failed: 0x%08lX, filtered by the host", hResult);
+	}
+
+	hResult = m_pCanControl->SetAccFilter(CAN_FILTER_STD, CAN_ACC_CODE_ALL, CAN_ACC_MASK_ALL);
+	if (hResult == VCI_OK)
+	{
+		hResult = m_pCanControl->SetAccFilter(CAN_FILTER_EXT, CAN_ACC_CODE_ALL, CAN_ACC_MASK_ALL);
+	}
+	return hResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Queues a received frame. Frames are dropped if the queue is full.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::Push(const CanFrame& sFrame)
+{
+	EnterCriticalSection(&m_csQueue);
+	if (m_dwHead - m_dwTail < RX_QUEUE_SIZE)
+	{
+		m_aQueue[m_dwHead % RX_QUEUE_SIZE] = sFrame;
+		m_dwHead++;
+	}
+	if (m_pRxNotify)
+	{
+		m_pRxNotify->Notify();
+	}
+	LeaveCriticalSection(&m_csQueue);
+	SetEvent(m_hEvent);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Print a message and queue data frames for the protocol
+
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::PrintMessage(PCANMSG pCanMsg)
+{
+	if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_DATA)
+	{
+		//
+		// show data frames
+		//
+		if (pCanMsg->uMsgInfo.Bits.rtr == 0)
+		{
+			// frames of other devices are not even traced
+			if (!m_Filter.Accepts(pCanMsg->dwMsgId))
+			{
+				m_dwFiltered++;
+				return;
+			}
+
+			// number of bytes in message payload
+			UINT payloadLen = CAN_SDLC_TO_LEN(pCanMsg->uMsgInfo.Bits.dlc);
+
+			// the logger keeps the format pointer, so select a literal per frame type
+			BootLogData(LOG_TRACE, pCanMsg->abData, (UINT8)payloadLen,
+				(pCanMsg->uMsgInfo.Bits.ext == 1)
+				? "\nTime: %10u  ID: %3X Ext  Len: %1u  Data:"
+				: "\nTime: %10u  ID: %3X Std  Len: %1u  Data:",
+				pCanMsg->dwTime,
+				pCanMsg->dwMsgId,
+				payloadLen);
+
+			UINT64 qwHostTime = GetTime();
+			UINT64 qwBusTime = BusTime(pCanMsg->dwTime, qwHostTime);
+
+			if (pCanMsg->uMsgInfo.Bits.srr == 1)
+			{
+				// self reception of a sent frame
+				if (pCanMsg->dwMsgId < VCI_MAX_STD_ID)
+				{
+					EnterCriticalSection(&m_csQueue);
+					m_aqwTxTime[pCanMsg->dwMsgId] = qwBusTime;
+					LeaveCriticalSection(&m_csQueue);
+				}
+			}
+			else
+			{
+				// hand the frame to the protocol
+				CanFrame sFrame;
+				sFrame.qwTime = qwHostTime;
+				sFrame.qwBusTime = qwBusTime;
+				sFrame.dwMsgId = pCanMsg->dwMsgId;
+				sFrame.bLen = (UINT8)payloadLen;
+				sFrame.bFlags = 0;
+				memcpy(sFrame.abData, pCanMsg->abData, CAN_MAX_LEN);
+				Push(sFrame);
+			}
+		}
+		else
+		{
+			BootLog(LOG_TRACE, "\nTime: %10u ID: %3X  DLC: %1u  Remote Frame",
+				pCanMsg->dwTime,
+				pCanMsg->dwMsgId,
+				pCanMsg->uMsgInfo.Bits.dlc);
+		}
+	}
+	else if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_INFO)
+	{
+		//
+		// show informational frames
+		//
+		switch (pCanMsg->abData[0])
+		{
+		case CAN_INFO_START: BootLog(LOG_INFO, "\nCAN started..."); break;
+		case CAN_INFO_STOP: BootLog(LOG_INFO, "\nCAN stopped..."); break;
+		case CAN_INFO_RESET: BootLog(LOG_INFO, "\nCAN reseted..."); break;
+		}
+	}
+	else if (pCanMsg->uMsgInfo.Bytes.bType == CAN_MSGTYPE_ERROR)
+	{
+		//
+		// show error frames
+		//
+		switch (pCanMsg->abData[0])
+		{
+		case CAN_ERROR_STUFF: BootLog(LOG_ERROR, "\nstuff error...");          break;
+		case CAN_ERROR_FORM: BootLog(LOG_ERROR, "\nform error...");           break;
+		case CAN_ERROR_ACK: BootLog(LOG_ERROR, "\nacknowledgment error..."); break;
+		case CAN_ERROR_BIT: BootLog(LOG_ERROR, "\nbit error...");            break;
+		case CAN_ERROR_CRC: BootLog(LOG_ERROR, "\nCRC error...");            break;
+		case CAN_ERROR_OTHER:
+		default: BootLog(LOG_ERROR, "\nother error...");          break;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Process messages
+
+  @param wLimit  max number of messages to process
+
+  @return VCI_OK if more messages (may be) available
+
+*/
+//////////////////////////////////////////////////////////////////////////
+HRESULT CVciTransport::ProcessMessages(WORD wLimit)
+{
+	// parameter checking
+	if (!m_pReader) return E_UNEXPECTED;
+
+	PCANMSG pCanMsg;
+
+	// check if messages available
+	UINT16  wCount = 0;
+	HRESULT hr = m_pReader->AcquireRead((PVOID*)&pCanMsg, &wCount);
+	if (VCI_OK == hr)
+	{
+		// limit number of messages to read
+		if (wCount > wLimit)
+		{
+			wCount = wLimit;
+		}
+
+		UINT16 iter = wCount;
+		while (iter)
+		{
+			PrintMessage(pCanMsg);
+
+			// process next VCI message
+			iter--;
+			pCanMsg++;
+		}
+		m_pReader->ReleaseRead(wCount);
+	}
+	else if (VCI_E_RXQUEUE_EMPTY == hr)
+	{
+		// return error code
+	}
+	else
+	{
+		// ignore all other errors
+		hr = VCI_OK;
+	}
+
+	return hr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Receive thread.
+
+  Note:
+	Console output involves Asynchronous Local Procedure Calls (ALPC)
+	with the console host application (conhost.exe) and is slow.
+	Slow output can stall receive queue handling and finally lead
+	to controller overruns on some CAN interfaces, even with moderate busloads
+	(moderate = 1000 kBit/s, dlc=8, busload >= 30%).
+	Therefore the receive thread only queues log records, the console
+	output is done by the formatter thread of BootLog.
+
+  @param Param
+	the transport which owns the thread
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::ReceiveThread(void* Param)
+{
+	CVciTransport* pThis = (CVciTransport*)Param;
+
+	pThis->ReceiveLoop();
+	SetEvent(pThis->m_hThreadDone);
+
+	_endthread();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reads the receive FIFO after the reader event was signaled or the
+  wait for it timed out. The FIFO threshold follows the receive mode.
+
+  @param fSignaled
+	the reader event was signaled
+
+  @return
+	max. time in ms to wait for the reader event before the next call
+*/
+//////////////////////////////////////////////////////////////////////////
+DWORD CVciTransport::Service(BOOL fSignaled)
+{
+	LONG lMode = m_lRxMode;
+
+	// the FIFO signals a batch or every frame
+	if (lMode != m_lRxApplied)
+	{
+		m_lRxApplied = lMode;
+		m_pReader->SetThreshold(VciRxThreshold((UINT32)lMode));
+	}
+
+	// a partial batch is read after the latency bound, the poll mode reads without sleeping
+	if (VciRxMustRead((UINT32)lMode, fSignaled))
+	{
+		// try to process next chunk of messages (with max 100 msgs)
+		if (VCI_OK == ProcessMessages(100))
+		{
+			EnterCriticalSection(&m_csQueue);
+			m_aRxStats[lMode].dwWakeups++;
+			LeaveCriticalSection(&m_csQueue);
+
+			// process messages while messages are available
+			while ((m_lMustQuit == 0) && (VCI_OK == ProcessMessages(100)))
+			{
+			}
+		}
+	}
+
+	return VciRxWaitMs((UINT32)lMode);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Reads the receive FIFO until the transport is closed.
+*/
+//////////////////////////////////////////////////////////////////////////
+void CVciTransport::ReceiveLoop(void)
+{
+	DWORD dwWait = VCI_RX_IDLE_MS;
+
+	while (m_lMustQuit == 0)
+	{
+		BOOL fSignaled = (dwWait == 0)
+		              || (WAIT_OBJECT_0 == WaitForSingleObject(m_hEventReader, dwWait));
+		dwWait = Service(fSignaled);
+	}
+}
@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////////
+// CAN BootLoader
+//////////////////////////////////////////////////////////////////////////
+/**
+
+  Transport on a CAN controller of an IXXAT adapter (VCI).
+
+  @note
+	Every transport owns its VCI objects, so one process can drive
+	several controllers on one or more adapters. The receive FIFO is
+	read by an own thread or by the reactor shared by all channels.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _VCITRANSPORT_HPP_
+#define _VCITRANSPORT_HPP_
+
+//////////////////////////////////////////////////////////////////////////
+// include files
+//////////////////////////////////////////////////////////////////////////
+
+#include "vcisdk.h"
+#include "CanFilter.hpp"
+#include "CanTransport.hpp"
+#include "VciRxPolicy.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// constants and macros
+//////////////////////////////////////////////////////////////////////////
+
+#define RX_QUEUE_SIZE           1024
+#define VCI_TX_FIFO_SIZE        128     // frames in the transmit FIFO of the channel
+#define VCI_MAX_STD_ID          0x800   // identifiers with a transmit time stamp
+#define VCI_BIT_RATE            125000  // bit timing of InitLine()
+#define VCI_DRIFT_DIV           10000   // adapter and host clock differ by up to 100 ppm
+
+class CVciReactor;
+
+//////////////////////////////////////////////////////////////////////////
+/**
+  Transport on the VCI message channel. Frames are sent through the
+  FIFO writer. Received frames are queued by the receive thread and
+  handed to the session thread.
+
+  The time stamps of the controller are converted to the host clock.
+  A frame is queued by the host after the controller received it, so
+  the smallest difference of the two clocks is their offset. The
+  offset may grow by the drift of the clocks. Sent frames come back
+  as self reception, they give the transmit time stamps.
+
+  Only the identifiers of the acceptance filter are received. The
+  filter is programmed into the controller by InitSocket(), frames
+  which still arrive, e.g. if the controller was started by another
+  application, are dropped by the receive thread.
+
+  The receive thread wakes up for every frame by default. In the batch
+  mode the FIFO signals a number of frames and the thread reads the
+  FIFO at least after a latency bound, in the poll mode the receive
+  thread and the session thread spin without sleeping.
+
+  With a reactor the transport has no thread of its own, the reactor
+  waits for the reader events of all its channels and calls Service().
+*/
+//////////////////////////////////////////////////////////////////////////
+class CVciTransport : public ICanTransport
+{
+  public:
+	//---------------------------------------------------------------
+	// constructor / destructor
+	//---------------------------------------------------------------
+	CVciTransport();
+	~CVciTransport();
+
+	//---------------------------------------------------------------
+	// adapter handling
+	//---------------------------------------------------------------
+	HRESULT SelectDevice    (LONG lDevice, LONG lCtrlNo);
+	HRESULT CheckBalFeatures(LONG lCtrlNo);
+	HRESULT InitSocket      (LONG lCtrlNo);
+	void    SetFilter       (const CCanFilter& Filter) { m_Filter = Filter; }
+	void    Start           (CVciReactor* pReactor = NULL);
+	void    Close           (void);
+
+	LONG    GetCtrlNo(void) const { return m_lBusCtlNo; }
+	UINT32  GetFiltered(void) const { return m_dwFiltered; }
+
+	//---------------------------------------------------------------
+	// ICanTransport
+	//---------------------------------------------------------------
+	virtual BOOL   Send(const CanFrame& sFrame);
+	virtual BOOL   Receive(CanFrame& sFrame, UINT32 dwTimeoutUs);
+	virtual UINT64 GetTime(void);
+	virtual UINT64 GetTxTime(UINT32 dwMsgId);
+	virtual BOOL   GetBitRate(UINT32& dwBitRate, UINT32& dwDataBitRate);
+	virtual void   SetRxMode(UINT32 dwMode);
+	virtual BOOL   GetRxStats(CanRxStats* pStats);
+	virtual BOOL   GetTxQueued(UINT32& dwFrames);
+	virtual BOOL   SetRxNotify(ICanRxNotify* pNotify);
+
+  private:
+	//---------------------------------------------------------------
+	// utility functions
+	//---------------------------------------------------------------
+	void    TransmitViaPutDataEntry(UINT32 MsgId, UINT payloadLen, UINT8* Msg);
+	void    TransmitViaWriter();
+	void    Push(const CanFrame& sFrame);
+	UINT64  BusTime(UINT32 dwTicks, UINT64 qwHostTime);
+	HRESULT SetAccFilter(void);
+	void    PrintMessage(PCANMSG pCanMsg);
+	HRESULT ProcessMessages(WORD wLimit);
+	DWORD   Service(BOOL fSignaled);
+	void    ReceiveLoop(void);
+
+	static void ReceiveThread(void* Param);
+
+	friend class CVciReactor;
+
+	//---------------------------------------------------------------
+	// data members
+	//---------------------------------------------------------------
+	IBalObject*      m_pBalObject;          // bus access object
+	LONG             m_lSocketNo;           // socket number
+	LONG             m_lBusCtlNo;           // controller number
+	ICanControl*     m_pCanControl;         // control interface
+	ICanChannel*     m_pCanChn;             // channel interface
+	LONG volatile    m_lMustQuit;           // quit flag for the receive thread
+	HANDLE           m_hEventReader;        // set by the receive FIFO
+	HANDLE           m_hThreadDone;         // set when the receive thread ends
+	CVciReactor*     m_pReactor;            // reads the FIFO instead of the receive thread
+	PFIFOREADER      m_pReader;             // receive FIFO
+	PFIFOWRITER      m_pWriter;             // transmit FIFO
+
+	CRITICAL_SECTION m_csQueue;             // protects the receive queue
+	HANDLE           m_hEvent;              // set when a frame is queued
+	ICanRxNotify*    m_pRxNotify;           // woken when a frame is queued, NULL = none
+	CanFrame         m_aQueue[RX_QUEUE_SIZE];
+	UINT32           m_dwHead;              // next entry to write
+	UINT32           m_dwTail;              // next entry to read
+	LARGE_INTEGER    m_liFreq;              // performance counter frequency
+
+	UINT32           m_dwTscFreq;           // time stamp frequency of the controller, 0 = unknown
+	UINT64           m_qwTicks;             // time stamp counter extended to 64 bit
+	UINT64           m_qwSyncTime;          // host time of the last clock alignment, 0 = none
+	INT64            m_iClockOffset;        // host clock minus controller clock in us
+	UINT64           m_aqwTxTime[VCI_MAX_STD_ID]; // transmit time stamp per identifier
+
+	CCanFilter       m_Filter;              // identifiers of the sessions, open = all
+	UINT32           m_dwFiltered;          // frames dropped by the host
+
+	LONG volatile    m_lRxMode;             // CAN_RX_xxx, read by the receive thread
+	LONG             m_lRxApplied;          // receive mode the FIFO threshold is set for
+	UINT64           m_qwRxModeStart;       // host time the receive mode was selected
+	CanRxStats       m_aRxStats[CAN_RX_MODES]; // statistics per receive mode
+};
+
+#endif //_VCITRANSPORT_HPP_